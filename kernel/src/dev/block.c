@@ -0,0 +1,227 @@
+#include "block.h"
+#include <mm/pmm.h>
+#include <stdlib.h>
+#include <sys/cpu.h>
+#include <sys/debug.h>
+#include <time/clocksource.h>
+
+/* requests per queue depth, 4KiB each */
+#define BENCH_REQUESTS  4096
+#define BENCH_MAX_DEPTH 32
+#define BENCH_BYTES     4096
+/* give up on a device that stops completing */
+#define BENCH_TIMEOUT_NS (10 * NSEC_PER_SEC)
+
+static block_device_t *devices[BLOCK_MAX_DEVICES];
+static uint32_t        device_count = 0;
+static spinlock_t      devices_lock = SPINLOCK_INIT;
+
+void block_register(block_device_t *dev) {
+  uint64_t flags = spin_lock_irqsave(&devices_lock);
+  if(device_count == BLOCK_MAX_DEVICES) {
+    spin_unlock_irqrestore(&devices_lock, flags);
+    kwarn("block: no room for %s\n", dev->name);
+    return;
+  }
+  dev->index            = device_count;
+  devices[device_count] = dev;
+  __atomic_store_n(&device_count, device_count + 1, __ATOMIC_RELEASE);
+  spin_unlock_irqrestore(&devices_lock, flags);
+  kinfo("block: %s, %lu sectors of %u bytes (%lu MiB), %u queues\n",
+        dev->name,
+        dev->sectors,
+        dev->sector_size,
+        dev->sectors * dev->sector_size >> 20,
+        dev->queue_count);
+}
+
+uint32_t block_device_count(void) {
+  return __atomic_load_n(&device_count, __ATOMIC_ACQUIRE);
+}
+
+block_device_t *block_device_get(uint32_t index) {
+  return index < block_device_count() ? devices[index] : NULL;
+}
+
+block_device_t *block_device_find(const char *name) {
+  for(uint32_t i = 0; i < block_device_count(); ++i)
+    if(strcmp(devices[i]->name, name) == 0)
+      return devices[i];
+  return NULL;
+}
+
+static void lsblk_cmd(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+  for(uint32_t i = 0; i < block_device_count(); ++i) {
+    block_device_t *dev = devices[i];
+    printf("%-10s %lu MiB, %u byte sectors, %u queues\n",
+           dev->name,
+           dev->sectors * dev->sector_size >> 20,
+           dev->sector_size,
+           dev->queue_count);
+  }
+}
+
+/*
+the benchmark spins in the debug command, reaping with poll. completions
+can also come in through a queue's interrupt on another CPU, so `done`
+only flags the request and the loop does the rest
+*/
+static block_request_t bench_reqs[BENCH_MAX_DEPTH];
+static bool            bench_finished[BENCH_MAX_DEPTH];
+/* handed to the driver and not seen finished yet */
+static bool            bench_busy[BENCH_MAX_DEPTH];
+static uint64_t        bench_buffers[BENCH_MAX_DEPTH];
+static uint64_t        bench_rng = 0x9E3779B97F4A7C15ull;
+
+static void bench_complete(block_request_t *req) {
+  __atomic_store_n(&bench_finished[req - bench_reqs], true, __ATOMIC_RELEASE);
+}
+
+static void bench_prepare(block_device_t *dev,
+                          uint32_t        i,
+                          enum block_op   op,
+                          uint32_t        flags) {
+  block_request_t *req   = &bench_reqs[i];
+  uint32_t         count = BENCH_BYTES / dev->sector_size;
+  // xorshift, random 4KiB aligned offsets over the whole device
+  bench_rng ^= bench_rng << 13;
+  bench_rng ^= bench_rng >> 7;
+  bench_rng ^= bench_rng << 17;
+  req->op     = op;
+  req->flags  = flags;
+  req->sector = bench_rng % (dev->sectors / count) * count;
+  req->count  = count;
+  req->phys   = bench_buffers[i];
+  req->pages  = NULL;
+  req->status = 0;
+  req->done   = bench_complete;
+  bench_busy[i] = true;
+}
+
+/*
+requests a timed out run left with the driver. their slots in the driver
+still point at them, so they can't be reused until they complete
+*/
+static uint32_t bench_outstanding(void) {
+  uint32_t busy = 0;
+  for(uint32_t i = 0; i < BENCH_MAX_DEPTH; ++i) {
+    if(!bench_busy[i])
+      continue;
+    block_poll(bench_reqs[i].dev);
+    if(__atomic_load_n(&bench_finished[i], __ATOMIC_ACQUIRE)) {
+      bench_finished[i] = false;
+      bench_busy[i]     = false;
+    } else {
+      busy++;
+    }
+  }
+  return busy;
+}
+
+/* false if it timed out, with requests still in flight */
+static bool bench_depth(block_device_t *dev,
+                        enum block_op   op,
+                        uint32_t        flags,
+                        uint32_t        depth) {
+  uint32_t         issued = 0, completed = 0, errors = 0;
+  block_request_t *list   = NULL;
+  for(uint32_t i = 0; i < depth; ++i) {
+    bench_finished[i] = false;
+    bench_prepare(dev, i, op, flags);
+    bench_reqs[i].next = list;
+    list               = &bench_reqs[i];
+    issued++;
+  }
+  uint64_t start = ktime_get();
+  block_submit(dev, list);
+  while(completed < BENCH_REQUESTS) {
+    block_poll(dev);
+    list = NULL;
+    for(uint32_t i = 0; i < depth; ++i) {
+      if(!__atomic_load_n(&bench_finished[i], __ATOMIC_ACQUIRE))
+        continue;
+      bench_finished[i] = false;
+      bench_busy[i]     = false;
+      completed++;
+      if(bench_reqs[i].status)
+        errors++;
+      if(issued < BENCH_REQUESTS) {
+        bench_prepare(dev, i, op, flags);
+        bench_reqs[i].next = list;
+        list               = &bench_reqs[i];
+        issued++;
+      }
+    }
+    // one doorbell for everything that completed this pass
+    if(list)
+      block_submit(dev, list);
+    else if(ktime_get() - start > BENCH_TIMEOUT_NS) {
+      printf("qd %2u: timed out after %u of %u requests\n",
+             depth,
+             completed,
+             BENCH_REQUESTS);
+      return false;
+    }
+  }
+  uint64_t ns = ktime_get() - start;
+  printf("%-5s%s qd %2u: %6lu IOPS, %4lu MB/s, %lu us average latency%s\n",
+         op == BLOCK_READ ? "read" : "write",
+         flags & BLOCK_REQ_POLLED ? " (polled)" : "",
+         depth,
+         BENCH_REQUESTS * NSEC_PER_SEC / ns,
+         (uint64_t)BENCH_REQUESTS * BENCH_BYTES * 1000 / ns,
+         ns * depth / BENCH_REQUESTS / NSEC_PER_USEC,
+         errors ? ", with errors" : "");
+  return true;
+}
+
+static void bench_block_cmd(int argc, char **argv) {
+  block_device_t *dev =
+    argc > 1 ? block_device_find(argv[1]) : block_device_get(0);
+  if(dev == NULL) {
+    printf("no such block device\n");
+    return;
+  }
+  enum block_op op    = BLOCK_READ;
+  uint32_t      flags = 0;
+  for(int i = 2; i < argc; ++i) {
+    if(strcmp(argv[i], "write") == 0)
+      op = BLOCK_WRITE;
+    else if(strcmp(argv[i], "poll") == 0)
+      flags |= BLOCK_REQ_POLLED;
+  }
+  if(dev->sector_size > BENCH_BYTES || dev->sectors * dev->sector_size <
+                                         BENCH_BYTES * BENCH_MAX_DEPTH) {
+    printf("%s is too small to benchmark\n", dev->name);
+    return;
+  }
+  uint32_t busy = bench_outstanding();
+  if(busy) {
+    printf("%u requests of a timed out run are still outstanding\n", busy);
+    return;
+  }
+  // kept for the next run, a timed out request may still write into them
+  for(uint32_t i = 0; i < BENCH_MAX_DEPTH; ++i) {
+    if(bench_buffers[i] == 0)
+      bench_buffers[i] = pmm_alloc_zeroed_page();
+    if(bench_buffers[i] == 0) {
+      printf("out of memory\n");
+      return;
+    }
+  }
+  static const uint32_t depths[] = { 1, 4, 16, BENCH_MAX_DEPTH };
+  // the rest would reuse requests that are still with the driver
+  for(uint32_t d = 0; d < sizeof(depths) / sizeof(depths[0]); ++d)
+    if(!bench_depth(dev, op, flags, depths[d]))
+      break;
+}
+
+void block_init(void) {
+  debug_register("lsblk", "block devices", lsblk_cmd);
+  debug_register("bench-block",
+                 "[dev] [write] [poll]: random 4KiB IOPS at several queue "
+                 "depths, write destroys data",
+                 bench_block_cmd);
+}
@@ -0,0 +1,93 @@
+#ifndef _BLOCK_H
+#define _BLOCK_H
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+block devices. drivers register a block_device_t with one hardware queue
+per CPU (or as many as the device has, shared round robin). requests go
+out on the calling CPU's queue and complete there, either from the queue's
+interrupt or from `poll`
+*/
+
+#define BLOCK_MAX_DEVICES 8
+#define BLOCK_NAME_LEN    16
+/* longest page list a request can carry */
+#define BLOCK_MAX_PAGES 32
+
+enum block_op {
+  BLOCK_READ = 0,
+  BLOCK_WRITE,
+  BLOCK_FLUSH,
+};
+
+/*
+the caller reaps this request with block_poll. drivers that can keep
+a queue without interrupts put it there, others treat it as a hint
+*/
+#define BLOCK_REQ_POLLED (1 << 0)
+
+struct block_device;
+
+typedef struct block_request {
+  struct block_request *next;
+  /* set by block_submit */
+  struct block_device *dev;
+  enum block_op        op;
+  uint32_t             flags;
+  /* in units of the device's sector_size */
+  uint64_t sector;
+  uint32_t count;
+  /* physically contiguous buffer of count * sector_size bytes */
+  uint64_t phys;
+  /* or, when set, the buffer is these whole pages in order */
+  const uint64_t *pages;
+  /* 0 on success, set before `done` runs */
+  int status;
+  /* called in softirq context (or from `poll`) once the request is done */
+  void (*done)(struct block_request *req);
+  void *data;
+} block_request_t;
+
+typedef struct block_ops {
+  /**
+   * @brief queue a list of requests (linked through `next`) on the calling
+   * CPU's hardware queue, ringing the doorbell once for all of them
+   */
+  void (*submit)(struct block_device *dev, block_request_t *reqs);
+  /**
+   * @brief complete whatever the calling CPU's queue has finished
+   *
+   * @return number of requests completed
+   */
+  uint32_t (*poll)(struct block_device *dev);
+} block_ops_t;
+
+typedef struct block_device {
+  char               name[BLOCK_NAME_LEN];
+  /* slot in the registry, set by block_register */
+  uint32_t           index;
+  uint32_t           sector_size;
+  uint64_t           sectors;
+  uint32_t           queue_count;
+  /* sectors a single request may cover */
+  uint32_t           max_sectors;
+  const block_ops_t *ops;
+  void              *driver_data;
+} block_device_t;
+
+static inline void block_submit(block_device_t *dev, block_request_t *reqs) {
+  for(block_request_t *req = reqs; req; req = req->next) req->dev = dev;
+  dev->ops->submit(dev, reqs);
+}
+
+static inline uint32_t block_poll(block_device_t *dev) {
+  return dev->ops->poll(dev);
+}
+
+void            block_register(block_device_t *dev);
+uint32_t        block_device_count(void);
+block_device_t *block_device_get(uint32_t index);
+block_device_t *block_device_find(const char *name);
+void            block_init(void);
+#endif  // _BLOCK_H
@@ -0,0 +1,189 @@
+#include "msi.h"
+#include <stdlib.h>
+#include <sys/cpu.h>
+#include <sys/debug.h>
+#include <sys/interrupts.h>
+#include <sys/rcu.h>
+
+/* entry number recorded for a plain MSI vector */
+#define MSI_ENTRY_NONE 0xFFFF
+
+/* what each dynamic vector was handed out for, read by msi_interrupt */
+static struct {
+  pci_device_t *dev;
+  msi_handler_t handler;
+  void         *data;
+  uint32_t      cpu;
+  uint16_t      entry;
+} msi_vectors[256];
+
+static void msi_interrupt(uint64_t vector) {
+  msi_vectors[vector].handler(msi_vectors[vector].data);
+}
+
+/*
+without interrupt remapping the destination field only holds 8 bits, CPUs
+with larger x2APIC ids can't be targeted
+*/
+static bool msi_address(uint32_t cpu, uint32_t *address) {
+  uint32_t apic_id = cpu_lapic_id(cpu);
+  if(apic_id > 0xFF) {
+    kwarn("msi: cpu %u (APIC id %u) needs interrupt remapping\n",
+          cpu,
+          apic_id);
+    return false;
+  }
+  *address = MSI_ADDRESS_BASE | apic_id << MSI_DEST_SHIFT;
+  return true;
+}
+
+static uint8_t claim_vector(pci_device_t *dev,
+                            uint16_t      entry,
+                            uint32_t      cpu,
+                            msi_handler_t handler,
+                            void         *data) {
+  uint8_t vector = irq_alloc_vector();
+  if(vector == 0) {
+    kwarn("msi: out of vectors\n");
+    return 0;
+  }
+  msi_vectors[vector].dev     = dev;
+  msi_vectors[vector].handler = handler;
+  msi_vectors[vector].data    = data;
+  msi_vectors[vector].cpu     = cpu;
+  msi_vectors[vector].entry   = entry;
+  set_fast_interrupt_handler(vector, msi_interrupt);
+  return vector;
+}
+
+/* handlers run with interrupts off, so once a grace period has passed no CPU
+ * is still in msi_interrupt for it and the caller can free `data` */
+static void release_vector(uint8_t vector) {
+  set_fast_interrupt_handler(vector, NULL);
+  synchronize_rcu();
+  msi_vectors[vector].dev = NULL;
+  irq_free_vector(vector);
+}
+
+static volatile uint32_t *msix_entry(pci_device_t *dev, uint16_t entry) {
+  return dev->msix_table + entry * MSIX_ENTRY_WORDS;
+}
+
+uint16_t pci_msix_enable(pci_device_t *dev) {
+  if(dev->msix_cap == 0)
+    return 0;
+  if(dev->msix_table)
+    return dev->msix_count;
+  uint8_t  cap     = dev->msix_cap;
+  uint16_t control = pci_read16(dev, cap + MSIX_CONTROL);
+  uint32_t table   = pci_read32(dev, cap + MSIX_TABLE_OFFSET);
+  uint8_t *bar     = pci_map_bar(dev, table & MSIX_BIR_MASK);
+  if(bar == NULL)
+    return 0;
+  dev->msix_count = (control & MSIX_CONTROL_SIZE_MASK) + 1;
+  dev->msix_table = (volatile uint32_t *)(bar + (table & ~MSIX_BIR_MASK));
+  // the function mask holds everything back while the entries get masked
+  pci_write16(dev,
+              cap + MSIX_CONTROL,
+              control | MSIX_CONTROL_ENABLE | MSIX_CONTROL_FUNCTION_MASK);
+  for(uint16_t i = 0; i < dev->msix_count; ++i)
+    msix_entry(dev, i)[MSIX_ENTRY_CONTROL] |= MSIX_ENTRY_MASKED;
+  if(dev->msi_cap) {
+    uint16_t msi = pci_read16(dev, dev->msi_cap + MSI_CONTROL);
+    pci_write16(dev, dev->msi_cap + MSI_CONTROL, msi & ~MSI_CONTROL_ENABLE);
+  }
+  pci_write16(dev,
+              cap + MSIX_CONTROL,
+              (control | MSIX_CONTROL_ENABLE) & ~MSIX_CONTROL_FUNCTION_MASK);
+  return dev->msix_count;
+}
+
+uint8_t pci_msix_alloc(pci_device_t *dev,
+                       uint16_t      entry,
+                       uint32_t      cpu,
+                       msi_handler_t handler,
+                       void         *data) {
+  uint32_t address;
+  if(dev->msix_table == NULL || entry >= dev->msix_count ||
+     !msi_address(cpu, &address))
+    return 0;
+  uint8_t vector = claim_vector(dev, entry, cpu, handler, data);
+  if(vector == 0)
+    return 0;
+  volatile uint32_t *e = msix_entry(dev, entry);
+  e[MSIX_ENTRY_ADDR_LO] = address;
+  e[MSIX_ENTRY_ADDR_HI] = 0;
+  e[MSIX_ENTRY_DATA]    = vector;
+  e[MSIX_ENTRY_CONTROL] &= ~MSIX_ENTRY_MASKED;
+  return vector;
+}
+
+void pci_msix_set_affinity(pci_device_t *dev, uint16_t entry, uint32_t cpu) {
+  uint32_t address;
+  if(dev->msix_table == NULL || entry >= dev->msix_count ||
+     !msi_address(cpu, &address))
+    return;
+  volatile uint32_t *e       = msix_entry(dev, entry);
+  uint32_t           control = e[MSIX_ENTRY_CONTROL];
+  e[MSIX_ENTRY_CONTROL]      = control | MSIX_ENTRY_MASKED;
+  e[MSIX_ENTRY_ADDR_LO]      = address;
+  e[MSIX_ENTRY_CONTROL]      = control;
+  msi_vectors[e[MSIX_ENTRY_DATA] & 0xFF].cpu = cpu;
+}
+
+void pci_msix_free(pci_device_t *dev, uint16_t entry) {
+  if(dev->msix_table == NULL || entry >= dev->msix_count)
+    return;
+  volatile uint32_t *e   = msix_entry(dev, entry);
+  e[MSIX_ENTRY_CONTROL] |= MSIX_ENTRY_MASKED;
+  // read back so the mask has reached the device before the vector goes
+  (void)e[MSIX_ENTRY_CONTROL];
+  uint8_t vector = e[MSIX_ENTRY_DATA] & 0xFF;
+  if(vector >= VECTOR_DYNAMIC_BASE && msi_vectors[vector].dev == dev)
+    release_vector(vector);
+}
+
+uint8_t pci_msi_enable(pci_device_t *dev,
+                       uint32_t      cpu,
+                       msi_handler_t handler,
+                       void         *data) {
+  uint32_t address;
+  if(dev->msi_cap == 0 || !msi_address(cpu, &address))
+    return 0;
+  uint8_t vector = claim_vector(dev, MSI_ENTRY_NONE, cpu, handler, data);
+  if(vector == 0)
+    return 0;
+  uint8_t  cap     = dev->msi_cap;
+  uint16_t control = pci_read16(dev, cap + MSI_CONTROL);
+  pci_write32(dev, cap + MSI_ADDR_LO, address);
+  if(control & MSI_CONTROL_64) {
+    pci_write32(dev, cap + MSI_ADDR_HI, 0);
+    pci_write16(dev, cap + MSI_DATA_64, vector);
+  } else {
+    pci_write16(dev, cap + MSI_DATA_32, vector);
+  }
+  // one message only
+  control &= ~MSI_CONTROL_MME_MASK;
+  pci_write16(dev, cap + MSI_CONTROL, control | MSI_CONTROL_ENABLE);
+  return vector;
+}
+
+static void msi_cmd(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+  for(uint32_t v = VECTOR_DYNAMIC_BASE; v < VECTOR_DYNAMIC_END; ++v) {
+    pci_device_t *dev = msi_vectors[v].dev;
+    if(dev == NULL)
+      continue;
+    printf("vector 0x%02x: %02x:%02x.%u ", v, dev->bus, dev->dev, dev->func);
+    if(msi_vectors[v].entry == MSI_ENTRY_NONE)
+      printf("msi");
+    else
+      printf("msix %u", msi_vectors[v].entry);
+    printf(" -> cpu %u\n", msi_vectors[v].cpu);
+  }
+}
+
+void msi_init(void) {
+  debug_register("msi", "MSI/MSI-X vectors and their CPUs", msi_cmd);
+}
@@ -0,0 +1,88 @@
+#ifndef _MSI_H
+#define _MSI_H
+#include <dev/pci.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+message signalled interrupts. each MSI-X table entry (or the one MSI
+message) gets its own vector from irq_alloc_vector, steered at one CPU's
+local APIC, so a multi-queue device can complete each queue on the CPU
+that submits to it. handlers run on the fast interrupt path with
+interrupts off
+*/
+
+/* MSI-X capability */
+#define MSIX_CONTROL      0x02
+#define MSIX_TABLE_OFFSET 0x04
+#define MSIX_PBA_OFFSET   0x08
+
+#define MSIX_CONTROL_SIZE_MASK     0x7FF
+#define MSIX_CONTROL_FUNCTION_MASK (1 << 14)
+#define MSIX_CONTROL_ENABLE        (1 << 15)
+#define MSIX_BIR_MASK              0x7
+
+/* 16 byte table entries, as 32 bit words */
+#define MSIX_ENTRY_WORDS     4
+#define MSIX_ENTRY_ADDR_LO   0
+#define MSIX_ENTRY_ADDR_HI   1
+#define MSIX_ENTRY_DATA      2
+#define MSIX_ENTRY_CONTROL   3
+#define MSIX_ENTRY_MASKED    (1 << 0)
+
+/* MSI capability */
+#define MSI_CONTROL          0x02
+#define MSI_ADDR_LO          0x04
+#define MSI_ADDR_HI          0x08
+#define MSI_DATA_32          0x08
+#define MSI_DATA_64          0x0C
+#define MSI_CONTROL_ENABLE   (1 << 0)
+#define MSI_CONTROL_MME_MASK (7 << 4)
+#define MSI_CONTROL_64       (1 << 7)
+
+/* fixed delivery, physical destination, edge triggered */
+#define MSI_ADDRESS_BASE 0xFEE00000u
+#define MSI_DEST_SHIFT   12
+
+typedef void (*msi_handler_t)(void *data);
+
+/**
+ * @brief map the MSI-X table of `dev` and enable MSI-X with every entry
+ * masked, after which INTx and MSI are off
+ *
+ * @return number of table entries, 0 if the device has no MSI-X
+ */
+uint16_t pci_msix_enable(pci_device_t *dev);
+/**
+ * @brief give table `entry` a vector delivered to `cpu`, calling
+ * `handler(data)` there, and unmask it
+ *
+ * @return the vector, or 0 when out of vectors
+ */
+uint8_t pci_msix_alloc(pci_device_t *dev,
+                       uint16_t      entry,
+                       uint32_t      cpu,
+                       msi_handler_t handler,
+                       void         *data);
+/**
+ * @brief point `entry` at another CPU. masked while it's rewritten, so no
+ * message goes out half updated
+ */
+void pci_msix_set_affinity(pci_device_t *dev, uint16_t entry, uint32_t cpu);
+/**
+ * @brief mask `entry` and give its vector back. waits for a grace period, so
+ * the handler's data can be freed as soon as this returns. not from an
+ * interrupt handler or an RCU read-side section
+ */
+void pci_msix_free(pci_device_t *dev, uint16_t entry);
+/**
+ * @brief single message MSI, for devices without MSI-X
+ *
+ * @return the vector, or 0 if the device has no MSI or we're out of vectors
+ */
+uint8_t pci_msi_enable(pci_device_t *dev,
+                       uint32_t      cpu,
+                       msi_handler_t handler,
+                       void         *data);
+void msi_init(void);
+#endif  // _MSI_H
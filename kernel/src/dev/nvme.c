@@ -0,0 +1,726 @@
+#include "nvme.h"
+#include <dev/block.h>
+#include <dev/msi.h>
+#include <dev/pci.h>
+#include <mm/numa.h>
+#include <mm/pmm.h>
+#include <mm/slab.h>
+#include <stdlib.h>
+#include <sys/cpu.h>
+#include <sys/debug.h>
+#include <sys/softirq.h>
+#include <sys/spinlock.h>
+#include <time/clocksource.h>
+
+#define NVME_MAX_CONTROLLERS 4
+#define NVME_MAX_NAMESPACES  4
+#define NVME_ADMIN_DEPTH     32
+#define NVME_QUEUE_DEPTH     256
+
+/*
+interrupt coalescing set at probe time: completions to wait for, and the
+longest to wait in 100us units. off by default, at low queue depths the
+timer is added to every request's latency. `nvme coalesce` changes it
+*/
+#define NVME_COALESCE_THRESHOLD 0
+#define NVME_COALESCE_TIME      0
+
+typedef struct nvme_queue {
+  struct nvme         *ctrl;
+  spinlock_t           lock;
+  nvme_sqe_t          *sq;
+  volatile nvme_cqe_t *cq;
+  uint64_t             sq_phys;
+  uint64_t             cq_phys;
+  /* BLOCK_MAX_PAGES entries for each command id, I/O queues only */
+  uint64_t            *prps;
+  uint64_t             prps_phys;
+  volatile uint32_t   *sq_db;
+  volatile uint32_t   *cq_db;
+  uint16_t             qid;
+  uint16_t             depth;
+  uint16_t             sq_tail;
+  uint16_t             cq_head;
+  /* phase tag of entries we haven't seen yet, flips on every wrap */
+  uint8_t  phase;
+  /* 0 for the admin and polled queues */
+  uint8_t  vector;
+  uint32_t cpu;
+  /* by command id, one fewer than depth so the SQ can never overflow */
+  block_request_t *cmds[NVME_QUEUE_DEPTH];
+  uint16_t         free_cids[NVME_QUEUE_DEPTH];
+  uint16_t         free_count;
+  block_request_t  *pending;
+  block_request_t **pending_tail;
+  tasklet_t         tasklet;
+  uint64_t          requests;
+  uint64_t          doorbells;
+  uint64_t          interrupts;
+} __attribute__((aligned(CACHE_LINE))) nvme_queue_t;
+
+typedef struct nvme_ns {
+  struct nvme   *ctrl;
+  uint32_t       nsid;
+  block_device_t blk;
+} nvme_ns_t;
+
+typedef struct nvme {
+  pci_device_t     *pci;
+  volatile uint8_t *regs;
+  uint32_t          db_stride;
+  uint64_t          timeout_ns;
+  uint32_t          index;
+  /* per request, from MDTS */
+  uint32_t          max_pages;
+  nvme_queue_t      admin;
+  /* interrupt driven, one per CPU */
+  nvme_queue_t *queues;
+  uint32_t      queue_count;
+  /* NULL when the controller had no queue to spare */
+  nvme_queue_t *poll_queue;
+  nvme_ns_t     ns[NVME_MAX_NAMESPACES];
+  uint32_t      ns_count;
+  uint8_t       coalesce_threshold;
+  uint8_t       coalesce_time;
+} nvme_t;
+
+static nvme_t  *controllers[NVME_MAX_CONTROLLERS];
+static uint32_t controller_count = 0;
+
+static inline uint32_t nvme_read32(nvme_t *ctrl, uint32_t reg) {
+  return *(volatile uint32_t *)(ctrl->regs + reg);
+}
+
+static inline uint64_t nvme_read64(nvme_t *ctrl, uint32_t reg) {
+  return *(volatile uint64_t *)(ctrl->regs + reg);
+}
+
+static inline void nvme_write32(nvme_t *ctrl, uint32_t reg, uint32_t val) {
+  *(volatile uint32_t *)(ctrl->regs + reg) = val;
+}
+
+static inline void nvme_write64(nvme_t *ctrl, uint32_t reg, uint64_t val) {
+  *(volatile uint64_t *)(ctrl->regs + reg) = val;
+}
+
+static bool wait_ready(nvme_t *ctrl, bool ready) {
+  uint64_t start = ktime_get();
+  while(ktime_get() - start < ctrl->timeout_ns) {
+    uint32_t csts = nvme_read32(ctrl, NVME_REG_CSTS);
+    if(csts & NVME_CSTS_CFS)
+      return false;
+    if(((csts & NVME_CSTS_RDY) != 0) == ready)
+      return true;
+    cpu_relax();
+  }
+  return false;
+}
+
+/* smallest block of pages that holds `bytes` */
+static uint32_t pages_order(uint64_t bytes) {
+  uint32_t order = 0;
+  while((PAGE_SIZE << order) < bytes)
+    order++;
+  return order;
+}
+
+static bool queue_alloc(nvme_t       *ctrl,
+                        nvme_queue_t *q,
+                        uint16_t      qid,
+                        uint16_t      depth,
+                        uint32_t      cpu) {
+  uint32_t node   = numa_cpu_node(cpu);
+  uint32_t sq_ord = pages_order(sizeof(nvme_sqe_t) * depth);
+  uint32_t cq_ord = pages_order(sizeof(nvme_cqe_t) * depth);
+  page_t *sq = alloc_pages_node(node, sq_ord);
+  page_t *cq = alloc_pages_node(node, cq_ord);
+  if(sq == NULL || cq == NULL) {
+    if(sq)
+      free_pages(sq, sq_ord);
+    if(cq)
+      free_pages(cq, cq_ord);
+    return false;
+  }
+  // the controller posts with phase 1 first, a zeroed ring is all stale
+  memset(page_address(cq), 0, PAGE_SIZE << cq_ord);
+
+  volatile uint8_t *db = ctrl->regs + NVME_REG_DOORBELL;
+  q->ctrl               = ctrl;
+  q->sq                 = page_address(sq);
+  q->cq                 = page_address(cq);
+  q->sq_phys            = page_to_phys(sq);
+  q->cq_phys            = page_to_phys(cq);
+  q->sq_db = (volatile uint32_t *)(db + 2 * qid * ctrl->db_stride);
+  q->cq_db = (volatile uint32_t *)(db + (2 * qid + 1) * ctrl->db_stride);
+  q->qid          = qid;
+  q->depth        = depth;
+  q->phase        = 1;
+  q->cpu          = cpu;
+  q->pending_tail = &q->pending;
+  for(uint16_t cid = depth - 1; cid > 0; --cid)
+    q->free_cids[q->free_count++] = cid - 1;
+  return true;
+}
+
+/* undoes queue_alloc and io_queue_create, once the controller has deleted the
+ * queue or been disabled */
+static void queue_free(nvme_queue_t *q) {
+  if(q->vector)
+    pci_msix_free(q->ctrl->pci, q->qid);
+  if(q->prps)
+    free_pages(virt_to_page(q->prps),
+               pages_order(sizeof(uint64_t) * BLOCK_MAX_PAGES * q->depth));
+  free_pages(phys_to_page(q->sq_phys),
+             pages_order(sizeof(nvme_sqe_t) * q->depth));
+  free_pages(phys_to_page(q->cq_phys),
+             pages_order(sizeof(nvme_cqe_t) * q->depth));
+  memset(q, 0, sizeof(*q));
+}
+
+static inline bool cq_pop(nvme_queue_t *q,
+                          uint16_t     *cid,
+                          uint16_t     *status,
+                          uint32_t     *result) {
+  volatile nvme_cqe_t *cqe   = &q->cq[q->cq_head];
+  uint16_t             entry = __atomic_load_n(&cqe->status, __ATOMIC_ACQUIRE);
+  if((entry & 1) != q->phase)
+    return false;
+  *cid    = cqe->cid;
+  *status = entry >> 1;
+  if(result)
+    *result = cqe->result;
+  if(++q->cq_head == q->depth) {
+    q->cq_head = 0;
+    q->phase ^= 1;
+  }
+  return true;
+}
+
+static inline void sq_push(nvme_queue_t *q, const nvme_sqe_t *cmd) {
+  q->sq[q->sq_tail] = *cmd;
+  if(++q->sq_tail == q->depth)
+    q->sq_tail = 0;
+}
+
+/* one doorbell write covers everything pushed since the last one */
+static inline void sq_ring(nvme_queue_t *q) {
+  __atomic_store_n(q->sq_db, q->sq_tail, __ATOMIC_RELEASE);
+  q->doorbells++;
+}
+
+/*
+admin commands are rare enough to just spin on. the command id is the SQ
+slot, so the late completion of one that timed out is told apart from ours
+and dropped
+*/
+static int admin_cmd(nvme_t *ctrl, nvme_sqe_t *cmd, uint32_t *result) {
+  nvme_queue_t *q     = &ctrl->admin;
+  int           ret   = -1;
+  uint64_t      flags = spin_lock_irqsave(&q->lock);
+  uint16_t      id    = q->sq_tail;
+  cmd->cdw0 |= (uint32_t)id << 16;
+  sq_push(q, cmd);
+  sq_ring(q);
+  uint64_t start = ktime_get();
+  while(ktime_get() - start < ctrl->timeout_ns) {
+    uint16_t cid, status;
+    if(!cq_pop(q, &cid, &status, result)) {
+      cpu_relax();
+      continue;
+    }
+    *q->cq_db = q->cq_head;
+    if(cid != id) {
+      kwarn("nvme%u: late admin completion %u\n", ctrl->index, cid);
+      continue;
+    }
+    ret = status;
+    break;
+  }
+  spin_unlock_irqrestore(&q->lock, flags);
+  if(ret)
+    kwarn("nvme%u: admin command 0x%02x failed (%d)\n",
+          ctrl->index,
+          cmd->cdw0 & 0xFF,
+          ret);
+  return ret;
+}
+
+static int identify(nvme_t *ctrl, uint32_t cns, uint32_t nsid, uint64_t buf) {
+  nvme_sqe_t cmd = {
+    .cdw0  = NVME_ADMIN_IDENTIFY,
+    .nsid  = nsid,
+    .prp1  = buf,
+    .cdw10 = cns,
+  };
+  return admin_cmd(ctrl, &cmd, NULL);
+}
+
+static int set_feature(nvme_t   *ctrl,
+                       uint32_t  fid,
+                       uint32_t  val,
+                       uint32_t *result) {
+  nvme_sqe_t cmd = {
+    .cdw0  = NVME_ADMIN_SET_FEATURE,
+    .cdw10 = fid,
+    .cdw11 = val,
+  };
+  return admin_cmd(ctrl, &cmd, result);
+}
+
+static int set_coalescing(nvme_t *ctrl, uint8_t threshold, uint8_t time) {
+  // the threshold field is 0 based
+  uint32_t thr = threshold ? threshold - 1 : 0;
+  int ret = set_feature(ctrl, NVME_FEATURE_COALESCING, time << 8 | thr, NULL);
+  if(ret == 0) {
+    ctrl->coalesce_threshold = threshold;
+    ctrl->coalesce_time      = time;
+  }
+  return ret;
+}
+
+/* the i-th page of the buffer, the first one may start part way in */
+static inline uint64_t req_page(block_request_t *req, uint32_t i) {
+  if(req->pages)
+    return req->pages[i];
+  return i ? (req->phys & ~(PAGE_SIZE - 1)) + i * PAGE_SIZE : req->phys;
+}
+
+static void build_rw(nvme_queue_t    *q,
+                     nvme_sqe_t      *cmd,
+                     block_request_t *req,
+                     uint16_t         cid) {
+  nvme_ns_t *ns = req->dev->driver_data;
+  memset(cmd, 0, sizeof(*cmd));
+  cmd->nsid = ns->nsid;
+  if(req->op == BLOCK_FLUSH) {
+    cmd->cdw0 = NVME_CMD_FLUSH | (uint32_t)cid << 16;
+    return;
+  }
+  uint8_t  opcode = req->op == BLOCK_READ ? NVME_CMD_READ : NVME_CMD_WRITE;
+  uint64_t bytes  = req->count * req->dev->sector_size;
+  uint32_t pages  = req->pages ? bytes / PAGE_SIZE
+                               : ((req->phys & (PAGE_SIZE - 1)) + bytes +
+                                 PAGE_SIZE - 1) / PAGE_SIZE;
+  cmd->cdw0 = opcode | (uint32_t)cid << 16;
+  cmd->prp1 = req_page(req, 0);
+  if(pages == 2) {
+    cmd->prp2 = req_page(req, 1);
+  } else if(pages > 2) {
+    // the rest go in this command id's PRP list
+    uint64_t *list = &q->prps[cid * BLOCK_MAX_PAGES];
+    for(uint32_t i = 1; i < pages; ++i) list[i - 1] = req_page(req, i);
+    cmd->prp2 = q->prps_phys + cid * BLOCK_MAX_PAGES * sizeof(uint64_t);
+  }
+  cmd->cdw10 = (uint32_t)req->sector;
+  cmd->cdw11 = req->sector >> 32;
+  cmd->cdw12 = req->count - 1;
+}
+
+/* move pending requests onto the SQ, true if any went out */
+static bool start_pending(nvme_queue_t *q) {
+  bool started = false;
+  while(q->pending && q->free_count) {
+    block_request_t *req = q->pending;
+    q->pending           = req->next;
+    if(q->pending == NULL)
+      q->pending_tail = &q->pending;
+    uint16_t   cid = q->free_cids[--q->free_count];
+    nvme_sqe_t cmd;
+    build_rw(q, &cmd, req, cid);
+    q->cmds[cid] = req;
+    sq_push(q, &cmd);
+    q->requests++;
+    started = true;
+  }
+  return started;
+}
+
+static void queue_batch(nvme_queue_t *q, block_request_t *reqs) {
+  uint64_t flags   = spin_lock_irqsave(&q->lock);
+  *q->pending_tail = reqs;
+  while(*q->pending_tail) q->pending_tail = &(*q->pending_tail)->next;
+  if(start_pending(q))
+    sq_ring(q);
+  spin_unlock_irqrestore(&q->lock, flags);
+}
+
+static void nvme_submit(block_device_t *dev, block_request_t *reqs) {
+  nvme_ns_t    *ns    = dev->driver_data;
+  nvme_t       *ctrl  = ns->ctrl;
+  nvme_queue_t *local = &ctrl->queues[cpu_index() % ctrl->queue_count];
+  if(ctrl->poll_queue == NULL) {
+    queue_batch(local, reqs);
+    return;
+  }
+  // split off polled requests, each half still costs a single doorbell
+  block_request_t  *irq = NULL, *polled = NULL;
+  block_request_t **irq_tail = &irq, **polled_tail = &polled;
+  while(reqs) {
+    block_request_t *req = reqs;
+    reqs                 = req->next;
+    req->next            = NULL;
+    if(req->flags & BLOCK_REQ_POLLED) {
+      *polled_tail = req;
+      polled_tail  = &req->next;
+    } else {
+      *irq_tail = req;
+      irq_tail  = &req->next;
+    }
+  }
+  if(irq)
+    queue_batch(local, irq);
+  if(polled)
+    queue_batch(ctrl->poll_queue, polled);
+}
+
+static uint32_t nvme_reap(nvme_queue_t *q) {
+  block_request_t *done  = NULL;
+  uint32_t         count = 0;
+  uint16_t         cid, status;
+  uint64_t         flags = spin_lock_irqsave(&q->lock);
+  uint16_t         head  = q->cq_head;
+  while(cq_pop(q, &cid, &status, NULL)) {
+    block_request_t *req = cid < q->depth ? q->cmds[cid] : NULL;
+    if(req == NULL) {
+      kwarn("nvme: queue %u completed unknown command %u\n", q->qid, cid);
+      continue;
+    }
+    req->status = status;
+    req->next   = done;
+    done        = req;
+    q->cmds[cid] = NULL;
+    q->free_cids[q->free_count++] = cid;
+    count++;
+  }
+  // one head doorbell for the whole pass, unknown entries were consumed too
+  if(q->cq_head != head)
+    *q->cq_db = q->cq_head;
+  if(start_pending(q))
+    sq_ring(q);
+  spin_unlock_irqrestore(&q->lock, flags);
+  while(done) {
+    block_request_t *req = done;
+    done                 = req->next;
+    req->done(req);
+  }
+  return count;
+}
+
+static uint32_t nvme_poll(block_device_t *dev) {
+  nvme_ns_t *ns    = dev->driver_data;
+  nvme_t    *ctrl  = ns->ctrl;
+  uint32_t   count = nvme_reap(&ctrl->queues[cpu_index() % ctrl->queue_count]);
+  if(ctrl->poll_queue)
+    count += nvme_reap(ctrl->poll_queue);
+  return count;
+}
+
+static const block_ops_t nvme_ops = {
+  .submit = nvme_submit,
+  .poll   = nvme_poll,
+};
+
+static void nvme_tasklet(uint64_t data) {
+  nvme_reap((nvme_queue_t *)data);
+}
+
+/* the handler only defers, completions run in softirq context */
+static void nvme_interrupt(void *data) {
+  nvme_queue_t *q = data;
+  q->interrupts++;
+  tasklet_schedule(&q->tasklet);
+}
+
+/* CQ before SQ, the SQ names the CQ it completes to */
+static bool io_queue_create(nvme_t       *ctrl,
+                            nvme_queue_t *q,
+                            uint16_t      qid,
+                            uint16_t      depth,
+                            uint32_t      cpu,
+                            bool          irq) {
+  if(!queue_alloc(ctrl, q, qid, depth, cpu))
+    return false;
+  uint32_t order = pages_order(sizeof(uint64_t) * BLOCK_MAX_PAGES * depth);
+  page_t  *prps  = alloc_pages_node(numa_cpu_node(cpu), order);
+  if(prps == NULL)
+    goto fail;
+  q->prps      = page_address(prps);
+  q->prps_phys = page_to_phys(prps);
+  uint32_t cq_flags = NVME_QUEUE_CONTIGUOUS;
+  if(irq) {
+    // entry 0 belongs to the admin queue
+    tasklet_init(&q->tasklet, nvme_tasklet, (uint64_t)q);
+    q->vector = pci_msix_alloc(ctrl->pci, qid, cpu, nvme_interrupt, q);
+    if(q->vector == 0)
+      goto fail;
+    cq_flags |= NVME_CQ_IRQ_ENABLED | (uint32_t)qid << 16;
+  }
+  nvme_sqe_t cq = {
+    .cdw0  = NVME_ADMIN_CREATE_CQ,
+    .prp1  = q->cq_phys,
+    .cdw10 = (uint32_t)(depth - 1) << 16 | qid,
+    .cdw11 = cq_flags,
+  };
+  nvme_sqe_t sq = {
+    .cdw0  = NVME_ADMIN_CREATE_SQ,
+    .prp1  = q->sq_phys,
+    .cdw10 = (uint32_t)(depth - 1) << 16 | qid,
+    .cdw11 = (uint32_t)qid << 16 | NVME_QUEUE_CONTIGUOUS,
+  };
+  if(admin_cmd(ctrl, &cq, NULL) == 0) {
+    if(admin_cmd(ctrl, &sq, NULL) == 0)
+      return true;
+    nvme_sqe_t del = { .cdw0 = NVME_ADMIN_DELETE_CQ, .cdw10 = qid };
+    // the controller still has the CQ's address, keep the memory
+    if(admin_cmd(ctrl, &del, NULL))
+      return false;
+  }
+fail:
+  queue_free(q);
+  return false;
+}
+
+static bool enable_controller(nvme_t *ctrl) {
+  nvme_write32(ctrl,
+               NVME_REG_CC,
+               nvme_read32(ctrl, NVME_REG_CC) & ~NVME_CC_EN);
+  if(!wait_ready(ctrl, false))
+    return false;
+  if(!queue_alloc(ctrl, &ctrl->admin, 0, NVME_ADMIN_DEPTH, cpu_index()))
+    return false;
+  nvme_write32(ctrl,
+               NVME_REG_AQA,
+               (NVME_ADMIN_DEPTH - 1) << 16 | (NVME_ADMIN_DEPTH - 1));
+  nvme_write64(ctrl, NVME_REG_ASQ, ctrl->admin.sq_phys);
+  nvme_write64(ctrl, NVME_REG_ACQ, ctrl->admin.cq_phys);
+  // NVM command set, 4KiB pages, round robin arbitration
+  nvme_write32(ctrl,
+               NVME_REG_CC,
+               NVME_CC_IOCQES_16 | NVME_CC_IOSQES_64 | NVME_CC_EN);
+  return wait_ready(ctrl, true);
+}
+
+static bool create_queues(nvme_t *ctrl, uint64_t cap) {
+  // ask for one per CPU and one more to poll, 0 based
+  uint32_t want = cpu_count() + 1, granted;
+  if(set_feature(ctrl,
+                 NVME_FEATURE_NUM_QUEUES,
+                 (want - 1) << 16 | (want - 1),
+                 &granted))
+    return false;
+  uint32_t avail = (granted & 0xFFFF) + 1;
+  if((granted >> 16) + 1 < avail)
+    avail = (granted >> 16) + 1;
+
+  uint16_t entries = pci_msix_enable(ctrl->pci);
+  if(entries < 2) {
+    kwarn("nvme%u: need at least 2 MSI-X entries\n", ctrl->index);
+    return false;
+  }
+  uint32_t nq = cpu_count();
+  if(nq > avail)
+    nq = avail;
+  if(nq > entries - 1u)
+    nq = entries - 1u;
+  bool     poll  = avail > nq;
+  uint32_t depth = NVME_CAP_MQES(cap) + 1;
+  if(depth > NVME_QUEUE_DEPTH)
+    depth = NVME_QUEUE_DEPTH;
+
+  ctrl->queues = kzalloc(sizeof(nvme_queue_t) * (nq + poll));
+  if(ctrl->queues == NULL)
+    return false;
+  for(uint32_t q = 0; q < nq; ++q) {
+    if(!io_queue_create(ctrl, &ctrl->queues[q], q + 1, depth, q, true))
+      return false;
+    ctrl->queue_count++;
+  }
+  if(poll &&
+     io_queue_create(ctrl, &ctrl->queues[nq], nq + 1, depth, 0, false))
+    ctrl->poll_queue = &ctrl->queues[nq];
+  return true;
+}
+
+static void add_namespace(nvme_t *ctrl, uint32_t nsid, const uint8_t *id) {
+  uint64_t nsze = *(const uint64_t *)(id + NVME_ID_NS_NSZE);
+  if(nsze == 0)
+    return;
+  uint8_t  format = id[NVME_ID_NS_FLBAS] & 0xF;
+  uint32_t lbaf   = *(const uint32_t *)(id + NVME_ID_NS_LBAF + 4 * format);
+  uint16_t ms     = lbaf & 0xFFFF;
+  uint8_t  lbads  = (lbaf >> 16) & 0xFF;
+  if(ms || lbads < 9 || (1u << lbads) > PAGE_SIZE) {
+    kwarn("nvme%u: skipping namespace %u, unsupported format\n",
+          ctrl->index,
+          nsid);
+    return;
+  }
+  nvme_ns_t *ns = &ctrl->ns[ctrl->ns_count++];
+  ns->ctrl      = ctrl;
+  ns->nsid      = nsid;
+  // nvme<controller>n<namespace>, both single digits here
+  memcpy(ns->blk.name, "nvme0n1", 8);
+  ns->blk.name[4] += ctrl->index;
+  ns->blk.name[6] += nsid - 1;
+  ns->blk.sector_size = 1u << lbads;
+  ns->blk.sectors     = nsze;
+  ns->blk.queue_count = ctrl->queue_count;
+  ns->blk.max_sectors = ctrl->max_pages * PAGE_SIZE >> lbads;
+  ns->blk.ops         = &nvme_ops;
+  ns->blk.driver_data = ns;
+  block_register(&ns->blk);
+}
+
+static bool nvme_probe(pci_device_t *pci, const pci_device_id_t *id) {
+  (void)id;
+  // mass storage/NVM also covers the older NVMHCI interface
+  if(pci->prog_if != NVME_PROG_IF || controller_count == NVME_MAX_CONTROLLERS)
+    return false;
+  nvme_t *ctrl = kzalloc(sizeof(*ctrl));
+  page_t *buf  = alloc_pages(0);
+  if(ctrl == NULL || buf == NULL)
+    goto fail;
+  ctrl->pci   = pci;
+  ctrl->index = controller_count;
+  ctrl->regs  = pci_map_bar(pci, 0);
+  if(ctrl->regs == NULL)
+    goto fail;
+  pci_enable_device(pci);
+
+  uint64_t cap     = nvme_read64(ctrl, NVME_REG_CAP);
+  ctrl->db_stride  = 4u << NVME_CAP_DSTRD(cap);
+  ctrl->timeout_ns = (NVME_CAP_TO(cap) + 1) * 500 * NSEC_PER_MSEC;
+  if(!(cap & NVME_CAP_CSS_NVM) || NVME_CAP_MPSMIN(cap) != 0) {
+    kwarn("nvme%u: no NVM command set or 4KiB pages\n", ctrl->index);
+    goto fail;
+  }
+  if(!enable_controller(ctrl)) {
+    kwarn("nvme%u: controller didn't become ready\n", ctrl->index);
+    goto fail;
+  }
+
+  uint8_t *data = page_address(buf);
+  if(identify(ctrl, NVME_IDENTIFY_CONTROLLER, 0, page_to_phys(buf)))
+    goto fail;
+  uint32_t nn = *(uint32_t *)(data + NVME_ID_CTRL_NN);
+  // largest transfer as a power of two of pages, 0 for no limit
+  uint8_t mdts    = data[NVME_ID_CTRL_MDTS];
+  ctrl->max_pages = BLOCK_MAX_PAGES;
+  if(mdts && mdts < 31 && (1u << mdts) < ctrl->max_pages)
+    ctrl->max_pages = 1u << mdts;
+  if(!create_queues(ctrl, cap))
+    goto fail;
+  set_coalescing(ctrl, NVME_COALESCE_THRESHOLD, NVME_COALESCE_TIME);
+
+  uint32_t version = nvme_read32(ctrl, NVME_REG_VS);
+  kinfo("nvme%u: NVMe %u.%u, %u namespaces, %u I/O queues%s\n",
+        ctrl->index,
+        version >> 16,
+        (version >> 8) & 0xFF,
+        nn,
+        ctrl->queue_count,
+        ctrl->poll_queue ? " and a polled one" : "");
+  pci->driver_data = ctrl;
+  controllers[controller_count++] = ctrl;
+  for(uint32_t nsid = 1; nsid <= nn && nsid <= NVME_MAX_NAMESPACES; ++nsid)
+    if(identify(ctrl, NVME_IDENTIFY_NAMESPACE, nsid, page_to_phys(buf)) == 0)
+      add_namespace(ctrl, nsid, data);
+  free_pages(buf, 0);
+  return true;
+
+fail:
+  if(ctrl && ctrl->regs) {
+    nvme_write32(ctrl, NVME_REG_CC, 0);
+    // a controller that won't reset might still write to its queues, leave
+    // them (and ctrl, which points at them) allocated
+    if(!wait_ready(ctrl, false))
+      ctrl = NULL;
+  }
+  if(ctrl) {
+    for(uint32_t q = 0; q < ctrl->queue_count; ++q)
+      queue_free(&ctrl->queues[q]);
+    if(ctrl->poll_queue)
+      queue_free(ctrl->poll_queue);
+    if(ctrl->admin.sq)
+      queue_free(&ctrl->admin);
+    kfree(ctrl->queues);
+    kfree(ctrl);
+  }
+  if(buf)
+    free_pages(buf, 0);
+  kwarn("nvme: couldn't set up %02x:%02x.%u\n", pci->bus, pci->dev, pci->func);
+  return false;
+}
+
+static bool parse_u8(const char *s, uint8_t *out) {
+  uint32_t val = 0;
+  if(*s == '\0')
+    return false;
+  for(; *s; ++s) {
+    if(*s < '0' || *s > '9')
+      return false;
+    val = val * 10 + (*s - '0');
+    if(val > 0xFF)
+      return false;
+  }
+  *out = val;
+  return true;
+}
+
+static void print_queue(const char *kind, nvme_queue_t *q) {
+  printf("  %s queue %u (cpu %u, vector 0x%02x, depth %u): %lu requests, "
+         "%lu doorbells, %lu interrupts\n",
+         kind,
+         q->qid,
+         q->cpu,
+         q->vector,
+         q->depth,
+         q->requests,
+         q->doorbells,
+         q->interrupts);
+}
+
+static void nvme_cmd(int argc, char **argv) {
+  if(argc > 1 && strcmp(argv[1], "coalesce") == 0) {
+    uint8_t threshold, time;
+    if(argc < 4 || !parse_u8(argv[2], &threshold) ||
+       !parse_u8(argv[3], &time)) {
+      printf("usage: nvme coalesce <completions> <time in 100us>\n");
+      return;
+    }
+    for(uint32_t i = 0; i < controller_count; ++i)
+      set_coalescing(controllers[i], threshold, time);
+  }
+  for(uint32_t i = 0; i < controller_count; ++i) {
+    nvme_t *ctrl = controllers[i];
+    printf("nvme%u: coalescing ", ctrl->index);
+    if(ctrl->coalesce_time)
+      printf("%u completions or %u us\n",
+             ctrl->coalesce_threshold,
+             ctrl->coalesce_time * 100);
+    else
+      printf("off\n");
+    for(uint32_t q = 0; q < ctrl->queue_count; ++q)
+      print_queue("I/O", &ctrl->queues[q]);
+    if(ctrl->poll_queue)
+      print_queue("polled", ctrl->poll_queue);
+  }
+}
+
+static const pci_device_id_t nvme_ids[] = {
+  { PCI_ANY_ID, PCI_ANY_ID, NVME_CLASS },
+  { 0, 0, 0 },
+};
+
+static pci_driver_t nvme_driver = {
+  .name  = "nvme",
+  .ids   = nvme_ids,
+  .probe = nvme_probe,
+};
+
+void nvme_init(void) {
+  pci_register_driver(&nvme_driver);
+  debug_register("nvme",
+                 "[coalesce <completions> <100us>]: queues and coalescing",
+                 nvme_cmd);
+}
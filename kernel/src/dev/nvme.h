@@ -0,0 +1,97 @@
+#ifndef _NVME_H
+#define _NVME_H
+#include <stdint.h>
+
+/*
+NVMe over PCIe. the admin queue is only used at probe time and from the
+debug shell, so it's polled. I/O gets one submission/completion queue pair
+per CPU, completing through that CPU's MSI-X vector, plus (when the
+controller has one to spare) a queue without interrupts for
+BLOCK_REQ_POLLED requests
+*/
+
+#define NVME_CLASS   0x0108
+#define NVME_PROG_IF 0x02
+
+/* controller registers, in BAR0 */
+#define NVME_REG_CAP      0x00
+#define NVME_REG_VS       0x08
+#define NVME_REG_CC       0x14
+#define NVME_REG_CSTS     0x1C
+#define NVME_REG_AQA      0x24
+#define NVME_REG_ASQ      0x28
+#define NVME_REG_ACQ      0x30
+#define NVME_REG_DOORBELL 0x1000
+
+#define NVME_CAP_MQES(cap)   ((cap) & 0xFFFF)
+#define NVME_CAP_TO(cap)     (((cap) >> 24) & 0xFF)
+#define NVME_CAP_DSTRD(cap)  (((cap) >> 32) & 0xF)
+#define NVME_CAP_CSS_NVM     (1ull << 37)
+#define NVME_CAP_MPSMIN(cap) (((cap) >> 48) & 0xF)
+
+#define NVME_CC_EN        (1 << 0)
+#define NVME_CC_IOSQES_64 (6 << 16)
+#define NVME_CC_IOCQES_16 (4 << 20)
+#define NVME_CSTS_RDY     (1 << 0)
+#define NVME_CSTS_CFS     (1 << 1)
+
+#define NVME_ADMIN_CREATE_SQ   0x01
+#define NVME_ADMIN_DELETE_CQ   0x04
+#define NVME_ADMIN_CREATE_CQ   0x05
+#define NVME_ADMIN_IDENTIFY    0x06
+#define NVME_ADMIN_SET_FEATURE 0x09
+
+#define NVME_IDENTIFY_NAMESPACE  0
+#define NVME_IDENTIFY_CONTROLLER 1
+
+#define NVME_FEATURE_NUM_QUEUES 0x07
+#define NVME_FEATURE_COALESCING 0x08
+
+/* create queue flags (cdw11) */
+#define NVME_QUEUE_CONTIGUOUS (1 << 0)
+#define NVME_CQ_IRQ_ENABLED   (1 << 1)
+
+#define NVME_CMD_FLUSH 0x00
+#define NVME_CMD_WRITE 0x01
+#define NVME_CMD_READ  0x02
+
+/* bytes into the identify data */
+#define NVME_ID_CTRL_MDTS 77
+#define NVME_ID_CTRL_NN   516
+#define NVME_ID_NS_NSZE   0
+#define NVME_ID_NS_FLBAS  26
+#define NVME_ID_NS_LBAF   128
+
+typedef struct nvme_sqe {
+  /* opcode in the low byte, command id in the top half */
+  uint32_t cdw0;
+  uint32_t nsid;
+  uint32_t cdw2;
+  uint32_t cdw3;
+  uint64_t mptr;
+  uint64_t prp1;
+  uint64_t prp2;
+  uint32_t cdw10;
+  uint32_t cdw11;
+  uint32_t cdw12;
+  uint32_t cdw13;
+  uint32_t cdw14;
+  uint32_t cdw15;
+} nvme_sqe_t;
+
+typedef struct nvme_cqe {
+  uint32_t result;
+  uint32_t reserved;
+  uint16_t sq_head;
+  uint16_t sq_id;
+  uint16_t cid;
+  /* phase tag in bit 0, status code above it */
+  uint16_t status;
+} nvme_cqe_t;
+
+/**
+ * @brief claim every NVMe controller and register its namespaces as
+ * nvme0n1, nvme0n2, ... after pci_init and smp_init
+ */
+void nvme_init(void);
+#endif  // _NVME_H
@@ -0,0 +1,624 @@
+#include "pagecache.h"
+#include <mm/radix.h>
+#include <mm/slab.h>
+#include <sched/thread.h>
+#include <stdlib.h>
+#include <sys/cpu.h>
+#include <sys/debug.h>
+#include <sys/spinlock.h>
+#include <time/clocksource.h>
+#include <time/timer.h>
+
+#define PAGECACHE_TAG_DIRTY     0
+#define PAGECACHE_TAG_WRITEBACK 1
+
+/* read-ahead window, in pages */
+#define PAGECACHE_RA_MIN 4
+#define PAGECACHE_RA_MAX BLOCK_MAX_PAGES
+/* how often kflushd writes back */
+#define PAGECACHE_WRITEBACK_NS (5 * NSEC_PER_SEC)
+/*
+the cache may take a quarter of the memory free at boot, and kflushd is
+woken early once an eighth of that is dirty
+*/
+#define PAGECACHE_MEM_SHIFT   2
+#define PAGECACHE_DIRTY_SHIFT 3
+/* clean pages dropped at once when the cache is full */
+#define PAGECACHE_EVICT_BATCH 16
+/* dirty pages looked up at once during write-back */
+#define WRITEBACK_BATCH 64
+/* pages bench-pagecache reads, 8MiB */
+#define BENCH_PAGES 2048
+
+typedef struct pagecache {
+  block_device_t *dev;
+  spinlock_t      lock;
+  radix_tree_t    tree;
+  cache_page_t   *lru_head;
+  cache_page_t   *lru_tail;
+  /* device size in pages, sectors per page and pages per request */
+  uint64_t        dev_pages;
+  uint32_t        sectors_per_page;
+  uint32_t        max_pages;
+  uint64_t        pages;
+  uint64_t        dirty;
+  /* last page read, and the window most recently read ahead */
+  uint64_t        ra_prev;
+  uint64_t        ra_start;
+  uint32_t        ra_size;
+  /* halved whenever read-ahead turns out to be wasted */
+  uint32_t        ra_max;
+  uint64_t        hits;
+  uint64_t        misses;
+  uint64_t        ra_pages;
+  uint64_t        ra_wasted;
+  uint64_t        wb_ios;
+  uint64_t        wb_pages;
+  uint64_t        errors;
+} __attribute__((aligned(CACHE_LINE))) pagecache_t;
+
+/* one request's worth of cache pages */
+typedef struct cache_io {
+  block_request_t req;
+  pagecache_t    *pc;
+  uint32_t        count;
+  cache_page_t   *pages[BLOCK_MAX_PAGES];
+  uint64_t        phys[BLOCK_MAX_PAGES];
+} cache_io_t;
+
+static pagecache_t   caches[BLOCK_MAX_DEVICES];
+static spinlock_t    caches_lock = SPINLOCK_INIT;
+static kmem_cache_t *entry_cache;
+static kmem_cache_t *io_cache;
+static uint64_t      total_pages = 0;
+static uint64_t      total_dirty = 0;
+static uint64_t      page_limit  = 0;
+static uint64_t      dirty_limit = 0;
+static thread_t     *flusher;
+static ktimer_t      flush_timer;
+
+static pagecache_t *cache_of(block_device_t *dev) {
+  pagecache_t *pc = &caches[dev->index];
+  if(__atomic_load_n(&pc->dev, __ATOMIC_ACQUIRE))
+    return pc;
+  if(dev->sector_size > PAGE_SIZE)
+    return NULL;
+  uint64_t flags = spin_lock_irqsave(&caches_lock);
+  if(pc->dev == NULL) {
+    pc->sectors_per_page = PAGE_SIZE / dev->sector_size;
+    pc->dev_pages        = dev->sectors / pc->sectors_per_page;
+    pc->max_pages        = dev->max_sectors / pc->sectors_per_page;
+    if(pc->max_pages == 0)
+      pc->max_pages = 1;
+    if(pc->max_pages > BLOCK_MAX_PAGES)
+      pc->max_pages = BLOCK_MAX_PAGES;
+    // so a first read of page 0 counts as sequential
+    pc->ra_prev = UINT64_MAX;
+    pc->ra_max  = PAGECACHE_RA_MAX;
+    __atomic_store_n(&pc->dev, dev, __ATOMIC_RELEASE);
+  }
+  spin_unlock_irqrestore(&caches_lock, flags);
+  return pc;
+}
+
+static void lru_add(pagecache_t *pc, cache_page_t *cp) {
+  cp->lru_prev = pc->lru_tail;
+  cp->lru_next = NULL;
+  if(pc->lru_tail)
+    pc->lru_tail->lru_next = cp;
+  else
+    pc->lru_head = cp;
+  pc->lru_tail = cp;
+}
+
+static void lru_del(pagecache_t *pc, cache_page_t *cp) {
+  if(cp->lru_prev)
+    cp->lru_prev->lru_next = cp->lru_next;
+  else
+    pc->lru_head = cp->lru_next;
+  if(cp->lru_next)
+    cp->lru_next->lru_prev = cp->lru_prev;
+  else
+    pc->lru_tail = cp->lru_prev;
+}
+
+static void page_free(pagecache_t *pc, cache_page_t *cp) {
+  radix_delete(&pc->tree, cp->index);
+  lru_del(pc, cp);
+  free_pages(cp->page, 0);
+  kmem_cache_free(entry_cache, cp);
+  pc->pages--;
+  __atomic_sub_fetch(&total_pages, 1, __ATOMIC_RELAXED);
+}
+
+/* drop up to `want` clean, unused pages, least recently used first */
+static uint32_t evict(pagecache_t *pc, uint32_t want, bool pressure) {
+  uint32_t      freed = 0;
+  cache_page_t *cp    = pc->lru_head;
+  while(cp && freed < want) {
+    cache_page_t *next = cp->lru_next;
+    if(cp->refs == 0 &&
+       !(cp->flags & (CACHE_DIRTY | CACHE_READING | CACHE_WRITEBACK))) {
+      if(pressure && (cp->flags & CACHE_AHEAD)) {
+        // read ahead for nothing, be less eager
+        pc->ra_wasted++;
+        if(pc->ra_max > PAGECACHE_RA_MIN)
+          pc->ra_max /= 2;
+      }
+      page_free(pc, cp);
+      freed++;
+    }
+    cp = next;
+  }
+  return freed;
+}
+
+static cache_page_t *page_new(pagecache_t *pc, uint64_t index) {
+  if(__atomic_load_n(&total_pages, __ATOMIC_RELAXED) >= page_limit)
+    evict(pc, PAGECACHE_EVICT_BATCH, true);
+  page_t *page = alloc_pages(0);
+  if(page == NULL && evict(pc, PAGECACHE_EVICT_BATCH, true))
+    page = alloc_pages(0);
+  if(page == NULL)
+    return NULL;
+  cache_page_t *cp = kmem_cache_alloc(entry_cache);
+  if(cp == NULL) {
+    free_pages(page, 0);
+    return NULL;
+  }
+  cp->cache = pc;
+  cp->page  = page;
+  cp->index = index;
+  cp->flags = 0;
+  cp->refs  = 0;
+  if(!radix_insert(&pc->tree, index, cp)) {
+    kmem_cache_free(entry_cache, cp);
+    free_pages(page, 0);
+    return NULL;
+  }
+  lru_add(pc, cp);
+  pc->pages++;
+  __atomic_add_fetch(&total_pages, 1, __ATOMIC_RELAXED);
+  return cp;
+}
+
+static void io_done(block_request_t *req) {
+  cache_io_t  *io    = req->data;
+  pagecache_t *pc    = io->pc;
+  uint64_t     flags = spin_lock_irqsave(&pc->lock);
+  if(req->status)
+    pc->errors++;
+  for(uint32_t i = 0; i < io->count; ++i) {
+    cache_page_t *cp = io->pages[i];
+    if(req->op == BLOCK_READ) {
+      cp->flags &= ~CACHE_READING;
+      cp->flags |= req->status ? CACHE_ERROR : CACHE_UPTODATE;
+    } else {
+      // a failed write leaves the page clean, the data is gone on eviction
+      cp->flags &= ~CACHE_WRITEBACK;
+      if(req->status)
+        cp->flags |= CACHE_ERROR;
+      radix_tag_clear(&pc->tree, cp->index, PAGECACHE_TAG_WRITEBACK);
+    }
+  }
+  spin_unlock_irqrestore(&pc->lock, flags);
+  if(req->status)
+    kwarn("pagecache: %s of %u pages at sector %lu on %s failed\n",
+          req->op == BLOCK_READ ? "read" : "write",
+          io->count,
+          req->sector,
+          pc->dev->name);
+  kmem_cache_free(io_cache, io);
+}
+
+static cache_io_t *io_alloc(pagecache_t *pc, enum block_op op, uint64_t index) {
+  cache_io_t *io = kmem_cache_alloc(io_cache);
+  if(io == NULL)
+    return NULL;
+  memset(&io->req, 0, sizeof(io->req));
+  io->pc         = pc;
+  io->count      = 0;
+  io->req.op     = op;
+  io->req.sector = index * pc->sectors_per_page;
+  io->req.pages  = io->phys;
+  io->req.done   = io_done;
+  io->req.data   = io;
+  return io;
+}
+
+static inline void io_add(cache_io_t *io, cache_page_t *cp) {
+  io->pages[io->count] = cp;
+  io->phys[io->count]  = page_to_phys(cp->page);
+  io->count++;
+}
+
+static void io_queue(pagecache_t *pc, cache_io_t *io, block_request_t **list) {
+  io->req.count = io->count * pc->sectors_per_page;
+  io->req.next  = *list;
+  *list         = &io->req;
+}
+
+static uint32_t next_window(pagecache_t *pc) {
+  uint32_t size = pc->ra_size ? pc->ra_size * 2 : PAGECACHE_RA_MIN;
+  return size < pc->ra_max ? size : pc->ra_max;
+}
+
+/*
+read whatever isn't cached of [start, start + size) into `list`, one
+request per run of missing pages. the page half way in is the marker that
+starts the next window, so it's read while this one is being used
+*/
+static void read_window(pagecache_t      *pc,
+                        uint64_t          start,
+                        uint32_t          size,
+                        uint64_t          demand,
+                        block_request_t **list) {
+  if(start >= pc->dev_pages)
+    return;
+  if(size > pc->dev_pages - start)
+    size = pc->dev_pages - start;
+  uint64_t marker = size > 1 ? start + size / 2 : UINT64_MAX;
+  pc->ra_start    = start;
+  pc->ra_size     = size;
+
+  cache_io_t *io = NULL;
+  for(uint64_t index = start; index < start + size; ++index) {
+    cache_page_t *cp = radix_lookup(&pc->tree, index);
+    if(cp) {
+      if(index == marker)
+        cp->flags |= CACHE_MARKER;
+      if(io) {
+        io_queue(pc, io, list);
+        io = NULL;
+      }
+      continue;
+    }
+    if(io && io->count == pc->max_pages) {
+      io_queue(pc, io, list);
+      io = NULL;
+    }
+    if(io == NULL && (io = io_alloc(pc, BLOCK_READ, index)) == NULL)
+      break;
+    if((cp = page_new(pc, index)) == NULL)
+      break;
+    cp->flags = CACHE_READING;
+    if(index != demand) {
+      cp->flags |= CACHE_AHEAD;
+      pc->ra_pages++;
+    }
+    if(index == marker)
+      cp->flags |= CACHE_MARKER;
+    io_add(io, cp);
+  }
+  if(io && io->count)
+    io_queue(pc, io, list);
+  else if(io)
+    kmem_cache_free(io_cache, io);
+}
+
+/* poll rather than sleep, callers can be in any context */
+static void wait_clear(pagecache_t *pc, cache_page_t *cp, uint32_t bits) {
+  while(__atomic_load_n(&cp->flags, __ATOMIC_ACQUIRE) & bits) {
+    block_poll(pc->dev);
+    cpu_relax();
+  }
+}
+
+cache_page_t *pagecache_read(block_device_t *dev, uint64_t index) {
+  pagecache_t *pc = cache_of(dev);
+  if(pc == NULL || index >= pc->dev_pages)
+    return NULL;
+  block_request_t *reads      = NULL;
+  uint64_t         flags      = spin_lock_irqsave(&pc->lock);
+  cache_page_t    *cp         = radix_lookup(&pc->tree, index);
+  bool             sequential = index == pc->ra_prev + 1;
+  pc->ra_prev                 = index;
+  // a read that failed before is tried again
+  if(cp && (cp->flags & CACHE_ERROR) && cp->refs == 0 &&
+     !(cp->flags & (CACHE_DIRTY | CACHE_READING | CACHE_WRITEBACK))) {
+    page_free(pc, cp);
+    cp = NULL;
+  }
+  if(cp) {
+    pc->hits++;
+    lru_del(pc, cp);
+    lru_add(pc, cp);
+    if(cp->flags & CACHE_MARKER) {
+      // the stream is keeping up, read the next window before it gets there
+      if(pc->ra_max < PAGECACHE_RA_MAX)
+        pc->ra_max *= 2;
+      uint64_t next = pc->ra_start + pc->ra_size;
+      if(index < pc->ra_start || index >= next)
+        next = index + 1;
+      read_window(pc, next, next_window(pc), UINT64_MAX, &reads);
+    }
+    cp->flags &= ~(CACHE_AHEAD | CACHE_MARKER);
+  } else {
+    pc->misses++;
+    // random reads get just the page, sequential ones a growing window
+    read_window(pc, index, sequential ? next_window(pc) : 1, index, &reads);
+    if(!sequential)
+      pc->ra_size = 0;
+    // we're about to spin on it anyway
+    for(block_request_t *req = reads; req; req = req->next)
+      req->flags |= BLOCK_REQ_POLLED;
+    cp = radix_lookup(&pc->tree, index);
+  }
+  if(cp)
+    cp->refs++;
+  spin_unlock_irqrestore(&pc->lock, flags);
+  if(reads)
+    block_submit(dev, reads);
+  if(cp == NULL)
+    return NULL;
+  wait_clear(pc, cp, CACHE_READING);
+  if(!(cp->flags & CACHE_UPTODATE)) {
+    pagecache_release(cp);
+    return NULL;
+  }
+  return cp;
+}
+
+cache_page_t *pagecache_grab(block_device_t *dev, uint64_t index) {
+  pagecache_t *pc = cache_of(dev);
+  if(pc == NULL || index >= pc->dev_pages)
+    return NULL;
+  uint64_t      flags = spin_lock_irqsave(&pc->lock);
+  cache_page_t *cp    = radix_lookup(&pc->tree, index);
+  if(cp) {
+    lru_del(pc, cp);
+    lru_add(pc, cp);
+  } else {
+    cp = page_new(pc, index);
+  }
+  if(cp)
+    cp->refs++;
+  spin_unlock_irqrestore(&pc->lock, flags);
+  // a read finishing later would overwrite the caller's data
+  if(cp)
+    wait_clear(pc, cp, CACHE_READING);
+  return cp;
+}
+
+void pagecache_mark_dirty(cache_page_t *cp) {
+  pagecache_t *pc    = cp->cache;
+  bool         wake  = false;
+  uint64_t     flags = spin_lock_irqsave(&pc->lock);
+  cp->flags          = (cp->flags & ~CACHE_ERROR) | CACHE_UPTODATE;
+  if(!(cp->flags & CACHE_DIRTY)) {
+    cp->flags |= CACHE_DIRTY;
+    radix_tag_set(&pc->tree, cp->index, PAGECACHE_TAG_DIRTY);
+    pc->dirty++;
+    wake = __atomic_add_fetch(&total_dirty, 1, __ATOMIC_RELAXED) == dirty_limit;
+  }
+  spin_unlock_irqrestore(&pc->lock, flags);
+  if(wake && flusher)
+    thread_unpark(flusher);
+}
+
+void pagecache_release(cache_page_t *cp) {
+  pagecache_t *pc    = cp->cache;
+  uint64_t     flags = spin_lock_irqsave(&pc->lock);
+  cp->refs--;
+  spin_unlock_irqrestore(&pc->lock, flags);
+}
+
+/*
+queue every dirty page that isn't already being written, in index order so
+neighbours end up in the same request
+*/
+static uint32_t writeback(pagecache_t *pc, block_request_t **list) {
+  void       *batch[WRITEBACK_BATCH];
+  cache_io_t *io    = NULL;
+  uint64_t    start = 0;
+  uint32_t    pages = 0, ios = 0, n;
+  uint64_t    flags = spin_lock_irqsave(&pc->lock);
+  while((n = radix_gang_lookup_tag(
+           &pc->tree, batch, start, WRITEBACK_BATCH, PAGECACHE_TAG_DIRTY))) {
+    for(uint32_t i = 0; i < n; ++i) {
+      cache_page_t *cp = batch[i];
+      if(io && (io->count == pc->max_pages || (cp->flags & CACHE_WRITEBACK) ||
+                cp->index != io->pages[io->count - 1]->index + 1)) {
+        io_queue(pc, io, list);
+        io = NULL;
+        ios++;
+      }
+      // dirtied again while it's being written, it goes next time
+      if(cp->flags & CACHE_WRITEBACK)
+        continue;
+      if(io == NULL && (io = io_alloc(pc, BLOCK_WRITE, cp->index)) == NULL)
+        goto out;
+      cp->flags = (cp->flags & ~CACHE_DIRTY) | CACHE_WRITEBACK;
+      radix_tag_clear(&pc->tree, cp->index, PAGECACHE_TAG_DIRTY);
+      radix_tag_set(&pc->tree, cp->index, PAGECACHE_TAG_WRITEBACK);
+      pc->dirty--;
+      __atomic_sub_fetch(&total_dirty, 1, __ATOMIC_RELAXED);
+      io_add(io, cp);
+      pages++;
+    }
+    start = ((cache_page_t *)batch[n - 1])->index + 1;
+  }
+out:
+  if(io) {
+    io_queue(pc, io, list);
+    ios++;
+  }
+  pc->wb_ios += ios;
+  pc->wb_pages += pages;
+  spin_unlock_irqrestore(&pc->lock, flags);
+  return pages;
+}
+
+static void sync_done(block_request_t *req) {
+  __atomic_store_n((bool *)req->data, true, __ATOMIC_RELEASE);
+}
+
+int pagecache_sync(block_device_t *dev) {
+  pagecache_t *pc = cache_of(dev);
+  if(pc == NULL)
+    return 0;
+  uint64_t errors = __atomic_load_n(&pc->errors, __ATOMIC_RELAXED);
+  // writeback skips pages still being written, so go around until nothing
+  // is dirty or in flight, ours or kflushd's
+  for(;;) {
+    block_request_t *writes = NULL;
+    writeback(pc, &writes);
+    for(block_request_t *req = writes; req; req = req->next)
+      req->flags |= BLOCK_REQ_POLLED;
+    if(writes)
+      block_submit(dev, writes);
+    uint64_t flags = spin_lock_irqsave(&pc->lock);
+    bool     busy  = radix_tagged(&pc->tree, PAGECACHE_TAG_DIRTY) ||
+                radix_tagged(&pc->tree, PAGECACHE_TAG_WRITEBACK);
+    spin_unlock_irqrestore(&pc->lock, flags);
+    if(!busy)
+      break;
+    block_poll(dev);
+    cpu_relax();
+  }
+  bool            done  = false;
+  block_request_t flush = {
+    .op    = BLOCK_FLUSH,
+    .flags = BLOCK_REQ_POLLED,
+    .done  = sync_done,
+    .data  = &done,
+  };
+  block_submit(dev, &flush);
+  while(!__atomic_load_n(&done, __ATOMIC_ACQUIRE)) {
+    block_poll(dev);
+    cpu_relax();
+  }
+  if(flush.status || __atomic_load_n(&pc->errors, __ATOMIC_RELAXED) != errors)
+    return -1;
+  return 0;
+}
+
+static void flush_timer_fn(ktimer_t *timer) {
+  (void)timer;
+  thread_unpark(flusher);
+}
+
+static void kflushd(void *arg) {
+  (void)arg;
+  for(;;) {
+    timer_add(&flush_timer, ktime_get() + PAGECACHE_WRITEBACK_NS);
+    thread_park();
+    for(uint32_t i = 0; i < BLOCK_MAX_DEVICES; ++i) {
+      pagecache_t     *pc     = &caches[i];
+      block_request_t *writes = NULL;
+      if(__atomic_load_n(&pc->dev, __ATOMIC_ACQUIRE) && writeback(pc, &writes))
+        block_submit(pc->dev, writes);
+    }
+  }
+}
+
+static void pagecache_cmd(int argc, char **argv) {
+  bool sync = argc > 1 && strcmp(argv[1], "sync") == 0;
+  bool drop = argc > 1 && strcmp(argv[1], "drop") == 0;
+  for(uint32_t i = 0; i < BLOCK_MAX_DEVICES; ++i) {
+    pagecache_t *pc = &caches[i];
+    if(__atomic_load_n(&pc->dev, __ATOMIC_ACQUIRE) == NULL)
+      continue;
+    if(sync && pagecache_sync(pc->dev))
+      printf("%s: sync failed\n", pc->dev->name);
+    if(drop) {
+      uint64_t flags = spin_lock_irqsave(&pc->lock);
+      evict(pc, UINT32_MAX, false);
+      spin_unlock_irqrestore(&pc->lock, flags);
+    }
+    uint64_t lookups = pc->hits + pc->misses;
+    printf("%-8s %lu pages, %lu dirty, %lu%% hits of %lu reads\n",
+           pc->dev->name,
+           pc->pages,
+           pc->dirty,
+           lookups ? pc->hits * 100 / lookups : 0,
+           lookups);
+    printf("         read-ahead %lu pages, %lu wasted, window up to %u\n",
+           pc->ra_pages,
+           pc->ra_wasted,
+           pc->ra_max);
+    printf("         write-back %lu pages in %lu requests, %lu errors\n",
+           pc->wb_pages,
+           pc->wb_ios,
+           pc->errors);
+  }
+  printf("%lu pages cached of %lu allowed, %lu dirty\n",
+         __atomic_load_n(&total_pages, __ATOMIC_RELAXED),
+         page_limit,
+         __atomic_load_n(&total_dirty, __ATOMIC_RELAXED));
+}
+
+static bool bench_pass(block_device_t *dev, uint64_t pages, const char *what) {
+  pagecache_t *pc     = cache_of(dev);
+  uint64_t     hits   = pc->hits;
+  uint64_t     misses = pc->misses;
+  uint64_t     start  = ktime_get();
+  for(uint64_t i = 0; i < pages; ++i) {
+    cache_page_t *cp = pagecache_read(dev, i);
+    if(cp == NULL) {
+      printf("read of page %lu failed\n", i);
+      return false;
+    }
+    pagecache_release(cp);
+  }
+  uint64_t ns = ktime_get() - start;
+  printf("%-7s %6lu MB/s, %lu hits, %lu misses\n",
+         what,
+         pages * PAGE_SIZE * 1000 / ns,
+         pc->hits - hits,
+         pc->misses - misses);
+  return true;
+}
+
+static void bench_pagecache_cmd(int argc, char **argv) {
+  block_device_t *dev =
+    argc > 1 ? block_device_find(argv[1]) : block_device_get(0);
+  pagecache_t *pc = dev ? cache_of(dev) : NULL;
+  if(pc == NULL) {
+    printf("no such block device\n");
+    return;
+  }
+  uint64_t pages = pc->dev_pages < BENCH_PAGES ? pc->dev_pages : BENCH_PAGES;
+  uint64_t flags = spin_lock_irqsave(&pc->lock);
+  evict(pc, UINT32_MAX, false);
+  spin_unlock_irqrestore(&pc->lock, flags);
+  // sequential reads from the device, then the same again from memory
+  if(!bench_pass(dev, pages, "cold") || !bench_pass(dev, pages, "cached"))
+    return;
+  if(argc < 3 || strcmp(argv[2], "write") != 0)
+    return;
+
+  // rewrite what's there, so nothing is lost
+  uint64_t ios = pc->wb_ios;
+  for(uint64_t i = 0; i < pages; ++i) {
+    cache_page_t *cp = pagecache_read(dev, i);
+    if(cp == NULL)
+      return;
+    pagecache_mark_dirty(cp);
+    pagecache_release(cp);
+  }
+  uint64_t start = ktime_get();
+  int      ret   = pagecache_sync(dev);
+  uint64_t ns    = ktime_get() - start;
+  printf("sync    %6lu MB/s, %lu pages in %lu requests%s\n",
+         pages * PAGE_SIZE * 1000 / ns,
+         pages,
+         pc->wb_ios - ios,
+         ret ? ", with errors" : "");
+}
+
+void pagecache_init(void) {
+  entry_cache = kmem_cache_create("cache_page", sizeof(cache_page_t), 8, NULL);
+  io_cache    = kmem_cache_create("cache_io", sizeof(cache_io_t), 8, NULL);
+  page_limit  = pmm_free_count() >> PAGECACHE_MEM_SHIFT;
+  dirty_limit = page_limit >> PAGECACHE_DIRTY_SHIFT;
+  timer_setup(&flush_timer, flush_timer_fn);
+  flusher = thread_create_on(0, "kflushd", kflushd, NULL);
+  debug_register("pagecache",
+                 "[sync|drop]: cached pages, read-ahead and write-back",
+                 pagecache_cmd);
+  debug_register("bench-pagecache",
+                 "[dev] [write]: sequential reads cold and cached, write "
+                 "rewrites the same data and times the sync",
+                 bench_pagecache_cmd);
+}
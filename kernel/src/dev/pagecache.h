@@ -0,0 +1,72 @@
+#ifndef _PAGECACHE_H
+#define _PAGECACHE_H
+#include <dev/block.h>
+#include <mm/pmm.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+page cache over every block device. each device has a radix tree of
+cached pages, indexed by page (PAGE_SIZE worth of sectors). sequential
+readers get read-ahead in windows that double while the stream keeps up
+and shrink when read-ahead pages are evicted unused. writes only dirty
+the cache; kflushd writes them back every few seconds, or sooner when too
+much is dirty, merging adjacent dirty pages into requests as large as the
+device takes
+*/
+
+/* cache_page_t flags */
+#define CACHE_UPTODATE  (1 << 0)
+#define CACHE_DIRTY     (1 << 1)
+#define CACHE_READING   (1 << 2)
+#define CACHE_WRITEBACK (1 << 3)
+#define CACHE_ERROR     (1 << 4)
+/* read ahead and not looked at yet */
+#define CACHE_AHEAD     (1 << 5)
+/* reading it starts the next read-ahead window */
+#define CACHE_MARKER    (1 << 6)
+
+struct pagecache;
+
+typedef struct cache_page {
+  /* oldest first, see evict */
+  struct cache_page *lru_prev;
+  struct cache_page *lru_next;
+  struct pagecache  *cache;
+  page_t            *page;
+  uint64_t           index;
+  volatile uint32_t  flags;
+  uint32_t           refs;
+} cache_page_t;
+
+static inline void *cache_page_address(cache_page_t *cp) {
+  return page_address(cp->page);
+}
+
+/**
+ * @brief page `index` of `dev`, read in if it isn't cached. waits for the
+ * read by polling the device, so it works from any context
+ *
+ * @return a referenced, up to date page, or NULL on I/O errors or past the
+ * end of the device
+ */
+cache_page_t *pagecache_read(block_device_t *dev, uint64_t index);
+/**
+ * @brief page `index` of `dev` without reading it, for callers about to
+ * overwrite all of it and call pagecache_mark_dirty
+ */
+cache_page_t *pagecache_grab(block_device_t *dev, uint64_t index);
+/**
+ * @brief the page's contents are now newer than the device's
+ */
+void pagecache_mark_dirty(cache_page_t *cp);
+void pagecache_release(cache_page_t *cp);
+/**
+ * @brief write back every dirty page of `dev`, wait for it and flush the
+ * device's write cache
+ *
+ * @return 0, or -1 if anything failed
+ */
+int  pagecache_sync(block_device_t *dev);
+void pagecache_init(void);
+#endif  // _PAGECACHE_H
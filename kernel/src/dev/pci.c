@@ -0,0 +1,279 @@
+#include "pci.h"
+#include <mm/vmm.h>
+#include <stdlib.h>
+#include <sys/acpi.h>
+#include <sys/debug.h>
+
+/* each bus gets 32 devices x 8 functions x 4KiB of config space */
+#define ECAM_BUS_SHIFT  20
+#define ECAM_DEV_SHIFT  15
+#define ECAM_FUNC_SHIFT 12
+
+#define PCI_CLASS_BRIDGE      0x06
+#define PCI_SUBCLASS_HOST     0x00
+#define PCI_MAX_CAPABILITIES  48
+#define PCI_CAPABILITIES_BASE 0x40
+
+typedef struct ecam_window {
+  uint64_t base;
+  uint16_t segment;
+  uint8_t  start_bus;
+  uint8_t  end_bus;
+  /* a bit per bus, so bridges pointing at each other can't loop */
+  uint64_t scanned[4];
+} ecam_window_t;
+
+static ecam_window_t windows[PCI_MAX_WINDOWS];
+static uint32_t      window_count = 0;
+static pci_device_t  devices[PCI_MAX_DEVICES];
+static uint32_t      device_count = 0;
+
+/* only the buses we actually look at get mapped, 1MiB each */
+static volatile uint8_t *ecam_bus(ecam_window_t *w, uint8_t bus) {
+  uint64_t phys = w->base + ((uint64_t)bus << ECAM_BUS_SHIFT);
+  return vmm_map_phys(phys, 1ull << ECAM_BUS_SHIFT, PTE_MMIO);
+}
+
+uint8_t pci_find_capability(pci_device_t *dev, uint8_t id, uint8_t start) {
+  if(!(pci_read16(dev, PCI_STATUS) & PCI_STATUS_CAP_LIST))
+    return 0;
+  uint8_t off = pci_read8(dev, start ? start + 1 : PCI_CAPABILITIES);
+  // bounded, a broken list could point back at itself
+  for(int n = 0; off >= PCI_CAPABILITIES_BASE && n < PCI_MAX_CAPABILITIES;
+      ++n) {
+    off &= ~3;
+    if(pci_read8(dev, off) == id)
+      return off;
+    off = pci_read8(dev, off + 1);
+  }
+  return 0;
+}
+
+static void size_bars(pci_device_t *d) {
+  uint32_t nbars =
+    (d->header_type & 0x7F) == PCI_HEADER_BRIDGE ? 2 : PCI_BARS;
+  uint16_t command = pci_read16(d, PCI_COMMAND);
+  // no decoding while the BARs briefly hold all ones
+  pci_write16(
+    d, PCI_COMMAND, command & ~(PCI_COMMAND_IO | PCI_COMMAND_MEMORY));
+  for(uint32_t i = 0; i < nbars; ++i) {
+    uint32_t off  = PCI_BAR0 + i * 4;
+    uint32_t orig = pci_read32(d, off);
+    pci_write32(d, off, 0xFFFFFFFF);
+    uint32_t mask = pci_read32(d, off);
+    pci_write32(d, off, orig);
+    pci_bar_t *bar = &d->bars[i];
+    if(orig & 1) {
+      if((mask & ~3u) == 0)
+        continue;
+      bar->flags = PCI_BAR_IO;
+      bar->phys  = orig & ~3u;
+      bar->size  = (uint16_t)(~(mask & ~3u) + 1);
+      continue;
+    }
+    uint64_t phys   = orig & ~0xFu;
+    uint64_t mask64 = mask & ~0xFu;
+    uint32_t flags  = 0;
+    if(((orig >> 1) & 3) == 2 && i + 1 < nbars) {
+      uint32_t orig_hi = pci_read32(d, off + 4);
+      pci_write32(d, off + 4, 0xFFFFFFFF);
+      uint32_t mask_hi = pci_read32(d, off + 4);
+      pci_write32(d, off + 4, orig_hi);
+      phys   |= (uint64_t)orig_hi << 32;
+      mask64 |= (uint64_t)mask_hi << 32;
+      flags   = PCI_BAR_64;
+      // the upper half has no BAR of its own
+      i++;
+    } else {
+      mask64 |= 0xFFFFFFFF00000000ull;
+    }
+    // a 64 bit BAR of 4GiB or more has nothing writable in its low half
+    if((flags & PCI_BAR_64) ? mask64 == 0 : (uint32_t)mask64 == 0)
+      continue;
+    if(orig & 8)
+      flags |= PCI_BAR_PREFETCH;
+    bar->flags = flags;
+    bar->phys  = phys;
+    bar->size  = ~mask64 + 1;
+  }
+  pci_write16(d, PCI_COMMAND, command);
+}
+
+static void scan_bus(ecam_window_t *w, uint8_t bus);
+
+static void probe_function(ecam_window_t    *w,
+                           uint8_t           bus,
+                           uint8_t           dev,
+                           uint8_t           func,
+                           volatile uint8_t *config) {
+  if(device_count == PCI_MAX_DEVICES) {
+    kwarn("pci: no room for %02x:%02x.%u\n", bus, dev, func);
+    return;
+  }
+  pci_device_t *d = &devices[device_count++];
+  d->segment      = w->segment;
+  d->bus          = bus;
+  d->dev          = dev;
+  d->func         = func;
+  d->config       = config;
+  d->vendor_id    = pci_read16(d, PCI_VENDOR_ID);
+  d->device_id    = pci_read16(d, PCI_DEVICE_ID);
+  d->revision     = pci_read8(d, PCI_REVISION);
+  d->prog_if      = pci_read8(d, PCI_PROG_IF);
+  d->subclass     = pci_read8(d, PCI_SUBCLASS);
+  d->class_code   = pci_read8(d, PCI_CLASS);
+  d->header_type  = pci_read8(d, PCI_HEADER_TYPE);
+  d->irq_pin      = pci_read8(d, PCI_INTERRUPT_PIN);
+  d->msi_cap      = pci_find_capability(d, PCI_CAP_MSI, 0);
+  d->msix_cap     = pci_find_capability(d, PCI_CAP_MSIX, 0);
+  d->pcie_cap     = pci_find_capability(d, PCI_CAP_PCIE, 0);
+  size_bars(d);
+  if((d->header_type & 0x7F) == PCI_HEADER_BRIDGE)
+    scan_bus(w, pci_read8(d, PCI_SECONDARY_BUS));
+}
+
+static void scan_bus(ecam_window_t *w, uint8_t bus) {
+  if(bus < w->start_bus || bus > w->end_bus ||
+     (w->scanned[bus / 64] & (1ull << (bus % 64))))
+    return;
+  w->scanned[bus / 64] |= 1ull << (bus % 64);
+  volatile uint8_t *base = ecam_bus(w, bus);
+  if(base == NULL)
+    return;
+  for(uint8_t dev = 0; dev < 32; ++dev) {
+    volatile uint8_t *config = base + ((uint64_t)dev << ECAM_DEV_SHIFT);
+    if(*(volatile uint16_t *)config == 0xFFFF)
+      continue;
+    uint8_t funcs =
+      config[PCI_HEADER_TYPE] & PCI_HEADER_MULTI_FUNCTION ? 8 : 1;
+    for(uint8_t func = 0; func < funcs; ++func) {
+      volatile uint8_t *fn = config + ((uint64_t)func << ECAM_FUNC_SHIFT);
+      if(*(volatile uint16_t *)fn != 0xFFFF)
+        probe_function(w, bus, dev, func, fn);
+    }
+  }
+}
+
+/* a multi-function host bridge has one root bus per function */
+static void scan_window(ecam_window_t *w) {
+  scan_bus(w, w->start_bus);
+  volatile uint8_t *host = ecam_bus(w, w->start_bus);
+  if(host == NULL || !(host[PCI_HEADER_TYPE] & PCI_HEADER_MULTI_FUNCTION))
+    return;
+  for(uint8_t func = 1; func < 8; ++func) {
+    volatile uint8_t *fn = host + ((uint64_t)func << ECAM_FUNC_SHIFT);
+    if(*(volatile uint16_t *)fn != 0xFFFF &&
+       fn[PCI_CLASS] == PCI_CLASS_BRIDGE &&
+       fn[PCI_SUBCLASS] == PCI_SUBCLASS_HOST)
+      scan_bus(w, w->start_bus + func);
+  }
+}
+
+uint32_t pci_device_count(void) {
+  return device_count;
+}
+
+pci_device_t *pci_device_get(uint32_t index) {
+  return index < device_count ? &devices[index] : NULL;
+}
+
+static bool id_match(const pci_device_id_t *id, pci_device_t *d) {
+  return (id->vendor == PCI_ANY_ID || id->vendor == d->vendor_id) &&
+         (id->device == PCI_ANY_ID || id->device == d->device_id) &&
+         (id->class == PCI_ANY_ID ||
+          id->class == ((d->class_code << 8) | d->subclass));
+}
+
+uint32_t pci_register_driver(pci_driver_t *drv) {
+  uint32_t claimed = 0;
+  for(uint32_t i = 0; i < device_count; ++i) {
+    pci_device_t *d = &devices[i];
+    if(d->driver)
+      continue;
+    for(const pci_device_id_t *id = drv->ids;
+        id->vendor || id->device || id->class;
+        ++id) {
+      if(!id_match(id, d))
+        continue;
+      if(drv->probe(d, id)) {
+        d->driver = drv;
+        claimed++;
+      }
+      break;
+    }
+  }
+  return claimed;
+}
+
+void pci_enable_device(pci_device_t *dev) {
+  uint16_t command = pci_read16(dev, PCI_COMMAND);
+  command |= PCI_COMMAND_MASTER | PCI_COMMAND_INTX_DISABLE;
+  for(uint32_t i = 0; i < PCI_BARS; ++i) {
+    if(dev->bars[i].size == 0)
+      continue;
+    command |= dev->bars[i].flags & PCI_BAR_IO ? PCI_COMMAND_IO
+                                                : PCI_COMMAND_MEMORY;
+  }
+  pci_write16(dev, PCI_COMMAND, command);
+}
+
+void *pci_map_bar(pci_device_t *dev, uint32_t bar) {
+  if(bar >= PCI_BARS || dev->bars[bar].size == 0 ||
+     (dev->bars[bar].flags & PCI_BAR_IO))
+    return NULL;
+  return vmm_map_phys(dev->bars[bar].phys, dev->bars[bar].size, PTE_MMIO);
+}
+
+static void lspci_cmd(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+  for(uint32_t i = 0; i < device_count; ++i) {
+    pci_device_t *d = &devices[i];
+    printf("%04x:%02x:%02x.%u %04x:%04x class %02x%02x%02x%s%s%s%s%s\n",
+           d->segment,
+           d->bus,
+           d->dev,
+           d->func,
+           d->vendor_id,
+           d->device_id,
+           d->class_code,
+           d->subclass,
+           d->prog_if,
+           d->msi_cap ? " msi" : "",
+           d->msix_cap ? " msix" : "",
+           d->pcie_cap ? " pcie" : "",
+           d->driver ? ", driver " : "",
+           d->driver ? d->driver->name : "");
+    for(uint32_t b = 0; b < PCI_BARS; ++b) {
+      pci_bar_t *bar = &d->bars[b];
+      if(bar->size == 0)
+        continue;
+      printf("  bar %u: %s 0x%lx, %lu bytes%s\n",
+             b,
+             bar->flags & PCI_BAR_IO ? "io" : "mem",
+             bar->phys,
+             bar->size,
+             bar->flags & PCI_BAR_PREFETCH ? ", prefetchable" : "");
+    }
+  }
+}
+
+void pci_init(void) {
+  mcfg_t *mcfg = (mcfg_t *)find_header("MCFG");
+  if(mcfg == NULL) {
+    kwarn("pci: no MCFG, no PCI devices\n");
+    return;
+  }
+  uint32_t entries = (mcfg->h.length - sizeof(*mcfg)) / sizeof(mcfg_entry_t);
+  for(uint32_t i = 0; i < entries && window_count < PCI_MAX_WINDOWS; ++i) {
+    mcfg_entry_t  *e = &mcfg->entries[i];
+    ecam_window_t *w = &windows[window_count++];
+    w->base          = e->base;
+    w->segment       = e->segment;
+    w->start_bus     = e->start_bus;
+    w->end_bus       = e->end_bus;
+    scan_window(w);
+  }
+  kinfo("pci: %u functions in %u ECAM windows\n", device_count, window_count);
+  debug_register("lspci", "PCI functions, their BARs and drivers", lspci_cmd);
+}
@@ -0,0 +1,158 @@
+#ifndef _PCI_H
+#define _PCI_H
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+PCI/PCIe devices found through the MCFG's ECAM windows. every function gets
+an entry in a static registry at boot, with its BARs sized and its
+capabilities located; drivers then claim devices by id or class
+*/
+
+/* functions we keep track of */
+#define PCI_MAX_DEVICES 64
+/* ECAM windows (segment groups) from the MCFG */
+#define PCI_MAX_WINDOWS 4
+#define PCI_BARS        6
+
+/* type 0 configuration header */
+#define PCI_VENDOR_ID      0x00
+#define PCI_DEVICE_ID      0x02
+#define PCI_COMMAND        0x04
+#define PCI_STATUS         0x06
+#define PCI_REVISION       0x08
+#define PCI_PROG_IF        0x09
+#define PCI_SUBCLASS       0x0A
+#define PCI_CLASS          0x0B
+#define PCI_HEADER_TYPE    0x0E
+#define PCI_BAR0           0x10
+#define PCI_SECONDARY_BUS  0x19
+#define PCI_CAPABILITIES   0x34
+#define PCI_INTERRUPT_LINE 0x3C
+#define PCI_INTERRUPT_PIN  0x3D
+
+#define PCI_COMMAND_IO           (1 << 0)
+#define PCI_COMMAND_MEMORY       (1 << 1)
+#define PCI_COMMAND_MASTER       (1 << 2)
+#define PCI_COMMAND_INTX_DISABLE (1 << 10)
+
+#define PCI_STATUS_CAP_LIST (1 << 4)
+
+#define PCI_HEADER_MULTI_FUNCTION 0x80
+#define PCI_HEADER_BRIDGE         0x01
+
+#define PCI_BAR_IO       (1 << 0)
+#define PCI_BAR_64       (1 << 1)
+#define PCI_BAR_PREFETCH (1 << 2)
+
+/* capability ids */
+#define PCI_CAP_MSI    0x05
+#define PCI_CAP_VENDOR 0x09
+#define PCI_CAP_PCIE   0x10
+#define PCI_CAP_MSIX   0x11
+
+/* matches any vendor, device or class in a pci_device_id_t */
+#define PCI_ANY_ID 0xFFFF
+
+typedef struct pci_bar {
+  uint64_t phys;
+  uint64_t size;
+  uint32_t flags;
+} pci_bar_t;
+
+struct pci_driver;
+
+typedef struct pci_device {
+  uint16_t segment;
+  uint8_t  bus;
+  uint8_t  dev;
+  uint8_t  func;
+  uint8_t  header_type;
+  uint16_t vendor_id;
+  uint16_t device_id;
+  uint8_t  class_code;
+  uint8_t  subclass;
+  uint8_t  prog_if;
+  uint8_t  revision;
+  uint8_t  irq_pin;
+  /* capability offsets, 0 when the function doesn't have it */
+  uint8_t msi_cap;
+  uint8_t msix_cap;
+  uint8_t pcie_cap;
+  /* this function's 4KiB of ECAM config space */
+  volatile uint8_t  *config;
+  pci_bar_t          bars[PCI_BARS];
+  struct pci_driver *driver;
+  void              *driver_data;
+  /* msi.c, once pci_msix_enable has mapped the table */
+  volatile uint32_t *msix_table;
+  uint16_t           msix_count;
+} pci_device_t;
+
+typedef struct pci_device_id {
+  uint16_t vendor;
+  uint16_t device;
+  /* PCI_ANY_ID, or (class << 8) | subclass */
+  uint16_t class;
+} pci_device_id_t;
+
+typedef struct pci_driver {
+  const char *name;
+  /* terminated by an all-zero entry */
+  const pci_device_id_t *ids;
+  /* return false to leave the device unclaimed */
+  bool (*probe)(pci_device_t *dev, const pci_device_id_t *id);
+} pci_driver_t;
+
+static inline uint8_t pci_read8(pci_device_t *dev, uint32_t off) {
+  return *(volatile uint8_t *)(dev->config + off);
+}
+
+static inline uint16_t pci_read16(pci_device_t *dev, uint32_t off) {
+  return *(volatile uint16_t *)(dev->config + off);
+}
+
+static inline uint32_t pci_read32(pci_device_t *dev, uint32_t off) {
+  return *(volatile uint32_t *)(dev->config + off);
+}
+
+static inline void pci_write16(pci_device_t *dev, uint32_t off, uint16_t v) {
+  *(volatile uint16_t *)(dev->config + off) = v;
+}
+
+static inline void pci_write32(pci_device_t *dev, uint32_t off, uint32_t v) {
+  *(volatile uint32_t *)(dev->config + off) = v;
+}
+
+/**
+ * @brief map the ECAM windows from the MCFG and enumerate every function
+ * behind them. after acpi_init
+ */
+void          pci_init(void);
+uint32_t      pci_device_count(void);
+pci_device_t *pci_device_get(uint32_t index);
+/**
+ * @brief offer every unclaimed device matching `drv->ids` to `drv->probe`
+ *
+ * @return number of devices the driver claimed
+ */
+uint32_t pci_register_driver(pci_driver_t *drv);
+/**
+ * @brief next capability `id` after offset `start` (0 for the first one),
+ * for capabilities that come more than once like virtio's vendor ones
+ *
+ * @return its offset, or 0
+ */
+uint8_t pci_find_capability(pci_device_t *dev, uint8_t id, uint8_t start);
+/**
+ * @brief turn on memory/I/O decoding and bus mastering, and turn legacy
+ * INTx off
+ */
+void pci_enable_device(pci_device_t *dev);
+/**
+ * @brief map a memory BAR uncached
+ *
+ * @return its virtual address, or NULL for I/O or empty BARs
+ */
+void *pci_map_bar(pci_device_t *dev, uint32_t bar);
+#endif  // _PCI_H
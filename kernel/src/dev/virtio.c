@@ -0,0 +1,186 @@
+#include "virtio.h"
+#include <mm/pmm.h>
+#include <stdlib.h>
+#include <sys/cpu.h>
+
+/* the event index fields sit right after each ring */
+#define used_event(vq) (&(vq)->avail->ring[(vq)->size])
+#define avail_event(vq)                                                 \
+  ((volatile uint16_t *)((volatile uint8_t *)(vq)->used +               \
+                         sizeof(virtq_used_t) +                         \
+                         sizeof(virtq_used_elem_t) * (vq)->size))
+
+static inline void mb(void) {
+  __asm__ volatile("mfence" ::: "memory");
+}
+
+static volatile void *map_cap(pci_device_t *pci, uint8_t cap) {
+  uint8_t *bar = pci_map_bar(pci, pci_read8(pci, cap + VIRTIO_CAP_BAR));
+  if(bar == NULL)
+    return NULL;
+  return bar + pci_read32(pci, cap + VIRTIO_CAP_OFFSET);
+}
+
+bool virtio_pci_init(virtio_device_t *vdev, pci_device_t *pci) {
+  vdev->pci = pci;
+  for(uint8_t cap = pci_find_capability(pci, PCI_CAP_VENDOR, 0); cap;
+      cap = pci_find_capability(pci, PCI_CAP_VENDOR, cap)) {
+    // the first capability of each type is the preferred one
+    switch(pci_read8(pci, cap + VIRTIO_CAP_CFG_TYPE)) {
+      case VIRTIO_PCI_CAP_COMMON:
+        if(vdev->common == NULL)
+          vdev->common = map_cap(pci, cap);
+        break;
+      case VIRTIO_PCI_CAP_NOTIFY:
+        if(vdev->notify_base == NULL) {
+          vdev->notify_base = map_cap(pci, cap);
+          vdev->notify_mult = pci_read32(pci, cap + VIRTIO_CAP_NOTIFY_MULT);
+        }
+        break;
+      case VIRTIO_PCI_CAP_DEVICE:
+        if(vdev->device_cfg == NULL)
+          vdev->device_cfg = map_cap(pci, cap);
+        break;
+    }
+  }
+  if(vdev->common == NULL || vdev->notify_base == NULL)
+    return false;
+  pci_enable_device(pci);
+  vdev->common->device_status = 0;
+  while(vdev->common->device_status != 0) cpu_relax();
+  vdev->common->device_status = VIRTIO_STATUS_ACKNOWLEDGE;
+  vdev->common->device_status |= VIRTIO_STATUS_DRIVER;
+  vdev->common->msix_config = VIRTIO_MSI_NO_VECTOR;
+  return true;
+}
+
+bool virtio_negotiate(virtio_device_t *vdev, uint64_t wanted) {
+  volatile virtio_pci_common_cfg_t *common = vdev->common;
+
+  common->device_feature_select = 0;
+  uint64_t offered              = common->device_feature;
+  common->device_feature_select = 1;
+  offered |= (uint64_t)common->device_feature << 32;
+  vdev->features = offered & (wanted | VIRTIO_F_VERSION_1);
+  if(!(vdev->features & VIRTIO_F_VERSION_1))
+    return false;
+  common->driver_feature_select = 0;
+  common->driver_feature        = (uint32_t)vdev->features;
+  common->driver_feature_select = 1;
+  common->driver_feature        = vdev->features >> 32;
+  common->device_status |= VIRTIO_STATUS_FEATURES_OK;
+  // the device clears it again if it can't live with our choice
+  return (common->device_status & VIRTIO_STATUS_FEATURES_OK) != 0;
+}
+
+bool virtq_setup(virtio_device_t *vdev,
+                 virtq_t         *vq,
+                 uint16_t         index,
+                 uint16_t         max_size,
+                 uint16_t         msix_entry,
+                 uint32_t         node) {
+  volatile virtio_pci_common_cfg_t *common = vdev->common;
+
+  common->queue_select = index;
+  uint16_t size        = common->queue_size;
+  if(size == 0)
+    return false;
+  if(size > max_size)
+    size = max_size;
+  // split rings have to be a power of two
+  while(size & (size - 1)) size &= size - 1;
+
+  // descriptors, then the driver ring, then the device ring (4 byte
+  // aligned), each with room for its event index
+  uint64_t desc_bytes  = sizeof(virtq_desc_t) * size;
+  uint64_t avail_bytes = sizeof(virtq_avail_t) + 2ull * size + 2;
+  uint64_t used_off    = (desc_bytes + avail_bytes + 3) & ~3ull;
+  uint64_t bytes = used_off + sizeof(virtq_used_t) +
+                   sizeof(virtq_used_elem_t) * size + 2;
+  uint32_t order = 0;
+  while((PAGE_SIZE << order) < bytes) order++;
+  page_t *pages = alloc_pages_node(node, order);
+  if(pages == NULL)
+    return false;
+  uint8_t *ring = page_address(pages);
+  memset(ring, 0, PAGE_SIZE << order);
+  uint64_t phys = page_to_phys(pages);
+
+  vq->desc       = (volatile virtq_desc_t *)ring;
+  vq->avail      = (volatile virtq_avail_t *)(ring + desc_bytes);
+  vq->used       = (volatile virtq_used_t *)(ring + used_off);
+  vq->index      = index;
+  vq->size       = size;
+  vq->avail_idx  = 0;
+  vq->kicked_idx = 0;
+  vq->last_used  = 0;
+  vq->event_idx  = (vdev->features & VIRTIO_F_RING_EVENT_IDX) != 0;
+
+  common->queue_size        = size;
+  common->queue_msix_vector = msix_entry;
+  if(common->queue_msix_vector != msix_entry) {
+    free_pages(pages, order);
+    return false;
+  }
+  common->queue_desc_lo   = (uint32_t)phys;
+  common->queue_desc_hi   = phys >> 32;
+  common->queue_driver_lo = (uint32_t)(phys + desc_bytes);
+  common->queue_driver_hi = (phys + desc_bytes) >> 32;
+  common->queue_device_lo = (uint32_t)(phys + used_off);
+  common->queue_device_hi = (phys + used_off) >> 32;
+  vq->notify = (volatile uint16_t *)(vdev->notify_base +
+                                     common->queue_notify_off *
+                                       vdev->notify_mult);
+  common->queue_enable = 1;
+  return true;
+}
+
+void virtio_driver_ok(virtio_device_t *vdev) {
+  vdev->common->device_status |= VIRTIO_STATUS_DRIVER_OK;
+}
+
+void virtio_fail(virtio_device_t *vdev) {
+  vdev->common->device_status |= VIRTIO_STATUS_FAILED;
+}
+
+/* whether the device's event index falls in (old, new], wrapping */
+static inline bool need_event(uint16_t event, uint16_t new, uint16_t old) {
+  return (uint16_t)(new - event - 1) < (uint16_t)(new - old);
+}
+
+void virtq_kick(virtq_t *vq) {
+  uint16_t old = vq->kicked_idx;
+  uint16_t new = vq->avail_idx;
+  if(old == new)
+    return;
+  __atomic_store_n(&vq->avail->idx, new, __ATOMIC_RELEASE);
+  // the idx store has to be visible before we read what the device wants
+  mb();
+  vq->kicked_idx = new;
+  vq->kicks++;
+  bool notify = vq->event_idx ? need_event(*avail_event(vq), new, old)
+                              : !(vq->used->flags & VIRTQ_USED_F_NO_NOTIFY);
+  if(notify) {
+    *vq->notify = vq->index;
+    vq->notifies++;
+  }
+}
+
+bool virtq_used_pop(virtq_t *vq, uint32_t *id, uint32_t *len) {
+  if(vq->last_used == __atomic_load_n(&vq->used->idx, __ATOMIC_ACQUIRE))
+    return false;
+  volatile virtq_used_elem_t *elem =
+    &vq->used->ring[vq->last_used & (vq->size - 1)];
+  *id  = elem->id;
+  *len = elem->len;
+  vq->last_used++;
+  return true;
+}
+
+bool virtq_arm(virtq_t *vq) {
+  if(vq->event_idx)
+    *used_event(vq) = vq->last_used;
+  // same as virtq_kick, our store before the device's idx
+  mb();
+  return __atomic_load_n(&vq->used->idx, __ATOMIC_ACQUIRE) == vq->last_used;
+}
@@ -0,0 +1,170 @@
+#ifndef _VIRTIO_H
+#define _VIRTIO_H
+#include <dev/pci.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+virtio 1.x over PCI (the "modern" interface, found through vendor
+capabilities) and split virtqueues with event index notification
+suppression
+*/
+
+#define VIRTIO_VENDOR_ID 0x1AF4
+
+/* cfg_type of the vendor capabilities */
+#define VIRTIO_PCI_CAP_COMMON 1
+#define VIRTIO_PCI_CAP_NOTIFY 2
+#define VIRTIO_PCI_CAP_ISR    3
+#define VIRTIO_PCI_CAP_DEVICE 4
+
+/* layout of a virtio vendor capability */
+#define VIRTIO_CAP_CFG_TYPE    3
+#define VIRTIO_CAP_BAR         4
+#define VIRTIO_CAP_OFFSET      8
+#define VIRTIO_CAP_NOTIFY_MULT 16
+
+#define VIRTIO_STATUS_ACKNOWLEDGE 1
+#define VIRTIO_STATUS_DRIVER      2
+#define VIRTIO_STATUS_DRIVER_OK   4
+#define VIRTIO_STATUS_FEATURES_OK 8
+#define VIRTIO_STATUS_FAILED      128
+
+/* feature bits common to every device type */
+#define VIRTIO_F_INDIRECT_DESC  (1ull << 28)
+#define VIRTIO_F_RING_EVENT_IDX (1ull << 29)
+#define VIRTIO_F_VERSION_1      (1ull << 32)
+
+#define VIRTIO_MSI_NO_VECTOR 0xFFFF
+
+/* split rings are a power of two up to this many entries */
+#define VIRTQ_MAX_SIZE 256
+
+#define VIRTQ_DESC_F_NEXT     1
+#define VIRTQ_DESC_F_WRITE    2
+#define VIRTQ_DESC_F_INDIRECT 4
+
+#define VIRTQ_USED_F_NO_NOTIFY 1
+
+/* 64 bit fields are split, the spec only promises 32 bit accesses work */
+typedef struct virtio_pci_common_cfg {
+  uint32_t device_feature_select;
+  uint32_t device_feature;
+  uint32_t driver_feature_select;
+  uint32_t driver_feature;
+  uint16_t msix_config;
+  uint16_t num_queues;
+  uint8_t  device_status;
+  uint8_t  config_generation;
+  uint16_t queue_select;
+  uint16_t queue_size;
+  uint16_t queue_msix_vector;
+  uint16_t queue_enable;
+  uint16_t queue_notify_off;
+  uint32_t queue_desc_lo;
+  uint32_t queue_desc_hi;
+  uint32_t queue_driver_lo;
+  uint32_t queue_driver_hi;
+  uint32_t queue_device_lo;
+  uint32_t queue_device_hi;
+} __attribute__((packed)) virtio_pci_common_cfg_t;
+
+typedef struct virtq_desc {
+  uint64_t addr;
+  uint32_t len;
+  uint16_t flags;
+  uint16_t next;
+} virtq_desc_t;
+
+/* followed by used_event when VIRTIO_F_RING_EVENT_IDX is on */
+typedef struct virtq_avail {
+  uint16_t flags;
+  uint16_t idx;
+  uint16_t ring[];
+} virtq_avail_t;
+
+typedef struct virtq_used_elem {
+  uint32_t id;
+  uint32_t len;
+} virtq_used_elem_t;
+
+/* followed by avail_event when VIRTIO_F_RING_EVENT_IDX is on */
+typedef struct virtq_used {
+  uint16_t          flags;
+  uint16_t          idx;
+  virtq_used_elem_t ring[];
+} virtq_used_t;
+
+typedef struct virtio_device {
+  pci_device_t                     *pci;
+  volatile virtio_pci_common_cfg_t *common;
+  volatile uint8_t                 *notify_base;
+  uint32_t                          notify_mult;
+  volatile uint8_t                 *device_cfg;
+  uint64_t                          features;
+} virtio_device_t;
+
+typedef struct virtq {
+  volatile virtq_desc_t  *desc;
+  volatile virtq_avail_t *avail;
+  volatile virtq_used_t  *used;
+  volatile uint16_t      *notify;
+  uint16_t                index;
+  uint16_t                size;
+  /* our copy of avail->idx, and what it was at the last virtq_kick */
+  uint16_t avail_idx;
+  uint16_t kicked_idx;
+  uint16_t last_used;
+  bool     event_idx;
+  uint64_t kicks;
+  uint64_t notifies;
+} virtq_t;
+
+/**
+ * @brief find and map the virtio capabilities of `pci`, then reset the
+ * device and acknowledge it
+ */
+bool virtio_pci_init(virtio_device_t *vdev, pci_device_t *pci);
+/**
+ * @brief accept the features in `wanted` the device offers (VERSION_1 is
+ * required) and set FEATURES_OK
+ */
+bool virtio_negotiate(virtio_device_t *vdev, uint64_t wanted);
+/**
+ * @brief allocate queue `index` on `node`, up to `max_size` entries, with
+ * completions signalled through MSI-X table entry `msix_entry`
+ */
+bool virtq_setup(virtio_device_t *vdev,
+                 virtq_t         *vq,
+                 uint16_t         index,
+                 uint16_t         max_size,
+                 uint16_t         msix_entry,
+                 uint32_t         node);
+void virtio_driver_ok(virtio_device_t *vdev);
+void virtio_fail(virtio_device_t *vdev);
+
+/**
+ * @brief make the chain starting at descriptor `head` available. the device
+ * only sees it after virtq_kick
+ */
+static inline void virtq_push(virtq_t *vq, uint16_t head) {
+  vq->avail->ring[vq->avail_idx & (vq->size - 1)] = head;
+  vq->avail_idx++;
+}
+
+/**
+ * @brief publish everything pushed since the last kick, notifying the
+ * device only if it asked to hear about it
+ */
+void virtq_kick(virtq_t *vq);
+/**
+ * @brief take the next finished chain off the used ring
+ */
+bool virtq_used_pop(virtq_t *vq, uint32_t *id, uint32_t *len);
+/**
+ * @brief ask for an interrupt on the next completion
+ *
+ * @return false if something completed in the meantime, pop again
+ */
+bool virtq_arm(virtq_t *vq);
+#endif  // _VIRTIO_H
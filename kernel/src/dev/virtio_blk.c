@@ -0,0 +1,413 @@
+#include "virtio_blk.h"
+#include <dev/block.h>
+#include <dev/msi.h>
+#include <dev/virtio.h>
+#include <mm/numa.h>
+#include <mm/pmm.h>
+#include <mm/slab.h>
+#include <stdlib.h>
+#include <sys/cpu.h>
+#include <sys/debug.h>
+#include <sys/softirq.h>
+#include <sys/spinlock.h>
+
+/* device features we can use */
+#define VIRTIO_BLK_F_SEG_MAX  (1ull << 2)
+#define VIRTIO_BLK_F_BLK_SIZE (1ull << 6)
+#define VIRTIO_BLK_F_FLUSH    (1ull << 9)
+#define VIRTIO_BLK_F_MQ       (1ull << 12)
+
+/* device config space */
+#define VIRTIO_BLK_CFG_CAPACITY   0
+#define VIRTIO_BLK_CFG_SEG_MAX    12
+#define VIRTIO_BLK_CFG_BLK_SIZE   20
+#define VIRTIO_BLK_CFG_NUM_QUEUES 34
+
+#define VIRTIO_BLK_T_IN    0
+#define VIRTIO_BLK_T_OUT   1
+#define VIRTIO_BLK_T_FLUSH 4
+
+/* virtio sectors are 512 bytes whatever the logical block size */
+#define VIRTIO_SECTOR_SHIFT 9
+
+/*
+every request is a fixed chain of 3 descriptors: header, data, status. slot
+s owns descriptors 3s..3s+2, so there's no descriptor free list to manage
+*/
+#define VBLK_CHAIN     3
+#define VBLK_MAX_SLOTS (VIRTQ_MAX_SIZE / VBLK_CHAIN)
+/*
+requests made of a page list go out through the slot's indirect table
+instead (header, up to BLOCK_MAX_PAGES pages, status), still taking one
+ring descriptor
+*/
+#define VBLK_TABLE_SIZE (BLOCK_MAX_PAGES + 2)
+
+typedef struct virtio_blk_req_hdr {
+  uint32_t type;
+  uint32_t reserved;
+  uint64_t sector;
+} virtio_blk_req_hdr_t;
+
+typedef struct vblk_queue {
+  struct vblk          *vb;
+  spinlock_t            lock;
+  virtq_t               vq;
+  virtio_blk_req_hdr_t *hdrs;
+  uint8_t              *status;
+  uint64_t              hdrs_phys;
+  uint64_t              status_phys;
+  /* NULL without VIRTIO_F_INDIRECT_DESC */
+  virtq_desc_t         *tables;
+  uint64_t              tables_phys;
+  block_request_t      *slots[VBLK_MAX_SLOTS];
+  uint16_t              free_slots[VBLK_MAX_SLOTS];
+  uint16_t              free_count;
+  /* waiting for a slot */
+  block_request_t  *pending;
+  block_request_t **pending_tail;
+  tasklet_t         tasklet;
+  uint32_t          cpu;
+  uint8_t           vector;
+  uint64_t          requests;
+  uint64_t          interrupts;
+} __attribute__((aligned(CACHE_LINE))) vblk_queue_t;
+
+typedef struct vblk {
+  virtio_device_t vdev;
+  block_device_t  blk;
+  vblk_queue_t   *queues;
+  uint32_t        queue_count;
+  /* virtio sectors per block_device_t sector */
+  uint32_t sector_mult;
+} vblk_t;
+
+static vblk_t  *disks[BLOCK_MAX_DEVICES];
+static uint32_t disk_count = 0;
+
+static void fill_indirect(vblk_t          *vb,
+                          vblk_queue_t    *q,
+                          uint16_t         s,
+                          block_request_t *req) {
+  virtq_desc_t *t     = &q->tables[s * VBLK_TABLE_SIZE];
+  uint32_t      pages = req->count * vb->blk.sector_size / PAGE_SIZE;
+  uint16_t      write = req->op == BLOCK_READ ? VIRTQ_DESC_F_WRITE : 0;
+  t[0] = (virtq_desc_t){ q->hdrs_phys + s * sizeof(virtio_blk_req_hdr_t),
+                         sizeof(virtio_blk_req_hdr_t),
+                         VIRTQ_DESC_F_NEXT,
+                         1 };
+  for(uint32_t i = 0; i < pages; ++i)
+    t[i + 1] = (virtq_desc_t){
+      req->pages[i], PAGE_SIZE, VIRTQ_DESC_F_NEXT | write, i + 2
+    };
+  t[pages + 1] = (virtq_desc_t){ q->status_phys + s, 1, VIRTQ_DESC_F_WRITE, 0 };
+
+  volatile virtq_desc_t *d = &q->vq.desc[s * VBLK_CHAIN];
+  d->addr  = q->tables_phys + s * VBLK_TABLE_SIZE * sizeof(virtq_desc_t);
+  d->len   = (pages + 2) * sizeof(virtq_desc_t);
+  d->flags = VIRTQ_DESC_F_INDIRECT;
+}
+
+static void fill_chain(vblk_t          *vb,
+                       vblk_queue_t    *q,
+                       uint16_t         s,
+                       block_request_t *req) {
+  volatile virtq_desc_t *d = &q->vq.desc[s * VBLK_CHAIN];
+  d[0].addr  = q->hdrs_phys + s * sizeof(virtio_blk_req_hdr_t);
+  d[0].len   = sizeof(virtio_blk_req_hdr_t);
+  d[0].flags = VIRTQ_DESC_F_NEXT;
+  if(req->op == BLOCK_FLUSH) {
+    d[0].next = s * VBLK_CHAIN + 2;
+    return;
+  }
+  d[0].next  = s * VBLK_CHAIN + 1;
+  d[1].addr  = req->pages ? req->pages[0] : req->phys;
+  d[1].len   = req->count * vb->blk.sector_size;
+  d[1].flags =
+    VIRTQ_DESC_F_NEXT | (req->op == BLOCK_READ ? VIRTQ_DESC_F_WRITE : 0);
+}
+
+/* move pending requests into free slots, true if any went out */
+static bool start_pending(vblk_t *vb, vblk_queue_t *q) {
+  bool started = false;
+  while(q->pending && q->free_count) {
+    block_request_t *req = q->pending;
+    q->pending           = req->next;
+    if(q->pending == NULL)
+      q->pending_tail = &q->pending;
+
+    uint16_t              s   = q->free_slots[--q->free_count];
+    virtio_blk_req_hdr_t *hdr = &q->hdrs[s];
+    hdr->reserved             = 0;
+    hdr->sector               = req->sector * vb->sector_mult;
+    if(req->op == BLOCK_FLUSH)
+      hdr->type = VIRTIO_BLK_T_FLUSH;
+    else
+      hdr->type = req->op == BLOCK_READ ? VIRTIO_BLK_T_IN : VIRTIO_BLK_T_OUT;
+    // max_sectors only allows more than one page when tables exist
+    if(req->op != BLOCK_FLUSH && req->pages &&
+       req->count * vb->blk.sector_size > PAGE_SIZE)
+      fill_indirect(vb, q, s, req);
+    else
+      fill_chain(vb, q, s, req);
+    q->status[s] = 0xFF;
+    q->slots[s]  = req;
+    virtq_push(&q->vq, s * VBLK_CHAIN);
+    q->requests++;
+    started = true;
+  }
+  return started;
+}
+
+static void vblk_submit(block_device_t *dev, block_request_t *reqs) {
+  vblk_t       *vb    = dev->driver_data;
+  vblk_queue_t *q     = &vb->queues[cpu_index() % vb->queue_count];
+  uint64_t      flags = spin_lock_irqsave(&q->lock);
+  *q->pending_tail    = reqs;
+  while(*q->pending_tail) q->pending_tail = &(*q->pending_tail)->next;
+  // the whole batch goes out behind a single notification
+  if(start_pending(vb, q))
+    virtq_kick(&q->vq);
+  spin_unlock_irqrestore(&q->lock, flags);
+}
+
+static uint32_t vblk_reap(vblk_t *vb, vblk_queue_t *q) {
+  block_request_t *done  = NULL;
+  uint32_t         count = 0;
+  uint64_t         flags = spin_lock_irqsave(&q->lock);
+  do {
+    uint32_t id, len;
+    while(virtq_used_pop(&q->vq, &id, &len)) {
+      uint16_t         s   = id / VBLK_CHAIN;
+      block_request_t *req = q->slots[s];
+      req->status          = q->status[s];
+      req->next            = done;
+      done                 = req;
+      q->slots[s]          = NULL;
+      q->free_slots[q->free_count++] = s;
+      count++;
+    }
+  } while(!virtq_arm(&q->vq));
+  if(start_pending(vb, q))
+    virtq_kick(&q->vq);
+  spin_unlock_irqrestore(&q->lock, flags);
+  while(done) {
+    block_request_t *req = done;
+    done                 = req->next;
+    req->done(req);
+  }
+  return count;
+}
+
+static uint32_t vblk_poll(block_device_t *dev) {
+  vblk_t *vb = dev->driver_data;
+  return vblk_reap(vb, &vb->queues[cpu_index() % vb->queue_count]);
+}
+
+static const block_ops_t vblk_ops = {
+  .submit = vblk_submit,
+  .poll   = vblk_poll,
+};
+
+static void vblk_tasklet(uint64_t data) {
+  vblk_queue_t *q = (vblk_queue_t *)data;
+  vblk_reap(q->vb, q);
+}
+
+/* the handler only defers, completions run in softirq context */
+static void vblk_interrupt(void *data) {
+  vblk_queue_t *q = data;
+  q->interrupts++;
+  tasklet_schedule(&q->tasklet);
+}
+
+/* pages for the indirect tables of every slot */
+static uint32_t tables_order(vblk_queue_t *q) {
+  uint16_t slots = q->vq.size / VBLK_CHAIN;
+  uint64_t bytes = sizeof(virtq_desc_t) * VBLK_TABLE_SIZE * slots;
+  uint32_t order = 0;
+  while((PAGE_SIZE << order) < bytes) order++;
+  return order;
+}
+
+/* everything queue_init took but the ring, the device already has its
+ * address. nothing has been made available on it yet */
+static void queue_release(vblk_queue_t *q) {
+  if(q->vector)
+    pci_msix_free(q->vb->vdev.pci, q->vq.index);
+  if(q->tables)
+    free_pages(virt_to_page(q->tables), tables_order(q));
+  if(q->hdrs)
+    free_pages(virt_to_page(q->hdrs), 0);
+}
+
+static bool queue_init(vblk_t *vb, vblk_queue_t *q, uint16_t index) {
+  q->vb           = vb;
+  q->cpu          = index;
+  q->pending      = NULL;
+  q->pending_tail = &q->pending;
+  uint32_t node   = numa_cpu_node(q->cpu);
+  if(!virtq_setup(&vb->vdev, &q->vq, index, VIRTQ_MAX_SIZE, index, node))
+    return false;
+  // headers and status bytes for every slot share one page
+  page_t *page = alloc_pages_node(node, 0);
+  if(page == NULL)
+    return false;
+  uint16_t slots = q->vq.size / VBLK_CHAIN;
+  q->hdrs        = page_address(page);
+  q->status      = (uint8_t *)(q->hdrs + VBLK_MAX_SLOTS);
+  q->hdrs_phys   = page_to_phys(page);
+  q->status_phys = q->hdrs_phys + sizeof(virtio_blk_req_hdr_t) * VBLK_MAX_SLOTS;
+  // the link to the status byte and the status descriptor never change
+  for(uint16_t s = 0; s < slots; ++s) {
+    volatile virtq_desc_t *d = &q->vq.desc[s * VBLK_CHAIN];
+    d[1].next  = s * VBLK_CHAIN + 2;
+    d[2].addr  = q->status_phys + s;
+    d[2].len   = 1;
+    d[2].flags = VIRTQ_DESC_F_WRITE;
+    q->free_slots[q->free_count++] = slots - 1 - s;
+  }
+  if(vb->vdev.features & VIRTIO_F_INDIRECT_DESC) {
+    page_t *tables = alloc_pages_node(node, tables_order(q));
+    if(tables == NULL) {
+      queue_release(q);
+      return false;
+    }
+    q->tables      = page_address(tables);
+    q->tables_phys = page_to_phys(tables);
+  }
+  tasklet_init(&q->tasklet, vblk_tasklet, (uint64_t)q);
+  q->vector = pci_msix_alloc(vb->vdev.pci, index, q->cpu, vblk_interrupt, q);
+  if(q->vector == 0) {
+    queue_release(q);
+    return false;
+  }
+  return true;
+}
+
+static bool vblk_probe(pci_device_t *pci, const pci_device_id_t *id) {
+  (void)id;
+  if(disk_count == BLOCK_MAX_DEVICES)
+    return false;
+  vblk_t *vb = kzalloc(sizeof(*vb));
+  if(vb == NULL)
+    return false;
+  if(!virtio_pci_init(&vb->vdev, pci) || vb->vdev.device_cfg == NULL ||
+     !virtio_negotiate(&vb->vdev,
+                       VIRTIO_F_RING_EVENT_IDX | VIRTIO_F_INDIRECT_DESC |
+                         VIRTIO_BLK_F_SEG_MAX | VIRTIO_BLK_F_BLK_SIZE |
+                         VIRTIO_BLK_F_FLUSH | VIRTIO_BLK_F_MQ))
+    goto fail;
+
+  volatile uint8_t *cfg = vb->vdev.device_cfg;
+  uint32_t          nq  = 1;
+  if(vb->vdev.features & VIRTIO_BLK_F_MQ)
+    nq = *(volatile uint16_t *)(cfg + VIRTIO_BLK_CFG_NUM_QUEUES);
+  // one per CPU at most, and each needs its own MSI-X entry
+  uint16_t entries = pci_msix_enable(pci);
+  if(nq > cpu_count())
+    nq = cpu_count();
+  if(nq > entries)
+    nq = entries;
+  if(nq == 0) {
+    kwarn("virtio-blk: %02x:%02x.%u has no MSI-X\n",
+          pci->bus,
+          pci->dev,
+          pci->func);
+    goto fail;
+  }
+  vb->queues = kzalloc(sizeof(vblk_queue_t) * nq);
+  if(vb->queues == NULL)
+    goto fail;
+  for(uint32_t q = 0; q < nq; ++q) {
+    if(!queue_init(vb, &vb->queues[q], q))
+      goto fail;
+    vb->queue_count++;
+  }
+
+  uint32_t sector_size = 1 << VIRTIO_SECTOR_SHIFT;
+  if(vb->vdev.features & VIRTIO_BLK_F_BLK_SIZE)
+    sector_size = *(volatile uint32_t *)(cfg + VIRTIO_BLK_CFG_BLK_SIZE);
+  // 64 bit config fields take two reads too
+  volatile uint32_t *cap = (volatile uint32_t *)(cfg + VIRTIO_BLK_CFG_CAPACITY);
+  uint64_t capacity      = cap[0] | (uint64_t)cap[1] << 32;
+  // page lists need the indirect tables, and fit in the device's segments
+  uint32_t max_pages = 1;
+  if(vb->vdev.features & VIRTIO_F_INDIRECT_DESC) {
+    max_pages = BLOCK_MAX_PAGES;
+    if(vb->vdev.features & VIRTIO_BLK_F_SEG_MAX) {
+      uint32_t seg_max = *(volatile uint32_t *)(cfg + VIRTIO_BLK_CFG_SEG_MAX);
+      if(seg_max && seg_max < max_pages)
+        max_pages = seg_max;
+    }
+  }
+  vb->sector_mult      = sector_size >> VIRTIO_SECTOR_SHIFT;
+  vb->blk.sector_size  = sector_size;
+  vb->blk.sectors      = capacity / vb->sector_mult;
+  vb->blk.queue_count  = vb->queue_count;
+  vb->blk.max_sectors  = max_pages * PAGE_SIZE / sector_size;
+  vb->blk.ops          = &vblk_ops;
+  vb->blk.driver_data  = vb;
+  memcpy(vb->blk.name, "vda", 4);
+  vb->blk.name[2] += disk_count;
+  pci->driver_data = vb;
+  disks[disk_count++] = vb;
+  virtio_driver_ok(&vb->vdev);
+  block_register(&vb->blk);
+  return true;
+
+fail:
+  // the rings handed to the device stay, it may still write them
+  kwarn("virtio-blk: couldn't set up %02x:%02x.%u\n",
+        pci->bus,
+        pci->dev,
+        pci->func);
+  if(vb->vdev.common)
+    virtio_fail(&vb->vdev);
+  for(uint32_t q = 0; q < vb->queue_count; ++q)
+    queue_release(&vb->queues[q]);
+  kfree(vb->queues);
+  kfree(vb);
+  return false;
+}
+
+static void virtio_blk_cmd(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+  for(uint32_t i = 0; i < disk_count; ++i) {
+    vblk_t *vb = disks[i];
+    printf("%s: features 0x%lx\n", vb->blk.name, vb->vdev.features);
+    for(uint32_t n = 0; n < vb->queue_count; ++n) {
+      vblk_queue_t *q = &vb->queues[n];
+      printf("  queue %u (cpu %u, vector 0x%02x, %u entries): %lu requests, "
+             "%lu kicks, %lu notifies, %lu interrupts\n",
+             n,
+             q->cpu,
+             q->vector,
+             q->vq.size,
+             q->requests,
+             q->vq.kicks,
+             q->vq.notifies,
+             q->interrupts);
+    }
+  }
+}
+
+static const pci_device_id_t vblk_ids[] = {
+  { VIRTIO_VENDOR_ID, 0x1042, PCI_ANY_ID }, /* modern */
+  { VIRTIO_VENDOR_ID, 0x1001, PCI_ANY_ID }, /* transitional */
+  { 0, 0, 0 },
+};
+
+static pci_driver_t vblk_driver = {
+  .name  = "virtio-blk",
+  .ids   = vblk_ids,
+  .probe = vblk_probe,
+};
+
+void virtio_blk_init(void) {
+  pci_register_driver(&vblk_driver);
+  debug_register("virtio-blk",
+                 "per-queue requests, notifies and interrupts",
+                 virtio_blk_cmd);
+}
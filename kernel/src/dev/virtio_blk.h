@@ -0,0 +1,16 @@
+#ifndef _VIRTIO_BLK_H
+#define _VIRTIO_BLK_H
+
+/*
+virtio-blk over modern virtio-pci. one virtqueue per CPU (as many as the
+device offers), each with its own MSI-X vector on its CPU. a submitted
+batch costs one doorbell write, and with event indices the device is only
+notified when it's waiting for more
+*/
+
+/**
+ * @brief claim every virtio-blk device and register it as vda, vdb, ...
+ * after pci_init and smp_init
+ */
+void virtio_blk_init(void);
+#endif  // _VIRTIO_BLK_H
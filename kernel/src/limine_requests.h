@@ -30,6 +30,11 @@ REQUESTDEF struct limine_memmap_request memmap_request = {
   .revision = 0
 };
 
+REQUESTDEF struct limine_hhdm_request hhdm_request = {
+  .id = LIMINE_HHDM_REQUEST,
+  .revision = 0
+};
+
 REQUESTDEF struct limine_rsdp_request rsdp_request = {
   .id = LIMINE_RSDP_REQUEST,
   .revision = 0
@@ -40,6 +45,12 @@ REQUESTDEF struct limine_smbios_request smbios_request = {
   .revision = 0,
 };
 
+REQUESTDEF struct limine_mp_request mp_request = {
+  .id = LIMINE_MP_REQUEST,
+  .revision = 0,
+  .flags = LIMINE_MP_X2APIC,
+};
+
 REQUESTDEF struct limine_date_at_boot_request date_request = {
   .id = LIMINE_DATE_AT_BOOT_REQUEST,
   .revision = 0,
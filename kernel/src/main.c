@@ -1,8 +1,38 @@
+#include <dev/block.h>
+#include <dev/msi.h>
+#include <dev/nvme.h>
+#include <dev/pagecache.h>
+#include <dev/pci.h>
+#include <dev/virtio_blk.h>
 #include <limine.h>
+#include <mm/arena.h>
+#include <mm/numa.h>
+#include <mm/pmm.h>
+#include <mm/radix.h>
+#include <mm/slab.h>
+#include <mm/vmm.h>
+#include <sched/sched.h>
+#include <sched/task.h>
+#include <sched/topology.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <sys/acpi.h>
+#include <sys/apic.h>
+#include <sys/cpu.h>
+#include <sys/debug.h>
+#include <sys/gdt.h>
 #include <sys/interrupts.h>
+#include <sys/irqstat.h>
 #include <sys/pic.h>
+#include <sys/profile.h>
+#include <sys/rcu.h>
+#include <sys/serial.h>
+#include <sys/smp.h>
+#include <sys/softirq.h>
+#include <sys/spinlock.h>
+#include <time/clockevent.h>
+#include <time/clocksource.h>
+#include <time/timer.h>
 #include "limine_requests.h"
 
 #define FB_AT(fb, row, col)                                                    \
@@ -32,21 +62,16 @@ typedef struct limine_memmap_response *memmap_res;
 typedef struct limine_memmap_entry *memmap_entry;
 typedef struct limine_framebuffer_response *framebuffer_res;
 
-typedef struct rsdp_descriptor {
-    char signature[8];
-    uint8_t checksum;
-    char oemid[6];
-    uint8_t revision;
-    uint32_t rsdt_address;
-} __attribute__ ((packed)) rsdp_descriptor;
-
 typedef struct kernel_ctx {
   dtr_t *gdtr;
   dtr_t *idtr;
   bootldr_info_res bootloader;
   memmap_res mmap;
+  // copy in the boot arena, the bootloader's one is in reclaimable memory
+  memmap_entry memmap;
+  size_t memmap_count;
   framebuffer_res fb;
-  rsdp_descriptor *rsdp;
+  rsdp_descriptor_t *rsdp;
 };
 
 struct kernel_ctx ctx = {0};
@@ -56,12 +81,24 @@ struct kernel_ctx ctx = {0};
  * to not have to deal with long typenames
  */
 void init_ctx(void) {
-  ctx.gdtr = get_gdtr();
   ctx.bootloader = bootloader_info_request.response;
   ctx.mmap = memmap_request.response;
   ctx.fb = framebuffer_request.response;
 }
 
+/**
+ * @brief copy the memory map entries into the boot arena
+ */
+static void copy_memmap(void) {
+  ctx.memmap_count = ctx.mmap->entry_count;
+  ctx.memmap = arena_alloc(&boot_arena,
+                           ctx.memmap_count * sizeof(struct limine_memmap_entry),
+                           8);
+  assert(ctx.memmap != NULL);
+  for (size_t i = 0; i < ctx.memmap_count; ++i)
+    ctx.memmap[i] = *ctx.mmap->entries[i];
+}
+
 bool validate_rsdp(const char *byte_array, size_t size) {
     uint32_t sum = 0;
     for(int i = 0; i < size; ++i) {
@@ -86,23 +123,62 @@ void kmain(void) {
   // Fetch the first framebuffer.
   struct limine_framebuffer *framebuffer = ctx.fb->framebuffers[0];
 
+  // printf reads the per-CPU area, so this comes first
+  gdt_init(0);
+  percpu_init(0);
   init_io(framebuffer);
+  serial_init();
+  assert(hhdm_request.response != NULL);
+  vmm_init(hhdm_request.response->offset);
+  assert(memmap_request.response != NULL);
+  pmm_init(memmap_request.response);
+  slab_init();
+  radix_init();
+  arena_init(&boot_arena, "boot");
+  copy_memmap();
   assert(rsdp_request.response != NULL);
-  ctx.rsdp = (rsdp_descriptor *)rsdp_request.response->address;
+  acpi_init(rsdp_request.response->address);
+  ctx.rsdp = phys_to_virt(rsdp_request.response->address);
   
   // if(!validate_rsdp((char*)ctx.rsdp, sizeof(rsdp_descriptor))) {
   //   kpanic("couldn't validate rsdp at address %p\n", ctx.rsdp);
   // }
   printf("\e[1;34m%s v%s\e[0m\n", ctx.bootloader->name, ctx.bootloader->version);
   init_handlers();
-  
+  softirq_init();
+  rcu_init();
+  debug_init();
+  irqstat_init();
+  profile_init();
+  lock_stats_init();
+  interrupts_bench_init();
+  apic_init();
+  numa_init();
+  clocksource_init(date_request.response);
+  clockevent_init();
+  timer_init();
+  topology_init();
+  sched_init();
+  task_init();
+  // boot parsing is done, nothing writes to it from here on
+  arena_seal(&boot_arena);
+  smp_init(mp_request.response);
+  pci_init();
+  msi_init();
+  block_init();
+  virtio_blk_init();
+  nvme_init();
+  pagecache_init();
+  serial_enable_rx();
+  interrupts_enable();
+
   kinfo("%ld framebuffers present\n", ctx.fb->framebuffer_count);
 
-  kinfo("%ld mmap entries present\n", ctx.mmap->entry_count);
+  kinfo("%ld mmap entries present\n", ctx.memmap_count);
   uint64_t total_mem = 0;
   memmap_entry usable = NULL;
-  for (size_t i = 0; i < ctx.mmap->entry_count; ++i) {
-    memmap_entry entry = ctx.mmap->entries[i];
+  for (size_t i = 0; i < ctx.memmap_count; ++i) {
+    memmap_entry entry = &ctx.memmap[i];
     if(entry->type == LIMINE_MEMMAP_USABLE) {
       if(usable && usable->length < entry->length) usable = entry;
       else if(usable == NULL) usable = entry;
@@ -112,11 +188,12 @@ void kmain(void) {
     printf("\t0x%08X - 0x%08X (%06ld): %s\n", entry->base,
            entry->base + entry->length, entry->length, mmap_typenames[entry->type]);
   }
-  printf("rsdp at %p\n",8, ctx.rsdp);
+  printf("rsdp at %p\n", ctx.rsdp);
   kinfo("total mapped memory %ldM\n", total_mem/1024/1024);
   kinfo("located usable memory at 0x%08X - 0x%08X (%ldM)\n", usable->base, usable->base+usable->length, usable->length/1024/1024);
   // init_handlers(dummy_isr);
-  kinfo("GDTR at 0x%08X with limit %ull \n", ctx.gdtr->base,
+  ctx.gdtr = get_gdtr();
+  kinfo("GDTR at 0x%016lX with limit %u\n", ctx.gdtr->base,
          ctx.gdtr->limit);
 
   // Note: we assume the framebuffer model is RGB with 32-bit pixels.
@@ -125,6 +202,6 @@ void kmain(void) {
   //   fb_ptr[i * (framebuffer->pitch / 4) + i] = 0xffffff;
   // }
 
-  // We're done, just hang...
-  abort();
+  // We're done, idle while interrupts (and the debug console) do the work
+  cpu_idle();
 }
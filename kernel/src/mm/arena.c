@@ -0,0 +1,134 @@
+#include "arena.h"
+#include <mm/pmm.h>
+#include <mm/vmm.h>
+#include <stdlib.h>
+#include <sys/spinlock.h>
+
+arena_t boot_arena;
+
+/* virtual space is handed out once and never reused, there's plenty */
+static uint64_t   next_virt = ARENA_VIRT_BASE;
+static spinlock_t virt_lock = SPINLOCK_INIT;
+
+#define ALIGN_UP(x, a) (((x) + (a) - 1) & ~((size_t)(a) - 1))
+
+static uint64_t reserve_virt(size_t size) {
+  uint64_t flags = spin_lock_irqsave(&virt_lock);
+  uint64_t virt  = next_virt;
+  // an unmapped guard page after every chunk
+  next_virt += size + PAGE_SIZE;
+  spin_unlock_irqrestore(&virt_lock, flags);
+  return virt;
+}
+
+static void free_chunk(arena_chunk_t *chunk) {
+  uint64_t phys  = chunk->phys;
+  uint32_t order = chunk->order;
+  uint64_t virt  = (uint64_t)chunk;
+  for(uint64_t off = 0; off < PAGE_SIZE << order; off += PAGE_SIZE)
+    vmm_unmap_page(virt + off);
+  free_pages(phys_to_page(phys), order);
+}
+
+/* a chunk with room for at least `need` bytes after its header */
+static arena_chunk_t *new_chunk(size_t need) {
+  uint32_t order = ARENA_CHUNK_ORDER;
+  while(order < PMM_MAX_ORDER &&
+        (PAGE_SIZE << order) < need + sizeof(arena_chunk_t))
+    order++;
+  if(order == PMM_MAX_ORDER)
+    return NULL;
+  page_t *pages = alloc_pages(order);
+  if(pages == NULL)
+    return NULL;
+  uint64_t phys = page_to_phys(pages);
+  uint64_t virt = reserve_virt(PAGE_SIZE << order);
+  for(uint64_t off = 0; off < PAGE_SIZE << order; off += PAGE_SIZE) {
+    if(!vmm_map_page(virt + off, phys + off, PTE_WRITE | PTE_NX)) {
+      for(uint64_t undo = 0; undo < off; undo += PAGE_SIZE)
+        vmm_unmap_page(virt + undo);
+      free_pages(pages, order);
+      return NULL;
+    }
+  }
+  arena_chunk_t *chunk = (arena_chunk_t *)virt;
+  chunk->prev          = NULL;
+  chunk->phys          = phys;
+  chunk->order         = order;
+  chunk->size          = PAGE_SIZE << order;
+  chunk->used          = sizeof(arena_chunk_t);
+  return chunk;
+}
+
+void arena_init(arena_t *arena, const char *name) {
+  arena->name      = name;
+  arena->chunk     = NULL;
+  arena->allocated = 0;
+  arena->sealed    = false;
+}
+
+void *arena_alloc(arena_t *arena, size_t size, size_t align) {
+  if(arena->sealed) {
+    kwarn("allocation from sealed arena '%s'\n", arena->name);
+    return NULL;
+  }
+  arena_chunk_t *chunk = arena->chunk;
+  if(chunk == NULL || ALIGN_UP(chunk->used, align) + size > chunk->size) {
+    // what's left at the end of the old chunk is wasted
+    chunk = new_chunk(size + align);
+    if(chunk == NULL)
+      return NULL;
+    chunk->prev  = arena->chunk;
+    arena->chunk = chunk;
+  }
+  size_t off   = ALIGN_UP(chunk->used, align);
+  chunk->used  = off + size;
+  arena->allocated += size;
+  return (uint8_t *)chunk + off;
+}
+
+void *arena_memdup(arena_t *arena, const void *src, size_t size) {
+  void *dst = arena_alloc(arena, size, 16);
+  if(dst)
+    memcpy(dst, src, size);
+  return dst;
+}
+
+arena_mark_t arena_checkpoint(arena_t *arena) {
+  return (arena_mark_t){
+    .chunk     = arena->chunk,
+    .used      = arena->chunk ? arena->chunk->used : 0,
+    .allocated = arena->allocated,
+  };
+}
+
+void arena_rewind(arena_t *arena, arena_mark_t mark) {
+  assert(!arena->sealed);
+  while(arena->chunk != mark.chunk) {
+    arena_chunk_t *prev = arena->chunk->prev;
+    free_chunk(arena->chunk);
+    arena->chunk = prev;
+  }
+  if(arena->chunk)
+    arena->chunk->used = mark.used;
+  arena->allocated = mark.allocated;
+}
+
+void arena_seal(arena_t *arena) {
+  for(arena_chunk_t *chunk = arena->chunk; chunk; chunk = chunk->prev) {
+    for(uint64_t off = 0; off < chunk->size; off += PAGE_SIZE)
+      vmm_protect_page((uint64_t)chunk + off, PTE_NX);
+  }
+  arena->sealed = true;
+  kinfo("arena '%s' sealed, %lu bytes\n", arena->name, arena->allocated);
+}
+
+void arena_destroy(arena_t *arena) {
+  // the chunk headers are only read on the way out, sealed or not
+  while(arena->chunk) {
+    arena_chunk_t *prev = arena->chunk->prev;
+    free_chunk(arena->chunk);
+    arena->chunk = prev;
+  }
+  arena_init(arena, arena->name);
+}
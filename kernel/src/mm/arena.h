@@ -0,0 +1,64 @@
+#ifndef _ARENA_H
+#define _ARENA_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+bump allocator for things that live forever or die together. chunks come
+straight from the page allocator and are mapped on their own, outside the
+HHDM, so a finished arena can be sealed read-only. nothing is freed on its
+own: rewind to a checkpoint or destroy the whole arena
+*/
+
+/* pages per chunk, unless one allocation needs more */
+#define ARENA_CHUNK_ORDER 2
+/* where arena chunks get mapped, away from the HHDM and the kernel image */
+#define ARENA_VIRT_BASE   0xFFFFC00000000000ull
+
+typedef struct arena_chunk {
+  struct arena_chunk *prev;
+  uint64_t            phys;
+  uint32_t            order;
+  size_t              size;
+  size_t              used;
+} arena_chunk_t;
+
+typedef struct arena {
+  const char    *name;
+  arena_chunk_t *chunk;
+  size_t         allocated;
+  bool           sealed;
+} arena_t;
+
+typedef struct arena_mark {
+  arena_chunk_t *chunk;
+  size_t         used;
+  size_t         allocated;
+} arena_mark_t;
+
+/* boot time parsing, sealed before the APs start */
+extern arena_t boot_arena;
+
+void  arena_init(arena_t *arena, const char *name);
+/**
+ * @return `size` bytes aligned to `align` (a power of two), NULL when out of
+ * memory or sealed
+ */
+void *arena_alloc(arena_t *arena, size_t size, size_t align);
+void *arena_memdup(arena_t *arena, const void *src, size_t size);
+/**
+ * @brief remember the current fill level, to go back to with arena_rewind
+ */
+arena_mark_t arena_checkpoint(arena_t *arena);
+/**
+ * @brief drop everything allocated since `mark`, chunks included
+ */
+void         arena_rewind(arena_t *arena, arena_mark_t mark);
+/**
+ * @brief make the arena read-only. only the calling CPU's TLB is flushed, so
+ * seal before other CPUs have touched it
+ */
+void         arena_seal(arena_t *arena);
+void         arena_destroy(arena_t *arena);
+#endif  // _ARENA_H
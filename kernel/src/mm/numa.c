@@ -0,0 +1,206 @@
+#include "numa.h"
+#include <mm/pmm.h>
+#include <stdlib.h>
+#include <sys/acpi.h>
+#include <sys/apic.h>
+#include <sys/cpu.h>
+#include <sys/debug.h>
+
+typedef struct numa_range {
+  uint64_t base;
+  uint64_t end;
+  uint32_t node;
+} numa_range_t;
+
+static uint32_t node_count = 1;
+/* proximity domain each node stands for */
+static uint32_t node_domain[MAX_NUMA_NODES] = { 0 };
+static uint8_t  distance[MAX_NUMA_NODES][MAX_NUMA_NODES];
+static uint8_t  fallback[MAX_NUMA_NODES][MAX_NUMA_NODES] = { { 0 } };
+
+static numa_range_t ranges[MAX_NUMA_RANGES];
+static uint32_t     range_count = 0;
+
+static struct {
+  uint32_t apic_id;
+  uint32_t node;
+} cpu_affinity[MAX_NUMA_CPUS];
+static uint32_t cpu_affinity_count = 0;
+
+static uint32_t cpu_node[MAX_CPUS] = { 0 };
+
+/* dense node id of a proximity domain, handing out a new one if need be */
+static uint32_t domain_node(uint32_t domain) {
+  for(uint32_t n = 0; n < node_count; ++n)
+    if(node_domain[n] == domain)
+      return n;
+  if(node_count == MAX_NUMA_NODES) {
+    kwarn("numa: too many nodes, domain %u folded into node 0\n", domain);
+    return 0;
+  }
+  node_domain[node_count] = domain;
+  return node_count++;
+}
+
+static void add_cpu(uint32_t apic_id, uint32_t domain) {
+  if(cpu_affinity_count == MAX_NUMA_CPUS)
+    return;
+  cpu_affinity[cpu_affinity_count].apic_id = apic_id;
+  cpu_affinity[cpu_affinity_count].node    = domain_node(domain);
+  cpu_affinity_count++;
+}
+
+static void add_range(uint64_t base, uint64_t length, uint32_t domain) {
+  if(range_count == MAX_NUMA_RANGES) {
+    kwarn("numa: too many memory ranges, 0x%lx left on node 0\n", base);
+    return;
+  }
+  ranges[range_count].base = base;
+  ranges[range_count].end  = base + length;
+  ranges[range_count].node = domain_node(domain);
+  range_count++;
+}
+
+static bool parse_srat(srat_t *srat) {
+  // node 0 is claimed by the first domain the SRAT mentions
+  node_count   = 0;
+  uint8_t *p   = srat->entries;
+  uint8_t *end = (uint8_t *)srat + srat->h.length;
+  while(p + sizeof(madt_entry_t) <= end) {
+    madt_entry_t *entry = (madt_entry_t *)p;
+    if(entry->length < sizeof(madt_entry_t))
+      break;
+    switch(entry->type) {
+      case SRAT_LAPIC_AFFINITY: {
+        srat_lapic_affinity_t *lapic = (srat_lapic_affinity_t *)entry;
+        if(!(lapic->flags & SRAT_ENABLED))
+          break;
+        uint32_t domain = lapic->proximity_domain_lo |
+                          (uint32_t)lapic->proximity_domain_hi[0] << 8 |
+                          (uint32_t)lapic->proximity_domain_hi[1] << 16 |
+                          (uint32_t)lapic->proximity_domain_hi[2] << 24;
+        add_cpu(lapic->apic_id, domain);
+      } break;
+      case SRAT_X2APIC_AFFINITY: {
+        srat_x2apic_affinity_t *x2 = (srat_x2apic_affinity_t *)entry;
+        if(x2->flags & SRAT_ENABLED)
+          add_cpu(x2->x2apic_id, x2->proximity_domain);
+      } break;
+      case SRAT_MEMORY_AFFINITY: {
+        srat_memory_affinity_t *mem = (srat_memory_affinity_t *)entry;
+        if((mem->flags & SRAT_ENABLED) && mem->length != 0)
+          add_range(mem->base, mem->length, mem->proximity_domain);
+      } break;
+    }
+    p += entry->length;
+  }
+  if(node_count == 0) {
+    node_count = 1;
+    return false;
+  }
+  return true;
+}
+
+static void parse_slit(slit_t *slit) {
+  for(uint32_t a = 0; a < node_count; ++a) {
+    for(uint32_t b = 0; b < node_count; ++b) {
+      uint64_t da = node_domain[a], db = node_domain[b];
+      if(slit != NULL && da < slit->locality_count &&
+         db < slit->locality_count)
+        distance[a][b] = slit->entries[da * slit->locality_count + db];
+      else
+        distance[a][b] = a == b ? SLIT_LOCAL_DISTANCE : SLIT_REMOTE_DISTANCE;
+    }
+  }
+}
+
+static void build_fallback(void) {
+  for(uint32_t n = 0; n < node_count; ++n) {
+    fallback[n][0] = n;
+    uint32_t count = 1;
+    // insertion sort by distance, ties stay in node order
+    for(uint32_t other = 0; other < node_count; ++other) {
+      if(other == n)
+        continue;
+      uint32_t i = count++;
+      while(i > 1 && distance[n][fallback[n][i - 1]] > distance[n][other]) {
+        fallback[n][i] = fallback[n][i - 1];
+        i--;
+      }
+      fallback[n][i] = other;
+    }
+  }
+}
+
+uint32_t numa_node_count(void) {
+  return node_count;
+}
+
+uint32_t numa_phys_node(uint64_t phys) {
+  for(uint32_t i = 0; i < range_count; ++i)
+    if(phys >= ranges[i].base && phys < ranges[i].end)
+      return ranges[i].node;
+  return 0;
+}
+
+uint32_t numa_cpu_node(uint32_t cpu) {
+  return cpu_node[cpu];
+}
+
+uint8_t numa_distance(uint32_t a, uint32_t b) {
+  return distance[a][b];
+}
+
+const uint8_t *numa_fallback_order(uint32_t node, uint32_t *count) {
+  *count = node_count;
+  return fallback[node];
+}
+
+void numa_init_cpu(uint32_t cpu) {
+  uint32_t apic_id = lapic_id();
+  uint32_t node    = 0;
+  for(uint32_t i = 0; i < cpu_affinity_count; ++i)
+    if(cpu_affinity[i].apic_id == apic_id)
+      node = cpu_affinity[i].node;
+  cpu_node[cpu] = node;
+  this_cpu_write(numa_node, node);
+}
+
+static void numa_cmd(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+  for(uint32_t n = 0; n < node_count; ++n) {
+    printf("node %u (domain %u): %lu of %lu pages free, cpus",
+           n,
+           node_domain[n],
+           pmm_node_free_count(n),
+           pmm_node_managed_count(n));
+    for(uint32_t c = 0; c < cpu_count(); ++c)
+      if(cpu_node[c] == n)
+        printf(" %u", c);
+    printf("\n  distances");
+    for(uint32_t m = 0; m < node_count; ++m) printf(" %u", distance[n][m]);
+    printf("\n");
+  }
+  for(uint32_t i = 0; i < range_count; ++i)
+    printf("0x%016lx - 0x%016lx: node %u\n",
+           ranges[i].base,
+           ranges[i].end,
+           ranges[i].node);
+}
+
+void numa_init(void) {
+  srat_t *srat = (srat_t *)find_header("SRAT");
+  if(srat == NULL || !parse_srat(srat))
+    range_count = cpu_affinity_count = 0;
+  parse_slit((slit_t *)find_header("SLIT"));
+  build_fallback();
+  numa_init_cpu(0);
+  if(node_count > 1)
+    pmm_split_nodes();
+  kinfo("numa: %u node%s, %u memory ranges\n",
+        node_count,
+        node_count == 1 ? "" : "s",
+        range_count);
+  debug_register("numa", "nodes, their memory and distances", numa_cmd);
+}
@@ -0,0 +1,45 @@
+#ifndef _NUMA_H
+#define _NUMA_H
+#include <stdint.h>
+#include <sys/percpu.h>
+
+/*
+memory and CPU locality from the ACPI SRAT and SLIT. proximity domains are
+renumbered into dense node ids 0..numa_node_count()-1. without an SRAT
+everything is node 0
+*/
+
+#define MAX_NUMA_NODES 8
+/* enabled SRAT memory ranges we keep */
+#define MAX_NUMA_RANGES 32
+/* SRAT processor entries we keep, possible CPUs included */
+#define MAX_NUMA_CPUS 256
+
+/**
+ * @brief parse the SRAT and SLIT, then split the page allocator into one
+ * zone per node. after acpi_init and apic_init (for the BSP's APIC id)
+ */
+void     numa_init(void);
+/**
+ * @brief record the node of the calling CPU, by its local APIC id
+ */
+void     numa_init_cpu(uint32_t cpu);
+uint32_t numa_node_count(void);
+/**
+ * @brief node the memory at `phys` belongs to, 0 when no range covers it
+ */
+uint32_t numa_phys_node(uint64_t phys);
+uint32_t numa_cpu_node(uint32_t cpu);
+/**
+ * @brief SLIT distance between two nodes, 10 for a node to itself
+ */
+uint8_t  numa_distance(uint32_t a, uint32_t b);
+/**
+ * @brief every node, nearest to `node` first (`node` itself leads)
+ */
+const uint8_t *numa_fallback_order(uint32_t node, uint32_t *count);
+
+static inline uint32_t numa_node_id(void) {
+  return this_cpu_read(numa_node);
+}
+#endif  // _NUMA_H
@@ -0,0 +1,326 @@
+#include "pmm.h"
+#include <stdlib.h>
+#include <sys/cpu.h>
+#include <sys/debug.h>
+
+page_t  *mem_map = NULL;
+uint64_t max_pfn = 0;
+
+static zone_t zones[MAX_NUMA_NODES];
+
+/* only touched by the owning CPU with interrupts off */
+typedef struct zero_pool {
+  page_t  *head;
+  uint32_t count;
+  uint64_t hits;
+  uint64_t misses;
+} __attribute__((aligned(CACHE_LINE))) zero_pool_t;
+
+static zero_pool_t zero_pools[MAX_CPUS];
+
+static void list_add(page_t **head, page_t *page) {
+  page->prev = NULL;
+  page->next = *head;
+  if(*head)
+    (*head)->prev = page;
+  *head = page;
+}
+
+static void list_del(page_t **head, page_t *page) {
+  if(page->prev)
+    page->prev->next = page->next;
+  else
+    *head = page->next;
+  if(page->next)
+    page->next->prev = page->prev;
+}
+
+static void add_free(zone_t *z, page_t *page, uint32_t order) {
+  page->flags = PAGE_BUDDY;
+  page->order = order;
+  list_add(&z->free_area[order], page);
+  z->nr_free[order]++;
+}
+
+static void del_free(zone_t *z, page_t *page, uint32_t order) {
+  list_del(&z->free_area[order], page);
+  page->flags &= ~PAGE_BUDDY;
+  z->nr_free[order]--;
+}
+
+static page_t *zone_alloc(zone_t *z, uint32_t order) {
+  uint64_t flags = spin_lock_irqsave(&z->lock);
+  uint32_t o     = order;
+  while(o < PMM_MAX_ORDER && z->free_area[o] == NULL) o++;
+  if(o == PMM_MAX_ORDER) {
+    spin_unlock_irqrestore(&z->lock, flags);
+    return NULL;
+  }
+  page_t *page = z->free_area[o];
+  del_free(z, page, o);
+  // split it down, the upper halves go back on the smaller lists
+  while(o > order) {
+    o--;
+    add_free(z, page + (1ull << o), o);
+  }
+  page->flags    = 0;
+  page->order    = order;
+  z->free_pages -= 1ull << order;
+  spin_unlock_irqrestore(&z->lock, flags);
+  return page;
+}
+
+page_t *alloc_pages_node(uint32_t node, uint32_t order) {
+  if(order >= PMM_MAX_ORDER)
+    return NULL;
+  uint32_t       count;
+  const uint8_t *order_by_distance = numa_fallback_order(node, &count);
+  for(uint32_t i = 0; i < count; ++i) {
+    page_t *page = zone_alloc(&zones[order_by_distance[i]], order);
+    if(page)
+      return page;
+  }
+  return NULL;
+}
+
+page_t *alloc_pages(uint32_t order) {
+  return alloc_pages_node(numa_node_id(), order);
+}
+
+void free_pages(page_t *page, uint32_t order) {
+  zone_t  *z     = &zones[page->node];
+  uint64_t flags = spin_lock_irqsave(&z->lock);
+  uint64_t pfn   = page - mem_map;
+  z->free_pages += 1ull << order;
+  // merge with the buddy for as long as it's free, whole and on our node
+  while(order < PMM_MAX_ORDER - 1) {
+    uint64_t buddy_pfn = pfn ^ (1ull << order);
+    if(buddy_pfn >= max_pfn)
+      break;
+    page_t *buddy = &mem_map[buddy_pfn];
+    if(!(buddy->flags & PAGE_BUDDY) || buddy->order != order ||
+       buddy->node != page->node)
+      break;
+    del_free(z, buddy, order);
+    pfn &= ~(1ull << order);
+    order++;
+  }
+  add_free(z, &mem_map[pfn], order);
+  spin_unlock_irqrestore(&z->lock, flags);
+}
+
+static page_t *zero_pool_pop(bool count) {
+  uint64_t     flags = irq_save();
+  zero_pool_t *pool  = &zero_pools[cpu_index()];
+  page_t      *page  = pool->head;
+  if(page) {
+    pool->head = page->next;
+    pool->count--;
+  }
+  if(count) {
+    if(page)
+      pool->hits++;
+    else
+      pool->misses++;
+  }
+  irq_restore(flags);
+  return page;
+}
+
+uint64_t pmm_alloc_page(void) {
+  page_t *page = alloc_pages(0);
+  // the zero pools are the last reserve
+  if(page == NULL)
+    page = zero_pool_pop(false);
+  return page ? page_to_phys(page) : 0;
+}
+
+uint64_t pmm_alloc_zeroed_page(void) {
+  page_t *page = zero_pool_pop(true);
+  if(page)
+    return page_to_phys(page);
+  uint64_t phys = pmm_alloc_page();
+  // about to be used, so zeroing it through the cache is the better deal
+  if(phys)
+    memset(phys_to_virt(phys), 0, PAGE_SIZE);
+  return phys;
+}
+
+bool zero_pool_wants_page(void) {
+  // only from our own node, remote memory isn't worth zeroing ahead
+  return zero_pools[cpu_index()].count < ZERO_POOL_PAGES &&
+         zones[numa_node_id()].free_pages > 0;
+}
+
+static void zero_page_nt(void *page) {
+  uint64_t *p = page;
+  for(size_t i = 0; i < PAGE_SIZE / sizeof(uint64_t); i += 4) {
+    __asm__ volatile("movnti %1, 0(%0)\n\t"
+                     "movnti %1, 8(%0)\n\t"
+                     "movnti %1, 16(%0)\n\t"
+                     "movnti %1, 24(%0)"
+                     :
+                     : "r"(&p[i]), "r"(0ull)
+                     : "memory");
+  }
+  // non-temporal stores are weakly ordered, make them visible before the
+  // page is published
+  __asm__ volatile("sfence" ::: "memory");
+}
+
+void zero_pool_fill(void) {
+  page_t *page = zone_alloc(&zones[numa_node_id()], 0);
+  if(page == NULL)
+    return;
+  zero_page_nt(page_address(page));
+  uint64_t     flags = irq_save();
+  zero_pool_t *pool  = &zero_pools[cpu_index()];
+  page->next         = pool->head;
+  pool->head         = page;
+  pool->count++;
+  irq_restore(flags);
+}
+
+void pmm_free_page(uint64_t phys) {
+  free_pages(phys_to_page(phys), 0);
+}
+
+uint64_t pmm_free_count(void) {
+  uint64_t free = 0;
+  for(uint32_t n = 0; n < numa_node_count(); ++n) free += zones[n].free_pages;
+  return free;
+}
+
+uint64_t pmm_node_free_count(uint32_t node) {
+  return zones[node].free_pages;
+}
+
+uint64_t pmm_node_managed_count(uint32_t node) {
+  return zones[node].managed_pages;
+}
+
+/*
+hand [pfn, end) to the allocator in the largest aligned blocks that fit,
+each block going to the zone of its node. page_t.node is already set
+*/
+static void free_range(uint64_t pfn, uint64_t end) {
+  while(pfn < end) {
+    uint32_t node = mem_map[pfn].node;
+    uint64_t stop = pfn;
+    while(stop < end && mem_map[stop].node == node) stop++;
+    while(pfn < stop) {
+      uint32_t order = PMM_MAX_ORDER - 1;
+      while(order > 0 &&
+            ((pfn & ((1ull << order) - 1)) || pfn + (1ull << order) > stop))
+        order--;
+      for(uint64_t i = 0; i < 1ull << order; ++i)
+        mem_map[pfn + i].flags = 0;
+      add_free(&zones[node], &mem_map[pfn], order);
+      zones[node].free_pages += 1ull << order;
+      pfn                    += 1ull << order;
+    }
+  }
+}
+
+void pmm_split_nodes(void) {
+  for(uint32_t n = 0; n < numa_node_count(); ++n) {
+    zones[n].free_pages    = 0;
+    zones[n].managed_pages = 0;
+    if(n > 0)
+      spin_stats_attach(&zones[n].lock, &zones[n].lock_stats, zones[n].name);
+  }
+  for(uint64_t pfn = 0; pfn < max_pfn; ++pfn) {
+    mem_map[pfn].node = numa_phys_node(pfn << PAGE_SHIFT);
+    if(!(mem_map[pfn].flags & PAGE_RESERVED))
+      zones[mem_map[pfn].node].managed_pages++;
+  }
+  // everything free is still on node 0's lists, take it all off and hand it
+  // out again by node. the buddy heads keep their order
+  page_t *blocks = NULL;
+  for(uint32_t o = 0; o < PMM_MAX_ORDER; ++o) {
+    while(zones[0].free_area[o]) {
+      page_t *page = zones[0].free_area[o];
+      del_free(&zones[0], page, o);
+      page->next = blocks;
+      blocks     = page;
+    }
+  }
+  while(blocks) {
+    page_t  *page = blocks;
+    uint64_t pfn  = page - mem_map;
+    blocks        = page->next;
+    free_range(pfn, pfn + (1ull << page->order));
+  }
+}
+
+static void mem_cmd(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+  for(uint32_t n = 0; n < numa_node_count(); ++n) {
+    zone_t *z = &zones[n];
+    printf("node %u: %lu of %lu pages free (%lu MiB)\n",
+           n,
+           z->free_pages,
+           z->managed_pages,
+           z->free_pages * PAGE_SIZE >> 20);
+    for(uint32_t o = 0; o < PMM_MAX_ORDER; ++o)
+      printf("  order %2u: %lu blocks\n", o, z->nr_free[o]);
+  }
+  for(uint32_t c = 0; c < cpu_count(); ++c) {
+    zero_pool_t *pool  = &zero_pools[c];
+    uint64_t     total = pool->hits + pool->misses;
+    printf("cpu %u zero pool: %u pages, %lu hits, %lu misses (%lu%% hit)\n",
+           c,
+           pool->count,
+           pool->hits,
+           pool->misses,
+           total ? pool->hits * 100 / total : 0);
+  }
+}
+
+void pmm_init(struct limine_memmap_response *memmap) {
+  for(uint32_t n = 0; n < MAX_NUMA_NODES; ++n) {
+    memcpy(zones[n].name, "zone0", 6);
+    zones[n].name[4] += n;
+  }
+  for(uint64_t i = 0; i < memmap->entry_count; ++i) {
+    struct limine_memmap_entry *e = memmap->entries[i];
+    if(e->type == LIMINE_MEMMAP_USABLE &&
+       (e->base + e->length) >> PAGE_SHIFT > max_pfn)
+      max_pfn = (e->base + e->length) >> PAGE_SHIFT;
+  }
+  // the page_t array comes out of the first usable range it fits in
+  uint64_t                    bytes = PAGE_ALIGN_UP(max_pfn * sizeof(page_t));
+  struct limine_memmap_entry *home  = NULL;
+  for(uint64_t i = 0; i < memmap->entry_count && home == NULL; ++i) {
+    struct limine_memmap_entry *e = memmap->entries[i];
+    if(e->type == LIMINE_MEMMAP_USABLE && e->length >= bytes)
+      home = e;
+  }
+  if(home == NULL)
+    kpanic("no room for %lu bytes of page structs\n", bytes);
+  mem_map = phys_to_virt(home->base);
+  memset(mem_map, 0, bytes);
+  for(uint64_t pfn = 0; pfn < max_pfn; ++pfn)
+    mem_map[pfn].flags = PAGE_RESERVED;
+
+  for(uint64_t i = 0; i < memmap->entry_count; ++i) {
+    struct limine_memmap_entry *e = memmap->entries[i];
+    if(e->type != LIMINE_MEMMAP_USABLE)
+      continue;
+    uint64_t start = PAGE_ALIGN_UP(e->base);
+    uint64_t end   = PAGE_ALIGN_DOWN(e->base + e->length);
+    if(e == home)
+      start += bytes;
+    if(end > start)
+      zones[0].managed_pages += (end - start) >> PAGE_SHIFT;
+    free_range(start >> PAGE_SHIFT, end >> PAGE_SHIFT);
+  }
+  // node 0 holds everything until numa_init knows better
+  spin_stats_attach(&zones[0].lock, &zones[0].lock_stats, zones[0].name);
+  kinfo("pmm: %lu MiB free, %lu KiB of page structs\n",
+        zones[0].free_pages * PAGE_SIZE >> 20,
+        bytes >> 10);
+  debug_register(
+    "mem", "free physical memory by block size, zero pool hits", mem_cmd);
+}
@@ -0,0 +1,119 @@
+#ifndef _PMM_H
+#define _PMM_H
+#include <limine.h>
+#include <mm/numa.h>
+#include <mm/vmm.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/spinlock.h>
+
+/*
+physical page allocator. a buddy allocator over every usable page in the
+memory map, with a page_t for each page frame from 0 to the end of the
+highest usable range. there's one zone per NUMA node, allocations come from
+the calling CPU's node and fall back to the others nearest first
+*/
+
+/* blocks of 2^0 .. 2^(PMM_MAX_ORDER - 1) pages, up to 4MiB */
+#define PMM_MAX_ORDER 11
+
+/* head of a free block on a buddy list */
+#define PAGE_BUDDY    (1 << 0)
+/* never handed out: firmware, the kernel, the page_t array itself */
+#define PAGE_RESERVED (1 << 1)
+/* part of a slab, see slab.c */
+#define PAGE_SLAB     (1 << 2)
+/* head of a block kmalloc handed out whole */
+#define PAGE_LARGE    (1 << 3)
+
+/* zeroed pages each CPU keeps ready, filled while it's idle */
+#define ZERO_POOL_PAGES 64
+
+struct kmem_cache;
+
+typedef struct page {
+  /* buddy free list, or a cache's partial slab list */
+  struct page *next;
+  struct page *prev;
+  uint32_t     flags;
+  uint8_t      order;
+  /* zone the page frame belongs to */
+  uint8_t node;
+  /* slab.c, kept in the first page of a slab. the others point `head` at it */
+  uint16_t           inuse;
+  struct page       *head;
+  struct kmem_cache *cache;
+  void              *freelist;
+} page_t;
+
+typedef struct zone {
+  spinlock_t   lock;
+  page_t      *free_area[PMM_MAX_ORDER];
+  uint64_t     nr_free[PMM_MAX_ORDER];
+  uint64_t     free_pages;
+  uint64_t     managed_pages;
+  lock_stats_t lock_stats;
+  char         name[8];
+} __attribute__((aligned(CACHE_LINE))) zone_t;
+
+extern page_t  *mem_map;
+extern uint64_t max_pfn;
+
+static inline uint64_t page_to_phys(page_t *page) {
+  return (uint64_t)(page - mem_map) << PAGE_SHIFT;
+}
+
+static inline page_t *phys_to_page(uint64_t phys) {
+  return &mem_map[phys >> PAGE_SHIFT];
+}
+
+static inline void *page_address(page_t *page) {
+  return phys_to_virt(page_to_phys(page));
+}
+
+static inline page_t *virt_to_page(const void *virt) {
+  return phys_to_page((uint64_t)virt - hhdm_offset);
+}
+
+/**
+ * @brief build the page_t array and hand every usable page to the buddy
+ * allocator. after vmm_init
+ */
+void    pmm_init(struct limine_memmap_response *memmap);
+/**
+ * @brief move every page to the zone of its node once the SRAT is known.
+ * called by numa_init, only the BSP is running
+ */
+void    pmm_split_nodes(void);
+/**
+ * @brief 2^order physically contiguous pages, aligned to their size, from
+ * `node` or the nodes nearest to it
+ *
+ * @return the first page, or NULL
+ */
+page_t *alloc_pages_node(uint32_t node, uint32_t order);
+/**
+ * @brief alloc_pages_node on the calling CPU's node
+ */
+page_t *alloc_pages(uint32_t order);
+void    free_pages(page_t *page, uint32_t order);
+/**
+ * @brief one page, as a physical address (0 when out of memory)
+ */
+uint64_t pmm_alloc_page(void);
+/**
+ * @brief one zeroed page, from the calling CPU's pool when it has one
+ */
+uint64_t pmm_alloc_zeroed_page(void);
+void     pmm_free_page(uint64_t phys);
+uint64_t pmm_free_count(void);
+uint64_t pmm_node_free_count(uint32_t node);
+uint64_t pmm_node_managed_count(uint32_t node);
+/**
+ * @brief for cpu_idle: whether this CPU's zero pool has room, and zeroing
+ * one more page for it (with non-temporal stores, so the idle CPU doesn't
+ * fill its cache with zeroes nobody reads yet)
+ */
+bool     zero_pool_wants_page(void);
+void     zero_pool_fill(void);
+#endif  // _PMM_H
@@ -0,0 +1,172 @@
+#include "radix.h"
+#include <mm/slab.h>
+#include <stdlib.h>
+
+static kmem_cache_t *node_cache;
+
+static radix_node_t *node_alloc(uint8_t shift) {
+  radix_node_t *node = kmem_cache_alloc(node_cache);
+  if(node == NULL)
+    return NULL;
+  memset(node, 0, sizeof(*node));
+  node->shift = shift;
+  return node;
+}
+
+/* whether `index` is below the node's reach */
+static inline bool covers(radix_node_t *node, uint64_t index) {
+  uint32_t bits = node->shift + RADIX_BITS;
+  return bits >= 64 || (index >> bits) == 0;
+}
+
+static radix_node_t *leaf_of(radix_tree_t *tree, uint64_t index) {
+  radix_node_t *node = tree->root;
+  if(node == NULL || !covers(node, index))
+    return NULL;
+  while(node && node->shift)
+    node = node->slots[(index >> node->shift) & RADIX_MASK];
+  return node;
+}
+
+bool radix_insert(radix_tree_t *tree, uint64_t index, void *item) {
+  if(tree->root == NULL && (tree->root = node_alloc(0)) == NULL)
+    return false;
+  // grow upwards until the root reaches `index`
+  while(!covers(tree->root, index)) {
+    radix_node_t *root = node_alloc(tree->root->shift + RADIX_BITS);
+    if(root == NULL)
+      return false;
+    root->slots[0] = tree->root;
+    root->count    = 1;
+    for(uint32_t tag = 0; tag < RADIX_TAGS; ++tag)
+      if(tree->root->tags[tag])
+        root->tags[tag] = 1;
+    tree->root->parent = root;
+    tree->root->offset = 0;
+    tree->root         = root;
+  }
+  radix_node_t *node = tree->root;
+  while(node->shift) {
+    uint32_t      off   = (index >> node->shift) & RADIX_MASK;
+    radix_node_t *child = node->slots[off];
+    if(child == NULL) {
+      if((child = node_alloc(node->shift - RADIX_BITS)) == NULL)
+        return false;
+      child->parent    = node;
+      child->offset    = off;
+      node->slots[off] = child;
+      node->count++;
+    }
+    node = child;
+  }
+  uint32_t off = index & RADIX_MASK;
+  if(node->slots[off])
+    return false;
+  node->slots[off] = item;
+  node->count++;
+  return true;
+}
+
+void *radix_lookup(radix_tree_t *tree, uint64_t index) {
+  radix_node_t *leaf = leaf_of(tree, index);
+  return leaf ? leaf->slots[index & RADIX_MASK] : NULL;
+}
+
+/* clear `off` in `node` and in each parent until one has other tags left */
+static void clear_tag(radix_node_t *node, uint32_t off, uint32_t tag) {
+  while(node) {
+    node->tags[tag] &= ~(1ull << off);
+    if(node->tags[tag])
+      return;
+    off  = node->offset;
+    node = node->parent;
+  }
+}
+
+void *radix_delete(radix_tree_t *tree, uint64_t index) {
+  radix_node_t *node = leaf_of(tree, index);
+  uint32_t      off  = index & RADIX_MASK;
+  void         *item = node ? node->slots[off] : NULL;
+  if(item == NULL)
+    return NULL;
+  for(uint32_t tag = 0; tag < RADIX_TAGS; ++tag)
+    if(node->tags[tag] & (1ull << off))
+      clear_tag(node, off, tag);
+  node->slots[off] = NULL;
+  node->count--;
+  // empty nodes go, their tags are already clear all the way up
+  while(node->count == 0) {
+    radix_node_t *parent = node->parent;
+    uint32_t      offset = node->offset;
+    kmem_cache_free(node_cache, node);
+    if(parent == NULL) {
+      tree->root = NULL;
+      break;
+    }
+    parent->slots[offset] = NULL;
+    parent->count--;
+    node = parent;
+  }
+  return item;
+}
+
+void radix_tag_set(radix_tree_t *tree, uint64_t index, uint32_t tag) {
+  radix_node_t *node = leaf_of(tree, index);
+  uint32_t      off  = index & RADIX_MASK;
+  if(node == NULL || node->slots[off] == NULL)
+    return;
+  while(node && !(node->tags[tag] & (1ull << off))) {
+    node->tags[tag] |= 1ull << off;
+    off  = node->offset;
+    node = node->parent;
+  }
+}
+
+void radix_tag_clear(radix_tree_t *tree, uint64_t index, uint32_t tag) {
+  radix_node_t *node = leaf_of(tree, index);
+  uint32_t      off  = index & RADIX_MASK;
+  if(node && (node->tags[tag] & (1ull << off)))
+    clear_tag(node, off, tag);
+}
+
+bool radix_tagged(radix_tree_t *tree, uint32_t tag) {
+  return tree->root && tree->root->tags[tag];
+}
+
+static uint32_t gather_tagged(radix_node_t *node,
+                              uint64_t      base,
+                              uint64_t      start,
+                              void        **items,
+                              uint32_t      found,
+                              uint32_t      max,
+                              uint32_t      tag) {
+  uint64_t tags = node->tags[tag];
+  while(tags && found < max) {
+    uint32_t off = __builtin_ctzll(tags);
+    tags &= tags - 1;
+    uint64_t first = base | (uint64_t)off << node->shift;
+    uint64_t last  = first + ((1ull << node->shift) - 1);
+    if(last < start)
+      continue;
+    if(node->shift == 0)
+      items[found++] = node->slots[off];
+    else
+      found = gather_tagged(
+        node->slots[off], first, start, items, found, max, tag);
+  }
+  return found;
+}
+
+uint32_t radix_gang_lookup_tag(radix_tree_t *tree,
+                               void        **items,
+                               uint64_t      start,
+                               uint32_t      max,
+                               uint32_t      tag) {
+  if(tree->root == NULL || !covers(tree->root, start))
+    return 0;
+  return gather_tagged(tree->root, 0, start, items, 0, max, tag);
+}
+
+void radix_init(void) {
+  node_cache = kmem_cache_create("radix_node", sizeof(radix_node_t), 8, NULL);
+}
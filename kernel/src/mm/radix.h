@@ -0,0 +1,64 @@
+#ifndef _RADIX_H
+#define _RADIX_H
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+radix tree from 64 bit indices to pointers, 64 slots per node and only as
+tall as the largest index needs. every node keeps a bitmap per tag of the
+slots that are tagged (or lead to something tagged), so walking the tagged
+items skips whole untagged subtrees. callers do the locking
+*/
+
+#define RADIX_BITS  6
+#define RADIX_SLOTS (1 << RADIX_BITS)
+#define RADIX_MASK  (RADIX_SLOTS - 1)
+#define RADIX_TAGS  2
+
+typedef struct radix_node {
+  struct radix_node *parent;
+  /* index bits below this node, and its slot in the parent */
+  uint8_t            shift;
+  uint8_t            offset;
+  uint16_t           count;
+  uint64_t           tags[RADIX_TAGS];
+  void              *slots[RADIX_SLOTS];
+} radix_node_t;
+
+typedef struct radix_tree {
+  radix_node_t *root;
+} radix_tree_t;
+
+#define RADIX_TREE_INIT { .root = NULL }
+
+/**
+ * @brief store `item` at `index`
+ *
+ * @return false if something is already there or out of memory
+ */
+bool  radix_insert(radix_tree_t *tree, uint64_t index, void *item);
+void *radix_lookup(radix_tree_t *tree, uint64_t index);
+/**
+ * @brief remove whatever is at `index`, along with its tags
+ *
+ * @return what was there
+ */
+void *radix_delete(radix_tree_t *tree, uint64_t index);
+void  radix_tag_set(radix_tree_t *tree, uint64_t index, uint32_t tag);
+void  radix_tag_clear(radix_tree_t *tree, uint64_t index, uint32_t tag);
+/**
+ * @brief whether anything in the tree has `tag`
+ */
+bool  radix_tagged(radix_tree_t *tree, uint32_t tag);
+/**
+ * @brief up to `max` items tagged `tag` at `start` or above, in index order
+ *
+ * @return how many went into `items`
+ */
+uint32_t radix_gang_lookup_tag(radix_tree_t *tree,
+                               void        **items,
+                               uint64_t      start,
+                               uint32_t      max,
+                               uint32_t      tag);
+void     radix_init(void);
+#endif  // _RADIX_H
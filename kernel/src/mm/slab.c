@@ -0,0 +1,307 @@
+#include "slab.h"
+#include <mm/pmm.h>
+#include <stdlib.h>
+#include <sys/debug.h>
+#include <time/clocksource.h>
+
+static kmem_cache_t cache_pool[SLAB_MAX_CACHES];
+static uint32_t     cache_count = 0;
+static spinlock_t   pool_lock   = SPINLOCK_INIT;
+
+/* the kmalloc size classes, 96 and 192 fill the widest gaps between powers
+ * of two */
+static const uint32_t kmalloc_sizes[] = { 16,   32,   64,   96,   128,
+                                          192,  256,  512,  1024, 2048,
+                                          4096, 8192 };
+static const char    *kmalloc_names[] = {
+  "kmalloc-16",   "kmalloc-32",   "kmalloc-64",  "kmalloc-96",
+  "kmalloc-128",  "kmalloc-192",  "kmalloc-256", "kmalloc-512",
+  "kmalloc-1024", "kmalloc-2048", "kmalloc-4k",  "kmalloc-8k",
+};
+#define KMALLOC_CLASSES (sizeof(kmalloc_sizes) / sizeof(kmalloc_sizes[0]))
+
+static kmem_cache_t *kmalloc_caches[KMALLOC_CLASSES];
+/* class of sizes up to 192, indexed by (size + 15) / 16 */
+static const uint8_t small_index[13] = {
+  0, 0, 1, 2, 2, 3, 3, 4, 4, 5, 5, 5, 5,
+};
+
+static void *get_free(kmem_cache_t *cache, void *obj) {
+  return *(void **)((uint8_t *)obj + cache->offset);
+}
+
+static void set_free(kmem_cache_t *cache, void *obj, void *next) {
+  *(void **)((uint8_t *)obj + cache->offset) = next;
+}
+
+static void partial_add(kmem_cache_t *cache, page_t *slab) {
+  slab->prev = NULL;
+  slab->next = cache->partial;
+  if(cache->partial)
+    cache->partial->prev = slab;
+  cache->partial = slab;
+  cache->nr_partial++;
+}
+
+static void partial_del(kmem_cache_t *cache, page_t *slab) {
+  if(slab->prev)
+    slab->prev->next = slab->next;
+  else
+    cache->partial = slab->next;
+  if(slab->next)
+    slab->next->prev = slab->prev;
+  cache->nr_partial--;
+}
+
+static page_t *new_slab(kmem_cache_t *cache) {
+  page_t *slab = alloc_pages(cache->order);
+  if(slab == NULL)
+    return NULL;
+  for(uint32_t i = 0; i < 1u << cache->order; ++i) {
+    slab[i].flags |= PAGE_SLAB;
+    slab[i].head   = slab;
+    slab[i].cache  = cache;
+  }
+  uint8_t *base = page_address(slab);
+  void    *free = NULL;
+  for(int i = cache->objects - 1; i >= 0; --i) {
+    void *obj = base + (size_t)i * cache->size;
+    if(cache->ctor)
+      cache->ctor(obj);
+    set_free(cache, obj, free);
+    free = obj;
+  }
+  slab->freelist = free;
+  slab->inuse    = 0;
+  cache->nr_slabs++;
+  return slab;
+}
+
+static void discard_slab(kmem_cache_t *cache, page_t *slab) {
+  for(uint32_t i = 0; i < 1u << cache->order; ++i) {
+    slab[i].flags &= ~PAGE_SLAB;
+    slab[i].head   = NULL;
+    slab[i].cache  = NULL;
+  }
+  cache->nr_slabs--;
+  free_pages(slab, cache->order);
+}
+
+/* top the CPU's stack up to SLAB_BATCH objects, interrupts are off */
+static bool refill(kmem_cache_t *cache, kmem_cpu_cache_t *cpu) {
+  spin_lock(&cache->lock);
+  while(cpu->count < SLAB_BATCH) {
+    page_t *slab = cache->partial;
+    if(slab == NULL) {
+      slab = new_slab(cache);
+      if(slab == NULL)
+        break;
+      partial_add(cache, slab);
+    }
+    void *obj      = slab->freelist;
+    slab->freelist = get_free(cache, obj);
+    slab->inuse++;
+    // full slabs aren't tracked, a free puts them back on the list
+    if(slab->freelist == NULL)
+      partial_del(cache, slab);
+    cpu->objects[cpu->count++] = obj;
+  }
+  spin_unlock(&cache->lock);
+  return cpu->count > 0;
+}
+
+/* give the oldest SLAB_BATCH objects back to their slabs */
+static void flush(kmem_cache_t *cache, kmem_cpu_cache_t *cpu) {
+  spin_lock(&cache->lock);
+  for(uint32_t i = 0; i < SLAB_BATCH; ++i) {
+    void   *obj  = cpu->objects[i];
+    page_t *slab = virt_to_page(obj)->head;
+    if(slab->freelist == NULL)
+      partial_add(cache, slab);
+    set_free(cache, obj, slab->freelist);
+    slab->freelist = obj;
+    slab->inuse--;
+    if(slab->inuse == 0 && cache->nr_partial > SLAB_MIN_PARTIAL) {
+      partial_del(cache, slab);
+      discard_slab(cache, slab);
+    }
+  }
+  spin_unlock(&cache->lock);
+  cpu->count -= SLAB_BATCH;
+  memmove(cpu->objects, &cpu->objects[SLAB_BATCH], cpu->count * sizeof(void *));
+}
+
+void *kmem_cache_alloc(kmem_cache_t *cache) {
+  uint64_t          flags = irq_save();
+  kmem_cpu_cache_t *cpu   = &cache->cpu[cpu_index()];
+  void             *obj   = NULL;
+  if(cpu->count > 0 || refill(cache, cpu)) {
+    obj = cpu->objects[--cpu->count];
+    cpu->allocs++;
+  }
+  irq_restore(flags);
+  return obj;
+}
+
+void kmem_cache_free(kmem_cache_t *cache, void *obj) {
+  uint64_t          flags = irq_save();
+  kmem_cpu_cache_t *cpu   = &cache->cpu[cpu_index()];
+  if(cpu->count == SLAB_CPU_OBJECTS)
+    flush(cache, cpu);
+  cpu->objects[cpu->count++] = obj;
+  cpu->frees++;
+  irq_restore(flags);
+}
+
+kmem_cache_t *kmem_cache_create(const char *name, size_t size, size_t align,
+                                void (*ctor)(void *)) {
+  uint64_t flags = spin_lock_irqsave(&pool_lock);
+  if(cache_count == SLAB_MAX_CACHES) {
+    spin_unlock_irqrestore(&pool_lock, flags);
+    kwarn("no room for cache '%s'\n", name);
+    return NULL;
+  }
+  kmem_cache_t *cache = &cache_pool[cache_count++];
+  spin_unlock_irqrestore(&pool_lock, flags);
+
+  if(align < sizeof(void *))
+    align = sizeof(void *);
+  cache->name        = name;
+  cache->object_size = size;
+  cache->ctor        = ctor;
+  // a constructed object has to survive being on the free list
+  cache->offset = 0;
+  if(ctor) {
+    cache->offset = (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+    size          = cache->offset + sizeof(void *);
+  }
+  if(size < sizeof(void *))
+    size = sizeof(void *);
+  cache->size  = (size + align - 1) & ~(align - 1);
+  // at least 8 objects a slab, up to 8 pages
+  cache->order = 0;
+  while(cache->order < 3 && (PAGE_SIZE << cache->order) / cache->size < 8)
+    cache->order++;
+  cache->objects = (PAGE_SIZE << cache->order) / cache->size;
+  spin_init(&cache->lock);
+  return cache;
+}
+
+static kmem_cache_t *kmalloc_cache(size_t size) {
+  if(size <= 192)
+    return kmalloc_caches[small_index[(size + 15) / 16]];
+  // 256 and up are powers of two, class 6 onwards
+  return kmalloc_caches[6 + (64 - __builtin_clzll(size - 1)) - 8];
+}
+
+void *kmalloc(size_t size) {
+  if(size == 0)
+    return NULL;
+  if(size <= KMALLOC_MAX_CACHE_SIZE)
+    return kmem_cache_alloc(kmalloc_cache(size));
+  uint32_t order = 0;
+  while((PAGE_SIZE << order) < size) order++;
+  page_t *page = alloc_pages(order);
+  if(page == NULL)
+    return NULL;
+  page->flags |= PAGE_LARGE;
+  return page_address(page);
+}
+
+void *kzalloc(size_t size) {
+  void *ptr = kmalloc(size);
+  if(ptr)
+    memset(ptr, 0, size);
+  return ptr;
+}
+
+void kfree(void *ptr) {
+  if(ptr == NULL)
+    return;
+  page_t *page = virt_to_page(ptr);
+  if(page->flags & PAGE_SLAB) {
+    kmem_cache_free(page->cache, ptr);
+  } else if(page->flags & PAGE_LARGE) {
+    page->flags &= ~PAGE_LARGE;
+    free_pages(page, page->order);
+  } else {
+    kerror("kfree of %p, which kmalloc didn't hand out\n", ptr);
+  }
+}
+
+static void slabinfo_cmd(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+  printf("%-14s %6s %6s %4s %6s %7s %10s %10s\n",
+         "cache",
+         "object",
+         "stride",
+         "per",
+         "slabs",
+         "partial",
+         "allocs",
+         "frees");
+  for(uint32_t i = 0; i < cache_count; ++i) {
+    kmem_cache_t *cache  = &cache_pool[i];
+    uint64_t      allocs = 0, frees = 0;
+    for(uint32_t c = 0; c < cpu_count(); ++c) {
+      allocs += cache->cpu[c].allocs;
+      frees  += cache->cpu[c].frees;
+    }
+    printf("%-14s %6u %6u %4u %6lu %7lu %10lu %10lu\n",
+           cache->name,
+           cache->object_size,
+           cache->size,
+           cache->objects,
+           cache->nr_slabs,
+           cache->nr_partial,
+           allocs,
+           frees);
+  }
+}
+
+#define SLAB_BENCH_BATCH  SLAB_BATCH
+#define SLAB_BENCH_ROUNDS 65536
+
+static void bench_slab_cmd(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+  void    *objs[SLAB_BENCH_BATCH];
+  uint64_t alloc = 0, release = 0;
+  // batches that fit the CPU stack, so after the first round it's all
+  // fast path
+  for(int round = 0; round < SLAB_BENCH_ROUNDS; ++round) {
+    uint64_t start = rdtsc();
+    for(int i = 0; i < SLAB_BENCH_BATCH; ++i) objs[i] = kmalloc(64);
+    uint64_t mid = rdtsc();
+    for(int i = 0; i < SLAB_BENCH_BATCH; ++i) kfree(objs[i]);
+    release += rdtsc() - mid;
+    alloc   += mid - start;
+  }
+  uint64_t ops = (uint64_t)SLAB_BENCH_BATCH * SLAB_BENCH_ROUNDS;
+  printf("kmalloc(64): %lu ns, kfree: %lu ns (fast path, %lu ops)\n",
+         cycles_to_ns(alloc) / ops,
+         cycles_to_ns(release) / ops,
+         ops);
+
+  // more live objects than a CPU keeps, every batch goes through the slabs
+  static void *many[4096];
+  uint64_t     start = rdtsc();
+  for(int round = 0; round < 16; ++round) {
+    for(int i = 0; i < 4096; ++i) many[i] = kmalloc(256);
+    for(int i = 0; i < 4096; ++i) kfree(many[i]);
+  }
+  printf("kmalloc(256)+kfree with slab refills: %lu ns per pair\n",
+         cycles_to_ns(rdtsc() - start) / (16 * 4096));
+}
+
+void slab_init(void) {
+  for(uint32_t i = 0; i < KMALLOC_CLASSES; ++i) {
+    size_t size = kmalloc_sizes[i];
+    // powers of two stay naturally aligned, up to a page
+    size_t align = size & (size - 1) ? 16 : size > PAGE_SIZE ? PAGE_SIZE : size;
+    kmalloc_caches[i] = kmem_cache_create(kmalloc_names[i], size, align, NULL);
+  }
+  debug_register("slabinfo", "object caches and their slabs", slabinfo_cmd);
+  debug_register("bench-slab", "kmalloc/kfree cost", bench_slab_cmd);
+}
@@ -0,0 +1,70 @@
+#ifndef _SLAB_H
+#define _SLAB_H
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/cpu.h>
+#include <sys/spinlock.h>
+
+/*
+object caches on top of the page allocator. every CPU keeps a small stack of
+free objects per cache, so the common alloc/free is a push or pop with
+interrupts off. below that, a cache's slabs with free objects sit on a
+partial list under the cache lock
+*/
+
+/* objects a CPU keeps per cache, half of it moves to or from slabs at once */
+#define SLAB_CPU_OBJECTS 32
+#define SLAB_BATCH       (SLAB_CPU_OBJECTS / 2)
+/* empty slabs kept around before giving pages back */
+#define SLAB_MIN_PARTIAL 2
+#define SLAB_MAX_CACHES  32
+/* kmalloc sizes above this come straight from the page allocator */
+#define KMALLOC_MAX_CACHE_SIZE 8192
+
+typedef struct kmem_cpu_cache {
+  uint32_t count;
+  void    *objects[SLAB_CPU_OBJECTS];
+  uint64_t allocs;
+  uint64_t frees;
+} __attribute__((aligned(CACHE_LINE))) kmem_cpu_cache_t;
+
+typedef struct kmem_cache {
+  const char *name;
+  /* object size as asked for, and the stride between objects */
+  uint32_t    object_size;
+  uint32_t    size;
+  /* where the free list link lives, after the object when there's a ctor */
+  uint32_t    offset;
+  uint32_t    order;
+  uint32_t    objects;
+  void (*ctor)(void *obj);
+  spinlock_t       lock;
+  struct page     *partial;
+  uint64_t         nr_partial;
+  uint64_t         nr_slabs;
+  kmem_cpu_cache_t cpu[MAX_CPUS];
+} kmem_cache_t;
+
+/**
+ * @brief set up the kmalloc caches. after pmm_init
+ */
+void slab_init(void);
+/**
+ * @brief a cache of `size` byte objects. `ctor`, if given, runs once per
+ * object when its slab is created, objects have to be freed in that state
+ *
+ * @return NULL when SLAB_MAX_CACHES are in use
+ */
+kmem_cache_t *kmem_cache_create(const char *name, size_t size, size_t align,
+                                void (*ctor)(void *));
+void         *kmem_cache_alloc(kmem_cache_t *cache);
+void          kmem_cache_free(kmem_cache_t *cache, void *obj);
+
+/**
+ * @brief general purpose allocation, 16 byte aligned (page aligned from a
+ * page up)
+ */
+void *kmalloc(size_t size);
+void *kzalloc(size_t size);
+void  kfree(void *ptr);
+#endif  // _SLAB_H
@@ -0,0 +1,112 @@
+#include "vmm.h"
+#include <mm/pmm.h>
+#include <stdlib.h>
+#include <sys/cpu.h>
+
+uint64_t hhdm_offset = 0;
+
+/*
+page tables needed before there is a physical allocator come out of this
+pool. it lives in the kernel image so it's always mapped. once pmm_init has
+run, tables come from there when it runs out
+*/
+#define EARLY_TABLES 64
+__attribute__((aligned(PAGE_SIZE))) static uint8_t
+  early_tables[EARLY_TABLES][PAGE_SIZE];
+static size_t early_tables_used = 0;
+
+#define PT_INDEX(virt, level) (((virt) >> (12 + 9 * ((level) - 1))) & 0x1ff)
+
+void vmm_init(uint64_t hhdm) {
+  hhdm_offset = hhdm;
+  kinfo("HHDM at 0x%016lX, cr3 0x%016lX\n", hhdm_offset, read_cr3());
+}
+
+uint64_t vmm_virt_to_phys(uint64_t virt) {
+  uint64_t *table = phys_to_virt(read_cr3() & PTE_ADDR_MASK);
+  for(int level = 4; level > 0; --level) {
+    uint64_t entry = table[PT_INDEX(virt, level)];
+    if(!(entry & PTE_PRESENT))
+      return 0;
+    if(level == 1 || (level < 4 && (entry & PTE_HUGE))) {
+      uint64_t page_mask = (1ull << (12 + 9 * (level - 1))) - 1;
+      return (entry & PTE_ADDR_MASK & ~page_mask) | (virt & page_mask);
+    }
+    table = phys_to_virt(entry & PTE_ADDR_MASK);
+  }
+  return 0;
+}
+
+static uint64_t alloc_table(void) {
+  if(early_tables_used >= EARLY_TABLES) {
+    if(mem_map == NULL)
+      kpanic("out of early page tables (%d)\n", EARLY_TABLES);
+    return pmm_alloc_zeroed_page();
+  }
+  uint8_t *table = early_tables[early_tables_used++];
+  memset(table, 0, PAGE_SIZE);
+  return vmm_virt_to_phys((uint64_t)table);
+}
+
+bool vmm_map_page(uint64_t virt, uint64_t phys, uint64_t flags) {
+  uint64_t *table = phys_to_virt(read_cr3() & PTE_ADDR_MASK);
+  for(int level = 4; level > 1; --level) {
+    uint64_t *entry = &table[PT_INDEX(virt, level)];
+    if(!(*entry & PTE_PRESENT)) {
+      uint64_t next = alloc_table();
+      if(next == 0)
+        return false;
+      // permissions are enforced at the leaf
+      *entry = next | PTE_PRESENT | PTE_WRITE;
+    } else if(*entry & PTE_HUGE) {
+      return true;
+    }
+    table = phys_to_virt(*entry & PTE_ADDR_MASK);
+  }
+  uint64_t *pte = &table[PT_INDEX(virt, 1)];
+  if(!(*pte & PTE_PRESENT)) {
+    *pte = (phys & PTE_ADDR_MASK) | flags | PTE_PRESENT;
+    invlpg(virt);
+  }
+  return true;
+}
+
+/* the leaf entry of a 4KiB mapping, NULL if there's none */
+static uint64_t *walk(uint64_t virt) {
+  uint64_t *table = phys_to_virt(read_cr3() & PTE_ADDR_MASK);
+  for(int level = 4; level > 1; --level) {
+    uint64_t entry = table[PT_INDEX(virt, level)];
+    if(!(entry & PTE_PRESENT) || (entry & PTE_HUGE))
+      return NULL;
+    table = phys_to_virt(entry & PTE_ADDR_MASK);
+  }
+  uint64_t *pte = &table[PT_INDEX(virt, 1)];
+  return (*pte & PTE_PRESENT) ? pte : NULL;
+}
+
+void vmm_unmap_page(uint64_t virt) {
+  uint64_t *pte = walk(virt);
+  if(pte == NULL)
+    return;
+  *pte = 0;
+  invlpg(virt);
+}
+
+bool vmm_protect_page(uint64_t virt, uint64_t flags) {
+  uint64_t *pte = walk(virt);
+  if(pte == NULL)
+    return false;
+  *pte = (*pte & PTE_ADDR_MASK) | flags | PTE_PRESENT;
+  invlpg(virt);
+  return true;
+}
+
+void *vmm_map_phys(uint64_t phys, size_t len, uint64_t flags) {
+  uint64_t start = PAGE_ALIGN_DOWN(phys);
+  uint64_t end   = PAGE_ALIGN_UP(phys + len);
+  for(uint64_t p = start; p < end; p += PAGE_SIZE) {
+    if(!vmm_map_page(p + hhdm_offset, p, flags))
+      return NULL;
+  }
+  return phys_to_virt(phys);
+}
@@ -0,0 +1,65 @@
+#ifndef _VMM_H
+#define _VMM_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define PAGE_SIZE  4096ull
+#define PAGE_SHIFT 12
+
+#define PTE_PRESENT   (1ull << 0)
+#define PTE_WRITE     (1ull << 1)
+#define PTE_USER      (1ull << 2)
+#define PTE_PWT       (1ull << 3)
+#define PTE_PCD       (1ull << 4)
+#define PTE_HUGE      (1ull << 7)
+#define PTE_GLOBAL    (1ull << 8)
+#define PTE_NX        (1ull << 63)
+#define PTE_ADDR_MASK 0x000ffffffffff000ull
+
+/* PCD | PWT selects PAT3 (UC) with the PAT layout limine sets up */
+#define PTE_MMIO (PTE_WRITE | PTE_PCD | PTE_PWT | PTE_NX)
+
+#define PAGE_ALIGN_DOWN(x) ((x) & ~(PAGE_SIZE - 1))
+#define PAGE_ALIGN_UP(x)   (((x) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1))
+
+extern uint64_t hhdm_offset;
+
+static inline void *phys_to_virt(uint64_t phys) {
+  return (void *)(phys + hhdm_offset);
+}
+
+void vmm_init(uint64_t hhdm);
+/**
+ * @brief translate a virtual address through the active page tables
+ *
+ * @return physical address, or 0 if `virt` is not mapped
+ */
+uint64_t vmm_virt_to_phys(uint64_t virt);
+/**
+ * @brief map a single 4KiB page, allocating intermediate tables as needed.
+ * already present mappings are left alone
+ */
+bool vmm_map_page(uint64_t virt, uint64_t phys, uint64_t flags);
+/**
+ * @brief make sure a physical range is reachable through the HHDM
+ *
+ * limine (base revision 3) only maps usable, bootloader and framebuffer
+ * memory into the HHDM, so ACPI tables and MMIO have to be mapped in
+ * before they can be touched.
+ *
+ * @return virtual address of `phys`
+ */
+void *vmm_map_phys(uint64_t phys, size_t len, uint64_t flags);
+/**
+ * @brief remove the 4KiB mapping of `virt`, if there is one. the page tables
+ * above it stay
+ */
+void  vmm_unmap_page(uint64_t virt);
+/**
+ * @brief replace the flags of the 4KiB mapping of `virt`
+ *
+ * @return false if it isn't mapped with a 4KiB page
+ */
+bool  vmm_protect_page(uint64_t virt, uint64_t flags);
+#endif  // _VMM_H
@@ -0,0 +1,61 @@
+#include "deque.h"
+
+#define MASK (DEQUE_SIZE - 1)
+
+void deque_init(deque_t *q) {
+  q->top    = 0;
+  q->bottom = 0;
+}
+
+bool deque_push(deque_t *q, void *item) {
+  int64_t b = __atomic_load_n(&q->bottom, __ATOMIC_RELAXED);
+  int64_t t = __atomic_load_n(&q->top, __ATOMIC_ACQUIRE);
+  if(b - t >= DEQUE_SIZE)
+    return false;
+  __atomic_store_n(&q->items[b & MASK], item, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  __atomic_store_n(&q->bottom, b + 1, __ATOMIC_RELAXED);
+  return true;
+}
+
+void *deque_pop(deque_t *q) {
+  int64_t b = __atomic_load_n(&q->bottom, __ATOMIC_RELAXED) - 1;
+  __atomic_store_n(&q->bottom, b, __ATOMIC_RELAXED);
+  // the bottom store has to be visible before we look at top, or a thief
+  // and we could both take the last item
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  int64_t t    = __atomic_load_n(&q->top, __ATOMIC_RELAXED);
+  void   *item = NULL;
+  if(t <= b) {
+    item = __atomic_load_n(&q->items[b & MASK], __ATOMIC_RELAXED);
+    if(t == b) {
+      // last one, race the thieves for it
+      if(!__atomic_compare_exchange_n(
+           &q->top, &t, t + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        item = NULL;
+      __atomic_store_n(&q->bottom, b + 1, __ATOMIC_RELAXED);
+    }
+  } else {
+    __atomic_store_n(&q->bottom, b + 1, __ATOMIC_RELAXED);
+  }
+  return item;
+}
+
+void *deque_steal(deque_t *q) {
+  int64_t t = __atomic_load_n(&q->top, __ATOMIC_ACQUIRE);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  int64_t b = __atomic_load_n(&q->bottom, __ATOMIC_ACQUIRE);
+  if(t >= b)
+    return NULL;
+  void *item = __atomic_load_n(&q->items[t & MASK], __ATOMIC_RELAXED);
+  if(!__atomic_compare_exchange_n(
+       &q->top, &t, t + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+    return DEQUE_ABORT;
+  return item;
+}
+
+uint64_t deque_size(deque_t *q) {
+  int64_t b = __atomic_load_n(&q->bottom, __ATOMIC_RELAXED);
+  int64_t t = __atomic_load_n(&q->top, __ATOMIC_RELAXED);
+  return b > t ? b - t : 0;
+}
@@ -0,0 +1,44 @@
+#ifndef _DEQUE_H
+#define _DEQUE_H
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/percpu.h>
+
+/*
+Chase-Lev work-stealing deque (with the C11 orderings from Le et al. 2013).
+one owner pushes and pops at the bottom, any number of thieves take from the
+top. the buffer is a fixed ring, a full deque refuses the push
+*/
+
+#define DEQUE_SIZE 1024
+static_assert((DEQUE_SIZE & (DEQUE_SIZE - 1)) == 0, "power of two");
+
+/* a steal that lost a race, worth retrying (unlike an empty deque) */
+#define DEQUE_ABORT ((void *)1)
+
+typedef struct deque {
+  volatile int64_t top;
+  /* thieves hammer top, keep the owner's end on its own line */
+  uint8_t          pad[CACHE_LINE - sizeof(int64_t)];
+  volatile int64_t bottom;
+  void *volatile   items[DEQUE_SIZE];
+} __attribute__((aligned(CACHE_LINE))) deque_t;
+
+void deque_init(deque_t *q);
+/**
+ * @brief owner only, with preemption off
+ *
+ * @return false when the deque is full
+ */
+bool  deque_push(deque_t *q, void *item);
+/**
+ * @brief owner only, with preemption off. NULL when empty
+ */
+void *deque_pop(deque_t *q);
+/**
+ * @brief any CPU. NULL when empty, DEQUE_ABORT when another thief or the
+ * owner won the last item
+ */
+void    *deque_steal(deque_t *q);
+uint64_t deque_size(deque_t *q);
+#endif  // _DEQUE_H
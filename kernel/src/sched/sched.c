@@ -0,0 +1,692 @@
+#include "sched.h"
+#include <sched/topology.h>
+#include <stdlib.h>
+#include <sys/cpu.h>
+#include <sys/debug.h>
+#include <sys/interrupts.h>
+#include <sys/preempt.h>
+#include <sys/rcu.h>
+#include <sys/smp.h>
+#include <sys/softirq.h>
+#include <sys/spinlock.h>
+#include <time/clockevent.h>
+#include <time/clocksource.h>
+
+typedef struct runqueue {
+  spinlock_t lock;
+  thread_t  *head;
+  thread_t  *tail;
+  uint32_t   nr_running;
+  uint64_t   steals;
+  /* last average vruntime seen, where threads land when the queue is empty */
+  uint64_t   vclock;
+} runqueue_t;
+
+typedef struct sched_lat {
+  /* lat_gen when this CPU last cleared it, see schedstat reset */
+  uint64_t gen;
+  uint64_t count;
+  uint64_t max_cycles;
+  uint64_t hist[SCHED_LAT_BUCKETS];
+} __attribute__((aligned(CACHE_LINE))) sched_lat_t;
+
+static runqueue_t runqueues[MAX_CPUS];
+/* the context each CPU booted on, which runs whenever nothing else can */
+static thread_t    idle_threads[MAX_CPUS];
+static sched_lat_t sched_lat[MAX_CPUS];
+/* bumped by schedstat reset, each CPU clears its own counters on seeing it */
+static uint64_t    lat_gen = 0;
+
+/* nice -20..19, each step is ~10% of CPU time against a nice 0 thread */
+static const uint32_t nice_weights[NICE_MAX - NICE_MIN + 1] = {
+  88761, 71755, 56483, 46273, 36291, 29154, 23254, 18705, 14949, 11916,
+  9548,  7620,  6100,  4904,  3906,  3121,  2501,  1991,  1586,  1277,
+  1024,  820,   655,   526,   423,   335,   272,   215,   172,   137,
+  110,   87,    70,    56,    45,    36,    29,    23,    18,    15,
+};
+
+static uint64_t base_slice = 0;
+
+extern thread_t *context_switch(thread_t *prev, thread_t *next);
+
+static void rq_push(runqueue_t *rq, thread_t *t) {
+  t->next = NULL;
+  if(rq->tail)
+    rq->tail->next = t;
+  else
+    rq->head = t;
+  rq->tail = t;
+  rq->nr_running++;
+}
+
+static void rq_remove(runqueue_t *rq, thread_t *t, thread_t *prev) {
+  if(prev)
+    prev->next = t->next;
+  else
+    rq->head = t->next;
+  if(rq->tail == t)
+    rq->tail = prev;
+  rq->nr_running--;
+}
+
+static uint64_t thread_slice(thread_t *t) {
+  return t->slice ? t->slice : base_slice;
+}
+
+/* real cycles to virtual time, which passes slower for heavier threads */
+static uint64_t to_virtual(thread_t *t, uint64_t cycles) {
+  return cycles * NICE_0_WEIGHT / t->weight;
+}
+
+static void set_deadline(thread_t *t) {
+  t->slice_used = 0;
+  t->deadline   = t->vruntime + to_virtual(t, thread_slice(t));
+}
+
+/* the thread running on the run queue's CPU, which counts towards its load */
+static thread_t *rq_curr(runqueue_t *rq) {
+  percpu_t *pc  = percpu_get(rq - runqueues);
+  thread_t *cur = pc->current;
+  if(cur == pc->idle || cur->state != THREAD_RUNNING)
+    return NULL;
+  return cur;
+}
+
+/* V, the weighted average vruntime of the queued threads and `curr`. a thread
+ * whose vruntime is at or before it has received no more than its share */
+static uint64_t avg_vruntime(runqueue_t *rq, thread_t *curr) {
+  uint64_t base = curr ? curr->vruntime : UINT64_MAX;
+  for(thread_t *t = rq->head; t; t = t->next) {
+    if(t->vruntime < base)
+      base = t->vruntime;
+  }
+  if(base == UINT64_MAX)
+    return rq->vclock;
+  // relative to the smallest so the weighted sum stays small
+  uint64_t sum  = 0;
+  uint64_t load = 0;
+  for(thread_t *t = rq->head; t; t = t->next) {
+    sum  += (t->vruntime - base) * t->weight;
+    load += t->weight;
+  }
+  if(curr) {
+    sum  += (curr->vruntime - base) * curr->weight;
+    load += curr->weight;
+  }
+  uint64_t v = base + sum / load;
+  if((int64_t)(v - rq->vclock) > 0)
+    rq->vclock = v;
+  return v;
+}
+
+/* lag is bounded by a slice, so a thread can't bank service by sleeping */
+static int64_t clamp_lag(thread_t *t, int64_t lag) {
+  int64_t limit = to_virtual(t, thread_slice(t));
+  if(lag > limit)
+    return limit;
+  if(lag < -limit)
+    return -limit;
+  return lag;
+}
+
+/* put a thread on the queue with the lag it left with. call with the lock */
+static void place_thread(runqueue_t *rq, thread_t *t) {
+  uint64_t v  = avg_vruntime(rq, rq_curr(rq));
+  t->vruntime = v - clamp_lag(t, t->vlag);
+  t->vlag     = 0;
+  set_deadline(t);
+  rq_push(rq, t);
+}
+
+/* remember how far from the average the thread was as it leaves the queue */
+static void save_lag(runqueue_t *rq, thread_t *t, thread_t *curr) {
+  t->vlag = clamp_lag(t, avg_vruntime(rq, curr) - t->vruntime);
+}
+
+/* the eligible thread with the earliest deadline, or NULL */
+static thread_t *pick_eevdf(runqueue_t *rq) {
+  uint64_t  v          = avg_vruntime(rq, NULL);
+  thread_t *best       = NULL;
+  thread_t *best_prev  = NULL;
+  thread_t *first      = NULL;
+  thread_t *first_prev = NULL;
+  for(thread_t *t = rq->head, *prev = NULL; t; prev = t, t = t->next) {
+    if(first == NULL || (int64_t)(t->vruntime - first->vruntime) < 0) {
+      first      = t;
+      first_prev = prev;
+    }
+    if((int64_t)(t->vruntime - v) > 0)
+      continue;
+    if(best == NULL || (int64_t)(t->deadline - best->deadline) < 0) {
+      best      = t;
+      best_prev = prev;
+    }
+  }
+  // rounding in the average can leave nothing eligible, take the one that's
+  // furthest behind then
+  if(best == NULL) {
+    best      = first;
+    best_prev = first_prev;
+  }
+  if(best)
+    rq_remove(rq, best, best_prev);
+  return best;
+}
+
+/* charge the running thread for the time since it was last accounted */
+static void update_curr(thread_t *cur) {
+  uint64_t now    = rdtsc();
+  uint64_t delta  = now - cur->exec_start;
+  cur->exec_start = now;
+  cur->runtime    += delta;
+  cur->slice_used += delta;
+  cur->vruntime   += to_virtual(cur, delta);
+}
+
+/* the only timer interrupt a CPU gets is the end of its current slice, an
+ * idle one gets none */
+static void arm_slice(thread_t *t) {
+  if(t == this_cpu_read(idle)) {
+    clockevent_cancel(CLOCKEVENT_SCHED);
+    return;
+  }
+  uint64_t slice = thread_slice(t);
+  uint64_t left  = t->slice_used < slice ? slice - t->slice_used : 0;
+  clockevent_program(CLOCKEVENT_SCHED, rdtsc() + left);
+}
+
+static void record_latency(uint32_t cpu, uint64_t cycles) {
+  sched_lat_t *lat = &sched_lat[cpu];
+  uint64_t     gen = __atomic_load_n(&lat_gen, __ATOMIC_RELAXED);
+  if(lat->gen != gen) {
+    memset(lat, 0, sizeof(*lat));
+    lat->gen = gen;
+  }
+  uint32_t b = cycles ? 63 - __builtin_clzll(cycles) : 0;
+  if(b >= SCHED_LAT_BUCKETS)
+    b = SCHED_LAT_BUCKETS - 1;
+  lat->hist[b]++;
+  lat->count++;
+  if(cycles > lat->max_cycles)
+    lat->max_cycles = cycles;
+}
+
+static bool cpu_is_idle(uint32_t cpu) {
+  percpu_t *pc = percpu_get(cpu);
+  return pc->current == pc->idle;
+}
+
+/* an idle CPU picks up new work right away. a busy one preempts its current
+ * thread if `t` is due first, otherwise it only gets to it at the end of the
+ * slice, so nudge the nearest idle CPU to come and steal it */
+static void resched_cpu(uint32_t cpu, thread_t *t) {
+  if(!cpu_is_idle(cpu)) {
+    // whatever it's running can exit and be freed under us
+    rcu_read_lock();
+    thread_t *cur   = rcu_dereference(percpu_get(cpu)->current);
+    bool      first = (int64_t)(t->deadline - cur->deadline) < 0;
+    rcu_read_unlock();
+    if(first) {
+      percpu_get(cpu)->need_resched = true;
+      if(cpu != cpu_index())
+        smp_kick(cpu);
+      return;
+    }
+    if(t->pinned)
+      return;
+    uint32_t       count;
+    const uint8_t *order = topology_steal_order(cpu, &count);
+    for(uint32_t i = 0; i < count; ++i) {
+      if(cpu_is_idle(order[i])) {
+        smp_kick(order[i]);
+        return;
+      }
+    }
+    return;
+  }
+  percpu_get(cpu)->need_resched = true;
+  if(cpu != cpu_index())
+    smp_kick(cpu);
+}
+
+/* lock the run queue `t` is on, which can change while we wait for it */
+static runqueue_t *lock_thread_rq(thread_t *t, uint64_t *flags) {
+  for(;;) {
+    uint32_t    cpu = __atomic_load_n(&t->cpu, __ATOMIC_ACQUIRE);
+    runqueue_t *rq  = &runqueues[cpu];
+    *flags          = spin_lock_irqsave(&rq->lock);
+    if(t->cpu == cpu)
+      return rq;
+    spin_unlock_irqrestore(&rq->lock, *flags);
+  }
+}
+
+void sched_enqueue(thread_t *t) {
+  runqueue_t *rq    = &runqueues[t->cpu];
+  uint64_t    flags = spin_lock_irqsave(&rq->lock);
+  t->state          = THREAD_RUNNABLE;
+  place_thread(rq, t);
+  spin_unlock_irqrestore(&rq->lock, flags);
+  resched_cpu(t->cpu, t);
+}
+
+bool sched_steal(void) {
+  uint32_t       self = cpu_index();
+  uint32_t       count;
+  const uint8_t *order = topology_steal_order(self, &count);
+  for(uint32_t i = 0; i < count; ++i) {
+    runqueue_t *rq = &runqueues[order[i]];
+    if(rq->nr_running == 0)
+      continue;
+    uint64_t  flags = spin_lock_irqsave(&rq->lock);
+    thread_t *prev  = NULL;
+    thread_t *t     = rq->head;
+    // a thread still switching out on its CPU can't move yet
+    while(t && (t->pinned || t->on_cpu)) {
+      prev = t;
+      t    = t->next;
+    }
+    if(t) {
+      rq_remove(rq, t, prev);
+      // its lag carries over, vruntimes on different CPUs don't compare
+      save_lag(rq, t, rq_curr(rq));
+      __atomic_store_n(&t->cpu, self, __ATOMIC_RELEASE);
+    }
+    spin_unlock_irqrestore(&rq->lock, flags);
+    if(t) {
+      runqueues[self].steals++;
+      sched_enqueue(t);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool sched_has_work(void) {
+  return runqueues[cpu_index()].head != NULL;
+}
+
+static void finish_switch(thread_t *prev) {
+  __atomic_store_n(&prev->on_cpu, false, __ATOMIC_RELEASE);
+  // it can't be running on its own stack any more
+  if(prev->state == THREAD_DEAD)
+    thread_free(prev);
+}
+
+void schedule(void) {
+  uint64_t    flags = irq_save();
+  percpu_t   *pc    = this_cpu_ptr();
+  thread_t   *prev  = pc->current;
+  runqueue_t *rq    = &runqueues[pc->index];
+  pc->need_resched  = false;
+
+  spin_lock(&rq->lock);
+  update_curr(prev);
+  if(prev != pc->idle) {
+    if(prev->state == THREAD_RUNNING) {
+      if(prev->slice_used >= thread_slice(prev))
+        set_deadline(prev);
+      prev->state = THREAD_RUNNABLE;
+      rq_push(rq, prev);
+    } else if(prev->state == THREAD_BLOCKED) {
+      save_lag(rq, prev, prev);
+    }
+  }
+  thread_t *next = pick_eevdf(rq);
+  if(next == NULL)
+    next = pc->idle;
+  next->state = THREAD_RUNNING;
+  spin_unlock(&rq->lock);
+  arm_slice(next);
+
+  if(next != prev) {
+    // nobody switches while holding locks or RCU references
+    rcu_quiescent_state();
+    uint64_t now     = rdtsc();
+    next->exec_start = now;
+    if(next->woken_at) {
+      record_latency(pc->index, now - next->woken_at);
+      next->woken_at = 0;
+    }
+    next->switches++;
+    next->cpu    = pc->index;
+    next->on_cpu = true;
+    pc->current  = next;
+    prev         = context_switch(prev, next);
+    finish_switch(prev);
+  }
+  irq_restore(flags);
+}
+
+/* first thing a new thread runs, from thread_entry_stub */
+[[noreturn]] void thread_start(thread_t *prev, thread_fn_t fn, void *arg) {
+  finish_switch(prev);
+  interrupts_enable();
+  fn(arg);
+  thread_exit();
+}
+
+void thread_yield(void) {
+  schedule();
+}
+
+void thread_park(void) {
+  uint64_t    flags = irq_save();
+  thread_t   *self  = this_cpu_read(current);
+  runqueue_t *rq    = &runqueues[self->cpu];
+  spin_lock(&rq->lock);
+  if(self->park_token) {
+    self->park_token = false;
+    spin_unlock(&rq->lock);
+    irq_restore(flags);
+    return;
+  }
+  self->state = THREAD_BLOCKED;
+  spin_unlock(&rq->lock);
+  schedule();
+  irq_restore(flags);
+}
+
+void thread_unpark(thread_t *t) {
+  uint64_t    flags;
+  runqueue_t *rq    = lock_thread_rq(t, &flags);
+  bool        woken = t->state == THREAD_BLOCKED;
+  if(woken) {
+    t->state    = THREAD_RUNNABLE;
+    t->woken_at = rdtsc();
+    place_thread(rq, t);
+  } else {
+    t->park_token = true;
+  }
+  spin_unlock_irqrestore(&rq->lock, flags);
+  if(woken)
+    resched_cpu(t->cpu, t);
+}
+
+void preempt_schedule(void) {
+  uint64_t flags = irq_save();
+  if((flags & RFLAGS_IF) && !in_interrupt() && this_cpu_read(current))
+    schedule();
+  irq_restore(flags);
+}
+
+void preempt_irq_return(uint64_t vector) {
+  // exceptions and NMIs can hit anywhere, and an IST stack would be reused
+  // by the next interrupt on it. an IRQ only arrives with interrupts on, what
+  // the interrupted code holds shows in preempt_count
+  if(vector < EXCEPTION_COUNT || get_idt_ist(vector))
+    return;
+  if(this_cpu_read(need_resched) && this_cpu_read(preempt_count) == 0 &&
+     !in_interrupt())
+    schedule();
+}
+
+/* the clockevent for the end of a slice */
+static void sched_tick(void) {
+  percpu_t *pc = this_cpu_ptr();
+  // preemption was on and nothing but this timer is running on top of the
+  // interrupted code, so it can't be inside an RCU read-side section
+  if(pc->preempt_count == 0 && pc->irq_nesting == 1 && !pc->in_softirq)
+    rcu_quiescent_state();
+  thread_t   *cur = pc->current;
+  runqueue_t *rq  = &runqueues[pc->index];
+  if(cur == pc->idle) {
+    if(rq->head)
+      pc->need_resched = true;
+    return;
+  }
+  // thread_set_nice may be moving `cur` from another CPU
+  spin_lock(&rq->lock);
+  update_curr(cur);
+  if(cur->slice_used < thread_slice(cur)) {
+    spin_unlock(&rq->lock);
+    arm_slice(cur);
+    return;
+  }
+  // out of slice: let schedule() pick again (and arm the next one), or just
+  // start a new one if there's nobody else. a busy CPU keeps getting these
+  // even alone, they're what reports its RCU quiescent states
+  if(rq->nr_running > 0) {
+    pc->need_resched = true;
+  } else {
+    set_deadline(cur);
+    arm_slice(cur);
+  }
+  spin_unlock(&rq->lock);
+}
+
+/*
+a new weight changes how fast virtual time passes for `t`. it keeps the lag
+it had and the rest of its slice in real time: a queued thread is taken off
+and placed again like a wakeup, a running one is moved relative to the
+others in place, and the queue's average is recomputed from the weights on
+the next look
+*/
+void thread_set_nice(thread_t *t, int32_t nice) {
+  if(nice < NICE_MIN)
+    nice = NICE_MIN;
+  if(nice > NICE_MAX)
+    nice = NICE_MAX;
+  uint64_t    flags;
+  runqueue_t *rq     = lock_thread_rq(t, &flags);
+  uint32_t    weight = nice_weights[nice - NICE_MIN];
+  thread_t   *curr   = rq_curr(rq);
+  thread_t   *prev   = NULL;
+  thread_t   *queued = rq->head;
+  while(queued && queued != t) {
+    prev   = queued;
+    queued = queued->next;
+  }
+  t->nice = nice;
+  if(queued == NULL && t != curr) {
+    // blocked or moving between CPUs, only the saved lag needs scaling
+    t->vlag   = t->vlag * (int64_t)t->weight / weight;
+    t->weight = weight;
+    spin_unlock_irqrestore(&rq->lock, flags);
+    return;
+  }
+  // a remote running thread's last stretch is charged at the new weight
+  if(t == curr && t->cpu == cpu_index())
+    update_curr(t);
+  int64_t left = (int64_t)(t->deadline - t->vruntime);
+  save_lag(rq, t, curr);
+  t->vlag   = t->vlag * (int64_t)t->weight / weight;
+  left      = left * (int64_t)t->weight / weight;
+  t->weight = weight;
+  if(queued) {
+    rq_remove(rq, t, prev);
+    place_thread(rq, t);
+  } else {
+    // alone on the CPU there's nobody to lag behind
+    if(rq->head)
+      t->vruntime = avg_vruntime(rq, NULL) - clamp_lag(t, t->vlag);
+    t->vlag     = 0;
+    t->deadline = t->vruntime + left;
+  }
+  spin_unlock_irqrestore(&rq->lock, flags);
+}
+
+void thread_set_latency_hint(thread_t *t, uint32_t slice_us) {
+  if(slice_us != 0 && slice_us < SCHED_MIN_SLICE_US)
+    slice_us = SCHED_MIN_SLICE_US;
+  if(slice_us > SCHED_BASE_SLICE_US)
+    slice_us = SCHED_BASE_SLICE_US;
+  uint64_t    flags;
+  runqueue_t *rq = lock_thread_rq(t, &flags);
+  t->slice       = ns_to_cycles(slice_us * NSEC_PER_USEC);
+  spin_unlock_irqrestore(&rq->lock, flags);
+}
+
+/* softirq work that didn't fit in the budget of an interrupt exit */
+static void ksoftirqd(void *arg) {
+  (void)arg;
+  for(;;) {
+    while(softirq_pending()) {
+      do_softirq();
+      thread_yield();
+    }
+    thread_park();
+  }
+}
+
+void sched_init_cpu(uint32_t cpu) {
+  thread_t *idle = &idle_threads[cpu];
+  idle->tid         = 0;
+  idle->name        = "idle";
+  idle->state       = THREAD_RUNNING;
+  idle->cpu         = cpu;
+  idle->pinned      = true;
+  idle->on_cpu      = true;
+  idle->weight      = NICE_0_WEIGHT;
+  idle->exec_start  = rdtsc();
+  spin_init(&runqueues[cpu].lock);
+  this_cpu_write(idle, idle);
+  this_cpu_write(current, idle);
+  this_cpu_write(ksoftirqd, thread_create_on(cpu, "ksoftirqd", ksoftirqd, NULL));
+}
+
+#define PINGPONG_ROUNDS 100000
+
+static struct {
+  thread_t *ping;
+  thread_t *waiter;
+  uint64_t  cycles;
+} pingpong;
+
+/* `arg` is pong. ping publishes itself before pong can first need it, it may
+ * run before thread_create_on has returned it to run_pingpong */
+static void ping(void *arg) {
+  thread_t *peer = arg;
+  pingpong.ping  = thread_current();
+  uint64_t start = rdtsc();
+  for(int i = 0; i < PINGPONG_ROUNDS; ++i) {
+    thread_unpark(peer);
+    thread_park();
+  }
+  pingpong.cycles = rdtsc() - start;
+  thread_unpark(pingpong.waiter);
+}
+
+static void pong(void *arg) {
+  (void)arg;
+  for(int i = 0; i < PINGPONG_ROUNDS; ++i) {
+    thread_park();
+    thread_unpark(pingpong.ping);
+  }
+}
+
+/* cycles per round trip between a thread on `a` and one on `b` */
+static uint64_t run_pingpong(uint32_t a, uint32_t b) {
+  pingpong.waiter = thread_current();
+  thread_t *peer  = thread_create_on(b, "pong", pong, NULL);
+  if(peer == NULL || thread_create_on(a, "ping", ping, peer) == NULL)
+    return 0;
+  thread_park();
+  return pingpong.cycles / PINGPONG_ROUNDS;
+}
+
+static void bench_ctxsw(void *arg) {
+  (void)arg;
+  uint32_t cpu   = cpu_index();
+  uint64_t round = run_pingpong(cpu, cpu);
+  // one round trip is two switches, each with a park and an unpark
+  printf("same cpu: %lu cycles per context switch (park/unpark ping-pong)\n",
+         round / 2);
+  if(cpu_count() > 1) {
+    uint32_t other = cpu == 0 ? 1 : 0;
+    printf("cpu %u <-> cpu %u: %lu cycles per round trip wakeup\n",
+           cpu,
+           other,
+           run_pingpong(cpu, other));
+  }
+}
+
+static void bench_ctxsw_cmd(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+  // debug commands run in softirq context, which can't block
+  thread_create("bench-ctxsw", bench_ctxsw, NULL);
+}
+
+static void threads_cmd(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+  for(uint32_t c = 0; c < cpu_count(); ++c) {
+    printf("cpu %u: %u queued, %lu stolen, idle for %lu cycles\n",
+           c,
+           runqueues[c].nr_running,
+           runqueues[c].steals,
+           idle_threads[c].runtime);
+  }
+  thread_dump();
+}
+
+/* smallest latency that at least `permille` of the wakeups were served in,
+ * rounded up to the end of its bucket */
+static uint64_t lat_percentile(const uint64_t *hist, uint64_t count,
+                               uint64_t max, uint32_t permille) {
+  uint64_t want = (count * permille + 999) / 1000;
+  uint64_t seen = 0;
+  for(uint32_t b = 0; b < SCHED_LAT_BUCKETS; ++b) {
+    seen += hist[b];
+    if(seen >= want) {
+      uint64_t upper = (2ull << b) - 1;
+      return upper < max ? upper : max;
+    }
+  }
+  return max;
+}
+
+static void schedstat_cmd(int argc, char **argv) {
+  if(argc > 1 && strcmp(argv[1], "reset") == 0) {
+    // the counters belong to their CPUs, which clear them on the next wakeup
+    __atomic_add_fetch(&lat_gen, 1, __ATOMIC_RELAXED);
+    return;
+  }
+  uint64_t gen = __atomic_load_n(&lat_gen, __ATOMIC_RELAXED);
+  uint64_t hist[SCHED_LAT_BUCKETS] = { 0 };
+  uint64_t count                   = 0;
+  uint64_t max                     = 0;
+  for(uint32_t c = 0; c < cpu_count(); ++c) {
+    // no wakeups since the last reset
+    if(sched_lat[c].gen != gen) {
+      printf("cpu %u: 0 wakeups\n", c);
+      continue;
+    }
+    for(uint32_t b = 0; b < SCHED_LAT_BUCKETS; ++b)
+      hist[b] += sched_lat[c].hist[b];
+    count += sched_lat[c].count;
+    if(sched_lat[c].max_cycles > max)
+      max = sched_lat[c].max_cycles;
+    printf("cpu %u: %lu wakeups, max %lu cycles\n",
+           c,
+           sched_lat[c].count,
+           sched_lat[c].max_cycles);
+  }
+  if(count == 0)
+    return;
+  static const uint32_t  permille[] = { 500, 900, 990, 999 };
+  static const char     *names[]    = { "p50", "p90", "p99", "p99.9" };
+  for(uint32_t i = 0; i < 4; ++i) {
+    uint64_t cycles = lat_percentile(hist, count, max, permille[i]);
+    printf("%-5s <= %lu cycles (%lu us)\n",
+           names[i],
+           cycles,
+           cycles_to_ns(cycles) / NSEC_PER_USEC);
+  }
+  printf("max   %lu cycles (%lu us)\n",
+         max,
+         cycles_to_ns(max) / NSEC_PER_USEC);
+}
+
+void sched_init(void) {
+  base_slice = ns_to_cycles(SCHED_BASE_SLICE_US * NSEC_PER_USEC);
+  clockevent_set_handler(CLOCKEVENT_SCHED, sched_tick);
+  sched_init_cpu(0);
+  debug_register("threads", "list threads and run queues", threads_cmd);
+  debug_register(
+    "bench-ctxsw", "context switch cost, thread ping-pong", bench_ctxsw_cmd);
+  debug_register("schedstat",
+                 "wakeup to run latency percentiles, `reset` clears them",
+                 schedstat_cmd);
+}
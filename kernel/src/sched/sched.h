@@ -0,0 +1,51 @@
+#ifndef _SCHED_H
+#define _SCHED_H
+#include <sched/thread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* slice a thread gets unless it asks for a shorter one */
+#define SCHED_BASE_SLICE_US 3000
+/* shortest slice a latency hint can ask for */
+#define SCHED_MIN_SLICE_US 100
+
+#define NICE_MIN      (-20)
+#define NICE_MAX      19
+#define NICE_0_WEIGHT 1024
+
+/* bucket n counts wakeups that waited [2^n, 2^(n+1)) TSC cycles to run */
+#define SCHED_LAT_BUCKETS 40
+
+/**
+ * @brief turn the BSP's boot context into its idle thread. after
+ * clockevent_init
+ */
+void sched_init(void);
+/**
+ * @brief same for an AP, which also gets its own ksoftirqd
+ */
+void sched_init_cpu(uint32_t cpu);
+/**
+ * @brief pick the eligible thread with the earliest virtual deadline on this
+ * CPU's run queue and switch to it
+ */
+void schedule(void);
+/**
+ * @brief queue a runnable thread on its CPU, kicking it if it's another one
+ */
+void sched_enqueue(thread_t *t);
+bool sched_has_work(void);
+/**
+ * @brief move one queued, unpinned thread from the nearest busy CPU to this
+ * one. called when the CPU is about to go idle
+ *
+ * @return whether there's something to run now
+ */
+bool sched_steal(void);
+/**
+ * @brief called by both interrupt stubs just before iretq, switches away if the
+ * end of a slice (or a wakeup) asked for it, the interrupted code holds no
+ * lock and the IRQ isn't on an IST stack
+ */
+void preempt_irq_return(uint64_t vector);
+#endif  // _SCHED_H
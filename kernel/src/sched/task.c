@@ -0,0 +1,182 @@
+#include "task.h"
+#include <sched/deque.h>
+#include <sched/thread.h>
+#include <sched/topology.h>
+#include <stdlib.h>
+#include <sys/cpu.h>
+#include <sys/debug.h>
+#include <sys/preempt.h>
+#include <sys/softirq.h>
+
+static deque_t   deques[MAX_CPUS];
+static thread_t *workers[MAX_CPUS] = { 0 };
+/* workers that found nothing to do and parked (or are about to) */
+static volatile uint64_t idle_workers = 0;
+/* only CPUs below this take part, so the benchmark can vary it */
+static volatile uint32_t active_cpus  = MAX_CPUS;
+
+static bool is_active(uint32_t cpu) {
+  return cpu < __atomic_load_n(&active_cpus, __ATOMIC_RELAXED);
+}
+
+static void task_run(task_t *t) {
+  task_group_t *group = t->group;
+  t->fn(t->arg);
+  __atomic_fetch_sub(&group->pending, 1, __ATOMIC_RELEASE);
+}
+
+/* the deque has a single owner, so the CPU can't change under us */
+static task_t *pop_local(void) {
+  task_t *t = NULL;
+  preempt_disable();
+  uint32_t cpu = cpu_index();
+  if(is_active(cpu))
+    t = deque_pop(&deques[cpu]);
+  preempt_enable();
+  return t;
+}
+
+static task_t *steal(void) {
+  uint32_t       count;
+  const uint8_t *order = topology_steal_order(cpu_index(), &count);
+  for(uint32_t i = 0; i < count; ++i) {
+    if(!is_active(order[i]))
+      continue;
+    void *t;
+    do t = deque_steal(&deques[order[i]]);
+    while(t == DEQUE_ABORT);
+    if(t)
+      return t;
+  }
+  return NULL;
+}
+
+static task_t *task_find(void) {
+  task_t *t = pop_local();
+  return t ? t : steal();
+}
+
+static void wake_worker(void) {
+  uint64_t mask = __atomic_load_n(&idle_workers, __ATOMIC_SEQ_CST);
+  while(mask) {
+    uint32_t cpu = __builtin_ctzll(mask);
+    uint64_t bit = 1ull << cpu;
+    mask &= mask - 1;
+    if(!is_active(cpu))
+      continue;
+    // whoever clears the bit owns the wakeup
+    if(__atomic_fetch_and(&idle_workers, ~bit, __ATOMIC_SEQ_CST) & bit) {
+      thread_unpark(workers[cpu]);
+      return;
+    }
+  }
+}
+
+void task_spawn(task_group_t *group, task_t *t, task_fn_t fn, void *arg) {
+  assert(!in_interrupt());
+  t->fn    = fn;
+  t->arg   = arg;
+  t->group = group;
+  __atomic_fetch_add(&group->pending, 1, __ATOMIC_RELAXED);
+  preempt_disable();
+  uint32_t cpu    = cpu_index();
+  bool     queued = is_active(cpu) && deque_push(&deques[cpu], t);
+  preempt_enable();
+  if(!queued) {
+    task_run(t);
+    return;
+  }
+  wake_worker();
+}
+
+void task_wait(task_group_t *group) {
+  while(__atomic_load_n(&group->pending, __ATOMIC_ACQUIRE)) {
+    task_t *t = task_find();
+    if(t)
+      task_run(t);
+    else
+      cpu_relax();
+  }
+}
+
+static void worker(void *arg) {
+  uint32_t cpu = (uint64_t)arg;
+  uint64_t bit = 1ull << cpu;
+  for(;;) {
+    task_t *t = is_active(cpu) ? task_find() : NULL;
+    if(t) {
+      task_run(t);
+      continue;
+    }
+    __atomic_fetch_or(&idle_workers, bit, __ATOMIC_SEQ_CST);
+    // a spawn between the search and the mask update didn't see us
+    t = is_active(cpu) ? task_find() : NULL;
+    if(t) {
+      __atomic_fetch_and(&idle_workers, ~bit, __ATOMIC_SEQ_CST);
+      task_run(t);
+      continue;
+    }
+    thread_park();
+    __atomic_fetch_and(&idle_workers, ~bit, __ATOMIC_SEQ_CST);
+  }
+}
+
+void task_init_cpu(uint32_t cpu) {
+  deque_init(&deques[cpu]);
+  workers[cpu] =
+    thread_create_on(cpu, "kworker", worker, (void *)(uint64_t)cpu);
+}
+
+#define BENCH_TASKS       16384
+#define BENCH_TASK_CYCLES 10000
+
+static task_t bench_tasks[BENCH_TASKS];
+
+static void bench_leaf(void *arg) {
+  (void)arg;
+  uint64_t end = rdtsc() + BENCH_TASK_CYCLES;
+  while(rdtsc() < end) cpu_relax();
+}
+
+static uint64_t bench_run(uint32_t cpus) {
+  __atomic_store_n(&active_cpus, cpus, __ATOMIC_SEQ_CST);
+  task_group_t group = TASK_GROUP_INIT;
+  uint64_t     start = rdtsc();
+  for(int i = 0; i < BENCH_TASKS; ++i)
+    task_spawn(&group, &bench_tasks[i], bench_leaf, NULL);
+  task_wait(&group);
+  return rdtsc() - start;
+}
+
+static void bench_forkjoin(void *arg) {
+  (void)arg;
+  uint32_t n    = cpu_count();
+  uint64_t base = 0;
+  printf("%u tasks of %u cycles each\n", BENCH_TASKS, BENCH_TASK_CYCLES);
+  for(uint32_t cpus = 1; cpus <= n; ++cpus) {
+    uint64_t cycles = bench_run(cpus);
+    if(cpus == 1)
+      base = cycles;
+    uint64_t speedup = base * 100 / cycles;
+    printf("%2u cpus: %lu cycles, %lu.%02lux\n",
+           cpus,
+           cycles,
+           speedup / 100,
+           speedup % 100);
+  }
+  __atomic_store_n(&active_cpus, MAX_CPUS, __ATOMIC_SEQ_CST);
+}
+
+static void bench_forkjoin_cmd(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+  // spawning from cpu 0 keeps every run's producer in the same place
+  thread_create_on(0, "bench-forkjoin", bench_forkjoin, NULL);
+}
+
+void task_init(void) {
+  task_init_cpu(0);
+  debug_register("bench-forkjoin",
+                 "fork/join scaling over 1..N cpus",
+                 bench_forkjoin_cmd);
+}
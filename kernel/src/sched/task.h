@@ -0,0 +1,41 @@
+#ifndef _TASK_H
+#define _TASK_H
+#include <stdint.h>
+
+/*
+fork/join pool for short tasks. every CPU has a worker thread and a
+work-stealing deque: spawned tasks go on the spawning CPU's deque, its worker
+runs them newest first while idle workers steal the oldest, nearest CPUs
+first. tasks run in thread context and may spawn and wait themselves
+*/
+
+typedef void (*task_fn_t)(void *arg);
+
+typedef struct task_group {
+  volatile uint32_t pending;
+} task_group_t;
+
+#define TASK_GROUP_INIT { .pending = 0 }
+
+/* owned by the caller until the group's task_wait returns */
+typedef struct task {
+  task_fn_t     fn;
+  void         *arg;
+  task_group_t *group;
+} task_t;
+
+void task_init(void);
+/**
+ * @brief start the worker of `cpu`, on that CPU
+ */
+void task_init_cpu(uint32_t cpu);
+/**
+ * @brief queue `fn(arg)` as part of `group`, `t` is the storage for it. runs
+ * it right away if the local deque is full. not from interrupt context
+ */
+void task_spawn(task_group_t *group, task_t *t, task_fn_t fn, void *arg);
+/**
+ * @brief run and steal tasks until everything in `group` has finished
+ */
+void task_wait(task_group_t *group);
+#endif  // _TASK_H
@@ -0,0 +1,130 @@
+#include "thread.h"
+#include <sched/sched.h>
+#include <stdlib.h>
+#include <sys/cpu.h>
+#include <sys/spinlock.h>
+
+extern void thread_entry_stub(void);
+
+static thread_t threads[THREAD_MAX] = { 0 };
+__attribute__((aligned(16))) static uint8_t
+  thread_stacks[THREAD_MAX][THREAD_STACK_SIZE];
+static thread_t *free_threads = NULL;
+static bool      pool_ready   = false;
+static spinlock_t pool_lock   = SPINLOCK_INIT;
+static uint32_t   next_tid    = 1;
+
+static thread_t *thread_alloc(void) {
+  uint64_t flags = spin_lock_irqsave(&pool_lock);
+  if(!pool_ready) {
+    for(int i = THREAD_MAX - 1; i >= 0; --i) {
+      threads[i].state = THREAD_DEAD;
+      threads[i].stack = thread_stacks[i];
+      threads[i].next  = free_threads;
+      free_threads     = &threads[i];
+    }
+    pool_ready = true;
+  }
+  thread_t *t = free_threads;
+  if(t)
+    free_threads = t->next;
+  spin_unlock_irqrestore(&pool_lock, flags);
+  return t;
+}
+
+static void thread_release(rcu_head_t *head) {
+  thread_t *t     = (thread_t *)((uint8_t *)head - offsetof(thread_t, rcu));
+  uint64_t  flags = spin_lock_irqsave(&pool_lock);
+  t->next         = free_threads;
+  free_threads    = t;
+  spin_unlock_irqrestore(&pool_lock, flags);
+}
+
+void thread_free(thread_t *t) {
+  t->state = THREAD_DEAD;
+  call_rcu(&t->rcu, thread_release);
+}
+
+static thread_t *spawn(uint32_t cpu, bool pinned, const char *name,
+                       thread_fn_t fn, void *arg) {
+  thread_t *t = thread_alloc();
+  if(t == NULL) {
+    kwarn("out of threads, can't start '%s'\n", name);
+    return NULL;
+  }
+  // the frame context_switch pops: r15, r14, r13, r12, rbp, rbx and the
+  // return address, which leaves rsp 16 byte aligned in thread_entry_stub
+  uint64_t *top = (uint64_t *)&t->stack[THREAD_STACK_SIZE];
+  top[-1]       = (uint64_t)thread_entry_stub;
+  top[-2]       = 0;              // rbx
+  top[-3]       = 0;              // rbp
+  top[-4]       = (uint64_t)fn;   // r12
+  top[-5]       = (uint64_t)arg;  // r13
+  top[-6]       = 0;              // r14
+  top[-7]       = 0;              // r15
+  t->rsp        = (uint64_t)&top[-7];
+
+  t->tid        = __atomic_fetch_add(&next_tid, 1, __ATOMIC_RELAXED);
+  t->name       = name;
+  t->cpu        = cpu;
+  t->pinned     = pinned;
+  t->on_cpu     = false;
+  t->park_token = false;
+  t->nice       = 0;
+  t->weight     = NICE_0_WEIGHT;
+  t->slice      = 0;
+  t->vlag       = 0;
+  // spawn to first run isn't a wakeup, keep it out of the histogram
+  t->woken_at   = 0;
+  t->runtime    = 0;
+  t->switches   = 0;
+  sched_enqueue(t);
+  return t;
+}
+
+thread_t *thread_create(const char *name, thread_fn_t fn, void *arg) {
+  return spawn(cpu_index(), false, name, fn, arg);
+}
+
+thread_t *thread_create_on(uint32_t cpu, const char *name, thread_fn_t fn,
+                           void *arg) {
+  assert(cpu < cpu_count());
+  return spawn(cpu, true, name, fn, arg);
+}
+
+[[noreturn]] void thread_exit(void) {
+  interrupts_disable();
+  thread_current()->state = THREAD_DEAD;
+  schedule();
+  __builtin_unreachable();
+}
+
+thread_t *thread_current(void) {
+  return this_cpu_read(current);
+}
+
+static const char *state_names[] = {
+  [THREAD_RUNNABLE] = "runnable",
+  [THREAD_RUNNING]  = "running",
+  [THREAD_BLOCKED]  = "blocked",
+  [THREAD_DEAD]     = "dead",
+};
+
+void thread_dump(void) {
+  if(!pool_ready)
+    return;
+  for(int i = 0; i < THREAD_MAX; ++i) {
+    thread_t *t = &threads[i];
+    if(t->state == THREAD_DEAD)
+      continue;
+    printf("%4u %-12s cpu %u%s %-8s nice %3d %lu switches, %lu cycles\n",
+           t->tid,
+           t->name,
+           t->cpu,
+           t->pinned ? "*" : " ",
+           state_names[t->state],
+           t->nice,
+           t->switches,
+           t->runtime);
+  }
+}
@@ -0,0 +1,99 @@
+#ifndef _THREAD_H
+#define _THREAD_H
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/rcu.h>
+
+/* kernel threads come from a fixed pool until there's a heap */
+#define THREAD_MAX        64
+#define THREAD_STACK_SIZE (16 * 1024)
+
+enum thread_state {
+  THREAD_RUNNABLE = 0,
+  THREAD_RUNNING,
+  THREAD_BLOCKED,
+  THREAD_DEAD
+};
+
+typedef struct thread {
+  /* saved by context_switch, has to stay first */
+  uint64_t          rsp;
+  uint32_t          tid;
+  const char       *name;
+  volatile uint32_t state;
+  /* run queue it's on (or last ran on) */
+  uint32_t          cpu;
+  bool              pinned;
+  /* still running on `cpu`, possibly half way through switching out */
+  volatile bool     on_cpu;
+  /* an unpark that came before the park, see thread_park */
+  bool              park_token;
+  struct thread    *next;
+  uint8_t          *stack;
+  /* EEVDF state, virtual times are TSC cycles scaled by NICE_0_WEIGHT/weight */
+  int32_t           nice;
+  uint32_t          weight;
+  /* requested slice in cycles, 0 for the default one */
+  uint64_t          slice;
+  uint64_t          vruntime;
+  uint64_t          deadline;
+  /* service it was owed (or ahead by) when it left the run queue */
+  int64_t           vlag;
+  /* cycles run since the deadline was last set */
+  uint64_t          slice_used;
+  uint64_t          exec_start;
+  /* when it became runnable, for the wakeup latency histogram */
+  uint64_t          woken_at;
+  uint64_t          runtime;
+  uint64_t          switches;
+  /* back to the pool through call_rcu, see thread_free */
+  rcu_head_t        rcu;
+} thread_t;
+
+typedef void (*thread_fn_t)(void *arg);
+
+/**
+ * @brief start a thread on the calling CPU
+ *
+ * @return the thread, or NULL when the pool is exhausted
+ */
+thread_t *thread_create(const char *name, thread_fn_t fn, void *arg);
+/**
+ * @brief start a thread that only ever runs on `cpu`
+ */
+thread_t *thread_create_on(uint32_t cpu, const char *name, thread_fn_t fn,
+                           void *arg);
+/**
+ * @brief end the calling thread, its stack is reclaimed once another thread
+ * has switched in
+ */
+[[noreturn]] void thread_exit(void);
+/**
+ * @brief return a dead thread to the pool after a grace period, other CPUs
+ * may still be looking at it as some CPU's current thread
+ */
+void              thread_free(thread_t *t);
+thread_t         *thread_current(void);
+/**
+ * @brief block until thread_unpark. an unpark that arrives first is
+ * remembered, so the pair can't lose a wakeup
+ */
+void thread_park(void);
+void thread_unpark(thread_t *t);
+void thread_yield(void);
+/**
+ * @brief CPU share relative to other threads, -20 (most) to 19 (least). each
+ * step is worth about 10%
+ */
+void thread_set_nice(thread_t *t, int32_t nice);
+/**
+ * @brief ask for slices of `slice_us` rather than the default. shorter slices
+ * get earlier deadlines, so the thread is picked sooner after waking up
+ * without getting a bigger share of the CPU. 0 restores the default
+ */
+void thread_set_latency_hint(thread_t *t, uint32_t slice_us);
+/**
+ * @brief print every live thread
+ */
+void thread_dump(void);
+#endif  // _THREAD_H
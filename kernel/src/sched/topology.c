@@ -0,0 +1,97 @@
+#include "topology.h"
+#include <stdlib.h>
+#include <sys/apic.h>
+#include <sys/cpu.h>
+#include <sys/debug.h>
+
+#define CPUID_EXT_TOPOLOGY (1 << 22)
+
+static struct {
+  uint32_t l2_id;
+  uint32_t llc_id;
+} topo[MAX_CPUS];
+
+static uint8_t  steal_order[MAX_CPUS][MAX_CPUS];
+static uint32_t steal_count[MAX_CPUS] = { 0 };
+
+static uint32_t cache_leaf(void) {
+  if(cpuid(0, 0).eax >= 4 && (cpuid(4, 0).eax & 0x1F))
+    return 4;
+  if(cpuid(0x80000000, 0).eax >= 0x8000001D &&
+     (cpuid(0x80000001, 0).ecx & CPUID_EXT_TOPOLOGY))
+    return 0x8000001D;
+  return 0;
+}
+
+void topology_init_cpu(uint32_t cpu) {
+  uint32_t apic_id = lapic_id();
+  uint32_t leaf    = cache_leaf();
+  uint32_t llc_lvl = 0;
+  // without cache info every CPU is on its own
+  topo[cpu].l2_id  = apic_id;
+  topo[cpu].llc_id = apic_id;
+  for(uint32_t i = 0; leaf != 0; ++i) {
+    cpuid_regs_t r = cpuid(leaf, i);
+    if((r.eax & 0x1F) == 0)
+      break;
+    uint32_t level   = (r.eax >> 5) & 0x7;
+    uint32_t sharing = ((r.eax >> 14) & 0xFFF) + 1;
+    // CPUs sharing the cache have APIC ids that only differ in the low
+    // ceil(log2(sharing)) bits
+    uint32_t shift = 0;
+    while((1u << shift) < sharing) shift++;
+    if(level == 2)
+      topo[cpu].l2_id = apic_id >> shift;
+    if(level >= llc_lvl) {
+      llc_lvl          = level;
+      topo[cpu].llc_id = apic_id >> shift;
+    }
+  }
+}
+
+enum topology_distance topology_distance(uint32_t a, uint32_t b) {
+  if(topo[a].l2_id == topo[b].l2_id)
+    return TOPO_SAME_L2;
+  if(topo[a].llc_id == topo[b].llc_id)
+    return TOPO_SAME_LLC;
+  return TOPO_REMOTE;
+}
+
+void topology_build(void) {
+  uint32_t n = cpu_count();
+  for(uint32_t c = 0; c < n; ++c) {
+    uint32_t count = 0;
+    // start right after ourselves so thieves at the same distance spread out
+    // over their victims instead of all hitting the lowest numbered one
+    for(int d = 0; d < TOPO_DISTANCES; ++d) {
+      for(uint32_t k = 1; k < n; ++k) {
+        uint32_t other = (c + k) % n;
+        if(topology_distance(c, other) == (enum topology_distance)d)
+          steal_order[c][count++] = other;
+      }
+    }
+    __atomic_store_n(&steal_count[c], count, __ATOMIC_RELEASE);
+  }
+}
+
+const uint8_t *topology_steal_order(uint32_t cpu, uint32_t *count) {
+  *count = __atomic_load_n(&steal_count[cpu], __ATOMIC_ACQUIRE);
+  return steal_order[cpu];
+}
+
+static void topology_cmd(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+  for(uint32_t c = 0; c < cpu_count(); ++c) {
+    printf(
+      "cpu %u: l2 %u llc %u, steals from", c, topo[c].l2_id, topo[c].llc_id);
+    for(uint32_t i = 0; i < steal_count[c]; ++i)
+      printf(" %u", steal_order[c][i]);
+    printf("\n");
+  }
+}
+
+void topology_init(void) {
+  topology_init_cpu(0);
+  debug_register("topology", "cache sharing and steal order", topology_cmd);
+}
@@ -0,0 +1,29 @@
+#ifndef _TOPOLOGY_H
+#define _TOPOLOGY_H
+#include <stdint.h>
+
+/* how far apart two CPUs are, by the caches they share */
+enum topology_distance {
+  TOPO_SAME_L2 = 0, /* SMT siblings or a shared L2 cluster */
+  TOPO_SAME_LLC,
+  TOPO_REMOTE,
+  TOPO_DISTANCES
+};
+
+/**
+ * @brief read the cache sharing of the calling CPU from CPUID (leaf 4, or
+ * 0x8000001D on AMD)
+ */
+void topology_init_cpu(uint32_t cpu);
+/**
+ * @brief work out every CPU's steal order once they're all online
+ */
+void                   topology_build(void);
+void                   topology_init(void);
+enum topology_distance topology_distance(uint32_t a, uint32_t b);
+/**
+ * @brief the other CPUs, nearest first, in the order `cpu` should look for
+ * work on them. empty until topology_build
+ */
+const uint8_t *topology_steal_order(uint32_t cpu, uint32_t *count);
+#endif  // _TOPOLOGY_H
@@ -9,6 +9,9 @@
 #define STB_SPRINTF_NOFLOAT
 #include "stb_sprintf.h"
 #include "stdio.h"
+#include <sys/cpu.h>
+#include <sys/serial.h>
+#include <sys/spinlock.h>
 #include <olive.c>
 
 /*
@@ -75,6 +78,30 @@ typedef struct console_state {
 
 static struct console_state console = { 0 };
 
+static spinlock_t        console_lock = SPINLOCK_INIT;
+static lock_stats_t      console_lock_stats;
+static volatile uint32_t console_owner = UINT32_MAX;
+
+/* reentrant on the CPU holding it, so a fault or a failed assertion in the
+ * middle of printing still gets its message out */
+static uint64_t console_acquire(bool *nested) {
+  uint64_t flags = irq_save();
+  *nested        = console_owner == cpu_index();
+  if(!*nested) {
+    spin_lock(&console_lock);
+    console_owner = cpu_index();
+  }
+  return flags;
+}
+
+static void console_release(uint64_t flags, bool nested) {
+  if(!nested) {
+    console_owner = UINT32_MAX;
+    spin_unlock(&console_lock);
+  }
+  irq_restore(flags);
+}
+
 #define OLIVEC_RED(color)   (((color) & 0x000000FF) >> (8 * 0))
 #define OLIVEC_GREEN(color) (((color) & 0x0000FF00) >> (8 * 1))
 #define OLIVEC_BLUE(color)  (((color) & 0x00FF0000) >> (8 * 2))
@@ -203,26 +230,38 @@ void _putchar(char c) {
 
 void printf(const char *format, ...) {
   static char printf_buf[1 << 12];
+  bool        nested;
+  uint64_t    flags = console_acquire(&nested);
   va_list     args;
   va_start(args, format);
-  stbsp_vsnprintf(
+  int len = stbsp_vsnprintf(
     printf_buf, sizeof(printf_buf) / sizeof(printf_buf[0]), format, args);
   va_end(args);
+  if(len > (int)sizeof(printf_buf) - 1)
+    len = sizeof(printf_buf) - 1;
+  serial_write(printf_buf, len);
   for(size_t i = 0; printf_buf[i] != '\0';) {
     uint32_t c;
     int      n = utf8_to_utf32(&c, &printf_buf[i], NULL);
     putwchar(c);
     i += n;
   }
+  console_release(flags, nested);
 }
 
 void printw(const wchar_t *buf) {
-  size_t i;
+  bool     nested;
+  uint64_t flags = console_acquire(&nested);
+  size_t   i;
   for(i = 0; buf[i] != '\0'; ++i) putchar(buf[i]);
+  console_release(flags, nested);
 };
 void print(const char *buf) {
-  size_t i;
+  bool     nested;
+  uint64_t flags = console_acquire(&nested);
+  size_t   i;
   for(i = 0; buf[i] != '\0'; ++i) putchar(buf[i]);
+  console_release(flags, nested);
 };
 
 [[noreturn]] void __assert_fail(const char *assertion, const char *file,
@@ -254,4 +293,5 @@ void init_io(struct limine_framebuffer *framebuffer) {
   console.bg        = COLOUR(0x181818ff);
   console.fg        = COLOUR(0xe3e3e3ff);
   olivec_fill(fb, console.bg);
+  spin_stats_attach(&console_lock, &console_lock_stats, "console");
 }
\ No newline at end of file
@@ -12,12 +12,12 @@ static const uint32_t UTF32_MAX = 0x10FFFF;
   ((void)((x) || (__assert_fail(#x, __FILE__, __LINE__, __func__), 0)))
 
 #define kerror(fmt, ...) \
-  printf("\e[31m[kernel] [error]\e[0m: " fmt, __VA_ARGS__)
+  printf("\e[31m[kernel] [error]\e[0m: " fmt, ##__VA_ARGS__)
 #define kwarn(fmt, ...) \
-  printf("\e[33m[kernel] [warning]\e[0m: " fmt, __VA_ARGS__)
-#define kinfo(fmt, ...) printf("\e[36m[kernel] [info]\e[0m: " fmt, __VA_ARGS__)
+  printf("\e[33m[kernel] [warning]\e[0m: " fmt, ##__VA_ARGS__)
+#define kinfo(fmt, ...) printf("\e[36m[kernel] [info]\e[0m: " fmt, ##__VA_ARGS__)
 #define kpanic(fmt, ...) \
-  (printf("\e[31m[kernel] [panic]\e[0m: " fmt, __VA_ARGS__), abort())
+  (printf("\e[31m[kernel] [panic]\e[0m: " fmt, ##__VA_ARGS__), abort())
 
 #define COLOUR(val) ((((uint64_t)(val) << 24) | ((val) >> 8)) & 0xffffffff)
 void printf(const char *format, ...);
@@ -25,5 +25,7 @@ format ELF64
 section '.text' executable
  public hcf ; Halt and catch fire function.
  hcf:
+   cli
   .start:
    hlt
+   jmp .start
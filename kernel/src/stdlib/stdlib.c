@@ -13,6 +13,14 @@ size_t strlen(const char *s) {
   return res;
 }
 
+int strcmp(const char *s1, const char *s2) {
+  while(*s1 && *s1 == *s2) {
+    s1++;
+    s2++;
+  }
+  return (unsigned char)*s1 - (unsigned char)*s2;
+}
+
 // GCC and Clang reserve the right to generate calls to the following
 // 4 functions even if they are not directly called.
 // Implement them as the C specification mandates.
@@ -7,6 +7,7 @@
 
 size_t strlen(const char *s);
 size_t strnlen(const char *s, size_t maxlen);
+int strcmp(const char *s1, const char *s2);
 
 void *memcpy(void *restrict dest, const void *restrict src, size_t n);
 void *memset(void *s, int c, size_t n);
@@ -1,83 +1,208 @@
 #include "acpi.h"
+#include <mm/arena.h>
+#include <mm/vmm.h>
+#include <sys/debug.h>
 
 rsdp_descriptor20_t *rsdp_descriptor;
 rsdt_t* rsdt;
 xsdt_t* xsdt;
 
-uint8_t validate_rsdp_checksum() 
+/*
+every table the XSDT (or RSDT) points at, plus the DSDT, copied into the boot
+arena once at init so lookups don't map firmware memory again and the copies
+end up read-only. the copies are found through a hash of their signature.
+the index is built before any other CPU is up and never changes after, so
+lookups take no lock
+*/
+typedef struct acpi_entry
 {
-    uint64_t checksum = rsdp_descriptor->descriptor10.checksum;
-    for (uint8_t i = 0; i < 8; i++) 
+    struct acpi_entry* next;
+    acpi_std_header_t* table;
+} acpi_entry_t;
+
+typedef struct acpi_index
+{
+    acpi_entry_t* buckets[ACPI_HASH_BUCKETS];
+    uint32_t count;
+} acpi_index_t;
+
+static acpi_index_t* acpi_index;
+
+static uint32_t signature_of(const char* signature)
+{
+    return (uint32_t)(uint8_t)signature[0] | (uint32_t)(uint8_t)signature[1] << 8 |
+           (uint32_t)(uint8_t)signature[2] << 16 | (uint32_t)(uint8_t)signature[3] << 24;
+}
+
+static uint32_t signature_hash(uint32_t signature)
+{
+    return (signature * 0x9E3779B1u) >> (32 - ACPI_HASH_BITS);
+}
+
+static bool checksum_ok(const void* data, uint32_t length)
+{
+    uint8_t sum = 0;
+    for (uint32_t i = 0; i < length; i++)
     {
-        checksum += rsdp_descriptor->descriptor10.signature[i];
+        sum += ((const uint8_t*) data)[i];
     }
+    return sum == 0;
+}
+
+bool validate_rsdp_checksum()
+{
+    if (!checksum_ok(rsdp_descriptor, sizeof(rsdp_descriptor_t)))
+        return false;
+    // ACPI 2.0+ adds an extended checksum over the whole structure
+    if (rsdp_descriptor->descriptor10.revision >= 2)
+        return checksum_ok(rsdp_descriptor, rsdp_descriptor->length);
+    return true;
+}
+
+uint8_t validatesdt_checksum(acpi_std_header_t* table_header)
+{
+    return checksum_ok(table_header, table_header->length);
+}
+
+/*
+the tables live in ACPI reclaimable/NVS memory which isn't part of the HHDM,
+so map the header first to learn the length and then the rest of the table
+*/
+static acpi_std_header_t* map_table(uint64_t phys)
+{
+    acpi_std_header_t* header = vmm_map_phys(phys, sizeof(acpi_std_header_t), PTE_NX);
+    return vmm_map_phys(phys, header->length, PTE_NX);
+}
+
+static void index_add(acpi_index_t* index, acpi_std_header_t* table)
+{
+    acpi_entry_t* entry = arena_alloc(&boot_arena, sizeof(*entry), 8);
+    if (entry == NULL)
+        kpanic("no memory for the ACPI index\n");
+    // appended, so instances come back in firmware order
+    acpi_entry_t** link = &index->buckets[signature_hash(signature_of(table->signature))];
+    while (*link)
+        link = &(*link)->next;
+    entry->next = NULL;
+    entry->table = table;
+    *link = entry;
+    index->count++;
+}
 
-    for (uint8_t i = 0; i < 6; i++) 
+static void copy_table(acpi_index_t* index, uint64_t phys)
+{
+    if (phys == 0)
+        return;
+    acpi_std_header_t* header = map_table(phys);
+    arena_mark_t mark = arena_checkpoint(&boot_arena);
+    acpi_std_header_t* copy = arena_memdup(&boot_arena, header, header->length);
+    if (copy == NULL)
+        kpanic("no memory for ACPI table %.4s\n", header->signature);
+    // checked on the copy, firmware memory could still change under us
+    if (!validatesdt_checksum(copy))
     {
-        checksum += rsdp_descriptor->descriptor10.oem_id[i];
+        kwarn("ACPI table %.4s has a bad checksum, ignoring it\n", header->signature);
+        arena_rewind(&boot_arena, mark);
+        return;
     }
+    index_add(index, copy);
+}
 
-    uint32_t address_byte = rsdp_descriptor->descriptor10.rsdt_address;
-    checksum += rsdp_descriptor->descriptor10.revision;
+static void copy_tables(void)
+{
+    acpi_index_t* index = arena_alloc(&boot_arena, sizeof(*index), 8);
+    if (index == NULL)
+        kpanic("no memory for the ACPI index\n");
+    memset(index, 0, sizeof(*index));
 
-    // split address into bytes and add to the checksum
-    for (int i = 0 ; i < 4; i++) 
+    if (xsdt)
     {
-    	checksum += address_byte & 0xFF;
-    	address_byte >>= 8;
+        uint32_t entries = (xsdt->h.length - sizeof(xsdt->h)) / 8;
+        for (uint32_t i = 0; i < entries; i++)
+            copy_table(index, xsdt->other_sdt[i]);
+    }
+    else
+    {
+        uint32_t entries = (rsdt->h.length - sizeof(rsdt->h)) / 4;
+        for (uint32_t i = 0; i < entries; i++)
+            copy_table(index, rsdt->other_sdt[i]);
     }
 
-    // add these bytes if ACPI is version 2
-    if (rsdp_descriptor->descriptor10.revision == 2) 
+    // the DSDT hangs off the FADT instead of the root table
+    fadt_t* fadt = NULL;
+    for (acpi_entry_t* e = index->buckets[signature_hash(signature_of("FACP"))]; e; e = e->next)
     {
-        address_byte = rsdp_descriptor->length;
-        for (int i = 0 ; i < 4; i++) 
+        if (signature_of(e->table->signature) == signature_of("FACP"))
         {
-    	    checksum += address_byte & 0xFF;
-    	    address_byte >>= 8;
+            fadt = (fadt_t*) e->table;
+            break;
         }
+    }
+    if (fadt)
+    {
+        uint64_t dsdt = fadt->dsdt;
+        if (fadt->h.length >= offsetof(fadt_t, x_dsdt) + sizeof(fadt->x_dsdt) && fadt->x_dsdt)
+            dsdt = fadt->x_dsdt;
+        copy_table(index, dsdt);
+    }
+    acpi_index = index;
+}
 
-        address_byte = rsdp_descriptor->xsdt_address;
-        for (int i = 0 ; i < 8; i++) 
+static void acpi_cmd(int argc, char** argv)
+{
+    (void) argc;
+    (void) argv;
+    for (uint32_t b = 0; acpi_index && b < ACPI_HASH_BUCKETS; b++)
+    {
+        for (acpi_entry_t* e = acpi_index->buckets[b]; e; e = e->next)
         {
-    	    checksum += address_byte & 0xFF;
-    	    address_byte >>= 8;
+            printf("%.4s rev %u %.6s %.8s, %u bytes (bucket %u)\n",
+                   e->table->signature, e->table->revision, e->table->oem_id,
+                   e->table->oem_table_id, e->table->length, b);
         }
-
-        checksum += rsdp_descriptor->extended_checksum;
-
-        for (uint8_t i = 0; i < 3; i++) {
-            checksum += rsdp_descriptor->reserved[i];
-    	}
     }
-    return checksum;
 }
 
-uint8_t validatesdt_checksum(acpi_std_header_t* table_header) 
+void acpi_init(uint64_t rsdp_phys)
 {
-    uint8_t sum = 0;
- 
-    for (uint32_t i = 0; i < table_header->length; i++)
+    rsdp_descriptor = vmm_map_phys(rsdp_phys, sizeof(rsdp_descriptor20_t), PTE_NX);
+    if (!validate_rsdp_checksum())
+        kwarn("RSDP at 0x%lx has a bad checksum\n", rsdp_phys);
+
+    uint8_t revision = rsdp_descriptor->descriptor10.revision;
+    if (revision >= 2 && rsdp_descriptor->xsdt_address)
     {
-        sum += ((uint8_t *) table_header)[i];
+        xsdt = (xsdt_t*) map_table(rsdp_descriptor->xsdt_address);
+        if (!validatesdt_checksum(&xsdt->h))
+        {
+            kwarn("XSDT has a bad checksum, falling back to the RSDT\n");
+            xsdt = NULL;
+        }
     }
- 
-    return sum == 0;
+    if (xsdt == NULL)
+    {
+        rsdt = (rsdt_t*) map_table(rsdp_descriptor->descriptor10.rsdt_address);
+        if (!validatesdt_checksum(&rsdt->h))
+            kpanic("RSDT has a bad checksum\n");
+    }
+    copy_tables();
+    kinfo("ACPI revision %u, %u tables from the %s\n", revision, acpi_index->count,
+          xsdt ? "XSDT" : "RSDT");
+    debug_register("acpi", "ACPI tables by hash bucket", acpi_cmd);
 }
 
-acpi_std_header_t* find_header(char* signature) 
+acpi_std_header_t* find_table(const char* signature, uint32_t instance)
 {
-    uint32_t entries = (rsdt->h.length - sizeof(rsdt->h)) / 4;
-
-    for (uint32_t i = 0; i < entries; i++)
+    uint32_t sig = signature_of(signature);
+    for (acpi_entry_t* e = acpi_index ? acpi_index->buckets[signature_hash(sig)] : NULL; e; e = e->next)
     {
-        acpi_std_header_t* header = (acpi_std_header_t*) (uintptr_t)rsdt->other_sdt[i];
-        if (header->signature[0] == signature[0] && header->signature[1] == signature[1] && header->signature[2] == signature[2] && header->signature[3] == signature[3])
-            return header;
+        if (signature_of(e->table->signature) == sig && instance-- == 0)
+            return e->table;
     }
-
-    // No header found
     return NULL;
 }
 
-
+acpi_std_header_t* find_header(char* signature)
+{
+    return find_table(signature, 0);
+}
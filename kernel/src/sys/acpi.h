@@ -49,4 +49,251 @@ typedef struct xsdt
     uint64_t other_sdt[];
 } __attribute__ ((packed)) xsdt_t;
 
+/*
+MADT ("APIC") and the interrupt controller structures we care about
+*/
+
+#define MADT_PCAT_COMPAT 1 // system also has dual 8259s
+
+enum madt_entry_type
+{
+    MADT_LAPIC = 0,
+    MADT_IOAPIC = 1,
+    MADT_INT_SOURCE_OVERRIDE = 2,
+    MADT_LAPIC_NMI = 4,
+    MADT_LAPIC_ADDRESS_OVERRIDE = 5,
+    MADT_X2APIC = 9,
+    MADT_X2APIC_NMI = 10,
+};
+
+#define MADT_LAPIC_ENABLED 1
+#define MADT_LAPIC_ONLINE_CAPABLE 2
+
+// MPS INTI flags used by overrides and NMI entries
+#define MADT_POLARITY_MASK 0x3
+#define MADT_POLARITY_LOW 0x3
+#define MADT_TRIGGER_MASK 0xC
+#define MADT_TRIGGER_LEVEL 0xC
+
+typedef struct madt
+{
+    struct acpi_std_header h;
+    uint32_t lapic_address;
+    uint32_t flags;
+    uint8_t entries[];
+} __attribute__ ((packed)) madt_t;
+
+typedef struct madt_entry
+{
+    uint8_t type;
+    uint8_t length;
+} __attribute__ ((packed)) madt_entry_t;
+
+typedef struct madt_lapic
+{
+    struct madt_entry h;
+    uint8_t acpi_processor_id;
+    uint8_t apic_id;
+    uint32_t flags;
+} __attribute__ ((packed)) madt_lapic_t;
+
+typedef struct madt_ioapic
+{
+    struct madt_entry h;
+    uint8_t ioapic_id;
+    uint8_t reserved;
+    uint32_t address;
+    uint32_t gsi_base;
+} __attribute__ ((packed)) madt_ioapic_t;
+
+typedef struct madt_int_source_override
+{
+    struct madt_entry h;
+    uint8_t bus;
+    uint8_t source;
+    uint32_t gsi;
+    uint16_t flags;
+} __attribute__ ((packed)) madt_int_source_override_t;
+
+typedef struct madt_lapic_nmi
+{
+    struct madt_entry h;
+    uint8_t acpi_processor_id; // 0xFF means all processors
+    uint16_t flags;
+    uint8_t lint;
+} __attribute__ ((packed)) madt_lapic_nmi_t;
+
+typedef struct madt_lapic_address_override
+{
+    struct madt_entry h;
+    uint16_t reserved;
+    uint64_t address;
+} __attribute__ ((packed)) madt_lapic_address_override_t;
+
+typedef struct madt_x2apic
+{
+    struct madt_entry h;
+    uint16_t reserved;
+    uint32_t x2apic_id;
+    uint32_t flags;
+    uint32_t acpi_processor_uid;
+} __attribute__ ((packed)) madt_x2apic_t;
+
+typedef struct madt_x2apic_nmi
+{
+    struct madt_entry h;
+    uint16_t flags;
+    uint32_t acpi_processor_uid; // 0xFFFFFFFF means all processors
+    uint8_t lint;
+    uint8_t reserved[3];
+} __attribute__ ((packed)) madt_x2apic_nmi_t;
+
+/*
+HPET, one event timer block described by a generic address structure
+*/
+
+#define ACPI_ADDRESS_SPACE_MEMORY 0
+
+typedef struct acpi_gas
+{
+    uint8_t address_space_id;
+    uint8_t register_bit_width;
+    uint8_t register_bit_offset;
+    uint8_t access_size;
+    uint64_t address;
+} __attribute__ ((packed)) acpi_gas_t;
+
+typedef struct hpet_table
+{
+    struct acpi_std_header h;
+    uint32_t event_timer_block_id;
+    struct acpi_gas address;
+    uint8_t hpet_number;
+    uint16_t minimum_tick;
+    uint8_t page_protection;
+} __attribute__ ((packed)) hpet_table_t;
+
+/*
+SRAT and SLIT, which CPUs and memory ranges belong to which proximity domain
+and how far apart the domains are
+*/
+
+enum srat_entry_type
+{
+    SRAT_LAPIC_AFFINITY = 0,
+    SRAT_MEMORY_AFFINITY = 1,
+    SRAT_X2APIC_AFFINITY = 2,
+};
+
+#define SRAT_ENABLED 1
+
+typedef struct srat
+{
+    struct acpi_std_header h;
+    uint32_t reserved1; // 1 for backwards compatibility
+    uint64_t reserved2;
+    uint8_t entries[];
+} __attribute__ ((packed)) srat_t;
+
+typedef struct srat_lapic_affinity
+{
+    struct madt_entry h;
+    uint8_t proximity_domain_lo;
+    uint8_t apic_id;
+    uint32_t flags;
+    uint8_t sapic_eid;
+    uint8_t proximity_domain_hi[3];
+    uint32_t clock_domain;
+} __attribute__ ((packed)) srat_lapic_affinity_t;
+
+typedef struct srat_memory_affinity
+{
+    struct madt_entry h;
+    uint32_t proximity_domain;
+    uint16_t reserved1;
+    uint64_t base;
+    uint64_t length;
+    uint32_t reserved2;
+    uint32_t flags;
+    uint64_t reserved3;
+} __attribute__ ((packed)) srat_memory_affinity_t;
+
+typedef struct srat_x2apic_affinity
+{
+    struct madt_entry h;
+    uint16_t reserved1;
+    uint32_t proximity_domain;
+    uint32_t x2apic_id;
+    uint32_t flags;
+    uint32_t clock_domain;
+    uint32_t reserved2;
+} __attribute__ ((packed)) srat_x2apic_affinity_t;
+
+// relative distances, 10 is local
+#define SLIT_LOCAL_DISTANCE 10
+#define SLIT_REMOTE_DISTANCE 20
+
+typedef struct slit
+{
+    struct acpi_std_header h;
+    uint64_t locality_count;
+    uint8_t entries[]; // locality_count x locality_count
+} __attribute__ ((packed)) slit_t;
+
+/*
+FADT ("FACP"), only as far as the pointer to the DSDT
+*/
+
+typedef struct fadt
+{
+    struct acpi_std_header h;
+    uint32_t firmware_ctrl;
+    uint32_t dsdt;
+    uint8_t reserved1[88]; // x_firmware_ctrl is at offset 132
+    uint64_t x_firmware_ctrl;
+    uint64_t x_dsdt;
+} __attribute__ ((packed)) fadt_t;
+
+/*
+MCFG, the memory mapped (ECAM) PCI configuration space windows
+*/
+
+typedef struct mcfg_entry
+{
+    uint64_t base; // config space of bus 0, even when start_bus isn't 0
+    uint16_t segment;
+    uint8_t start_bus;
+    uint8_t end_bus;
+    uint32_t reserved;
+} __attribute__ ((packed)) mcfg_entry_t;
+
+typedef struct mcfg
+{
+    struct acpi_std_header h;
+    uint64_t reserved;
+    mcfg_entry_t entries[];
+} __attribute__ ((packed)) mcfg_t;
+
+// buckets in the signature index
+#define ACPI_HASH_BITS 6
+#define ACPI_HASH_BUCKETS (1 << ACPI_HASH_BITS)
+
+/**
+ * @brief set up table access from the physical RSDP address limine hands us,
+ * copying every table in the XSDT (or the RSDT before ACPI 2.0) into the boot
+ * arena and indexing them by signature. after arena_init
+ */
+void acpi_init(uint64_t rsdp_phys);
+/**
+ * @brief find an ACPI table by its 4 character signature
+ *
+ * @return mapped table or NULL if it's not present
+ */
+acpi_std_header_t* find_header(char* signature);
+/**
+ * @brief like find_header, for signatures that can appear more than once
+ * (SSDTs). instances are numbered from 0 in firmware order
+ */
+acpi_std_header_t* find_table(const char* signature, uint32_t instance);
+
 #endif // _ACPI_H
\ No newline at end of file
@@ -0,0 +1,378 @@
+#include "apic.h"
+#include <mm/vmm.h>
+#include <stdlib.h>
+#include <sys/acpi.h>
+#include <sys/cpu.h>
+#include <sys/interrupts.h>
+#include <sys/pic.h>
+#include <sys/pit.h>
+
+#define MAX_IOAPICS    8
+#define MAX_LAPIC_NMIS 8
+#define MAX_MADT_CPUS  256
+
+#define IOAPIC_REGSEL 0x00
+#define IOAPIC_WINDOW 0x10
+
+#define IOAPIC_REG_ID       0x00
+#define IOAPIC_REG_VERSION  0x01
+#define IOAPIC_REG_REDIR(n) (0x10 + 2 * (n))
+
+typedef struct ioapic {
+  uint8_t            id;
+  uint32_t           gsi_base;
+  uint32_t           gsi_count;
+  volatile uint32_t *mmio;
+} ioapic_t;
+
+static struct {
+  bool               x2apic;
+  uint64_t           lapic_phys;
+  volatile uint32_t *lapic_mmio;
+  ioapic_t           ioapics[MAX_IOAPICS];
+  size_t             ioapic_count;
+  struct {
+    uint32_t gsi;
+    uint64_t flags;
+  } isa_irqs[16];
+  struct {
+    uint32_t acpi_uid;  // 0xFFFFFFFF for every processor
+    uint8_t  lint;
+    uint64_t flags;
+  } nmis[MAX_LAPIC_NMIS];
+  size_t nmi_count;
+  struct {
+    uint32_t apic_id;
+    uint32_t acpi_uid;
+  } cpus[MAX_MADT_CPUS];
+  size_t   cpu_count;
+  uint32_t timer_ticks_per_ms;
+} apic = { 0 };
+
+/* MPS INTI polarity/trigger flags -> redirection entry/LVT bits */
+static uint64_t inti_flags(uint16_t flags) {
+  uint64_t res = 0;
+  if((flags & MADT_POLARITY_MASK) == MADT_POLARITY_LOW)
+    res |= IOAPIC_ACTIVE_LOW;
+  if((flags & MADT_TRIGGER_MASK) == MADT_TRIGGER_LEVEL)
+    res |= IOAPIC_LEVEL;
+  return res;
+}
+
+static void parse_madt(madt_t *madt) {
+  apic.lapic_phys = madt->lapic_address;
+  for(uint8_t i = 0; i < 16; ++i) apic.isa_irqs[i].gsi = i;
+
+  uint8_t *p   = madt->entries;
+  uint8_t *end = (uint8_t *)madt + madt->h.length;
+  while(p + sizeof(madt_entry_t) <= end) {
+    madt_entry_t *entry = (madt_entry_t *)p;
+    if(entry->length < sizeof(madt_entry_t))
+      break;
+    switch(entry->type) {
+      case MADT_LAPIC: {
+        madt_lapic_t *lapic = (madt_lapic_t *)entry;
+        if(!(lapic->flags & (MADT_LAPIC_ENABLED | MADT_LAPIC_ONLINE_CAPABLE)))
+          break;
+        if(apic.cpu_count < MAX_MADT_CPUS) {
+          apic.cpus[apic.cpu_count].apic_id  = lapic->apic_id;
+          apic.cpus[apic.cpu_count].acpi_uid = lapic->acpi_processor_id;
+          apic.cpu_count++;
+        }
+      } break;
+      case MADT_X2APIC: {
+        madt_x2apic_t *x2 = (madt_x2apic_t *)entry;
+        if(!(x2->flags & (MADT_LAPIC_ENABLED | MADT_LAPIC_ONLINE_CAPABLE)))
+          break;
+        if(apic.cpu_count < MAX_MADT_CPUS) {
+          apic.cpus[apic.cpu_count].apic_id  = x2->x2apic_id;
+          apic.cpus[apic.cpu_count].acpi_uid = x2->acpi_processor_uid;
+          apic.cpu_count++;
+        }
+      } break;
+      case MADT_IOAPIC: {
+        madt_ioapic_t *io = (madt_ioapic_t *)entry;
+        if(apic.ioapic_count >= MAX_IOAPICS) {
+          kwarn("ignoring I/O APIC %u, too many\n", io->ioapic_id);
+          break;
+        }
+        ioapic_t *ioapic = &apic.ioapics[apic.ioapic_count++];
+        ioapic->id       = io->ioapic_id;
+        ioapic->gsi_base = io->gsi_base;
+        ioapic->mmio     = vmm_map_phys(io->address, PAGE_SIZE, PTE_MMIO);
+      } break;
+      case MADT_INT_SOURCE_OVERRIDE: {
+        madt_int_source_override_t *iso = (madt_int_source_override_t *)entry;
+        if(iso->bus != 0 || iso->source >= 16)
+          break;
+        apic.isa_irqs[iso->source].gsi   = iso->gsi;
+        apic.isa_irqs[iso->source].flags = inti_flags(iso->flags);
+      } break;
+      case MADT_LAPIC_NMI: {
+        madt_lapic_nmi_t *nmi = (madt_lapic_nmi_t *)entry;
+        if(apic.nmi_count >= MAX_LAPIC_NMIS)
+          break;
+        apic.nmis[apic.nmi_count].acpi_uid =
+          nmi->acpi_processor_id == 0xFF ? 0xFFFFFFFF : nmi->acpi_processor_id;
+        apic.nmis[apic.nmi_count].lint  = nmi->lint;
+        apic.nmis[apic.nmi_count].flags = inti_flags(nmi->flags);
+        apic.nmi_count++;
+      } break;
+      case MADT_X2APIC_NMI: {
+        madt_x2apic_nmi_t *nmi = (madt_x2apic_nmi_t *)entry;
+        if(apic.nmi_count >= MAX_LAPIC_NMIS)
+          break;
+        apic.nmis[apic.nmi_count].acpi_uid = nmi->acpi_processor_uid;
+        apic.nmis[apic.nmi_count].lint     = nmi->lint;
+        apic.nmis[apic.nmi_count].flags    = inti_flags(nmi->flags);
+        apic.nmi_count++;
+      } break;
+      case MADT_LAPIC_ADDRESS_OVERRIDE: {
+        madt_lapic_address_override_t *o =
+          (madt_lapic_address_override_t *)entry;
+        apic.lapic_phys = o->address;
+      } break;
+      default: break;
+    }
+    p += entry->length;
+  }
+}
+
+bool lapic_is_x2apic(void) {
+  return apic.x2apic;
+}
+
+uint32_t lapic_read(uint32_t reg) {
+  if(apic.x2apic)
+    return (uint32_t)rdmsr(X2APIC_MSR(reg));
+  return apic.lapic_mmio[reg / sizeof(uint32_t)];
+}
+
+void lapic_write(uint32_t reg, uint32_t value) {
+  if(apic.x2apic)
+    wrmsr(X2APIC_MSR(reg), value);
+  else
+    apic.lapic_mmio[reg / sizeof(uint32_t)] = value;
+}
+
+uint32_t lapic_id(void) {
+  if(apic.x2apic)
+    return (uint32_t)rdmsr(X2APIC_MSR(LAPIC_ID));
+  return apic.lapic_mmio[LAPIC_ID / sizeof(uint32_t)] >> 24;
+}
+
+void lapic_eoi(void) {
+  if(apic.x2apic)
+    wrmsr(X2APIC_MSR(LAPIC_EOI), 0);
+  else
+    apic.lapic_mmio[LAPIC_EOI / sizeof(uint32_t)] = 0;
+}
+
+void lapic_send_ipi(uint32_t apic_id, uint8_t vector) {
+  if(apic.x2apic) {
+    // the ICR is a single 64 bit MSR in x2APIC mode
+    wrmsr(X2APIC_MSR(LAPIC_ICR_LOW),
+          ((uint64_t)apic_id << 32) | LAPIC_DELIVERY_FIXED | vector);
+    return;
+  }
+  lapic_write(LAPIC_ICR_HIGH, apic_id << 24);
+  lapic_write(LAPIC_ICR_LOW, LAPIC_DELIVERY_FIXED | vector);
+  while(lapic_read(LAPIC_ICR_LOW) & LAPIC_DELIVERY_STATUS) cpu_relax();
+}
+
+#define TIMER_CALIBRATE_US 10000
+
+void lapic_timer_calibrate(void) {
+  lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIV_16);
+  lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+  pit_oneshot_start(TIMER_CALIBRATE_US);
+  lapic_write(LAPIC_TIMER_INIT, 0xFFFFFFFF);
+  while(!pit_oneshot_done()) cpu_relax();
+  uint32_t elapsed = 0xFFFFFFFF - lapic_read(LAPIC_TIMER_COUNT);
+  lapic_write(LAPIC_TIMER_INIT, 0);
+  apic.timer_ticks_per_ms = elapsed / (TIMER_CALIBRATE_US / 1000);
+  kinfo("local APIC timer: %u ticks/ms (divide by 16)\n",
+        apic.timer_ticks_per_ms);
+}
+
+uint32_t lapic_timer_ticks_per_ms(void) {
+  return apic.timer_ticks_per_ms;
+}
+
+void lapic_timer_oneshot(uint8_t vector, uint32_t ticks) {
+  lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIV_16);
+  lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_ONESHOT | vector);
+  lapic_write(LAPIC_TIMER_INIT, ticks);
+}
+
+void lapic_timer_tsc_deadline(uint8_t vector) {
+  lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_TSC_DEADLINE | vector);
+  // the mode change has to land before the first deadline write, and an
+  // MMIO write isn't ordered against a later wrmsr
+  __asm__ volatile("mfence" ::: "memory");
+}
+
+void lapic_timer_stop(void) {
+  lapic_write(LAPIC_TIMER_INIT, 0);
+  lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+}
+
+static uint32_t acpi_uid_of(uint32_t apic_id) {
+  for(size_t i = 0; i < apic.cpu_count; ++i) {
+    if(apic.cpus[i].apic_id == apic_id)
+      return apic.cpus[i].acpi_uid;
+  }
+  return 0xFFFFFFFF;
+}
+
+void lapic_init(void) {
+  uint64_t base = rdmsr(MSR_APIC_BASE) | APIC_BASE_ENABLE;
+  // x2APIC can only be entered from the enabled xAPIC state
+  wrmsr(MSR_APIC_BASE, base);
+  if(apic.x2apic)
+    wrmsr(MSR_APIC_BASE, base | APIC_BASE_X2APIC);
+
+  lapic_write(LAPIC_TPR, 0);
+  lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+  lapic_write(LAPIC_LVT_THERMAL, LAPIC_LVT_MASKED);
+  lapic_write(LAPIC_LVT_PERF, LAPIC_LVT_MASKED);
+  lapic_write(LAPIC_LVT_LINT0, LAPIC_LVT_MASKED);
+  lapic_write(LAPIC_LVT_LINT1, LAPIC_LVT_MASKED);
+  lapic_write(LAPIC_LVT_ERROR, LAPIC_LVT_MASKED);
+
+  uint32_t uid = acpi_uid_of(lapic_id());
+  for(size_t i = 0; i < apic.nmi_count; ++i) {
+    if(apic.nmis[i].acpi_uid != 0xFFFFFFFF && apic.nmis[i].acpi_uid != uid)
+      continue;
+    uint32_t lvt = LAPIC_DELIVERY_NMI;
+    if(apic.nmis[i].flags & IOAPIC_ACTIVE_LOW)
+      lvt |= LAPIC_LVT_ACTIVE_LOW;
+    lapic_write(apic.nmis[i].lint ? LAPIC_LVT_LINT1 : LAPIC_LVT_LINT0, lvt);
+  }
+
+  // the ESR has to be written before it's read
+  lapic_write(LAPIC_ESR, 0);
+  lapic_write(LAPIC_ESR, 0);
+  lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | VECTOR_SPURIOUS);
+  lapic_eoi();
+}
+
+static uint32_t ioapic_read(ioapic_t *ioapic, uint8_t reg) {
+  ioapic->mmio[IOAPIC_REGSEL / sizeof(uint32_t)] = reg;
+  return ioapic->mmio[IOAPIC_WINDOW / sizeof(uint32_t)];
+}
+
+static void ioapic_write(ioapic_t *ioapic, uint8_t reg, uint32_t value) {
+  ioapic->mmio[IOAPIC_REGSEL / sizeof(uint32_t)] = reg;
+  ioapic->mmio[IOAPIC_WINDOW / sizeof(uint32_t)] = value;
+}
+
+static ioapic_t *ioapic_for_gsi(uint32_t gsi) {
+  for(size_t i = 0; i < apic.ioapic_count; ++i) {
+    ioapic_t *ioapic = &apic.ioapics[i];
+    if(gsi >= ioapic->gsi_base && gsi < ioapic->gsi_base + ioapic->gsi_count)
+      return ioapic;
+  }
+  return NULL;
+}
+
+static uint64_t ioapic_read_redir(ioapic_t *ioapic, uint32_t pin) {
+  uint64_t lo = ioapic_read(ioapic, IOAPIC_REG_REDIR(pin));
+  uint64_t hi = ioapic_read(ioapic, IOAPIC_REG_REDIR(pin) + 1);
+  return (hi << 32) | lo;
+}
+
+static void ioapic_write_redir(ioapic_t *ioapic, uint32_t pin, uint64_t redir) {
+  // keep the line masked while the two halves disagree
+  ioapic_write(ioapic, IOAPIC_REG_REDIR(pin), IOAPIC_MASKED);
+  ioapic_write(ioapic, IOAPIC_REG_REDIR(pin) + 1, redir >> 32);
+  ioapic_write(ioapic, IOAPIC_REG_REDIR(pin), (uint32_t)redir);
+}
+
+bool ioapic_route(uint32_t gsi, uint8_t vector, uint32_t dest, uint64_t flags) {
+  ioapic_t *ioapic = ioapic_for_gsi(gsi);
+  if(ioapic == NULL) {
+    kerror("no I/O APIC handles GSI %u\n", gsi);
+    return false;
+  }
+  uint64_t redir = vector | IOAPIC_DELIVERY_FIXED | flags |
+                   ((uint64_t)(dest & 0xFF) << 56);
+  ioapic_write_redir(ioapic, gsi - ioapic->gsi_base, redir);
+  return true;
+}
+
+void ioapic_mask(uint32_t gsi) {
+  ioapic_t *ioapic = ioapic_for_gsi(gsi);
+  if(ioapic == NULL)
+    return;
+  uint32_t pin = gsi - ioapic->gsi_base;
+  ioapic_write(ioapic,
+               IOAPIC_REG_REDIR(pin),
+               ioapic_read(ioapic, IOAPIC_REG_REDIR(pin)) | IOAPIC_MASKED);
+}
+
+void ioapic_unmask(uint32_t gsi) {
+  ioapic_t *ioapic = ioapic_for_gsi(gsi);
+  if(ioapic == NULL)
+    return;
+  uint32_t pin = gsi - ioapic->gsi_base;
+  ioapic_write(ioapic,
+               IOAPIC_REG_REDIR(pin),
+               ioapic_read(ioapic, IOAPIC_REG_REDIR(pin)) & ~IOAPIC_MASKED);
+}
+
+uint32_t isa_irq_to_gsi(uint8_t irq, uint64_t *flags) {
+  if(irq >= 16) {
+    if(flags)
+      *flags = 0;
+    return irq;
+  }
+  if(flags)
+    *flags = apic.isa_irqs[irq].flags;
+  return apic.isa_irqs[irq].gsi;
+}
+
+bool ioapic_route_isa(uint8_t irq, uint8_t vector) {
+  uint64_t flags;
+  uint32_t gsi = isa_irq_to_gsi(irq, &flags);
+  return ioapic_route(gsi, vector, lapic_id(), flags);
+}
+
+static void ioapic_init(ioapic_t *ioapic) {
+  uint32_t version  = ioapic_read(ioapic, IOAPIC_REG_VERSION);
+  ioapic->gsi_count = ((version >> 16) & 0xFF) + 1;
+  for(uint32_t pin = 0; pin < ioapic->gsi_count; ++pin) {
+    uint64_t redir = ioapic_read_redir(ioapic, pin);
+    ioapic_write_redir(ioapic, pin, redir | IOAPIC_MASKED);
+  }
+  kinfo("I/O APIC %u: GSIs %u-%u\n",
+        ioapic->id,
+        ioapic->gsi_base,
+        ioapic->gsi_base + ioapic->gsi_count - 1);
+}
+
+void apic_init(void) {
+  if(!(cpuid(1, 0).edx & CPUID_1_EDX_APIC))
+    kpanic("CPU has no local APIC\n");
+  madt_t *madt = (madt_t *)find_header("APIC");
+  if(madt == NULL)
+    kpanic("no MADT found\n");
+  parse_madt(madt);
+
+  // limine masks the 8259s but they still need moving off the exception
+  // vectors in case one raises a spurious IRQ
+  if(madt->flags & MADT_PCAT_COMPAT)
+    pic_disable();
+
+  apic.x2apic = (cpuid(1, 0).ecx & CPUID_1_ECX_X2APIC) != 0;
+  if(!apic.x2apic)
+    apic.lapic_mmio = vmm_map_phys(apic.lapic_phys, PAGE_SIZE, PTE_MMIO);
+  lapic_init();
+  cpu_register(0, lapic_id());
+  kinfo("local APIC %u in %s mode, %lu CPUs in MADT\n",
+        lapic_id(),
+        apic.x2apic ? "x2APIC" : "xAPIC",
+        apic.cpu_count);
+
+  for(size_t i = 0; i < apic.ioapic_count; ++i) ioapic_init(&apic.ioapics[i]);
+}
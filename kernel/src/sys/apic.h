@@ -0,0 +1,106 @@
+#ifndef _APIC_H
+#define _APIC_H
+#include <stdbool.h>
+#include <stdint.h>
+
+/* local APIC register offsets (xAPIC MMIO layout) */
+#define LAPIC_ID           0x020
+#define LAPIC_VERSION      0x030
+#define LAPIC_TPR          0x080
+#define LAPIC_EOI          0x0B0
+#define LAPIC_SVR          0x0F0
+#define LAPIC_ESR          0x280
+#define LAPIC_ICR_LOW      0x300
+#define LAPIC_ICR_HIGH     0x310
+#define LAPIC_LVT_TIMER    0x320
+#define LAPIC_LVT_THERMAL  0x330
+#define LAPIC_LVT_PERF     0x340
+#define LAPIC_LVT_LINT0    0x350
+#define LAPIC_LVT_LINT1    0x360
+#define LAPIC_LVT_ERROR    0x370
+#define LAPIC_TIMER_INIT   0x380
+#define LAPIC_TIMER_COUNT  0x390
+#define LAPIC_TIMER_DIVIDE 0x3E0
+
+/* x2APIC exposes the same registers as MSRs */
+#define X2APIC_MSR(reg) (0x800 + ((reg) >> 4))
+
+#define LAPIC_SVR_ENABLE      (1 << 8)
+#define LAPIC_LVT_MASKED      (1 << 16)
+#define LAPIC_LVT_LEVEL       (1 << 15)
+#define LAPIC_LVT_ACTIVE_LOW  (1 << 13)
+#define LAPIC_DELIVERY_FIXED  (0 << 8)
+#define LAPIC_DELIVERY_NMI    (4 << 8)
+#define LAPIC_DELIVERY_INIT   (5 << 8)
+#define LAPIC_DELIVERY_STATUS (1 << 12)
+#define LAPIC_TIMER_ONESHOT      (0 << 17)
+#define LAPIC_TIMER_PERIODIC     (1 << 17)
+#define LAPIC_TIMER_TSC_DEADLINE (2 << 17)
+#define LAPIC_TIMER_DIV_16       0x3
+
+/* I/O APIC redirection entry bits */
+#define IOAPIC_DELIVERY_FIXED (0ull << 8)
+#define IOAPIC_DEST_LOGICAL   (1ull << 11)
+#define IOAPIC_ACTIVE_LOW     (1ull << 13)
+#define IOAPIC_LEVEL          (1ull << 15)
+#define IOAPIC_MASKED         (1ull << 16)
+
+/**
+ * @brief parse the MADT, turn off the 8259s and bring up the BSP's local
+ * APIC and every I/O APIC (with all lines masked)
+ */
+void apic_init(void);
+/**
+ * @brief enable the local APIC of the calling CPU
+ */
+void lapic_init(void);
+bool lapic_is_x2apic(void);
+uint32_t lapic_read(uint32_t reg);
+void     lapic_write(uint32_t reg, uint32_t value);
+uint32_t lapic_id(void);
+/**
+ * @brief signal end of interrupt. one MSR write in x2APIC mode
+ */
+void lapic_eoi(void);
+void lapic_send_ipi(uint32_t apic_id, uint8_t vector);
+
+/**
+ * @brief measure the local APIC timer against the PIT, on the BSP. every
+ * CPU's timer is assumed to run at the same rate
+ */
+void     lapic_timer_calibrate(void);
+uint32_t lapic_timer_ticks_per_ms(void);
+/**
+ * @brief fire `vector` once on the calling CPU after `ticks` timer ticks
+ */
+void lapic_timer_oneshot(uint8_t vector, uint32_t ticks);
+/**
+ * @brief switch the calling CPU's timer to TSC-deadline mode, after which
+ * writing MSR_TSC_DEADLINE arms it (and 0 disarms it)
+ */
+void lapic_timer_tsc_deadline(uint8_t vector);
+void lapic_timer_stop(void);
+
+/**
+ * @brief program the redirection entry of `gsi`
+ *
+ * @param gsi global system interrupt
+ * @param vector IDT vector to deliver
+ * @param dest physical APIC ID of the target CPU
+ * @param flags IOAPIC_* polarity/trigger/mask bits
+ */
+bool ioapic_route(uint32_t gsi, uint8_t vector, uint32_t dest, uint64_t flags);
+void ioapic_mask(uint32_t gsi);
+void ioapic_unmask(uint32_t gsi);
+/**
+ * @brief translate a legacy ISA IRQ into its GSI, applying MADT source
+ * overrides
+ *
+ * @param flags if not NULL, receives the IOAPIC_* polarity/trigger bits
+ */
+uint32_t isa_irq_to_gsi(uint8_t irq, uint64_t *flags);
+/**
+ * @brief route ISA `irq` to `vector` on the BSP and unmask it
+ */
+bool ioapic_route_isa(uint8_t irq, uint8_t vector);
+#endif  // _APIC_H
@@ -6,11 +6,11 @@ public inb  ; src
 outb:
   mov edx, edi ; destination
   mov eax, esi ; value
-  out dx, eax
+  out dx, al
   xor eax, eax
   ret
 inb:
   xor eax, eax
   mov dx, di
-  in eax, dx
-  ret
\ No newline at end of file
+  in al, dx
+  ret
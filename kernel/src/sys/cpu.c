@@ -0,0 +1,25 @@
+#include "cpu.h"
+
+static uint32_t          cpus_registered = 1;
+static volatile uint64_t online_mask     = 1;
+
+uint32_t cpu_count(void) {
+  return cpus_registered;
+}
+
+void cpu_register(uint32_t index, uint32_t lapic_id) {
+  if(index >= MAX_CPUS)
+    return;
+  percpu_get(index)->lapic_id = lapic_id;
+  __atomic_fetch_or(&online_mask, 1ull << index, __ATOMIC_RELEASE);
+  if(index >= cpus_registered)
+    cpus_registered = index + 1;
+}
+
+uint64_t cpu_online_mask(void) {
+  return __atomic_load_n(&online_mask, __ATOMIC_ACQUIRE);
+}
+
+uint32_t cpu_lapic_id(uint32_t index) {
+  return percpu_get(index)->lapic_id;
+}
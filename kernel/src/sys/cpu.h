@@ -0,0 +1,126 @@
+#ifndef _CPU_H
+#define _CPU_H
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/percpu.h>
+
+/* upper bound on CPUs we keep static per-CPU state for */
+#define MAX_CPUS 32
+static_assert(MAX_CPUS <= 64, "CPU masks are a uint64_t");
+
+#define MSR_APIC_BASE 0x1B
+
+#define APIC_BASE_BSP    (1 << 8)
+#define APIC_BASE_X2APIC (1 << 10)
+#define APIC_BASE_ENABLE (1 << 11)
+
+/* CPUID.01H:ECX */
+#define CPUID_1_ECX_X2APIC       (1 << 21)
+#define CPUID_1_ECX_TSC_DEADLINE (1 << 24)
+/* CPUID.01H:EDX */
+#define CPUID_1_EDX_APIC (1 << 9)
+/* CPUID.(EAX=07H,ECX=0):EBX */
+#define CPUID_7_EBX_FSGSBASE (1 << 0)
+
+#define CR4_FSGSBASE (1 << 16)
+
+#define MSR_TSC_DEADLINE 0x6E0
+
+typedef struct cpuid_regs {
+  uint32_t eax, ebx, ecx, edx;
+} cpuid_regs_t;
+
+static inline cpuid_regs_t cpuid(uint32_t leaf, uint32_t subleaf) {
+  cpuid_regs_t r;
+  __asm__ volatile("cpuid"
+                   : "=a"(r.eax), "=b"(r.ebx), "=c"(r.ecx), "=d"(r.edx)
+                   : "a"(leaf), "c"(subleaf));
+  return r;
+}
+
+static inline uint64_t rdmsr(uint32_t msr) {
+  uint32_t lo, hi;
+  __asm__ volatile("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+  return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t value) {
+  __asm__ volatile("wrmsr"
+                   :
+                   : "c"(msr), "a"((uint32_t)value), "d"(value >> 32)
+                   : "memory");
+}
+
+static inline uint64_t rdtsc(void) {
+  uint32_t lo, hi;
+  __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+  return ((uint64_t)hi << 32) | lo;
+}
+
+static inline uint64_t read_cr3(void) {
+  uint64_t value;
+  __asm__ volatile("mov %%cr3, %0" : "=r"(value));
+  return value;
+}
+
+static inline uint64_t read_cr4(void) {
+  uint64_t value;
+  __asm__ volatile("mov %%cr4, %0" : "=r"(value));
+  return value;
+}
+
+static inline void write_cr4(uint64_t value) {
+  __asm__ volatile("mov %0, %%cr4" : : "r"(value) : "memory");
+}
+
+static inline void invlpg(uint64_t virt) {
+  __asm__ volatile("invlpg (%0)" : : "r"(virt) : "memory");
+}
+
+static inline void cpu_relax(void) {
+  __asm__ volatile("pause" ::: "memory");
+}
+
+static inline void interrupts_enable(void) {
+  __asm__ volatile("sti" ::: "memory");
+}
+
+static inline void interrupts_disable(void) {
+  __asm__ volatile("cli" ::: "memory");
+}
+
+#define RFLAGS_IF (1 << 9)
+
+/**
+ * @brief disable interrupts, returning the previous rflags for irq_restore
+ */
+static inline uint64_t irq_save(void) {
+  uint64_t flags;
+  __asm__ volatile("pushfq\n\tpop %0\n\tcli" : "=r"(flags) : : "memory");
+  return flags;
+}
+
+static inline void irq_restore(uint64_t flags) {
+  if(flags & RFLAGS_IF)
+    interrupts_enable();
+}
+
+/**
+ * @brief index (0..MAX_CPUS-1) of the calling CPU, the BSP is 0
+ */
+static inline uint32_t cpu_index(void) {
+  return this_cpu_read(index);
+}
+
+uint32_t cpu_count(void);
+/**
+ * @brief bit n set for every CPU index n that has come online
+ */
+uint64_t cpu_online_mask(void);
+/**
+ * @brief record that the CPU with local APIC `lapic_id` uses `index`
+ */
+void     cpu_register(uint32_t index, uint32_t lapic_id);
+uint32_t cpu_lapic_id(uint32_t index);
+
+#endif  // _CPU_H
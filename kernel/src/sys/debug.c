@@ -0,0 +1,52 @@
+#include "debug.h"
+#include <stdlib.h>
+
+static struct {
+  const char *name;
+  const char *help;
+  debug_cmd_t cmd;
+} commands[DEBUG_MAX_COMMANDS];
+static int command_count = 0;
+
+void debug_register(const char *name, const char *help, debug_cmd_t cmd) {
+  if(command_count >= DEBUG_MAX_COMMANDS) {
+    kwarn("no room for debug command '%s'\n", name);
+    return;
+  }
+  commands[command_count].name = name;
+  commands[command_count].help = help;
+  commands[command_count].cmd  = cmd;
+  command_count++;
+}
+
+void debug_exec(char *line) {
+  char *argv[DEBUG_MAX_ARGS];
+  int   argc = 0;
+  while(*line && argc < DEBUG_MAX_ARGS) {
+    while(*line == ' ') *line++ = '\0';
+    if(*line == '\0')
+      break;
+    argv[argc++] = line;
+    while(*line && *line != ' ') line++;
+  }
+  if(argc == 0)
+    return;
+  for(int i = 0; i < command_count; ++i) {
+    if(strcmp(commands[i].name, argv[0]) == 0) {
+      commands[i].cmd(argc, argv);
+      return;
+    }
+  }
+  printf("unknown command '%s', try 'help'\n", argv[0]);
+}
+
+static void help_cmd(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+  for(int i = 0; i < command_count; ++i)
+    printf("  %-12s %s\n", commands[i].name, commands[i].help);
+}
+
+void debug_init(void) {
+  debug_register("help", "list debug commands", help_cmd);
+}
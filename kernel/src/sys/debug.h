@@ -0,0 +1,19 @@
+#ifndef _DEBUG_H
+#define _DEBUG_H
+
+/*
+kernel debug commands, typed on the serial console
+*/
+
+#define DEBUG_MAX_COMMANDS 32
+#define DEBUG_MAX_ARGS     8
+
+typedef void (*debug_cmd_t)(int argc, char **argv);
+
+void debug_register(const char *name, const char *help, debug_cmd_t cmd);
+/**
+ * @brief split `line` on spaces (in place) and run the command it names
+ */
+void debug_exec(char *line);
+void debug_init(void);
+#endif  // _DEBUG_H
@@ -0,0 +1,52 @@
+#include "gdt.h"
+#include <stdlib.h>
+#include <sys/cpu.h>
+
+#define SEG_CODE64      0x00AF9A000000FFFFull
+#define SEG_DATA        0x00CF92000000FFFFull
+#define SEG_USER_DATA   0x00CFF2000000FFFFull
+#define SEG_USER_CODE64 0x00AFFA000000FFFFull
+
+#define TSS_AVAILABLE 0x9
+#define SEG_PRESENT   (1ull << 47)
+
+static cpu_gdt_t gdts[MAX_CPUS] = { 0 };
+__attribute__((aligned(16))) static uint8_t
+  ist_stacks[MAX_CPUS][IST_COUNT][IST_STACK_SIZE];
+
+cpu_gdt_t *gdt_get(uint32_t cpu) {
+  return &gdts[cpu];
+}
+
+static void set_tss_descriptor(cpu_gdt_t *gdt, int index) {
+  uint64_t base  = (uint64_t)&gdt->tss;
+  uint64_t limit = sizeof(tss_t) - 1;
+  gdt->entries[index] = (limit & 0xFFFF) | ((base & 0xFFFFFF) << 16) |
+                        ((uint64_t)TSS_AVAILABLE << 40) | SEG_PRESENT |
+                        (((limit >> 16) & 0xF) << 48) |
+                        (((base >> 24) & 0xFF) << 56);
+  gdt->entries[index + 1] = base >> 32;
+}
+
+void gdt_init(uint32_t cpu) {
+  assert(cpu < MAX_CPUS);
+  cpu_gdt_t *gdt  = &gdts[cpu];
+  gdt->entries[0] = 0;
+  gdt->entries[GDT_KERNEL_CODE >> 3] = SEG_CODE64;
+  gdt->entries[GDT_KERNEL_DATA >> 3] = SEG_DATA;
+  gdt->entries[GDT_USER_DATA >> 3]   = SEG_USER_DATA;
+  gdt->entries[GDT_USER_CODE >> 3]   = SEG_USER_CODE64;
+
+  memset(&gdt->tss, 0, sizeof(gdt->tss));
+  // the stacks grow down so each IST entry points at the end of its stack
+  for(int i = 0; i < IST_COUNT; ++i)
+    gdt->tss.ist[i] = (uint64_t)&ist_stacks[cpu][i][IST_STACK_SIZE];
+  // no I/O permission bitmap
+  gdt->tss.iomap_base = sizeof(tss_t);
+  set_tss_descriptor(gdt, GDT_TSS >> 3);
+
+  gdt->gdtr.limit = sizeof(gdt->entries) - 1;
+  gdt->gdtr.base  = (uint64_t)gdt->entries;
+  load_gdt(&gdt->gdtr, GDT_KERNEL_CODE, GDT_KERNEL_DATA);
+  load_tss(GDT_TSS);
+}
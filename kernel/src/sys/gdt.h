@@ -0,0 +1,54 @@
+#ifndef _GDT_H
+#define _GDT_H
+#include <stdint.h>
+#include <sys/interrupts.h>
+
+/* selectors, in the order gdt_init lays out the descriptors */
+#define GDT_KERNEL_CODE 0x08
+#define GDT_KERNEL_DATA 0x10
+#define GDT_USER_DATA   (0x18 | 3)
+#define GDT_USER_CODE   (0x20 | 3)
+#define GDT_TSS         0x28
+
+/* 5 segment descriptors + the 16 byte TSS descriptor */
+#define GDT_ENTRIES 7
+
+/* interrupt stack table slots, numbered like the IDT `ist` field */
+#define IST_DOUBLE_FAULT  1
+#define IST_NMI           2
+#define IST_MACHINE_CHECK 3
+#define IST_PROFILE       4
+#define IST_COUNT         4
+
+#define IST_STACK_SIZE (16 * 1024)
+
+typedef struct tss {
+  uint32_t reserved0;
+  uint64_t rsp[3];
+  uint64_t reserved1;
+  uint64_t ist[7];
+  uint64_t reserved2;
+  uint16_t reserved3;
+  uint16_t iomap_base;
+} __attribute__((packed)) tss_t;
+
+typedef struct cpu_gdt {
+  uint64_t entries[GDT_ENTRIES];
+  tss_t    tss;
+  dtr_t    gdtr;
+} cpu_gdt_t;
+
+/**
+ * @brief build and load the GDT and TSS (with its IST stacks) of a CPU
+ *
+ * @param cpu index of the calling CPU
+ */
+void       gdt_init(uint32_t cpu);
+cpu_gdt_t *gdt_get(uint32_t cpu);
+
+/**
+ * @brief `lgdt` then reload every segment register (cs through a far return)
+ */
+extern void load_gdt(dtr_t *gdtr, uint16_t code, uint16_t data);
+extern void load_tss(uint16_t selector);
+#endif  // _GDT_H
@@ -27,7 +27,7 @@ format ELF64
 struc dtr_t limit,base ; structure for both gdtr & idtr
 {
   .limit dw limit ; length
-  .base dd base   ; address
+  .base dq base   ; address
 }
 
 struc interrupt_frame n
@@ -41,15 +41,40 @@ struc interrupt_frame n
 
 section '.text' executable align 16
 extrn interrupt_dispatch
+extrn irq_enter
+extrn preempt_irq_return
+extrn fast_interrupt_exit
+extrn fast_handlers
 public set_idtr
 public interrupt_stub
+public fast_interrupt_stub
+public isr_table
+public fast_isr_table
 public get_gdtr
+public load_gdt
+public load_tss
   set_idtr:
     mov [idtr.limit], di
-    mov [idtr.base], esi
+    mov [idtr.base], rsi
     lidt [idtr]
     lea rax, [idtr]
     ret
+  load_gdt: ; gdtr, code selector, data selector
+    lgdt [rdi]
+    mov ds, dx
+    mov es, dx
+    mov ss, dx
+    xor eax, eax
+    mov fs, ax
+    mov gs, ax
+    ; cs can only be reloaded with a far transfer
+    pop rax
+    push rsi
+    push rax
+    retfq
+  load_tss: ; selector
+    ltr di
+    ret
   get_gdtr:
     sgdt [gdtr]
     lea rax, [gdtr]
@@ -59,37 +84,83 @@ public get_gdtr
     push rbx
     push rcx
     push rdx
+    push rbp
     push rsi
     push rdi
     rept 8 n:8
     {
     push r#n
     }
+    ; 15 registers + vector/error code + iret frame keeps rsp 16 byte aligned
+    rdtsc
+    shl rdx, 32
+    or rax, rdx
+    mov rsi, rax ; entry timestamp, the handler's latency is recorded in C
     mov rdi, rsp
     call interrupt_dispatch
+    ; may switch threads, we come back here when this one runs again
+    mov rdi, [rsp + 15 * 8] ; vector_number
+    call preempt_irq_return
     rept 8 n:8
     {
     reverse pop r#n
     }
     pop rdi
     pop rsi
+    pop rbp
     pop rdx
     pop rcx
     pop rbx
     pop rax
     add rsp, 16
-    iret
+    iretq
 
 
-rept 256 n:0
-{
-public isr_#n
-}
+  ; hot IRQ path: only the registers a SysV callee may clobber are saved,
+  ; the C handler preserves the rest itself
+  fast_interrupt_stub:
+    push rax
+    push rcx
+    push rdx
+    push rsi
+    push rdi
+    push r8
+    push r9
+    push r10
+    push r11
+    sub rsp, 8 ; realign, the slot holds the entry timestamp
+    rdtsc
+    shl rdx, 32
+    or rax, rdx
+    mov [rsp], rax
+    call irq_enter
+    mov rdi, [rsp + 10 * 8] ; vector
+    lea rax, [fast_handlers]
+    call qword [rax + rdi * 8]
+    mov rdi, [rsp + 10 * 8]
+    mov rsi, [rsp]
+    call fast_interrupt_exit
+    ; a completion handler may have woken something, same as above
+    mov rdi, [rsp + 10 * 8]
+    call preempt_irq_return
+    add rsp, 8
+    pop r11
+    pop r10
+    pop r9
+    pop r8
+    pop rdi
+    pop rsi
+    pop rdx
+    pop rcx
+    pop rax
+    add rsp, 8 ; vector
+    iretq
+
+; the stubs are packed, interrupts.c finds them through the tables below
 macro isr n
 {
-align 16
 isr_#n:
-  if n in <8,10,11,12,13,14,17>
+  if n in <8,10,11,12,13,14,17,21,29,30>
   push QWORD n
   else
   push QWORD 0
@@ -97,10 +168,34 @@ isr_#n:
   end if
   jmp interrupt_stub
 }
-rept 256 n:0 
+rept 256 n:0
 {
 isr n
 }
+; IRQ vectors only, exceptions always need the full cpu_status_t
+macro fast_isr n
+{
+fast_isr_#n:
+  push QWORD n
+  jmp fast_interrupt_stub
+}
+rept 224 n:32
+{
+fast_isr n
+}
+
+section '.rodata' align 8
+isr_table:
+rept 256 n:0
+{
+  dq isr_#n
+}
+fast_isr_table:
+rept 224 n:32
+{
+  dq fast_isr_#n
+}
+
 section '.data' writeable
 idtr dtr_t 0, 0
 gdtr dtr_t 0, 0
\ No newline at end of file
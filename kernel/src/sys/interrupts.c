@@ -1,9 +1,48 @@
 #include "interrupts.h"
 #include <stdlib.h>
-extern char isr_0[];
-__attribute__((used, aligned(0x10))) static volatile struct idt_entry idt[256] = {0};
+#include <sys/apic.h>
+#include <sys/cpu.h>
+#include <sys/debug.h>
+#include <sys/gdt.h>
+#include <sys/irqstat.h>
+#include <sys/rcu.h>
+#include <sys/softirq.h>
+#include <sys/spinlock.h>
+extern uint64_t isr_table[256];
+extern uint64_t fast_isr_table[256 - EXCEPTION_COUNT];
+__attribute__((used, aligned(0x10))) static struct idt_entry idt[256] = {0};
 
-static interrupt_handler_t dummy = NULL;
+/* read on every interrupt, replaced almost never */
+static interrupt_handler_t handlers[256] = { 0 };
+// indexed by the fast stub, so it can't be static
+fast_interrupt_handler_t fast_handlers[256] = { 0 };
+
+/* a bit per vector in use from the dynamic range */
+static uint64_t   vectors_used[4] = { 0 };
+static spinlock_t vectors_lock    = SPINLOCK_INIT;
+
+static const char *exception_names[EXCEPTION_COUNT] = {
+  [0] = "divide error",
+  [1] = "debug",
+  [2] = "non-maskable interrupt",
+  [3] = "breakpoint",
+  [4] = "overflow",
+  [5] = "bound range exceeded",
+  [6] = "invalid opcode",
+  [7] = "device not available",
+  [8] = "double fault",
+  [10] = "invalid TSS",
+  [11] = "segment not present",
+  [12] = "stack-segment fault",
+  [13] = "general protection fault",
+  [14] = "page fault",
+  [16] = "x87 floating-point",
+  [17] = "alignment check",
+  [18] = "machine check",
+  [19] = "SIMD floating-point",
+  [20] = "virtualization",
+  [21] = "control protection",
+};
 
 /**
  * @brief Set idt entry to handler
@@ -18,40 +57,176 @@ void set_idt_entry(uint8_t vector, interrupt_handler_t handler, uint8_t dpl) {
   entry->address_low = handler_addr & 0xFFFF;
   entry->address_mid = (handler_addr >> 16) & 0xFFFF;
   entry->address_high = (handler_addr >> 32) & 0xffffffff;
-  // your code selector may be different!
-  entry->selector = 0x0;
-  // trap gate + present + DPL
-  entry->flags = 0b1110 | ((dpl & 0b11) << 5) | (1 << 7);
-  // ist disabled
+  entry->selector = GDT_KERNEL_CODE;
+  // interrupt gate + present + DPL
+  entry->flags = IDT_INTERRUPT_GATE | ((dpl & 0b11) << 5) | IDT_PRESENT;
+  // ist disabled, see set_idt_ist
   entry->ist = 0;
 }
 
-__attribute((naked)) void interrupt_dispatch(cpu_status_t *ctx) {
-  uint64_t n = ctx->vector_number;
-  if (n >= 32 && n <= 39)
-    kinfo("pic1 interrupt %llu\n", n);
-  else if (n >= 40 && n <= 47)
-    kinfo("pic2 interrupt %llu\n", n);
+void set_idt_ist(uint8_t vector, uint8_t ist) {
+  idt[vector].ist = ist & 0b111;
+}
+
+uint8_t get_idt_ist(uint8_t vector) {
+  return idt[vector].ist;
+}
+
+void set_interrupt_handler(uint8_t vector, interrupt_handler_t handler) {
+  rcu_assign_pointer(handlers[vector], handler);
+}
+
+void set_fast_interrupt_handler(uint8_t vector,
+                                fast_interrupt_handler_t handler) {
+  assert(vector >= EXCEPTION_COUNT);
+  uint8_t ist = idt[vector].ist;
+  fast_handlers[vector] = handler;
+  if (handler)
+    set_idt_entry(vector, (void *)fast_isr_table[vector - EXCEPTION_COUNT], 0);
   else
-    switch (ctx->vector_number) {
-  
-    case 13:
-      kerror("general protection fault. %llu\n", n);
-      break;
-    case 14:
-      kerror("page fault. %llu\n", n);
-      break;
-    default:
-      kerror("unexpected interrupt. %llu\n", ctx->vector_number);
+    set_idt_entry(vector, (void *)isr_table[vector], 0);
+  set_idt_ist(vector, ist);
+}
+
+uint8_t irq_alloc_vector(void) {
+  uint8_t  vector = 0;
+  uint64_t flags  = spin_lock_irqsave(&vectors_lock);
+  for (uint32_t v = VECTOR_DYNAMIC_BASE; v < VECTOR_DYNAMIC_END; ++v) {
+    if (!(vectors_used[v / 64] & (1ull << (v % 64)))) {
+      vectors_used[v / 64] |= 1ull << (v % 64);
+      vector = v;
       break;
     }
-  abort();
+  }
+  spin_unlock_irqrestore(&vectors_lock, flags);
+  return vector;
+}
+
+void irq_free_vector(uint8_t vector) {
+  assert(vector >= VECTOR_DYNAMIC_BASE && vector < VECTOR_DYNAMIC_END);
+  uint64_t flags = spin_lock_irqsave(&vectors_lock);
+  vectors_used[vector / 64] &= ~(1ull << (vector % 64));
+  spin_unlock_irqrestore(&vectors_lock, flags);
+}
+
+/*
+the latency recorded is up to the EOI, softirqs run by irq_exit are deferred
+work and not the handler's
+*/
+void fast_interrupt_exit(uint64_t vector, uint64_t entry_tsc) {
+  lapic_eoi();
+  irqstat_record(vector, rdtsc() - entry_tsc);
+  irq_exit();
+}
+
+void interrupt_dispatch(cpu_status_t *ctx, uint64_t entry_tsc) {
+  uint64_t n = ctx->vector_number;
+  interrupt_handler_t handler = rcu_dereference(handlers[n]);
+  if (n == VECTOR_NMI || n == VECTOR_PROFILE) {
+    // these land anywhere, even half way through irq_enter or a softirq, so
+    // no nesting count and no softirqs. an NMI nobody handles is ignored
+    if (handler)
+      handler(ctx);
+    if (n == VECTOR_PROFILE)
+      lapic_eoi();
+    irqstat_record(n, rdtsc() - entry_tsc);
+    return;
+  }
+  if (n >= EXCEPTION_COUNT)
+    irq_enter();
+  if (handler) {
+    handler(ctx);
+  } else if (n < EXCEPTION_COUNT) {
+    const char *name = exception_names[n] ? exception_names[n] : "reserved";
+    kerror("%s (vector %llu, error code 0x%llx) at rip 0x%016llx\n", name, n,
+           ctx->error_code, ctx->iret.ip);
+    abort();
+  } else if (n == VECTOR_SPURIOUS) {
+    // spurious interrupts must not be acknowledged
+    irqstat_record(n, rdtsc() - entry_tsc);
+    irq_exit();
+    return;
+  } else {
+    kwarn("unexpected interrupt. %llu\n", n);
+  }
+  if (n >= EXCEPTION_COUNT)
+    lapic_eoi();
+  irqstat_record(n, rdtsc() - entry_tsc);
+  // deferred work runs after the EOI so other interrupts can come in
+  if (n >= EXCEPTION_COUNT)
+    irq_exit();
+}
+
+void load_idt(void) {
+  set_idtr(sizeof(idt) - 1, (uint64_t)idt);
 }
 
 void init_handlers() {
   for (size_t i = 0; i < 256; i++)
-    set_idt_entry(i, (void *)((uint64_t)isr_0 + (i * 16)), 0);
+    set_idt_entry(i, (void *)isr_table[i], 0);
+  // these can hit with a broken kernel stack (or in the middle of another
+  // handler), so they always get a known good one
+  set_idt_ist(8, IST_DOUBLE_FAULT);
+  set_idt_ist(VECTOR_NMI, IST_NMI);
+  set_idt_ist(18, IST_MACHINE_CHECK);
+  set_idt_ist(VECTOR_PROFILE, IST_PROFILE);
 
-  dtr_t *ret = set_idtr(sizeof(idt) - 1, (uint32_t)idt);
-  kinfo("IDTR initialised to 0x%08X with length %u\n", ret->base, ret->limit);
-}
\ No newline at end of file
+  dtr_t *ret = set_idtr(sizeof(idt) - 1, (uint64_t)idt);
+  kinfo("IDTR initialised to 0x%016lX with length %u\n", ret->base, ret->limit);
+}
+
+#define BENCH_ITERATIONS 100000
+
+static volatile uint64_t bench_fired = 0;
+
+static void bench_handler(cpu_status_t *ctx) {
+  (void)ctx;
+  bench_fired++;
+}
+
+static void bench_fast_handler(uint64_t vector) {
+  (void)vector;
+  bench_fired++;
+}
+
+/*
+average cycles from sending a self-IPI through the ICR until its handler has
+run. a real delivery, so the EOI at the end acknowledges this vector and not
+whatever else happens to be in service
+*/
+static uint64_t bench_vector(uint8_t vector) {
+  uint32_t self = lapic_id();
+  bench_fired   = 0;
+  uint64_t start = rdtsc();
+  for (uint64_t i = 1; i <= BENCH_ITERATIONS; ++i) {
+    lapic_send_ipi(self, vector);
+    while (bench_fired != i)
+      cpu_relax();
+  }
+  return (rdtsc() - start) / BENCH_ITERATIONS;
+}
+
+/* round trip of a self-IPI through either entry path */
+static void bench_irq_cmd(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+  uint64_t flags = irq_save();
+  irq_restore(flags);
+  if (!(flags & RFLAGS_IF)) {
+    printf("bench-irq needs interrupts enabled\n");
+    return;
+  }
+  set_interrupt_handler(VECTOR_BENCH_FULL, bench_handler);
+  set_fast_interrupt_handler(VECTOR_BENCH_FAST, bench_fast_handler);
+  uint64_t full = bench_vector(VECTOR_BENCH_FULL);
+  uint64_t fast = bench_vector(VECTOR_BENCH_FAST);
+  set_interrupt_handler(VECTOR_BENCH_FULL, NULL);
+  set_fast_interrupt_handler(VECTOR_BENCH_FAST, NULL);
+  printf("full frame: %lu cycles/interrupt\n", full);
+  printf("fast path:  %lu cycles/interrupt\n", fast);
+}
+
+void interrupts_bench_init(void) {
+  debug_register("bench-irq", "compare full and fast interrupt entry cost",
+                 bench_irq_cmd);
+}
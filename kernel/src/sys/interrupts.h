@@ -23,27 +23,27 @@ typedef struct idt_entry {
     uint16_t address_mid;
   }; // offset bits 16..31
   union {
-    uint16_t offset_3;
-    uint16_t address_high;
+    uint32_t offset_3;
+    uint32_t address_high;
   }; // offset bits 32..63
   uint32_t zero; // reserved
-} idt_entry_t __attribute__((packed));
+} __attribute__((packed)) idt_entry_t;
 
-#define IDT_ENTRY(offset, _selector, flags)                                    \
+#define IDT_ENTRY(offset, _selector, _ist, flags)                              \
   ((struct idt_entry){                                                         \
       .offset_1 = (uint16_t)((uintptr_t)(offset) & 0xFFFF),                    \
       .selector = (_selector),                                                 \
-      .ist = 0,                                                                \
+      .ist = (_ist),                                                           \
       .type_attributes = (flags),                                              \
       .offset_2 = (uint16_t)(((uintptr_t)(offset) >> 16) & 0xFFFF),            \
-      .offset_3 = (uint16_t)(((uintptr_t)(offset) >> 32) & 0xFFFFFFFF)})
+      .offset_3 = (uint32_t)(((uintptr_t)(offset) >> 32) & 0xFFFFFFFF)})
 typedef struct iret_frame {
   uint64_t ip;
   uint64_t cs;
   uint64_t flags;
   uint64_t sp;
   uint64_t ss;
-} __attribute__((packed));
+} __attribute__((packed)) iret_frame_t;
 typedef struct cpu_status_t
 {
     uint64_t r15;
@@ -56,6 +56,7 @@ typedef struct cpu_status_t
     uint64_t r8;
     uint64_t rdi;
     uint64_t rsi;
+    uint64_t rbp;
     uint64_t rdx;
     uint64_t rcx;
     uint64_t rbx;
@@ -87,12 +88,67 @@ typedef struct cpu_status_t
 
 typedef struct dtr {
   uint16_t limit;
-  uint32_t base;
+  uint64_t base;
 } __attribute__((packed)) dtr_t;
 
+/* exceptions occupy 0..31, legacy ISA IRQs are routed to 0x20..0x2F */
+#define EXCEPTION_COUNT 32
+#define VECTOR_NMI      2
+#define IRQ_VECTOR_BASE 0x20
+/* handed out by irq_alloc_vector, for MSI/MSI-X */
+#define VECTOR_DYNAMIC_BASE 0x30
+#define VECTOR_DYNAMIC_END  0xF0
+#define VECTOR_TIMER 0xF0
+#define VECTOR_RESCHEDULE 0xFB
+#define VECTOR_BENCH_FULL 0xFC
+#define VECTOR_BENCH_FAST 0xFD
+#define VECTOR_PROFILE  0xFE
+#define VECTOR_SPURIOUS 0xFF
+
 typedef void (*interrupt_handler_t)(cpu_status_t *);
 void init_handlers(void);
 /**
+ * @brief install a C handler for `vector`, called from `interrupt_dispatch`.
+ * vectors >= 32 are acknowledged at the local APIC after the handler returns.
+ * VECTOR_NMI and VECTOR_PROFILE handlers can interrupt anything, so they run
+ * outside irq_enter/irq_exit and must stick to per-CPU state
+ *
+ * @param vector index in idt
+ * @param handler handler or NULL to remove it
+ */
+void set_interrupt_handler(uint8_t vector, interrupt_handler_t handler);
+
+/*
+fast path for hot IRQ vectors (timer, IPIs, devices): the entry stub only
+saves the caller-clobbered registers and calls the handler directly, no
+cpu_status_t is built. the handler runs with interrupts disabled and the
+EOI/softirq/stats work is done by the stub afterwards
+*/
+typedef void (*fast_interrupt_handler_t)(uint64_t vector);
+/**
+ * @brief route IRQ `vector` through the fast stub to `handler`, NULL puts
+ * the vector back on the full frame path
+ */
+void set_fast_interrupt_handler(uint8_t vector,
+                                fast_interrupt_handler_t handler);
+void interrupts_bench_init(void);
+/**
+ * @brief reserve a free vector in [VECTOR_DYNAMIC_BASE, VECTOR_DYNAMIC_END)
+ *
+ * @return the vector, or 0 when they're all taken
+ */
+uint8_t irq_alloc_vector(void);
+void    irq_free_vector(uint8_t vector);
+/**
+ * @brief run `vector` on interrupt stack `ist` (1..7, 0 to stay on the
+ * current stack)
+ */
+void set_idt_ist(uint8_t vector, uint8_t ist);
+uint8_t get_idt_ist(uint8_t vector);
+/**
+ * @brief load the shared IDT on the calling CPU
+ */
+void load_idt(void);
 /**
  * @brief Set the idt with `lidt` instruction
  *
@@ -100,6 +156,6 @@ void init_handlers(void);
  * @param base linear address containing idt
  * @return descriptor_table_reg* pointer to idtr
  */
-extern dtr_t *set_idtr(uint16_t limit, uint32_t base);
+extern dtr_t *set_idtr(uint16_t limit, uint64_t base);
 extern dtr_t *get_gdtr(void);
 #endif // _INTERRUPTS_H
\ No newline at end of file
@@ -0,0 +1,81 @@
+#include "irqstat.h"
+#include <stdlib.h>
+#include <sys/cpu.h>
+#include <sys/debug.h>
+
+static irqstat_t irqstats[MAX_CPUS][256] = { 0 };
+static uint64_t  irqstat_since           = 0;
+
+/* atomic read-modify-writes, so an NMI or profiling interrupt landing in
+ * the middle of this on the same CPU can't tear a counter */
+void irqstat_record(uint64_t vector, uint64_t cycles) {
+  irqstat_t *st = &irqstats[cpu_index()][vector & 0xFF];
+  __atomic_add_fetch(&st->count, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&st->cycles, cycles, __ATOMIC_RELAXED);
+  uint64_t max = __atomic_load_n(&st->max_cycles, __ATOMIC_RELAXED);
+  while(cycles > max && !__atomic_compare_exchange_n(&st->max_cycles,
+                                                     &max,
+                                                     cycles,
+                                                     true,
+                                                     __ATOMIC_RELAXED,
+                                                     __ATOMIC_RELAXED))
+    ;
+  int bucket = cycles ? 63 - __builtin_clzll(cycles) : 0;
+  if(bucket >= IRQSTAT_BUCKETS)
+    bucket = IRQSTAT_BUCKETS - 1;
+  __atomic_add_fetch(&st->hist[bucket], 1, __ATOMIC_RELAXED);
+}
+
+void irqstat_reset(void) {
+  uint64_t flags = irq_save();
+  memset(irqstats, 0, sizeof(irqstats));
+  irqstat_since = rdtsc();
+  irq_restore(flags);
+}
+
+void irqstat_dump(void) {
+  uint32_t cpus = cpu_count();
+  printf("interrupts over the last %lu TSC cycles:\n", rdtsc() - irqstat_since);
+  for(int v = 0; v < 256; ++v) {
+    irqstat_t total = { 0 };
+    for(uint32_t c = 0; c < cpus; ++c) {
+      irqstat_t *st = &irqstats[c][v];
+      total.count += st->count;
+      total.cycles += st->cycles;
+      if(st->max_cycles > total.max_cycles)
+        total.max_cycles = st->max_cycles;
+      for(int b = 0; b < IRQSTAT_BUCKETS; ++b) total.hist[b] += st->hist[b];
+    }
+    if(total.count == 0)
+      continue;
+    printf("vector 0x%02X: %lu total, avg %lu max %lu cycles\n",
+           v,
+           total.count,
+           total.cycles / total.count,
+           total.max_cycles);
+    printf("\tper cpu:");
+    for(uint32_t c = 0; c < cpus; ++c)
+      printf(" %u:%lu", c, irqstats[c][v].count);
+    printf("\n\tlog2 cycles:");
+    for(int b = 0; b < IRQSTAT_BUCKETS; ++b) {
+      if(total.hist[b])
+        printf(" 2^%d:%u", b, total.hist[b]);
+    }
+    printf("\n");
+  }
+}
+
+static void irqstat_cmd(int argc, char **argv) {
+  if(argc > 1 && strcmp(argv[1], "reset") == 0) {
+    irqstat_reset();
+    return;
+  }
+  irqstat_dump();
+}
+
+void irqstat_init(void) {
+  irqstat_since = rdtsc();
+  debug_register("irqstat",
+                 "per-vector interrupt counts and latency ('reset' clears)",
+                 irqstat_cmd);
+}
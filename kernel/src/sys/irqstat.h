@@ -0,0 +1,27 @@
+#ifndef _IRQSTAT_H
+#define _IRQSTAT_H
+#include <stdint.h>
+
+/* bucket n counts handler runs that took [2^n, 2^(n+1)) TSC cycles */
+#define IRQSTAT_BUCKETS 24
+
+typedef struct irqstat {
+  uint64_t count;
+  uint64_t cycles;
+  uint64_t max_cycles;
+  uint32_t hist[IRQSTAT_BUCKETS];
+} irqstat_t;
+
+/**
+ * @brief account one interrupt on the calling CPU, called on the way out
+ * with the cycles since the entry stub, up to the EOI. softirqs run after
+ * that are left out
+ */
+void irqstat_record(uint64_t vector, uint64_t cycles);
+void irqstat_reset(void);
+/**
+ * @brief print rate and latency histograms of every vector that fired
+ */
+void irqstat_dump(void);
+void irqstat_init(void);
+#endif  // _IRQSTAT_H
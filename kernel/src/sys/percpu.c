@@ -0,0 +1,31 @@
+#include "percpu.h"
+#include <stdlib.h>
+#include <sys/cpu.h>
+
+static percpu_t percpu_areas[MAX_CPUS] = { 0 };
+static bool     have_fsgsbase          = false;
+
+percpu_t *percpu_get(uint32_t cpu) {
+  return &percpu_areas[cpu];
+}
+
+void percpu_init(uint32_t cpu) {
+  assert(cpu < MAX_CPUS);
+  percpu_t *pc     = &percpu_areas[cpu];
+  pc->self         = pc;
+  pc->index        = cpu;
+  pc->tasklet_tail = &pc->tasklet_head;
+
+  // the BSP decides, the APs are assumed to match it
+  if(cpu == 0)
+    have_fsgsbase = (cpuid(7, 0).ebx & CPUID_7_EBX_FSGSBASE) != 0;
+  if(have_fsgsbase) {
+    write_cr4(read_cr4() | CR4_FSGSBASE);
+    __asm__ volatile("wrgsbase %0" : : "r"((uint64_t)pc) : "memory");
+  } else {
+    wrmsr(MSR_GS_BASE, (uint64_t)pc);
+  }
+  // there's no user mode yet; once there is, its GS lives here between
+  // swapgs on kernel entry and exit
+  wrmsr(MSR_KERNEL_GS_BASE, 0);
+}
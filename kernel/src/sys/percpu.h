@@ -0,0 +1,105 @@
+#ifndef _PERCPU_H
+#define _PERCPU_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+state owned by one CPU, reached through the GS base. only the owning CPU
+touches its area (with interrupts off where a handler could race), so nothing
+in here needs a lock
+*/
+
+#define MSR_FS_BASE        0xC0000100
+#define MSR_GS_BASE        0xC0000101
+#define MSR_KERNEL_GS_BASE 0xC0000102
+
+#define CACHE_LINE 64
+
+struct tasklet;
+struct rcu_head;
+struct thread;
+
+typedef struct percpu {
+  /* first so this_cpu_ptr is a single load */
+  struct percpu *self;
+  uint32_t       index;
+  uint32_t       lapic_id;
+
+  /* sched.c */
+  struct thread *current;
+  struct thread *idle;
+  struct thread *ksoftirqd;
+  uint32_t       preempt_count;
+  bool           need_resched;
+
+  /* softirq.c */
+  uint32_t         softirq_pending;
+  uint32_t         irq_nesting;
+  bool             in_softirq;
+  struct tasklet  *tasklet_head;
+  struct tasklet **tasklet_tail;
+
+  /* rcu.c */
+  uint64_t         rcu_qs_gp;
+  struct rcu_head *rcu_next;
+  struct rcu_head *rcu_wait;
+  uint64_t         rcu_wait_gp;
+
+  /* clockevent.c */
+  uint64_t clockevent_deadline;
+  uint64_t clockevent_fires;
+
+  /* numa.c */
+  uint32_t numa_node;
+} __attribute__((aligned(CACHE_LINE))) percpu_t;
+
+/**
+ * @brief point the GS base of the calling CPU at its per-CPU area
+ *
+ * has to run after gdt_init, reloading gs there may clear the base
+ */
+void      percpu_init(uint32_t cpu);
+percpu_t *percpu_get(uint32_t cpu);
+
+#define percpu_offset(field) offsetof(percpu_t, field)
+#define percpu_type(field)   __typeof__(((percpu_t *)0)->field)
+
+/* each of these is one gs: relative instruction, so they're also atomic with
+ * respect to interrupts on the calling CPU */
+#define this_cpu_read(field)                                                   \
+  ({                                                                           \
+    percpu_type(field) __v;                                                    \
+    __asm__ volatile("mov %%gs:%c1, %0"                                        \
+                     : "=r"(__v)                                               \
+                     : "i"(percpu_offset(field)));                             \
+    __v;                                                                       \
+  })
+
+#define this_cpu_write(field, val)                                             \
+  do {                                                                         \
+    percpu_type(field) __v = (val);                                            \
+    __asm__ volatile("mov %0, %%gs:%c1"                                        \
+                     :                                                         \
+                     : "r"(__v), "i"(percpu_offset(field))                     \
+                     : "memory");                                              \
+  } while(0)
+
+#define this_cpu_op(op, field, val)                                            \
+  do {                                                                         \
+    percpu_type(field) __v = (val);                                            \
+    __asm__ volatile(op " %0, %%gs:%c1"                                        \
+                     :                                                         \
+                     : "r"(__v), "i"(percpu_offset(field))                     \
+                     : "memory", "cc");                                        \
+  } while(0)
+
+#define this_cpu_add(field, val) this_cpu_op("add", field, val)
+#define this_cpu_sub(field, val) this_cpu_op("sub", field, val)
+#define this_cpu_or(field, val)  this_cpu_op("or", field, val)
+#define this_cpu_and(field, val) this_cpu_op("and", field, val)
+#define this_cpu_inc(field)      this_cpu_add(field, 1)
+#define this_cpu_dec(field)      this_cpu_sub(field, 1)
+
+#define this_cpu_ptr() this_cpu_read(self)
+#endif  // _PERCPU_H
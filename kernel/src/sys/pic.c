@@ -30,6 +30,16 @@ void PIC_remap() {
   outb(PIC2_DATA, 0);
 }
 
+/*
+moves the 8259s out of the way of the exception vectors and masks every
+line, interrupts are delivered through the APICs instead
+*/
+void pic_disable(void) {
+  PIC_remap();
+  outb(PIC1_DATA, 0xFF);
+  outb(PIC2_DATA, 0xFF);
+}
+
 #define PIC_READ_IRR                0x0a    /* OCW3 irq ready next CMD read */
 #define PIC_READ_ISR                0x0b    /* OCW3 irq service next CMD read */
 
@@ -25,5 +25,6 @@
 #define CASCADE_IRQ 2
 
 void PIC_remap(void);
+void pic_disable(void);
 uint16_t pic_get_isr(void);
 #endif // PIC_H
\ No newline at end of file
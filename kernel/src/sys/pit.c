@@ -0,0 +1,43 @@
+#include "pit.h"
+#include <stdlib.h>
+#include <sys/bits.h>
+#include <sys/cpu.h>
+
+void pit_oneshot_start(uint32_t us) {
+  assert(us > 0 && us <= PIT_MAX_US);
+  uint32_t count = (uint64_t)PIT_FREQUENCY * us / 1000000;
+  // gate off and the speaker disconnected while we set it up
+  uint8_t port_b = inb(PIT_PORT_B) & ~(PIT_PORT_B_GATE2 | PIT_PORT_B_SPEAKER);
+  outb(PIT_PORT_B, port_b);
+  // channel 2, lobyte/hibyte, mode 0 (interrupt on terminal count), binary
+  outb(PIT_COMMAND, 0xB0);
+  outb(PIT_CHANNEL2, count & 0xFF);
+  outb(PIT_CHANNEL2, count >> 8);
+  // the count starts once the gate goes high
+  outb(PIT_PORT_B, port_b | PIT_PORT_B_GATE2);
+}
+
+bool pit_oneshot_done(void) {
+  return (inb(PIT_PORT_B) & PIT_PORT_B_OUT2) != 0;
+}
+
+void pit_delay_us(uint32_t us) {
+  while(us > 0) {
+    uint32_t step = us > PIT_MAX_US ? PIT_MAX_US : us;
+    pit_oneshot_start(step);
+    while(!pit_oneshot_done()) cpu_relax();
+    us -= step;
+  }
+}
+
+void pit_irq_oneshot(uint16_t count) {
+  // channel 0, lobyte/hibyte, mode 0: IRQ 0 rises at terminal count
+  outb(PIT_COMMAND, 0x30);
+  outb(PIT_CHANNEL0, count & 0xFF);
+  outb(PIT_CHANNEL0, count >> 8);
+}
+
+void pit_irq_stop(void) {
+  // in mode 0 the counter holds until a new count is written
+  outb(PIT_COMMAND, 0x30);
+}
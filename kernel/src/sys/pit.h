@@ -0,0 +1,36 @@
+#ifndef _PIT_H
+#define _PIT_H
+#include <stdbool.h>
+#include <stdint.h>
+
+/* 8253/8254 programmable interval timer */
+#define PIT_FREQUENCY 1193182
+#define PIT_CHANNEL0  0x40
+#define PIT_CHANNEL2  0x42
+#define PIT_COMMAND   0x43
+/* keyboard controller port B: bit 0 gates channel 2, bit 5 is its output */
+#define PIT_PORT_B    0x61
+
+#define PIT_PORT_B_GATE2   (1 << 0)
+#define PIT_PORT_B_SPEAKER (1 << 1)
+#define PIT_PORT_B_OUT2    (1 << 5)
+
+/* the 16 bit counter runs out after this long */
+#define PIT_MAX_US 54000
+
+/**
+ * @brief start a one-shot countdown of `us` microseconds on channel 2, which
+ * doesn't need an interrupt line, poll pit_oneshot_done for the end
+ */
+void pit_oneshot_start(uint32_t us);
+bool pit_oneshot_done(void);
+/**
+ * @brief busy wait, only meant for calibrating other timers
+ */
+void pit_delay_us(uint32_t us);
+/**
+ * @brief raise IRQ 0 once, `count` PIT ticks from now
+ */
+void pit_irq_oneshot(uint16_t count);
+void pit_irq_stop(void);
+#endif  // _PIT_H
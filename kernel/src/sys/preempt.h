@@ -0,0 +1,32 @@
+#ifndef _PREEMPT_H
+#define _PREEMPT_H
+#include <sys/percpu.h>
+
+/*
+a thread can only be switched out involuntarily while the calling CPU's
+preempt_count is zero. spinlocks and RCU read-side sections bump it, so they
+are never left half way through by a timer tick
+*/
+
+/**
+ * @brief reschedule if something asked for it and we're allowed to, see
+ * sched.c
+ */
+void preempt_schedule(void);
+
+static inline void preempt_disable(void) {
+  this_cpu_inc(preempt_count);
+}
+
+static inline void preempt_enable(void) {
+  this_cpu_dec(preempt_count);
+  if(this_cpu_read(preempt_count) == 0 && this_cpu_read(need_resched))
+    preempt_schedule();
+}
+
+/* drop the count without the reschedule check, for callers that do it
+ * themselves once interrupts are back on */
+static inline void preempt_enable_no_resched(void) {
+  this_cpu_dec(preempt_count);
+}
+#endif  // _PREEMPT_H
@@ -0,0 +1,214 @@
+#include "profile.h"
+#include <sched/thread.h>
+#include <stdlib.h>
+#include <sys/apic.h>
+#include <sys/cpu.h>
+#include <sys/debug.h>
+#include <sys/interrupts.h>
+#include <time/clocksource.h>
+
+/* cycles between samples, PMC0 writes only take 31 bits of it */
+#define PROFILE_MIN_PERIOD 10000
+#define PROFILE_MAX_PERIOD 0x7FFFFFFF
+/* distinct rips the dump tells apart, and how many it prints */
+#define PROFILE_SLOT_BITS 10
+#define PROFILE_SLOTS     (1 << PROFILE_SLOT_BITS)
+#define PROFILE_TOP       20
+
+typedef struct profile_cpu {
+  uint64_t rips[PROFILE_SAMPLES];
+  /* samples taken since arming, the ring wraps at PROFILE_SAMPLES */
+  uint64_t taken;
+  /* NMIs that weren't the counter's */
+  uint64_t unclaimed;
+  bool     armed;
+} __attribute__((aligned(CACHE_LINE))) profile_cpu_t;
+
+typedef struct profile_slot {
+  uint64_t rip;
+  uint64_t count;
+} profile_slot_t;
+
+static profile_cpu_t  profile_cpus[MAX_CPUS];
+static profile_slot_t slots[PROFILE_SLOTS];
+static uint32_t       pmu_version = 0;
+static uint32_t       pmu_width   = 0;
+static uint64_t       period      = 0;
+/* LVT_PERF while sampling, NMI or VECTOR_PROFILE */
+static uint32_t       lvt         = LAPIC_LVT_MASKED;
+static bool           running     = false;
+
+static void pmu_rearm(void) {
+  // the low 32 bits, sign extended to the counter's width
+  wrmsr(MSR_PMC0, (uint32_t)-period);
+  if(pmu_version >= 2)
+    wrmsr(MSR_PERF_GLOBAL_OVF_CTRL, 1);
+  // delivering the interrupt masked the entry
+  lapic_write(LAPIC_LVT_PERF, lvt);
+}
+
+/* PMC0 counts up from -period, its top bit clears when it wraps */
+static inline bool pmu_overflowed(void) {
+  return !(rdmsr(MSR_PMC0) & (1ull << (pmu_width - 1)));
+}
+
+static bool sample(cpu_status_t *ctx) {
+  profile_cpu_t *pc = &profile_cpus[cpu_index()];
+  if(!pc->armed || !pmu_overflowed())
+    return false;
+  pc->rips[pc->taken % PROFILE_SAMPLES] = ctx->iret.ip;
+  pc->taken++;
+  pmu_rearm();
+  return true;
+}
+
+/* anything else raising an NMI is counted and otherwise ignored */
+static void nmi_handler(cpu_status_t *ctx) {
+  if(!sample(ctx))
+    profile_cpus[cpu_index()].unclaimed++;
+}
+
+static void profile_handler(cpu_status_t *ctx) {
+  sample(ctx);
+}
+
+/* runs pinned to each CPU, arg is non-NULL to arm and NULL to disarm */
+static void pmu_setup(void *arg) {
+  profile_cpu_t *pc    = &profile_cpus[cpu_index()];
+  uint64_t       flags = irq_save();
+  wrmsr(MSR_PERFEVTSEL0, 0);
+  if(arg) {
+    pc->taken = 0;
+    pmu_rearm();
+    if(pmu_version >= 2)
+      wrmsr(MSR_PERF_GLOBAL_CTRL, rdmsr(MSR_PERF_GLOBAL_CTRL) | 1);
+    wrmsr(MSR_PERFEVTSEL0,
+          PERF_EVENT_CORE_CYCLES | PERFEVTSEL_OS | PERFEVTSEL_INT |
+            PERFEVTSEL_EN);
+    pc->armed = true;
+  } else {
+    pc->armed = false;
+    lapic_write(LAPIC_LVT_PERF, LAPIC_LVT_MASKED);
+    if(pmu_version >= 2)
+      wrmsr(MSR_PERF_GLOBAL_CTRL, rdmsr(MSR_PERF_GLOBAL_CTRL) & ~1ull);
+  }
+  irq_restore(flags);
+}
+
+static void pmu_setup_all(bool arm) {
+  for(uint32_t c = 0; c < cpu_count(); ++c)
+    thread_create_on(c, "profile", pmu_setup, arm ? (void *)1 : NULL);
+}
+
+bool profile_start(uint32_t hz, bool nmi) {
+  if(pmu_version == 0 || running || hz == 0)
+    return false;
+  period = clocksource.tsc_hz / hz;
+  if(period < PROFILE_MIN_PERIOD)
+    period = PROFILE_MIN_PERIOD;
+  if(period > PROFILE_MAX_PERIOD)
+    period = PROFILE_MAX_PERIOD;
+  lvt     = nmi ? LAPIC_DELIVERY_NMI : LAPIC_DELIVERY_FIXED | VECTOR_PROFILE;
+  running = true;
+  pmu_setup_all(true);
+  return true;
+}
+
+void profile_stop(void) {
+  if(!running)
+    return;
+  running = false;
+  pmu_setup_all(false);
+}
+
+static void profile_dump(void) {
+  uint64_t total = 0, lost = 0;
+  memset(slots, 0, sizeof(slots));
+  for(uint32_t c = 0; c < cpu_count(); ++c) {
+    profile_cpu_t *pc = &profile_cpus[c];
+    uint64_t n = pc->taken < PROFILE_SAMPLES ? pc->taken : PROFILE_SAMPLES;
+    printf("cpu %u: %lu samples, %lu unclaimed NMIs\n",
+           c,
+           pc->taken,
+           pc->unclaimed);
+    for(uint64_t i = 0; i < n; ++i) {
+      uint64_t rip  = pc->rips[i];
+      uint32_t slot = (rip * 0x9E3779B97F4A7C15ull) >> (64 - PROFILE_SLOT_BITS);
+      uint32_t probe;
+      for(probe = 0; probe < PROFILE_SLOTS; ++probe) {
+        profile_slot_t *s = &slots[(slot + probe) % PROFILE_SLOTS];
+        if(s->count == 0 || s->rip == rip) {
+          s->rip = rip;
+          s->count++;
+          break;
+        }
+      }
+      if(probe == PROFILE_SLOTS)
+        lost++;
+      total++;
+    }
+  }
+  if(total == 0)
+    return;
+  if(lost)
+    printf("%lu samples past %u distinct rips not shown\n",
+           lost,
+           PROFILE_SLOTS);
+  for(int i = 0; i < PROFILE_TOP; ++i) {
+    profile_slot_t *top = &slots[0];
+    for(uint32_t s = 1; s < PROFILE_SLOTS; ++s)
+      if(slots[s].count > top->count)
+        top = &slots[s];
+    if(top->count == 0)
+      break;
+    printf("%8lu %3lu%%  0x%016lx\n",
+           top->count,
+           top->count * 100 / total,
+           top->rip);
+    top->count = 0;
+  }
+}
+
+static void profile_cmd(int argc, char **argv) {
+  if(argc > 1 && strcmp(argv[1], "start") == 0) {
+    uint32_t hz  = PROFILE_DEFAULT_HZ;
+    bool     nmi = true;
+    for(int i = 2; i < argc; ++i) {
+      if(strcmp(argv[i], "irq") == 0) {
+        nmi = false;
+        continue;
+      }
+      hz = 0;
+      for(const char *s = argv[i]; *s >= '0' && *s <= '9'; ++s)
+        hz = hz * 10 + (*s - '0');
+    }
+    if(pmu_version == 0)
+      printf("no architectural performance counters\n");
+    else if(running)
+      printf("already sampling\n");
+    else if(!profile_start(hz, nmi))
+      printf("usage: profile start [hz] [irq]\n");
+    return;
+  }
+  if(argc > 1 && strcmp(argv[1], "stop") == 0) {
+    profile_stop();
+    return;
+  }
+  profile_dump();
+}
+
+void profile_init(void) {
+  if(cpuid(0, 0).eax >= 0xA) {
+    cpuid_regs_t r = cpuid(0xA, 0);
+    // ebx bit 0 set (or not enumerated) means no core cycles event
+    if((r.eax >> 8 & 0xFF) > 0 && (r.eax >> 24) > 0 && !(r.ebx & 1)) {
+      pmu_version = r.eax & 0xFF;
+      pmu_width   = r.eax >> 16 & 0xFF;
+    }
+  }
+  set_interrupt_handler(VECTOR_NMI, nmi_handler);
+  set_interrupt_handler(VECTOR_PROFILE, profile_handler);
+  debug_register("profile",
+                 "sample rips (start [hz] [irq], stop, or dump the top ones)",
+                 profile_cmd);
+}
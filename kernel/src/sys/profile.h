@@ -0,0 +1,42 @@
+#ifndef _PROFILE_H
+#define _PROFILE_H
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+sampling profiler. the first architectural performance counter counts
+unhalted core cycles and interrupts every CPU when it wraps, by default as
+an NMI so code running with interrupts off is sampled too. each interrupt
+records the interrupted rip in a per-CPU ring. the handlers run on their
+own IST stacks and only touch per-CPU state: no locks, no irq_enter/irq_exit
+and no console output
+*/
+
+/* architectural performance monitoring, CPUID.0AH */
+#define MSR_PMC0                 0xC1
+#define MSR_PERFEVTSEL0          0x186
+#define MSR_PERF_GLOBAL_STATUS   0x38E
+#define MSR_PERF_GLOBAL_CTRL     0x38F
+#define MSR_PERF_GLOBAL_OVF_CTRL 0x390
+
+#define PERFEVTSEL_OS  (1 << 17)
+#define PERFEVTSEL_INT (1 << 20)
+#define PERFEVTSEL_EN  (1 << 22)
+/* unhalted core cycles, umask 0 */
+#define PERF_EVENT_CORE_CYCLES 0x3C
+
+/* rips kept per CPU, older ones are overwritten */
+#define PROFILE_SAMPLES 2048
+#define PROFILE_DEFAULT_HZ 1000
+
+/**
+ * @brief start sampling every CPU `hz` times a second of busy time
+ *
+ * @param nmi deliver the counter interrupt as an NMI rather than on
+ * VECTOR_PROFILE, which only sees code running with interrupts on
+ * @return false if the CPU has no usable performance counter
+ */
+bool profile_start(uint32_t hz, bool nmi);
+void profile_stop(void);
+void profile_init(void);
+#endif  // _PROFILE_H
@@ -0,0 +1,141 @@
+#include "rcu.h"
+#include <stdlib.h>
+#include <sys/cpu.h>
+#include <sys/debug.h>
+#include <sys/smp.h>
+#include <sys/softirq.h>
+#include <sys/spinlock.h>
+
+static struct {
+  spinlock_t lock;
+  /* last grace period started and last one completed, equal when idle */
+  volatile uint64_t gp_seq;
+  volatile uint64_t gp_completed;
+  uint64_t          gp_requested;
+  /* CPUs that still have to report for gp_seq */
+  volatile uint64_t qs_mask;
+  /* CPUs with callbacks waiting on a grace period */
+  volatile uint64_t cb_mask;
+} rcu = { .lock = SPINLOCK_INIT };
+
+/* call with rcu.lock held. the mask is published before the new sequence
+ * number, a CPU that sees the new number clears its bit in the right mask */
+static void start_gp_locked(void) {
+  if(rcu.gp_seq != rcu.gp_completed || rcu.gp_requested <= rcu.gp_completed)
+    return;
+  __atomic_store_n(&rcu.qs_mask, cpu_online_mask(), __ATOMIC_RELAXED);
+  __atomic_store_n(&rcu.gp_seq, rcu.gp_seq + 1, __ATOMIC_RELEASE);
+  // idle CPUs won't notice until something wakes them
+  smp_kick_mask(cpu_online_mask());
+}
+
+/* the caller cleared the last bit of qs_mask. that ends whichever grace
+ * period is in progress now, which may be newer than the one it looked at */
+static void end_gp(void) {
+  uint64_t flags = spin_lock_irqsave(&rcu.lock);
+  __atomic_store_n(&rcu.gp_completed, rcu.gp_seq, __ATOMIC_RELEASE);
+  start_gp_locked();
+  spin_unlock_irqrestore(&rcu.lock, flags);
+  // the CPUs whose callbacks are now ready run them on their next pass
+  smp_kick_mask(__atomic_load_n(&rcu.cb_mask, __ATOMIC_RELAXED));
+}
+
+/* returns the grace period that has to complete before anything queued now
+ * is safe to free: the next one to start */
+static uint64_t request_gp(void) {
+  uint64_t flags  = spin_lock_irqsave(&rcu.lock);
+  uint64_t target = rcu.gp_seq + 1;
+  if(target > rcu.gp_requested)
+    rcu.gp_requested = target;
+  start_gp_locked();
+  spin_unlock_irqrestore(&rcu.lock, flags);
+  return target;
+}
+
+/* interrupts off, on the owning CPU */
+static void advance_callbacks(percpu_t *pc) {
+  if(pc->rcu_wait != NULL || pc->rcu_next == NULL)
+    return;
+  pc->rcu_wait = pc->rcu_next;
+  pc->rcu_next = NULL;
+  __atomic_fetch_or(&rcu.cb_mask, 1ull << pc->index, __ATOMIC_RELAXED);
+  pc->rcu_wait_gp = request_gp();
+}
+
+static bool callbacks_ready(percpu_t *pc) {
+  return pc->rcu_wait &&
+         __atomic_load_n(&rcu.gp_completed, __ATOMIC_ACQUIRE) >=
+           pc->rcu_wait_gp;
+}
+
+void call_rcu(rcu_head_t *head, void (*func)(rcu_head_t *)) {
+  uint64_t  flags = irq_save();
+  percpu_t *pc    = this_cpu_ptr();
+  head->func      = func;
+  head->next      = pc->rcu_next;
+  pc->rcu_next    = head;
+  advance_callbacks(pc);
+  irq_restore(flags);
+}
+
+void rcu_quiescent_state(void) {
+  uint64_t  flags = irq_save();
+  percpu_t *pc    = this_cpu_ptr();
+  uint64_t  gp    = __atomic_load_n(&rcu.gp_seq, __ATOMIC_ACQUIRE);
+  if(gp != __atomic_load_n(&rcu.gp_completed, __ATOMIC_RELAXED) &&
+     pc->rcu_qs_gp != gp) {
+    pc->rcu_qs_gp = gp;
+    uint64_t bit  = 1ull << pc->index;
+    // we're quiescent right now, which counts for any grace period that has
+    // started, even one newer than `gp`
+    if(__atomic_fetch_and(&rcu.qs_mask, ~bit, __ATOMIC_ACQ_REL) == bit)
+      end_gp();
+  }
+  if(callbacks_ready(pc) || (pc->rcu_wait == NULL && pc->rcu_next))
+    raise_softirq(SOFTIRQ_RCU);
+  irq_restore(flags);
+}
+
+static void rcu_process_callbacks(void) {
+  uint64_t    flags = irq_save();
+  percpu_t   *pc    = this_cpu_ptr();
+  rcu_head_t *done  = NULL;
+  if(callbacks_ready(pc)) {
+    done         = pc->rcu_wait;
+    pc->rcu_wait = NULL;
+    __atomic_fetch_and(&rcu.cb_mask, ~(1ull << pc->index), __ATOMIC_RELAXED);
+  }
+  advance_callbacks(pc);
+  irq_restore(flags);
+
+  while(done) {
+    rcu_head_t *next = done->next;
+    done->func(done);
+    done = next;
+  }
+}
+
+void synchronize_rcu(void) {
+  uint64_t target = request_gp();
+  while(__atomic_load_n(&rcu.gp_completed, __ATOMIC_ACQUIRE) < target) {
+    rcu_quiescent_state();
+    cpu_relax();
+  }
+}
+
+static void rcu_cmd(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+  printf("grace period %lu, completed %lu, requested %lu\n",
+         rcu.gp_seq,
+         rcu.gp_completed,
+         rcu.gp_requested);
+  printf("waiting on cpus 0x%lx, callbacks on cpus 0x%lx\n",
+         rcu.qs_mask,
+         rcu.cb_mask);
+}
+
+void rcu_init(void) {
+  open_softirq(SOFTIRQ_RCU, rcu_process_callbacks);
+  debug_register("rcu", "grace period state", rcu_cmd);
+}
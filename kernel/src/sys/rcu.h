@@ -0,0 +1,46 @@
+#ifndef _RCU_H
+#define _RCU_H
+#include <stdint.h>
+#include <sys/preempt.h>
+
+/*
+quiescent-state-based RCU. readers just read: a CPU passing through its idle
+loop (or a scheduler tick outside any read-side section) has dropped every
+reference it had, and once every CPU has done so since an update, whatever
+the update replaced can be freed.
+
+readers must not block or sleep between rcu_read_lock and rcu_read_unlock.
+the only cost to them is keeping preemption off, a gs relative inc/dec
+*/
+
+typedef struct rcu_head {
+  struct rcu_head *next;
+  void (*func)(struct rcu_head *head);
+} rcu_head_t;
+
+#define rcu_read_lock()   preempt_disable()
+#define rcu_read_unlock() preempt_enable()
+
+/* x86 doesn't reorder dependent loads, a plain (non-torn) load is enough */
+#define rcu_dereference(p) (*(volatile __typeof__(p) *)&(p))
+/* everything written to *v before is visible to whoever sees the pointer */
+#define rcu_assign_pointer(p, v) __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+
+void rcu_init(void);
+/**
+ * @brief run `func(head)` once every CPU has passed a quiescent state
+ *
+ * callbacks are batched per CPU, one grace period covers all of them, and
+ * they run from SOFTIRQ_RCU on the CPU that queued them
+ */
+void call_rcu(rcu_head_t *head, void (*func)(rcu_head_t *));
+/**
+ * @brief wait for a full grace period, spinning. not from a read-side section
+ */
+void synchronize_rcu(void);
+/**
+ * @brief report that the calling CPU holds no RCU references right now.
+ * called from the idle loop and scheduler ticks
+ */
+void rcu_quiescent_state(void);
+#endif  // _RCU_H
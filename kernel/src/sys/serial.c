@@ -0,0 +1,94 @@
+#include "serial.h"
+#include <stdlib.h>
+#include <sys/apic.h>
+#include <sys/bits.h>
+#include <sys/debug.h>
+#include <sys/interrupts.h>
+#include <sys/softirq.h>
+
+static bool serial_present = false;
+
+/* filled by the interrupt handler, drained by the tasklet */
+static volatile char     rx_buf[SERIAL_RX_BUFFER];
+static volatile uint32_t rx_head = 0, rx_tail = 0;
+static tasklet_t         rx_tasklet;
+
+static char   line[128];
+static size_t line_len = 0;
+
+bool serial_init(void) {
+  outb(COM1 + UART_IER, 0x00);  // no interrupts while configuring
+  outb(COM1 + UART_LCR, 0x80);  // DLAB on
+  outb(COM1 + UART_DATA, 0x01); // divisor 1 -> 115200 baud
+  outb(COM1 + UART_IER, 0x00);
+  outb(COM1 + UART_LCR, 0x03);  // 8N1, DLAB off
+  outb(COM1 + UART_FCR, 0xC7);  // enable and clear FIFOs, 14 byte threshold
+  // loopback test, the port might not exist at all
+  outb(COM1 + UART_MCR, 0x1E);
+  outb(COM1 + UART_DATA, 0xAE);
+  if(inb(COM1 + UART_DATA) != 0xAE)
+    return false;
+  outb(COM1 + UART_MCR, 0x0B);  // DTR, RTS, OUT2 (interrupt enable)
+  serial_present = true;
+  return true;
+}
+
+void serial_putc(char c) {
+  if(!serial_present)
+    return;
+  while(!(inb(COM1 + UART_LSR) & UART_LSR_THR_EMPTY)) {}
+  outb(COM1 + UART_DATA, c);
+}
+
+void serial_write(const char *buf, size_t len) {
+  for(size_t i = 0; i < len; ++i) {
+    if(buf[i] == '\n')
+      serial_putc('\r');
+    serial_putc(buf[i]);
+  }
+}
+
+/* keep the hard interrupt short: empty the FIFO and defer the rest */
+static void serial_irq(cpu_status_t *ctx) {
+  (void)ctx;
+  while(inb(COM1 + UART_LSR) & UART_LSR_DATA_READY) {
+    char     c    = inb(COM1 + UART_DATA);
+    uint32_t next = (rx_head + 1) % SERIAL_RX_BUFFER;
+    if(next == rx_tail)
+      continue;  // full, drop
+    rx_buf[rx_head] = c;
+    rx_head         = next;
+  }
+  tasklet_schedule(&rx_tasklet);
+}
+
+static void serial_rx_tasklet(uint64_t data) {
+  (void)data;
+  while(rx_tail != rx_head) {
+    char c  = rx_buf[rx_tail];
+    rx_tail = (rx_tail + 1) % SERIAL_RX_BUFFER;
+    if(c == '\r' || c == '\n') {
+      serial_write("\n", 1);
+      line[line_len] = '\0';
+      line_len       = 0;
+      debug_exec(line);
+      serial_write("> ", 2);
+    } else if((c == '\b' || c == 0x7F) && line_len > 0) {
+      line_len--;
+      serial_write("\b \b", 3);
+    } else if(c >= ' ' && line_len < sizeof(line) - 1) {
+      line[line_len++] = c;
+      serial_putc(c);
+    }
+  }
+}
+
+void serial_enable_rx(void) {
+  if(!serial_present)
+    return;
+  tasklet_init(&rx_tasklet, serial_rx_tasklet, 0);
+  set_interrupt_handler(IRQ_VECTOR_BASE + COM1_IRQ, serial_irq);
+  ioapic_route_isa(COM1_IRQ, IRQ_VECTOR_BASE + COM1_IRQ);
+  outb(COM1 + UART_IER, 0x01);  // data available
+  serial_write("> ", 2);
+}
@@ -0,0 +1,34 @@
+#ifndef _SERIAL_H
+#define _SERIAL_H
+#include <stdbool.h>
+#include <stddef.h>
+
+#define COM1     0x3F8
+#define COM1_IRQ 4
+
+/* 16550 UART register offsets */
+#define UART_DATA 0
+#define UART_IER  1
+#define UART_FCR  2
+#define UART_LCR  3
+#define UART_MCR  4
+#define UART_LSR  5
+
+#define UART_LSR_DATA_READY (1 << 0)
+#define UART_LSR_THR_EMPTY  (1 << 5)
+
+#define SERIAL_RX_BUFFER 256
+
+/**
+ * @brief set up COM1 at 115200 8N1. output works right away, input needs
+ * `serial_enable_rx` once the I/O APIC is up
+ */
+bool serial_init(void);
+void serial_putc(char c);
+void serial_write(const char *buf, size_t len);
+/**
+ * @brief route the receive interrupt; finished lines are run as debug
+ * commands from a tasklet
+ */
+void serial_enable_rx(void);
+#endif  // _SERIAL_H
@@ -0,0 +1,163 @@
+#include "smp.h"
+#include <mm/numa.h>
+#include <mm/pmm.h>
+#include <sched/sched.h>
+#include <sched/task.h>
+#include <sched/topology.h>
+#include <stdlib.h>
+#include <sys/apic.h>
+#include <sys/cpu.h>
+#include <sys/gdt.h>
+#include <sys/interrupts.h>
+#include <sys/rcu.h>
+#include <sys/softirq.h>
+#include <time/clockevent.h>
+#include <time/timer.h>
+
+__attribute__((aligned(16))) static uint8_t
+  ap_stacks[MAX_CPUS][AP_STACK_SIZE];
+/* written by the AP once it's done initialising, polled by the BSP */
+static volatile uint64_t ap_online_tsc[MAX_CPUS] = { 0 };
+/*
+lapic id of the AP being started. it swaps in AP_CLAIMED before touching
+anything of its index, the BSP swaps in AP_NONE when it gives up, so
+exactly one of them wins and a late AP never uses an index handed on
+*/
+#define AP_NONE    (~0ull)
+#define AP_CLAIMED (~1ull)
+static volatile uint64_t ap_starting = AP_NONE;
+
+[[noreturn]] void cpu_idle(void) {
+  for(;;) {
+    rcu_quiescent_state();
+    interrupts_disable();
+    if(softirq_pending()) {
+      interrupts_enable();
+      do_softirq();
+      continue;
+    }
+    if(sched_has_work() || sched_steal()) {
+      schedule();
+      interrupts_enable();
+      continue;
+    }
+    // one page at a time, so new work doesn't wait for a whole refill
+    if(zero_pool_wants_page()) {
+      interrupts_enable();
+      zero_pool_fill();
+      continue;
+    }
+    // sti only takes effect after the next instruction, so nothing can
+    // sneak in between the check and the hlt
+    __asm__ volatile("sti\n\thlt" ::: "memory");
+  }
+}
+
+void smp_kick(uint32_t cpu) {
+  lapic_send_ipi(cpu_lapic_id(cpu), VECTOR_RESCHEDULE);
+}
+
+void smp_kick_mask(uint64_t mask) {
+  mask &= ~(1ull << cpu_index());
+  while(mask) {
+    smp_kick(__builtin_ctzll(mask));
+    mask &= mask - 1;
+  }
+}
+
+/* the interrupt itself is the point, the EOI happens in interrupt_dispatch */
+static void kick_handler(cpu_status_t *ctx) {
+  (void)ctx;
+}
+
+/* runs on the AP's own stack */
+[[noreturn]] __attribute__((used)) void smp_ap_main(uint32_t cpu) {
+  gdt_init(cpu);
+  percpu_init(cpu);
+  load_idt();
+  lapic_init();
+  clockevent_init_cpu();
+  timer_init_cpu();
+  cpu_register(cpu, lapic_id());
+  numa_init_cpu(cpu);
+  topology_init_cpu(cpu);
+  sched_init_cpu(cpu);
+  task_init_cpu(cpu);
+  __atomic_store_n(&ap_online_tsc[cpu], rdtsc(), __ATOMIC_RELEASE);
+  cpu_idle();
+}
+
+/* limine jumps here on the AP with interrupts off and a bootloader stack */
+[[noreturn]] static void ap_entry(struct limine_mp_info *info) {
+  uint32_t cpu      = info->extra_argument;
+  uint64_t expected = info->lapic_id;
+  if(!__atomic_compare_exchange_n(&ap_starting,
+                                  &expected,
+                                  AP_CLAIMED,
+                                  false,
+                                  __ATOMIC_ACQ_REL,
+                                  __ATOMIC_ACQUIRE)) {
+    // the BSP gave up on us, stay out of the way for good
+    for(;;) __asm__ volatile("cli\n\thlt");
+  }
+  __asm__ volatile("mov %0, %%rsp\n\t"
+                   "xor %%ebp, %%ebp\n\t"
+                   "call smp_ap_main"
+                   :
+                   : "r"(&ap_stacks[cpu][AP_STACK_SIZE]), "D"(cpu)
+                   : "memory");
+  __builtin_unreachable();
+}
+
+void smp_init(struct limine_mp_response *mp) {
+  set_interrupt_handler(VECTOR_RESCHEDULE, kick_handler);
+  if(mp == nullptr) {
+    kwarn("no MP response, running on the BSP only\n");
+    return;
+  }
+  uint32_t next = 1;
+  for(uint64_t i = 0; i < mp->cpu_count; ++i) {
+    struct limine_mp_info *info = mp->cpus[i];
+    if(info->lapic_id == mp->bsp_lapic_id)
+      continue;
+    if(next >= MAX_CPUS) {
+      kwarn("cpu with lapic %u ignored, MAX_CPUS is %d\n", info->lapic_id,
+            MAX_CPUS);
+      continue;
+    }
+    // indices stay dense: one is only used up by an AP that claims it, an
+    // AP that doesn't in time is refused if it turns up later
+    uint32_t cpu         = next;
+    info->extra_argument = cpu;
+    __atomic_store_n(&ap_starting, info->lapic_id, __ATOMIC_RELEASE);
+    uint64_t start = rdtsc();
+    __atomic_store_n(&info->goto_address, ap_entry, __ATOMIC_SEQ_CST);
+    uint64_t expected = info->lapic_id;
+    while(__atomic_load_n(&ap_starting, __ATOMIC_ACQUIRE) != AP_CLAIMED) {
+      if(rdtsc() - start > AP_TIMEOUT_CYCLES &&
+         __atomic_compare_exchange_n(&ap_starting,
+                                     &expected,
+                                     AP_NONE,
+                                     false,
+                                     __ATOMIC_ACQ_REL,
+                                     __ATOMIC_ACQUIRE))
+        break;
+      cpu_relax();
+    }
+    if(__atomic_load_n(&ap_starting, __ATOMIC_ACQUIRE) != AP_CLAIMED) {
+      kerror("cpu with lapic %u did not come up\n", info->lapic_id);
+      continue;
+    }
+    next++;
+    // it's running our code on its own stack now, from here a hang is a bug
+    uint64_t online;
+    while((online = __atomic_load_n(&ap_online_tsc[cpu], __ATOMIC_ACQUIRE)) ==
+          0)
+      cpu_relax();
+    __atomic_store_n(&ap_starting, AP_NONE, __ATOMIC_RELEASE);
+    kinfo("cpu %u (lapic %u) online after %lu cycles\n", cpu, info->lapic_id,
+          online - start);
+  }
+  kinfo("%u of %lu cpus online\n", cpu_count(), mp->cpu_count);
+  topology_build();
+}
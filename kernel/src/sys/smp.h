@@ -0,0 +1,32 @@
+#ifndef _SMP_H
+#define _SMP_H
+#include <limine.h>
+#include <stdint.h>
+
+/* stack each AP switches to, away from the bootloader reclaimable one */
+#define AP_STACK_SIZE (16 * 1024)
+/* give up on an AP that hasn't checked in after this many TSC cycles */
+#define AP_TIMEOUT_CYCLES 4000000000ull
+
+/**
+ * @brief start every application processor in `mp`, one at a time
+ *
+ * each AP loads its own GDT/TSS, the shared IDT and its local APIC, then parks
+ * in `cpu_idle`. must run after apic_init on the BSP
+ */
+void smp_init(struct limine_mp_response *mp);
+/**
+ * @brief send VECTOR_RESCHEDULE to `cpu`, which does nothing but make it
+ * leave `hlt` and go around its idle loop (or scheduler) once
+ */
+void smp_kick(uint32_t cpu);
+/**
+ * @brief smp_kick every CPU in `mask` except the calling one
+ */
+void smp_kick_mask(uint64_t mask);
+/**
+ * @brief the per-CPU idle loop: report a quiescent state, run deferred work
+ * and queued threads, and sleep until the next interrupt, forever
+ */
+[[noreturn]] void cpu_idle(void);
+#endif  // _SMP_H
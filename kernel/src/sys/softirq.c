@@ -0,0 +1,126 @@
+#include "softirq.h"
+#include <stdlib.h>
+#include <sched/thread.h>
+#include <sys/cpu.h>
+
+static softirq_handler_t softirq_handlers[SOFTIRQ_COUNT] = { 0 };
+
+static void tasklet_action(void);
+
+void softirq_init(void) {
+  open_softirq(SOFTIRQ_TASKLET, tasklet_action);
+}
+
+void open_softirq(enum softirq_class nr, softirq_handler_t handler) {
+  softirq_handlers[nr] = handler;
+}
+
+void raise_softirq(enum softirq_class nr) {
+  this_cpu_or(softirq_pending, 1u << nr);
+}
+
+bool softirq_pending(void) {
+  return this_cpu_read(softirq_pending) != 0;
+}
+
+void do_softirq(void) {
+  uint64_t flags = irq_save();
+  if(this_cpu_read(in_softirq) || this_cpu_read(irq_nesting) > 0) {
+    irq_restore(flags);
+    return;
+  }
+  this_cpu_write(in_softirq, true);
+  uint64_t start = rdtsc();
+  for(int restart = 0; restart < SOFTIRQ_MAX_RESTART; ++restart) {
+    // take a snapshot, anything raised while the handlers run is picked up
+    // on the next pass
+    // interrupts are off, so nothing can raise in between
+    uint32_t pending = this_cpu_read(softirq_pending);
+    this_cpu_write(softirq_pending, 0);
+    if(pending == 0)
+      break;
+    interrupts_enable();
+    while(pending) {
+      int nr = __builtin_ctz(pending);
+      pending &= pending - 1;
+      if(softirq_handlers[nr])
+        softirq_handlers[nr]();
+    }
+    interrupts_disable();
+    if(rdtsc() - start > SOFTIRQ_BUDGET_CYCLES)
+      break;
+  }
+  this_cpu_write(in_softirq, false);
+  // out of budget, hand the rest to this CPU's ksoftirqd
+  thread_t *k = this_cpu_read(ksoftirqd);
+  if(this_cpu_read(softirq_pending) && k && k != this_cpu_read(current))
+    thread_unpark(k);
+  irq_restore(flags);
+}
+
+void irq_enter(void) {
+  this_cpu_inc(irq_nesting);
+}
+
+void irq_exit(void) {
+  this_cpu_dec(irq_nesting);
+  if(this_cpu_read(irq_nesting) == 0 && !this_cpu_read(in_softirq) &&
+     this_cpu_read(softirq_pending))
+    do_softirq();
+}
+
+bool in_interrupt(void) {
+  return this_cpu_read(irq_nesting) > 0 || this_cpu_read(in_softirq);
+}
+
+void tasklet_init(tasklet_t *t, void (*func)(uint64_t), uint64_t data) {
+  t->next  = NULL;
+  t->func  = func;
+  t->data  = data;
+  t->state = 0;
+}
+
+void tasklet_schedule(tasklet_t *t) {
+  if(__atomic_fetch_or(&t->state, TASKLET_SCHEDULED, __ATOMIC_ACQ_REL) &
+     TASKLET_SCHEDULED)
+    return;
+  uint64_t  flags   = irq_save();
+  percpu_t *pc      = this_cpu_ptr();
+  t->next           = NULL;
+  *pc->tasklet_tail = t;
+  pc->tasklet_tail  = &t->next;
+  raise_softirq(SOFTIRQ_TASKLET);
+  irq_restore(flags);
+}
+
+static void tasklet_action(void) {
+  uint64_t   flags = irq_save();
+  percpu_t  *pc    = this_cpu_ptr();
+  tasklet_t *list  = pc->tasklet_head;
+  pc->tasklet_head = NULL;
+  pc->tasklet_tail = &pc->tasklet_head;
+  irq_restore(flags);
+
+  int budget = TASKLET_BUDGET;
+  while(list) {
+    tasklet_t *t = list;
+    list         = list->next;
+    // another CPU is still running it, or we're out of budget: requeue
+    if(budget == 0 ||
+       __atomic_fetch_or(&t->state, TASKLET_RUNNING, __ATOMIC_ACQUIRE) &
+         TASKLET_RUNNING) {
+      flags             = irq_save();
+      t->next           = NULL;
+      *pc->tasklet_tail = t;
+      pc->tasklet_tail  = &t->next;
+      raise_softirq(SOFTIRQ_TASKLET);
+      irq_restore(flags);
+      continue;
+    }
+    budget--;
+    // clear SCHEDULED first so the tasklet can requeue itself
+    __atomic_fetch_and(&t->state, ~TASKLET_SCHEDULED, __ATOMIC_ACQ_REL);
+    t->func(t->data);
+    __atomic_fetch_and(&t->state, ~TASKLET_RUNNING, __ATOMIC_RELEASE);
+  }
+}
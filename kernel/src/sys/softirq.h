@@ -0,0 +1,71 @@
+#ifndef _SOFTIRQ_H
+#define _SOFTIRQ_H
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+deferred interrupt work. hard interrupt handlers only acknowledge the device
+and raise a softirq (or schedule a tasklet); the heavy lifting runs on the
+way out of the outermost interrupt with interrupts enabled again
+*/
+
+/* lower numbers run first */
+enum softirq_class {
+  SOFTIRQ_HI = 0,
+  SOFTIRQ_TIMER,
+  SOFTIRQ_NET_TX,
+  SOFTIRQ_NET_RX,
+  SOFTIRQ_BLOCK,
+  SOFTIRQ_TASKLET,
+  SOFTIRQ_SCHED,
+  SOFTIRQ_RCU,
+  SOFTIRQ_COUNT
+};
+
+/* stop after this many passes over the pending mask... */
+#define SOFTIRQ_MAX_RESTART 10
+/* ...or once this many TSC cycles have gone by (~1ms at 2GHz) */
+#define SOFTIRQ_BUDGET_CYCLES 2000000ull
+/* tasklets run per SOFTIRQ_TASKLET invocation */
+#define TASKLET_BUDGET 64
+
+typedef void (*softirq_handler_t)(void);
+
+#define TASKLET_SCHEDULED (1 << 0)
+#define TASKLET_RUNNING   (1 << 1)
+
+typedef struct tasklet {
+  struct tasklet *next;
+  void (*func)(uint64_t data);
+  uint64_t          data;
+  volatile uint32_t state;
+} tasklet_t;
+
+void softirq_init(void);
+void open_softirq(enum softirq_class nr, softirq_handler_t handler);
+/**
+ * @brief mark `nr` pending on the calling CPU. safe from interrupt context
+ */
+void raise_softirq(enum softirq_class nr);
+bool softirq_pending(void);
+/**
+ * @brief run pending softirqs within the budget, whatever is left is handed
+ * to the CPU's ksoftirqd thread
+ */
+void do_softirq(void);
+
+/**
+ * @brief bookkeeping around hard interrupt handlers, `irq_exit` runs
+ * softirqs when leaving the outermost interrupt
+ */
+void irq_enter(void);
+void irq_exit(void);
+bool in_interrupt(void);
+
+void tasklet_init(tasklet_t *t, void (*func)(uint64_t), uint64_t data);
+/**
+ * @brief queue `t` on the calling CPU. a tasklet that's already scheduled
+ * is not queued twice, and never runs concurrently with itself
+ */
+void tasklet_schedule(tasklet_t *t);
+#endif  // _SOFTIRQ_H
@@ -0,0 +1,316 @@
+#include "spinlock.h"
+#include <stdlib.h>
+#include <sys/cpu.h>
+#include <sys/debug.h>
+#include <sys/preempt.h>
+
+static lock_stats_t *stats_head    = NULL;
+static spinlock_t    registry_lock = SPINLOCK_INIT;
+
+/* exclusive holders own their stats, no atomics needed */
+static inline void stats_acquired(lock_stats_t *st, uint64_t start,
+                                  bool contended) {
+  uint64_t now = rdtsc();
+  st->acquisitions++;
+  if(contended) {
+    st->contended++;
+    st->spin_cycles += now - start;
+  }
+  st->acquired_at = now;
+}
+
+static inline void stats_released(lock_stats_t *st) {
+  // attached while the lock was held, no start time to go by
+  if(st->acquired_at == 0)
+    return;
+  uint64_t held = rdtsc() - st->acquired_at;
+  if(held > st->max_hold_cycles)
+    st->max_hold_cycles = held;
+}
+
+/* readers share the lock, and so its stats */
+static inline void stats_shared(lock_stats_t *st, uint64_t start,
+                                bool contended) {
+  __atomic_fetch_add(&st->acquisitions, 1, __ATOMIC_RELAXED);
+  if(contended) {
+    __atomic_fetch_add(&st->contended, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&st->spin_cycles, rdtsc() - start, __ATOMIC_RELAXED);
+  }
+}
+
+void spin_init(spinlock_t *lock) {
+  lock->word  = 0;
+  lock->stats = NULL;
+}
+
+void spin_lock(spinlock_t *lock) {
+  preempt_disable();
+  uint16_t ticket = __atomic_fetch_add(&lock->next, 1, __ATOMIC_RELAXED);
+  bool     contended = false;
+  uint64_t start     = 0;
+  if(__atomic_load_n(&lock->owner, __ATOMIC_ACQUIRE) != ticket) {
+    contended = true;
+    start     = rdtsc();
+    while(__atomic_load_n(&lock->owner, __ATOMIC_ACQUIRE) != ticket)
+      cpu_relax();
+  }
+  if(lock->stats)
+    stats_acquired(lock->stats, start, contended);
+}
+
+bool spin_trylock(spinlock_t *lock) {
+  preempt_disable();
+  uint32_t old = __atomic_load_n(&lock->word, __ATOMIC_RELAXED);
+  // take the next ticket if it's also the one being served
+  if((old & 0xFFFF) != (old >> 16) ||
+     !__atomic_compare_exchange_n(&lock->word,
+                                  &old,
+                                  old + (1u << 16),
+                                  false,
+                                  __ATOMIC_ACQUIRE,
+                                  __ATOMIC_RELAXED)) {
+    preempt_enable();
+    return false;
+  }
+  if(lock->stats)
+    stats_acquired(lock->stats, 0, false);
+  return true;
+}
+
+static inline void spin_release(spinlock_t *lock) {
+  if(lock->stats)
+    stats_released(lock->stats);
+  // only the holder writes owner
+  __atomic_store_n(&lock->owner, lock->owner + 1, __ATOMIC_RELEASE);
+}
+
+void spin_unlock(spinlock_t *lock) {
+  spin_release(lock);
+  preempt_enable();
+}
+
+bool spin_is_locked(spinlock_t *lock) {
+  uint32_t word = __atomic_load_n(&lock->word, __ATOMIC_RELAXED);
+  return (word & 0xFFFF) != (word >> 16);
+}
+
+uint64_t spin_lock_irqsave(spinlock_t *lock) {
+  uint64_t flags = irq_save();
+  spin_lock(lock);
+  return flags;
+}
+
+/* the reschedule check waits until interrupts are back on */
+void spin_unlock_irqrestore(spinlock_t *lock, uint64_t flags) {
+  spin_release(lock);
+  irq_restore(flags);
+  preempt_enable();
+}
+
+void mcs_lock(mcs_lock_t *lock, mcs_node_t *node) {
+  preempt_disable();
+  node->next   = NULL;
+  node->locked = true;
+  mcs_node_t *prev = __atomic_exchange_n(&lock->tail, node, __ATOMIC_ACQ_REL);
+  bool        contended = prev != NULL;
+  uint64_t    start     = 0;
+  if(contended) {
+    start = rdtsc();
+    __atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);
+    // spin on our own node, not on the shared lock word
+    while(__atomic_load_n(&node->locked, __ATOMIC_ACQUIRE)) cpu_relax();
+  }
+  if(lock->stats)
+    stats_acquired(lock->stats, start, contended);
+}
+
+static void mcs_release(mcs_lock_t *lock, mcs_node_t *node) {
+  if(lock->stats)
+    stats_released(lock->stats);
+  mcs_node_t *next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE);
+  if(next == NULL) {
+    mcs_node_t *expected = node;
+    if(__atomic_compare_exchange_n(&lock->tail,
+                                   &expected,
+                                   NULL,
+                                   false,
+                                   __ATOMIC_RELEASE,
+                                   __ATOMIC_RELAXED))
+      return;
+    // someone swapped themselves in but hasn't linked up yet
+    while((next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE)) == NULL)
+      cpu_relax();
+  }
+  __atomic_store_n(&next->locked, false, __ATOMIC_RELEASE);
+}
+
+void mcs_unlock(mcs_lock_t *lock, mcs_node_t *node) {
+  mcs_release(lock, node);
+  preempt_enable();
+}
+
+uint64_t mcs_lock_irqsave(mcs_lock_t *lock, mcs_node_t *node) {
+  uint64_t flags = irq_save();
+  mcs_lock(lock, node);
+  return flags;
+}
+
+void mcs_unlock_irqrestore(mcs_lock_t *lock, mcs_node_t *node,
+                           uint64_t flags) {
+  mcs_release(lock, node);
+  irq_restore(flags);
+  preempt_enable();
+}
+
+void read_lock(rwlock_t *lock) {
+  preempt_disable();
+  bool     contended = false;
+  uint64_t start     = 0;
+  for(;;) {
+    uint32_t v = __atomic_load_n(&lock->value, __ATOMIC_RELAXED);
+    if(!(v & (RW_WRITER | RW_WAITING)) &&
+       __atomic_compare_exchange_n(
+         &lock->value, &v, v + 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+      break;
+    if(!contended) {
+      contended = true;
+      start     = rdtsc();
+    }
+    cpu_relax();
+  }
+  if(lock->stats)
+    stats_shared(lock->stats, start, contended);
+}
+
+void read_unlock(rwlock_t *lock) {
+  __atomic_fetch_sub(&lock->value, 1, __ATOMIC_RELEASE);
+  preempt_enable();
+}
+
+void write_lock(rwlock_t *lock) {
+  preempt_disable();
+  bool     contended = false;
+  uint64_t start     = 0;
+  for(;;) {
+    uint32_t v = __atomic_load_n(&lock->value, __ATOMIC_RELAXED);
+    // free apart from (possibly our own) waiting bit, taking it clears the
+    // bit and any other waiting writer sets it again
+    if((v & ~RW_WAITING) == 0) {
+      if(__atomic_compare_exchange_n(&lock->value,
+                                     &v,
+                                     RW_WRITER,
+                                     false,
+                                     __ATOMIC_ACQUIRE,
+                                     __ATOMIC_RELAXED))
+        break;
+      continue;
+    }
+    if(!(v & RW_WAITING))
+      __atomic_fetch_or(&lock->value, RW_WAITING, __ATOMIC_RELAXED);
+    if(!contended) {
+      contended = true;
+      start     = rdtsc();
+    }
+    cpu_relax();
+  }
+  if(lock->stats)
+    stats_acquired(lock->stats, start, contended);
+}
+
+static inline void write_release(rwlock_t *lock) {
+  if(lock->stats)
+    stats_released(lock->stats);
+  __atomic_fetch_and(&lock->value, ~RW_WRITER, __ATOMIC_RELEASE);
+}
+
+void write_unlock(rwlock_t *lock) {
+  write_release(lock);
+  preempt_enable();
+}
+
+uint64_t read_lock_irqsave(rwlock_t *lock) {
+  uint64_t flags = irq_save();
+  read_lock(lock);
+  return flags;
+}
+
+void read_unlock_irqrestore(rwlock_t *lock, uint64_t flags) {
+  __atomic_fetch_sub(&lock->value, 1, __ATOMIC_RELEASE);
+  irq_restore(flags);
+  preempt_enable();
+}
+
+uint64_t write_lock_irqsave(rwlock_t *lock) {
+  uint64_t flags = irq_save();
+  write_lock(lock);
+  return flags;
+}
+
+void write_unlock_irqrestore(rwlock_t *lock, uint64_t flags) {
+  write_release(lock);
+  irq_restore(flags);
+  preempt_enable();
+}
+
+static void stats_register(lock_stats_t *stats, const char *name) {
+  memset(stats, 0, sizeof(*stats));
+  stats->name    = name;
+  uint64_t flags = spin_lock_irqsave(&registry_lock);
+  stats->next    = stats_head;
+  stats_head     = stats;
+  spin_unlock_irqrestore(&registry_lock, flags);
+}
+
+void spin_stats_attach(spinlock_t *lock, lock_stats_t *stats,
+                       const char *name) {
+  stats_register(stats, name);
+  lock->stats = stats;
+}
+
+void mcs_stats_attach(mcs_lock_t *lock, lock_stats_t *stats,
+                      const char *name) {
+  stats_register(stats, name);
+  lock->stats = stats;
+}
+
+void rw_stats_attach(rwlock_t *lock, lock_stats_t *stats, const char *name) {
+  stats_register(stats, name);
+  lock->stats = stats;
+}
+
+void lock_stats_dump(void) {
+  uint64_t flags = spin_lock_irqsave(&registry_lock);
+  for(lock_stats_t *st = stats_head; st; st = st->next) {
+    printf("%s: %lu acquired, %lu contended, avg spin %lu max hold %lu cycles\n",
+           st->name,
+           st->acquisitions,
+           st->contended,
+           st->contended ? st->spin_cycles / st->contended : 0,
+           st->max_hold_cycles);
+  }
+  spin_unlock_irqrestore(&registry_lock, flags);
+}
+
+void lock_stats_reset(void) {
+  uint64_t flags = spin_lock_irqsave(&registry_lock);
+  for(lock_stats_t *st = stats_head; st; st = st->next) {
+    st->acquisitions    = 0;
+    st->contended       = 0;
+    st->spin_cycles     = 0;
+    st->max_hold_cycles = 0;
+  }
+  spin_unlock_irqrestore(&registry_lock, flags);
+}
+
+static void locks_cmd(int argc, char **argv) {
+  if(argc > 1 && strcmp(argv[1], "reset") == 0) {
+    lock_stats_reset();
+    return;
+  }
+  lock_stats_dump();
+}
+
+void lock_stats_init(void) {
+  debug_register("locks", "lock contention stats, 'locks reset' clears them",
+                 locks_cmd);
+}
@@ -0,0 +1,108 @@
+#ifndef _SPINLOCK_H
+#define _SPINLOCK_H
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+busy waiting locks. ticket locks for short, lightly contended sections, MCS
+locks where many CPUs pile up (each waiter spins on its own cache line), and
+reader-writer locks for read-mostly data. the `_irqsave` variants also keep
+local interrupts off while the lock is held, use them for anything an
+interrupt handler can take. every lock keeps preemption off while held
+*/
+
+/* optional contention statistics, attached to a lock with *_stats_attach */
+typedef struct lock_stats {
+  const char        *name;
+  uint64_t           acquisitions;
+  uint64_t           contended;
+  uint64_t           spin_cycles;
+  uint64_t           max_hold_cycles;
+  uint64_t           acquired_at;
+  struct lock_stats *next;
+} lock_stats_t;
+
+typedef struct spinlock {
+  union {
+    volatile uint32_t word;
+    struct {
+      volatile uint16_t owner;
+      volatile uint16_t next;
+    };
+  };
+  lock_stats_t *stats;
+} spinlock_t;
+
+#define SPINLOCK_INIT { .word = 0, .stats = NULL }
+
+typedef struct mcs_node {
+  struct mcs_node *volatile next;
+  volatile bool locked;
+} mcs_node_t;
+
+typedef struct mcs_lock {
+  mcs_node_t *volatile tail;
+  lock_stats_t *stats;
+} mcs_lock_t;
+
+#define MCS_LOCK_INIT { .tail = NULL, .stats = NULL }
+
+/* bit 31 writer holds it, bit 30 a writer is waiting, the rest count readers */
+#define RW_WRITER  (1u << 31)
+#define RW_WAITING (1u << 30)
+#define RW_READERS (RW_WAITING - 1)
+
+typedef struct rwlock {
+  volatile uint32_t value;
+  lock_stats_t     *stats;
+} rwlock_t;
+
+#define RWLOCK_INIT { .value = 0, .stats = NULL }
+
+void spin_init(spinlock_t *lock);
+void spin_lock(spinlock_t *lock);
+bool spin_trylock(spinlock_t *lock);
+void spin_unlock(spinlock_t *lock);
+bool spin_is_locked(spinlock_t *lock);
+/**
+ * @brief disable local interrupts, then take the lock
+ *
+ * @return rflags to hand back to spin_unlock_irqrestore
+ */
+uint64_t spin_lock_irqsave(spinlock_t *lock);
+void     spin_unlock_irqrestore(spinlock_t *lock, uint64_t flags);
+
+/**
+ * @brief queue on `lock` using `node`, which has to stay alive (usually on
+ * the caller's stack) until the matching mcs_unlock
+ */
+void     mcs_lock(mcs_lock_t *lock, mcs_node_t *node);
+void     mcs_unlock(mcs_lock_t *lock, mcs_node_t *node);
+uint64_t mcs_lock_irqsave(mcs_lock_t *lock, mcs_node_t *node);
+void     mcs_unlock_irqrestore(mcs_lock_t *lock, mcs_node_t *node,
+                               uint64_t flags);
+
+/**
+ * @brief readers share the lock, a waiting writer holds off new readers so it
+ * can't be starved
+ */
+void     read_lock(rwlock_t *lock);
+void     read_unlock(rwlock_t *lock);
+void     write_lock(rwlock_t *lock);
+void     write_unlock(rwlock_t *lock);
+uint64_t read_lock_irqsave(rwlock_t *lock);
+void     read_unlock_irqrestore(rwlock_t *lock, uint64_t flags);
+uint64_t write_lock_irqsave(rwlock_t *lock);
+void     write_unlock_irqrestore(rwlock_t *lock, uint64_t flags);
+
+/**
+ * @brief start collecting statistics for a lock under `name`, shown by the
+ * "locks" debug command
+ */
+void spin_stats_attach(spinlock_t *lock, lock_stats_t *stats, const char *name);
+void mcs_stats_attach(mcs_lock_t *lock, lock_stats_t *stats, const char *name);
+void rw_stats_attach(rwlock_t *lock, lock_stats_t *stats, const char *name);
+void lock_stats_dump(void);
+void lock_stats_reset(void);
+void lock_stats_init(void);
+#endif  // _SPINLOCK_H
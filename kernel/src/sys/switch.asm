@@ -0,0 +1,39 @@
+format ELF64
+
+; ARGUMENT ORDER:
+; rdi, rsi, rdx, rcx, r8d
+; return value in rax
+
+section '.text' executable align 16
+extrn thread_start
+public context_switch
+public thread_entry_stub
+  ; prev, next (thread_t *, rsp is their first field)
+  ; only the callee-saved registers need keeping, the caller of
+  ; context_switch already assumes everything else is clobbered. returns the
+  ; thread we switched away from, as seen on the stack we switched to
+  context_switch:
+    push rbx
+    push rbp
+    push r12
+    push r13
+    push r14
+    push r15
+    mov [rdi], rsp
+    mov rsp, [rsi]
+    pop r15
+    pop r14
+    pop r13
+    pop r12
+    pop rbp
+    pop rbx
+    mov rax, rdi
+    ret
+  ; a new thread's first context_switch returns here with the entry point in
+  ; r12 and its argument in r13, see thread_create_on
+  thread_entry_stub:
+    mov rdi, rax
+    mov rsi, r12
+    mov rdx, r13
+    call thread_start
+    ud2
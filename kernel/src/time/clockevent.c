@@ -0,0 +1,182 @@
+#include "clockevent.h"
+#include <stdlib.h>
+#include <sys/apic.h>
+#include <sys/cpu.h>
+#include <sys/debug.h>
+#include <sys/interrupts.h>
+#include <sys/pit.h>
+#include <time/clocksource.h>
+
+static clockevent_t        *device = NULL;
+static clockevent_handler_t handlers[CLOCKEVENT_CLIENTS];
+static uint64_t             client_deadline[MAX_CPUS][CLOCKEVENT_CLIENTS];
+
+/* TSC-deadline: the deadline goes straight into an MSR */
+static void tsc_deadline_program(uint64_t deadline) {
+  // 0 would disarm it
+  wrmsr(MSR_TSC_DEADLINE, deadline ? deadline : 1);
+}
+
+static void tsc_deadline_stop(void) {
+  wrmsr(MSR_TSC_DEADLINE, 0);
+}
+
+static clockevent_t tsc_deadline_device = {
+  .name      = "tsc-deadline",
+  .max_delta = UINT64_MAX / 2,
+  .per_cpu   = true,
+  .program   = tsc_deadline_program,
+  .stop      = tsc_deadline_stop,
+};
+
+/* LAPIC one-shot: a countdown in bus clock ticks */
+static uint64_t tsc_to_lapic(uint64_t cycles) {
+  return cycles * lapic_timer_ticks_per_ms() / tsc_khz();
+}
+
+static void lapic_oneshot_program(uint64_t deadline) {
+  uint64_t now   = rdtsc();
+  uint64_t ticks = deadline > now ? tsc_to_lapic(deadline - now) : 0;
+  // a count of 0 doesn't start it
+  lapic_timer_oneshot(VECTOR_TIMER, ticks ? ticks : 1);
+}
+
+static clockevent_t lapic_oneshot_device = {
+  .name    = "lapic-oneshot",
+  .per_cpu = true,
+  .program = lapic_oneshot_program,
+  .stop    = lapic_timer_stop,
+};
+
+/* PIT channel 0: one for the whole machine, so it only serves the BSP */
+static void pit_program(uint64_t deadline) {
+  uint64_t now   = rdtsc();
+  uint64_t count = 0;
+  if(deadline > now)
+    count = (deadline - now) * (PIT_FREQUENCY / 1000) / tsc_khz();
+  pit_irq_oneshot(count ? count : 1);
+}
+
+static clockevent_t pit_device = {
+  .name    = "pit",
+  .per_cpu = false,
+  .program = pit_program,
+  .stop    = pit_irq_stop,
+};
+
+/* program the device for `deadline`, or as close as it can get */
+static void arm(uint64_t deadline) {
+  uint64_t now = rdtsc();
+  if(deadline > now && deadline - now > device->max_delta)
+    deadline = now + device->max_delta;
+  device->program(deadline);
+}
+
+/* program the earliest client deadline, if it isn't already */
+static void reprogram(void) {
+  uint64_t *deadlines = client_deadline[cpu_index()];
+  uint64_t  next      = CLOCKEVENT_NONE;
+  for(int c = 0; c < CLOCKEVENT_CLIENTS; ++c) {
+    if(deadlines[c] < next)
+      next = deadlines[c];
+  }
+  if(next == this_cpu_read(clockevent_deadline))
+    return;
+  this_cpu_write(clockevent_deadline, next);
+  if(next == CLOCKEVENT_NONE)
+    device->stop();
+  else
+    arm(next);
+}
+
+static void clockevent_interrupt(cpu_status_t *ctx) {
+  (void)ctx;
+  this_cpu_inc(clockevent_fires);
+  uint64_t armed = this_cpu_read(clockevent_deadline);
+  // cancelled after the interrupt was already on its way
+  if(armed == CLOCKEVENT_NONE)
+    return;
+  uint64_t now = rdtsc();
+  // an intermediate step of a long wait
+  if(now < armed) {
+    arm(armed);
+    return;
+  }
+  this_cpu_write(clockevent_deadline, CLOCKEVENT_NONE);
+  uint64_t *deadlines = client_deadline[cpu_index()];
+  for(int c = 0; c < CLOCKEVENT_CLIENTS; ++c) {
+    if(deadlines[c] > now)
+      continue;
+    deadlines[c] = CLOCKEVENT_NONE;
+    if(handlers[c])
+      handlers[c]();
+  }
+  reprogram();
+}
+
+void clockevent_program(enum clockevent_client client, uint64_t deadline) {
+  if(!device->per_cpu && cpu_index() != 0)
+    return;
+  client_deadline[cpu_index()][client] = deadline;
+  reprogram();
+}
+
+void clockevent_cancel(enum clockevent_client client) {
+  if(!device->per_cpu && cpu_index() != 0)
+    return;
+  client_deadline[cpu_index()][client] = CLOCKEVENT_NONE;
+  reprogram();
+}
+
+void clockevent_set_handler(enum clockevent_client client,
+                            clockevent_handler_t   handler) {
+  handlers[client] = handler;
+}
+
+void clockevent_init_cpu(void) {
+  for(int c = 0; c < CLOCKEVENT_CLIENTS; ++c)
+    client_deadline[cpu_index()][c] = CLOCKEVENT_NONE;
+  this_cpu_write(clockevent_deadline, CLOCKEVENT_NONE);
+  this_cpu_write(clockevent_fires, 0);
+  if(device == &tsc_deadline_device)
+    lapic_timer_tsc_deadline(VECTOR_TIMER);
+  else if(device->per_cpu)
+    lapic_timer_stop();
+}
+
+static void clockevents_cmd(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+  printf("device %s\n", device->name);
+  for(uint32_t c = 0; c < cpu_count(); ++c) {
+    percpu_t *pc = percpu_get(c);
+    if(pc->clockevent_deadline == CLOCKEVENT_NONE)
+      printf(
+        "cpu %u: %lu interrupts, nothing armed\n", c, pc->clockevent_fires);
+    else
+      printf("cpu %u: %lu interrupts, next at %lu\n",
+             c,
+             pc->clockevent_fires,
+             pc->clockevent_deadline);
+  }
+}
+
+void clockevent_init(void) {
+  lapic_timer_calibrate();
+
+  if(cpuid(1, 0).ecx & CPUID_1_ECX_TSC_DEADLINE) {
+    device = &tsc_deadline_device;
+  } else if(lapic_timer_ticks_per_ms() != 0) {
+    device            = &lapic_oneshot_device;
+    device->max_delta = 0xFFFFFFFFull * tsc_khz() / lapic_timer_ticks_per_ms();
+  } else {
+    device            = &pit_device;
+    device->max_delta = 0xFFFFull * tsc_khz() / (PIT_FREQUENCY / 1000);
+    ioapic_route_isa(0, VECTOR_TIMER);
+  }
+  set_interrupt_handler(VECTOR_TIMER, clockevent_interrupt);
+  clockevent_init_cpu();
+  kinfo("clockevent: %s\n", device->name);
+  debug_register(
+    "clockevents", "timer device and interrupts per CPU", clockevents_cmd);
+}
@@ -0,0 +1,51 @@
+#ifndef _CLOCKEVENT_H
+#define _CLOCKEVENT_H
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+one-shot timer interrupts, always for an absolute TSC value. each client has
+at most one event pending per CPU, only the earliest of those is programmed
+and nothing at all while there are none, so an idle CPU isn't woken up by a
+tick it has no use for
+*/
+
+#define CLOCKEVENT_NONE UINT64_MAX
+
+enum clockevent_client {
+  CLOCKEVENT_SCHED = 0,
+  CLOCKEVENT_TIMERS,
+  CLOCKEVENT_CLIENTS
+};
+
+typedef struct clockevent {
+  const char *name;
+  /* furthest out it can be programmed, longer waits take several steps */
+  uint64_t    max_delta;
+  /* every CPU has its own, otherwise only the BSP gets events */
+  bool        per_cpu;
+  /* arm for TSC value `deadline`, which may already be in the past */
+  void (*program)(uint64_t deadline);
+  void (*stop)(void);
+} clockevent_t;
+
+typedef void (*clockevent_handler_t)(void);
+
+/**
+ * @brief pick the best device (TSC-deadline, then LAPIC one-shot, then the
+ * PIT) and set it up on the BSP. after apic_init and clocksource_init
+ */
+void clockevent_init(void);
+void clockevent_init_cpu(void);
+/**
+ * @brief called in interrupt context on the CPU whose deadline passed
+ */
+void clockevent_set_handler(enum clockevent_client client,
+                            clockevent_handler_t   handler);
+/**
+ * @brief replace `client`'s pending event on the calling CPU with one at TSC
+ * `deadline`. call with interrupts off
+ */
+void clockevent_program(enum clockevent_client client, uint64_t deadline);
+void clockevent_cancel(enum clockevent_client client);
+#endif  // _CLOCKEVENT_H
@@ -0,0 +1,120 @@
+#include "clocksource.h"
+#include <mm/vmm.h>
+#include <stdlib.h>
+#include <sys/acpi.h>
+#include <sys/debug.h>
+#include <sys/pit.h>
+
+/* long enough that reading the reference clock is lost in the noise */
+#define CALIBRATE_NS (50 * NSEC_PER_MSEC)
+#define FS_PER_NS    1000000ull
+
+clocksource_t clocksource = { 0 };
+
+static uint32_t hpet_read32(volatile uint8_t *hpet, uint32_t reg) {
+  return *(volatile uint32_t *)(hpet + reg);
+}
+
+static uint64_t hpet_read64(volatile uint8_t *hpet, uint32_t reg) {
+  return *(volatile uint64_t *)(hpet + reg);
+}
+
+static void hpet_write64(volatile uint8_t *hpet, uint32_t reg, uint64_t v) {
+  *(volatile uint64_t *)(hpet + reg) = v;
+}
+
+/* TSC cycles over CALIBRATE_NS of HPET time, 0 if there's no usable HPET */
+static uint64_t calibrate_hpet(void) {
+  hpet_table_t *table = (hpet_table_t *)find_header("HPET");
+  if(table == NULL ||
+     table->address.address_space_id != ACPI_ADDRESS_SPACE_MEMORY)
+    return 0;
+  volatile uint8_t *hpet =
+    vmm_map_phys(table->address.address, PAGE_SIZE, PTE_MMIO);
+  uint64_t period_fs = hpet_read64(hpet, HPET_CAPABILITIES) >> 32;
+  if(period_fs == 0 || period_fs > 100000000)
+    return 0;
+  hpet_write64(
+    hpet, HPET_CONFIG, hpet_read64(hpet, HPET_CONFIG) | HPET_CONFIG_ENABLE);
+  // only the low half, the counter may be 32 bits wide and the window is
+  // far shorter than a wrap
+  uint32_t target = CALIBRATE_NS * FS_PER_NS / period_fs;
+  uint32_t start  = hpet_read32(hpet, HPET_COUNTER);
+  uint64_t tsc    = rdtsc();
+  uint32_t now;
+  do {
+    now = hpet_read32(hpet, HPET_COUNTER);
+  } while((uint32_t)(now - start) < target);
+  uint64_t cycles  = rdtsc() - tsc;
+  uint64_t elapsed = (uint64_t)(uint32_t)(now - start) * period_fs / FS_PER_NS;
+  return cycles * CALIBRATE_NS / elapsed;
+}
+
+static uint64_t calibrate_pit(void) {
+  uint64_t tsc = rdtsc();
+  pit_delay_us(CALIBRATE_NS / NSEC_PER_USEC);
+  return rdtsc() - tsc;
+}
+
+/* 1970-01-01 + `days` as a proleptic Gregorian date */
+static void civil_from_days(int64_t days, int64_t *y, uint32_t *m,
+                            uint32_t *d) {
+  days        += 719468;
+  int64_t  era = (days >= 0 ? days : days - 146096) / 146097;
+  uint32_t doe = days - era * 146097;
+  uint32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  uint32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  uint32_t mp  = (5 * doy + 2) / 153;
+  *d           = doy - (153 * mp + 2) / 5 + 1;
+  *m           = mp < 10 ? mp + 3 : mp - 9;
+  *y           = yoe + era * 400 + (*m <= 2);
+}
+
+static void clock_cmd(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+  printf("%s, TSC at %lu kHz\n", clocksource.name, tsc_khz());
+  uint64_t up = ktime_get();
+  printf("up %lu.%09lu s\n", up / NSEC_PER_SEC, up % NSEC_PER_SEC);
+  uint64_t real = ktime_get_real() / NSEC_PER_SEC;
+  int64_t  y;
+  uint32_t m, d;
+  civil_from_days(real / 86400, &y, &m, &d);
+  printf("%ld-%02u-%02u %02lu:%02lu:%02lu UTC\n",
+         y,
+         m,
+         d,
+         real % 86400 / 3600,
+         real % 3600 / 60,
+         real % 60);
+  uint64_t start = rdtsc();
+  for(int i = 0; i < 1000; ++i) {
+    uint64_t t = ktime_get();
+    __asm__ volatile("" : : "r"(t));
+  }
+  printf("ktime_get: %lu cycles\n", (rdtsc() - start) / 1000);
+}
+
+void clocksource_init(struct limine_date_at_boot_response *date) {
+  if(!(cpuid(0x80000007, 0).edx & CPUID_80000007_EDX_INVARIANT_TSC))
+    kwarn("TSC isn't invariant, time will drift with frequency changes\n");
+  uint64_t cycles  = calibrate_hpet();
+  clocksource.name = "tsc (hpet calibrated)";
+  if(cycles == 0) {
+    cycles           = calibrate_pit();
+    clocksource.name = "tsc (pit calibrated)";
+  }
+  clocksource.tsc_hz = cycles * (NSEC_PER_SEC / CALIBRATE_NS);
+  clocksource.mult =
+    (NSEC_PER_SEC << CLOCKSOURCE_SHIFT) / clocksource.tsc_hz;
+  // tsc_hz << 32 doesn't fit in 64 bits, divide in two steps
+  clocksource.ns_mult =
+    ((clocksource.tsc_hz / NSEC_PER_SEC) << CLOCKSOURCE_SHIFT) +
+    ((clocksource.tsc_hz % NSEC_PER_SEC) << CLOCKSOURCE_SHIFT) / NSEC_PER_SEC;
+
+  clocksource.tsc_base  = rdtsc();
+  clocksource.real_base = date ? date->timestamp * NSEC_PER_SEC : 0;
+  kinfo("clocksource: %s, %lu kHz\n", clocksource.name, tsc_khz());
+  debug_register(
+    "clock", "uptime, wall clock time and ktime_get cost", clock_cmd);
+}
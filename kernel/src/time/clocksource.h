@@ -0,0 +1,77 @@
+#ifndef _CLOCKSOURCE_H
+#define _CLOCKSOURCE_H
+#include <limine.h>
+#include <stdint.h>
+#include <sys/cpu.h>
+
+/*
+the invariant TSC is the clock. it's calibrated once against the HPET (or
+the PIT when there's none) and from then on reading the time is an rdtsc and
+a multiply-shift, nothing to lock and no MMIO or port I/O
+*/
+
+#define NSEC_PER_USEC 1000ull
+#define NSEC_PER_MSEC 1000000ull
+#define NSEC_PER_SEC  1000000000ull
+
+/* HPET general registers */
+#define HPET_CAPABILITIES 0x000
+#define HPET_CONFIG       0x010
+#define HPET_COUNTER      0x0F0
+
+#define HPET_CONFIG_ENABLE (1 << 0)
+
+/* CPUID.80000007H:EDX */
+#define CPUID_80000007_EDX_INVARIANT_TSC (1 << 8)
+
+/* ns = cycles * mult >> CLOCKSOURCE_SHIFT, with a 128 bit product */
+#define CLOCKSOURCE_SHIFT 32
+
+typedef struct clocksource {
+  const char *name;
+  uint64_t    tsc_hz;
+  uint64_t    mult;
+  /* the other way, cycles = ns * ns_mult >> CLOCKSOURCE_SHIFT */
+  uint64_t    ns_mult;
+  /* TSC value that is ktime 0 */
+  uint64_t    tsc_base;
+  /* realtime at tsc_base */
+  uint64_t    real_base;
+} clocksource_t;
+
+extern clocksource_t clocksource;
+
+/**
+ * @brief calibrate the TSC and anchor realtime to the bootloader's date. after
+ * acpi_init, before anything that converts between cycles and time
+ *
+ * @param date may be NULL, realtime then starts at the epoch
+ */
+void clocksource_init(struct limine_date_at_boot_response *date);
+static inline uint64_t cycles_to_ns(uint64_t cycles) {
+  return ((unsigned __int128)cycles * clocksource.mult) >> CLOCKSOURCE_SHIFT;
+}
+
+static inline uint64_t ns_to_cycles(uint64_t ns) {
+  return ((unsigned __int128)ns * clocksource.ns_mult) >> CLOCKSOURCE_SHIFT;
+}
+
+static inline uint64_t tsc_khz(void) {
+  return clocksource.tsc_hz / 1000;
+}
+
+/**
+ * @brief nanoseconds since clocksource_init. the TSCs of all CPUs are taken
+ * to be in sync, which holds for an invariant TSC started at reset
+ */
+static inline uint64_t ktime_get(void) {
+  return cycles_to_ns(rdtsc() - clocksource.tsc_base);
+}
+
+/**
+ * @brief nanoseconds since 1970-01-01 UTC
+ */
+static inline uint64_t ktime_get_real(void) {
+  return clocksource.real_base + ktime_get();
+}
+#endif  // _CLOCKSOURCE_H
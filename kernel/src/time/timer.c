@@ -0,0 +1,356 @@
+#include "timer.h"
+#include <mm/pmm.h>
+#include <stdlib.h>
+#include <sys/cpu.h>
+#include <sys/debug.h>
+#include <sys/softirq.h>
+#include <sys/spinlock.h>
+#include <time/clockevent.h>
+#include <time/clocksource.h>
+
+#define TIMER_NONE UINT64_MAX
+
+typedef struct timer_base {
+  spinlock_t lock;
+  /* next tick to process, it can lag behind while nothing is due */
+  uint64_t   clk;
+  /* tick the clockevent is set for */
+  uint64_t   next_expiry;
+  uint64_t   count;
+  uint64_t   expired;
+  uint64_t   cascaded;
+  /* bit n of level l is set while slots[l][n] isn't empty */
+  uint64_t   pending[TIMER_LEVELS];
+  ktimer_t  *slots[TIMER_LEVELS][TIMER_LVL_SIZE];
+} __attribute__((aligned(CACHE_LINE))) timer_base_t;
+
+static timer_base_t timer_bases[MAX_CPUS];
+
+static uint64_t now_tick(void) {
+  return rdtsc() >> TIMER_TICK_SHIFT;
+}
+
+static void enqueue(timer_base_t *base, ktimer_t *timer) {
+  uint64_t delta = timer->expires - base->clk;
+  uint64_t when  = timer->expires;
+  uint32_t lvl   = 0;
+  while(lvl < TIMER_LEVELS - 1 &&
+        delta >= 1ull << ((lvl + 1) * TIMER_LVL_BITS))
+    lvl++;
+  // beyond the last level it waits in that level's furthest slot, and is put
+  // back in the right place when that cascades
+  if(delta >= 1ull << (TIMER_LEVELS * TIMER_LVL_BITS))
+    when = base->clk + (1ull << (TIMER_LEVELS * TIMER_LVL_BITS)) - 1;
+  uint32_t   idx  = (when >> (lvl * TIMER_LVL_BITS)) & TIMER_LVL_MASK;
+  ktimer_t **head = &base->slots[lvl][idx];
+  timer->next     = *head;
+  if(timer->next)
+    timer->next->pprev = &timer->next;
+  *head        = timer;
+  timer->pprev = head;
+  timer->slot  = lvl * TIMER_LVL_SIZE + idx;
+  base->pending[lvl] |= 1ull << idx;
+  base->count++;
+}
+
+static void dequeue(timer_base_t *base, ktimer_t *timer) {
+  *timer->pprev = timer->next;
+  if(timer->next)
+    timer->next->pprev = timer->pprev;
+  uint32_t lvl = timer->slot / TIMER_LVL_SIZE;
+  uint32_t idx = timer->slot % TIMER_LVL_SIZE;
+  if(base->slots[lvl][idx] == NULL)
+    base->pending[lvl] &= ~(1ull << idx);
+  timer->pprev = NULL;
+  base->count--;
+}
+
+/* the wheel is entering a new level 1 slot: move its timers down, and the
+ * same one level up whenever that wrapped as well */
+static void cascade(timer_base_t *base) {
+  for(uint32_t lvl = 1; lvl < TIMER_LEVELS; ++lvl) {
+    uint32_t  idx   = (base->clk >> (lvl * TIMER_LVL_BITS)) & TIMER_LVL_MASK;
+    ktimer_t *timer = base->slots[lvl][idx];
+    base->slots[lvl][idx] = NULL;
+    base->pending[lvl] &= ~(1ull << idx);
+    while(timer) {
+      ktimer_t *next = timer->next;
+      base->count--;
+      base->cascaded++;
+      enqueue(base, timer);
+      timer = next;
+    }
+    if(idx != 0)
+      break;
+  }
+}
+
+/* earliest tick the wheel has to be looked at: a level 0 expiry, or the
+ * cascade of an upper level slot */
+static uint64_t next_expiry(timer_base_t *base) {
+  uint64_t next = TIMER_NONE;
+  for(uint32_t lvl = 0; lvl < TIMER_LEVELS; ++lvl) {
+    uint64_t bits = base->pending[lvl];
+    if(bits == 0)
+      continue;
+    uint32_t shift = lvl * TIMER_LVL_BITS;
+    uint32_t cur   = (base->clk >> shift) & TIMER_LVL_MASK;
+    // bit n is now the slot n after the current one
+    bits = (bits >> cur) | (bits << ((TIMER_LVL_SIZE - cur) & TIMER_LVL_MASK));
+    // an upper level's current slot was emptied when the wheel entered it,
+    // anything in it now is a full lap away
+    if(lvl > 0 && (base->clk & ((1ull << shift) - 1)) != 0)
+      bits &= ~1ull;
+    uint32_t dist = bits ? __builtin_ctzll(bits) : TIMER_LVL_SIZE;
+    uint64_t at   = lvl == 0 ? base->clk + dist
+                             : ((base->clk >> shift) + dist) << shift;
+    if(at < next)
+      next = at;
+  }
+  return next;
+}
+
+/* point the clockevent at the nearest expiry, when it moved. call with the
+ * lock held on the wheel's own CPU */
+static void program(timer_base_t *base, uint64_t next) {
+  if(next == base->next_expiry)
+    return;
+  base->next_expiry = next;
+  if(next == TIMER_NONE)
+    clockevent_cancel(CLOCKEVENT_TIMERS);
+  else
+    clockevent_program(CLOCKEVENT_TIMERS, next << TIMER_TICK_SHIFT);
+}
+
+/* run everything due up to tick `now`, skipping over empty slots */
+static void run_timers(timer_base_t *base, uint64_t now) {
+  uint64_t flags = spin_lock_irqsave(&base->lock);
+  while((int64_t)(base->clk - now) <= 0) {
+    uint32_t idx = base->clk & TIMER_LVL_MASK;
+    if(idx == 0)
+      cascade(base);
+    ktimer_t *timer;
+    while((timer = base->slots[0][idx])) {
+      dequeue(base, timer);
+      base->expired++;
+      spin_unlock_irqrestore(&base->lock, flags);
+      timer->fn(timer);
+      flags = spin_lock_irqsave(&base->lock);
+    }
+    // nothing can be due before the next occupied level 0 slot, or before
+    // the next cascade
+    uint64_t rest = base->pending[0] >> idx >> 1;
+    base->clk += rest ? (uint64_t)__builtin_ctzll(rest) + 1
+                      : (uint64_t)(TIMER_LVL_SIZE - idx);
+    if((int64_t)(base->clk - now) > 1)
+      base->clk = now + 1;
+  }
+  program(base, next_expiry(base));
+  spin_unlock_irqrestore(&base->lock, flags);
+}
+
+static void timer_softirq(void) {
+  run_timers(&timer_bases[cpu_index()], now_tick());
+}
+
+static void timer_clockevent(void) {
+  // that event is used up, whatever comes next has to be programmed again
+  timer_bases[cpu_index()].next_expiry = TIMER_NONE;
+  raise_softirq(SOFTIRQ_TIMER);
+}
+
+void timer_setup(ktimer_t *timer, timer_fn_t fn) {
+  timer->next  = NULL;
+  timer->pprev = NULL;
+  timer->fn    = fn;
+  timer->cpu   = 0;
+}
+
+bool timer_pending(ktimer_t *timer) {
+  return __atomic_load_n(&timer->pprev, __ATOMIC_RELAXED) != NULL;
+}
+
+/* lock the wheel `timer` is on, which can change while we wait for it */
+static timer_base_t *lock_timer_base(ktimer_t *timer, uint64_t *flags) {
+  for(;;) {
+    uint32_t      cpu  = __atomic_load_n(&timer->cpu, __ATOMIC_ACQUIRE);
+    timer_base_t *base = &timer_bases[cpu];
+    *flags             = spin_lock_irqsave(&base->lock);
+    if(timer->cpu == cpu)
+      return base;
+    spin_unlock_irqrestore(&base->lock, *flags);
+  }
+}
+
+bool timer_cancel(ktimer_t *timer) {
+  uint64_t      flags;
+  timer_base_t *base    = lock_timer_base(timer, &flags);
+  bool          pending = timer->pprev != NULL;
+  // the clockevent is left alone, at worst it fires for nothing
+  if(pending)
+    dequeue(base, timer);
+  spin_unlock_irqrestore(&base->lock, flags);
+  return pending;
+}
+
+/* lock our wheel and the one `timer` is on, lower CPU first so two CPUs
+ * moving timers onto each other's wheels can't deadlock. interrupts off */
+static timer_base_t *lock_timer_bases(ktimer_t *timer, uint32_t cpu) {
+  timer_base_t *base = &timer_bases[cpu];
+  for(;;) {
+    uint32_t      from = __atomic_load_n(&timer->cpu, __ATOMIC_ACQUIRE);
+    timer_base_t *old  = &timer_bases[from];
+    if(from == cpu) {
+      spin_lock(&base->lock);
+    } else if(from < cpu) {
+      spin_lock(&old->lock);
+      spin_lock(&base->lock);
+    } else {
+      spin_lock(&base->lock);
+      spin_lock(&old->lock);
+    }
+    if(timer->cpu == from)
+      return old;
+    if(old != base)
+      spin_unlock(&old->lock);
+    spin_unlock(&base->lock);
+  }
+}
+
+void timer_add(ktimer_t *timer, uint64_t expires_ns) {
+  // interrupts off before picking the wheel, so we can't migrate between
+  // choosing it and recording it in timer->cpu
+  uint64_t      flags = irq_save();
+  uint32_t      cpu   = cpu_index();
+  timer_base_t *base  = &timer_bases[cpu];
+  // both stay locked until timer->cpu says where it went, or a concurrent
+  // add could find it on neither wheel and link it twice
+  timer_base_t *old   = lock_timer_bases(timer, cpu);
+  if(timer->pprev)
+    dequeue(old, timer);
+  // an empty wheel has nothing to catch up on
+  if(base->count == 0)
+    base->clk = now_tick();
+  // rounded up so it can't run early
+  uint64_t tsc   = clocksource.tsc_base + ns_to_cycles(expires_ns);
+  timer->expires = (tsc + (1ull << TIMER_TICK_SHIFT) - 1) >> TIMER_TICK_SHIFT;
+  if((int64_t)(timer->expires - base->clk) < 0)
+    timer->expires = base->clk;
+  __atomic_store_n(&timer->cpu, cpu, __ATOMIC_RELEASE);
+  enqueue(base, timer);
+  uint64_t next = next_expiry(base);
+  if(next < base->next_expiry)
+    program(base, next);
+  if(old != base)
+    spin_unlock(&old->lock);
+  spin_unlock_irqrestore(&base->lock, flags);
+}
+
+void timer_init_cpu(void) {
+  timer_base_t *base = &timer_bases[cpu_index()];
+  spin_init(&base->lock);
+  base->clk         = now_tick();
+  base->next_expiry = TIMER_NONE;
+}
+
+static void timers_cmd(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+  for(uint32_t c = 0; c < cpu_count(); ++c) {
+    timer_base_t *base = &timer_bases[c];
+    printf("cpu %u: %lu pending, %lu expired, %lu cascaded, per level",
+           c,
+           base->count,
+           base->expired,
+           base->cascaded);
+    for(uint32_t lvl = 0; lvl < TIMER_LEVELS; ++lvl)
+      printf(" %u", __builtin_popcountll(base->pending[lvl]));
+    printf(" slots\n");
+  }
+}
+
+#define TIMER_BENCH_COUNT  (1u << 20)
+#define TIMER_BENCH_ROUNDS 4
+/* more than one allocation can hold, so the timers come in the largest
+ * blocks the page allocator hands out */
+#define TIMER_BENCH_ORDER (PMM_MAX_ORDER - 1)
+#define TIMER_BENCH_PER_BLOCK \
+  (uint32_t)((PAGE_SIZE << TIMER_BENCH_ORDER) / sizeof(ktimer_t))
+#define TIMER_BENCH_BLOCKS \
+  ((TIMER_BENCH_COUNT + TIMER_BENCH_PER_BLOCK - 1) / TIMER_BENCH_PER_BLOCK)
+
+static ktimer_t *bench_blocks[TIMER_BENCH_BLOCKS];
+
+static inline ktimer_t *bench_timer(uint32_t i) {
+  return &bench_blocks[i / TIMER_BENCH_PER_BLOCK][i % TIMER_BENCH_PER_BLOCK];
+}
+
+static void bench_timer_fn(ktimer_t *timer) {
+  (void)timer;
+}
+
+static void bench_free(void) {
+  for(uint32_t b = 0; b < TIMER_BENCH_BLOCKS; ++b) {
+    if(bench_blocks[b])
+      free_pages(virt_to_page(bench_blocks[b]), TIMER_BENCH_ORDER);
+    bench_blocks[b] = NULL;
+  }
+}
+
+static void bench_timers_cmd(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+  for(uint32_t b = 0; b < TIMER_BENCH_BLOCKS; ++b) {
+    page_t *page = alloc_pages(TIMER_BENCH_ORDER);
+    if(page == NULL) {
+      printf("not enough memory for %u timers\n", TIMER_BENCH_COUNT);
+      bench_free();
+      return;
+    }
+    bench_blocks[b] = page_address(page);
+  }
+  uint64_t seed   = rdtsc() | 1;
+  uint64_t insert = 0, rearm = 0, cancel = 0;
+  for(uint32_t i = 0; i < TIMER_BENCH_COUNT; ++i)
+    timer_setup(bench_timer(i), bench_timer_fn);
+  for(int round = 0; round < TIMER_BENCH_ROUNDS; ++round) {
+    uint64_t base = ktime_get();
+    // 1ms to ~17 minutes out, spread over every level
+    uint64_t start = rdtsc();
+    for(uint32_t i = 0; i < TIMER_BENCH_COUNT; ++i) {
+      seed ^= seed << 13;
+      seed ^= seed >> 7;
+      seed ^= seed << 17;
+      uint64_t delay = NSEC_PER_MSEC << (seed % 20);
+      timer_add(bench_timer(i), base + delay + (seed >> 44));
+    }
+    insert += rdtsc() - start;
+    start   = rdtsc();
+    for(uint32_t i = 0; i < TIMER_BENCH_COUNT; ++i)
+      timer_add(bench_timer(i), base + NSEC_PER_SEC + i * NSEC_PER_USEC);
+    rearm += rdtsc() - start;
+    if(round == 0)
+      timers_cmd(0, NULL);
+    start = rdtsc();
+    for(uint32_t i = 0; i < TIMER_BENCH_COUNT; ++i)
+      timer_cancel(bench_timer(i));
+    cancel += rdtsc() - start;
+  }
+  bench_free();
+  uint64_t ops = (uint64_t)TIMER_BENCH_COUNT * TIMER_BENCH_ROUNDS;
+  printf("%lu timers (%u live at once):\n", ops, TIMER_BENCH_COUNT);
+  printf("  insert %lu cycles, rearm %lu cycles, cancel %lu cycles each\n",
+         insert / ops,
+         rearm / ops,
+         cancel / ops);
+}
+
+void timer_init(void) {
+  open_softirq(SOFTIRQ_TIMER, timer_softirq);
+  clockevent_set_handler(CLOCKEVENT_TIMERS, timer_clockevent);
+  timer_init_cpu();
+  debug_register("timers", "timer wheel occupancy per CPU", timers_cmd);
+  debug_register("bench-timers",
+                 "timer wheel insert/rearm/cancel with 1M timers live",
+                 bench_timers_cmd);
+}
@@ -0,0 +1,55 @@
+#ifndef _TIMER_H
+#define _TIMER_H
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+per-CPU hierarchical timing wheel. level n has 64 slots of 64^n ticks each,
+adding and cancelling a timer is a list insert/unlink, and a timer only moves
+down a level (cascades) when the wheel reaches its slot. the wheel isn't
+turned by a periodic tick: it catches up when the clockevent for its nearest
+expiry fires, and expired timers run from SOFTIRQ_TIMER
+*/
+
+/* the wheel counts in absolute TSC values, so programming the clockevent is
+ * exact. one tick is 2^20 cycles, a third of a millisecond at 3GHz */
+#define TIMER_TICK_SHIFT 20
+#define TIMER_LVL_BITS   6
+#define TIMER_LVL_SIZE   (1 << TIMER_LVL_BITS)
+#define TIMER_LVL_MASK   (TIMER_LVL_SIZE - 1)
+/* 64^6 ticks, months at any TSC rate */
+#define TIMER_LEVELS     6
+
+struct ktimer;
+typedef void (*timer_fn_t)(struct ktimer *timer);
+
+typedef struct ktimer {
+  struct ktimer  *next;
+  /* the pointer to this timer, NULL while it isn't pending */
+  struct ktimer **pprev;
+  /* wheel tick (TSC >> TIMER_TICK_SHIFT) it expires at */
+  uint64_t        expires;
+  timer_fn_t      fn;
+  /* wheel it's on (or was last on) */
+  uint32_t        cpu;
+  /* level * TIMER_LVL_SIZE + slot */
+  uint16_t        slot;
+} ktimer_t;
+
+void timer_setup(ktimer_t *timer, timer_fn_t fn);
+/**
+ * @brief (re)arm `timer` on the calling CPU to run once ktime_get() has
+ * passed `expires_ns`. it may run up to a wheel tick late, never early
+ */
+void timer_add(ktimer_t *timer, uint64_t expires_ns);
+/**
+ * @brief take a pending timer off its wheel. a callback that is already
+ * running isn't waited for
+ *
+ * @return whether it was pending
+ */
+bool timer_cancel(ktimer_t *timer);
+bool timer_pending(ktimer_t *timer);
+void timer_init(void);
+void timer_init_cpu(void);
+#endif  // _TIMER_H